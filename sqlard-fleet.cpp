@@ -0,0 +1,486 @@
+/*
+	<< sqlard-fleet >>
+
+	Simulates a fleet of SQLard clients, each one a device running a mix of
+	inserts (like sqlard_test.ino) and polling selects (like sqlard-test.cpp)
+	with think time in between, and reports throughput and latency.
+
+	Clients are spread over a few threads; every thread runs the client that
+	is due next. Latency is measured from the time a query was due until its
+	result was decoded, so it includes the client side cost of SQLard itself
+	and the time the query waited for its thread: a slow query delays the
+	clients behind it, and that shows in their latency instead of hiding as a
+	lower query rate. Queries are due a think time after the previous one was
+	due, not after it finished. "lag" reports the waiting part alone.
+
+	Targets
+		--server a.b.c.d[:port]		a real server (default 127.0.0.1:1433)
+		--record file.sqlc			run a single client against the server for
+									--queries queries and capture its traffic
+		--replay file.sqlc			local stand-in: every client plays the capture
+									back in place of the socket, and starts over
+									with a new connection when it is exhausted
+
+	Fleet
+		--clients N					simulated clients (100)
+		--threads N					threads driving them (8)
+		--duration S				seconds to run (10)
+		--think MS					mean think time between queries of a client,
+									uniformly jittered by +-50% (1000)
+		--churn P					reconnect after a query with P percent chance (0)
+		--mix select=S,insert=I		weights of the query kinds (select=4,insert=1)
+		--select SQL, --insert SQL	statements to run
+		--seed N					seed of the query sequence (1)
+		--timeout MS				query timeout (30000, 1000 with --replay)
+		--original-speed			replay with the server delays of the capture
+		--database, --user, --password
+
+	A replayed client has to send exactly what was captured, so the query
+	sequence only depends on --seed and --mix; run --replay with the same
+	values as --record. Replayed bytes that differ are counted as errors.
+
+	Build (host):
+		g++ -std=c++11 -O2 -DWINDOWS sqlard-fleet.cpp -o sqlard-fleet -lpthread
+*/
+#define SQLARD_WIRE_CAPTURE
+#include "sqlard.h"
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <string>
+#include <vector>
+#include <queue>
+#include <random>
+#include <thread>
+#include <mutex>
+#include <atomic>
+#include <algorithm>
+
+enum FleetQueryKind {
+	QUERY_SELECT = 0,
+	QUERY_INSERT = 1,
+	QUERY_KINDS = 2
+};
+
+struct FleetOptions {
+	uint8_t ip[6];
+	uint16_t port;
+	const char * recordPath;
+	const char * replayPath;
+	uint32_t clients;
+	uint32_t threads;
+	uint32_t duration;
+	uint32_t think;
+	uint32_t churn;
+	uint32_t queries;
+	uint32_t weights[QUERY_KINDS];
+	uint32_t seed;
+	uint32_t timeout;
+	bool bOriginalSpeed;
+	/* UTF-8, as given on the command line */
+	std::string statements[QUERY_KINDS];
+	std::string database;
+	std::string user;
+	std::string password;
+};
+
+/* Latency samples and counters of one thread, merged at the end */
+struct FleetStats {
+	std::vector<uint32_t> latency[QUERY_KINDS];
+	std::vector<uint32_t> connectLatency;
+	/* from the due time until the query was sent */
+	std::vector<uint32_t> lag;
+	uint64_t queries[QUERY_KINDS];
+	uint64_t errors;
+	uint64_t connects;
+	uint64_t connectErrors;
+	uint64_t rows;
+
+	FleetStats() {
+		memset(queries, 0, sizeof(queries));
+		errors = 0;
+		connects = 0;
+		connectErrors = 0;
+		rows = 0;
+	}
+	void merge(const FleetStats & other) {
+		for (int k = 0; k < QUERY_KINDS; k++) {
+			latency[k].insert(latency[k].end(), other.latency[k].begin(), other.latency[k].end());
+			queries[k] += other.queries[k];
+		}
+		connectLatency.insert(connectLatency.end(), other.connectLatency.begin(), other.connectLatency.end());
+		lag.insert(lag.end(), other.lag.begin(), other.lag.end());
+		errors += other.errors;
+		connects += other.connects;
+		connectErrors += other.connectErrors;
+		rows += other.rows;
+	}
+};
+
+typedef std::chrono::steady_clock FleetClock;
+
+static uint32_t micros_between(const FleetClock::time_point & from, const FleetClock::time_point & to) {
+	return static_cast<uint32_t>(std::chrono::duration_cast<std::chrono::microseconds>(to - from).count());
+}
+
+/* One simulated device */
+class FleetClient {
+public:
+	FleetClient(const FleetOptions & options, const std::vector<uint8_t> & capture, const uint32_t index)
+		: m_options(options), m_capture(capture), m_jitter(options.seed * 7919 + index) {
+		m_pConnection = nullptr;
+		m_pReplay = nullptr;
+		resetSequence();
+	}
+	~FleetClient() {
+		disconnect();
+	}
+
+	/* Run the query due at the given time, connecting first if needed */
+	void step(FleetStats & stats, const FleetClock::time_point & due) {
+		/* time spent waiting for the thread counts, time spent connecting goes to connect */
+		const uint32_t lag = micros_between(due, FleetClock::now());
+		if (m_pConnection == nullptr && !connect(stats))
+			return;
+		const FleetQueryKind kind = nextKind();
+		const FleetClock::time_point start = FleetClock::now();
+		bool bError;
+		if (kind == QUERY_SELECT) {
+			SQLardTableResult * pResult = m_pConnection->executeReader(m_options.statements[QUERY_SELECT].c_str());
+			bError = m_pConnection->hasError();
+			for (; pResult->GetRow() != nullptr; pResult->MoveNext())
+				stats.rows++;
+			delete pResult;
+		}
+		else {
+			m_pConnection->executeNonQuery(m_options.statements[QUERY_INSERT].c_str());
+			bError = m_pConnection->hasError();
+		}
+		stats.latency[kind].push_back(lag + micros_between(start, FleetClock::now()));
+		stats.lag.push_back(lag);
+		stats.queries[kind]++;
+		if (m_pReplay != nullptr && m_pReplay->GetMismatchCount() > 0)
+			bError = true;
+		if (bError) {
+			stats.errors++;
+			disconnect();
+		}
+		else if (m_pReplay != nullptr ? m_pReplay->isFinished() : (m_options.churn > 0 && m_jitter() % 100 < m_options.churn))
+			disconnect();
+	}
+
+	/* Think time until the next query */
+	uint32_t thinkMicros() {
+		if (m_options.think == 0)
+			return 0;
+		const uint32_t mean = m_options.think * 1000;
+		return mean / 2 + m_jitter() % (mean + 1);
+	}
+	std::minstd_rand & jitter() { return m_jitter; }
+
+private:
+	bool connect(FleetStats & stats) {
+		const FleetClock::time_point start = FleetClock::now();
+		m_pConnection = new SQLard(const_cast<uint8_t*>(m_options.ip), m_options.port);
+		if (!m_capture.empty()) {
+			/* a replay starts over with the login, and so does the query sequence */
+			m_pReplay = new SQLardWireReplay(m_capture.data(), m_capture.size(), m_options.bOriginalSpeed);
+			m_pConnection->setReplay(m_pReplay);
+			resetSequence();
+		}
+		m_pConnection->setQueryTimeout(m_options.timeout);
+		stats.connects++;
+		if (!m_pConnection->connect()) {
+			stats.connectErrors++;
+			disconnect();
+			return false;
+		}
+		m_pConnection->setCredentials(m_options.database.c_str(), m_options.user.c_str(), m_options.password.c_str(), "sqlard-fleet");
+		if (!m_pConnection->login()) {
+			stats.connectErrors++;
+			disconnect();
+			return false;
+		}
+		stats.connectLatency.push_back(micros_between(start, FleetClock::now()));
+		return true;
+	}
+	void disconnect() {
+		if (m_pConnection != nullptr)
+			delete m_pConnection;
+		if (m_pReplay != nullptr)
+			delete m_pReplay;
+		m_pConnection = nullptr;
+		m_pReplay = nullptr;
+	}
+
+	void resetSequence() {
+		m_sequence.seed(m_options.seed);
+	}
+	FleetQueryKind nextKind() {
+		const uint32_t total = m_options.weights[QUERY_SELECT] + m_options.weights[QUERY_INSERT];
+		return m_sequence() % total < m_options.weights[QUERY_SELECT] ? QUERY_SELECT : QUERY_INSERT;
+	}
+
+	const FleetOptions & m_options;
+	const std::vector<uint8_t> & m_capture;
+	SQLard * m_pConnection;
+	SQLardWireReplay * m_pReplay;
+	/* query kinds, identical for every client so captures can be replayed */
+	std::minstd_rand m_sequence;
+	/* think time and churn, different for every client */
+	std::minstd_rand m_jitter;
+};
+
+/* Drive clients [first, first + count) until the deadline */
+static void run_thread(const FleetOptions & options, const std::vector<uint8_t> & capture, const uint32_t first, const uint32_t count,
+	const FleetClock::time_point deadline, FleetStats & stats) {
+	typedef std::pair<FleetClock::time_point, uint32_t> Due;
+	std::vector<FleetClient*> clients;
+	std::priority_queue<Due, std::vector<Due>, std::greater<Due> > due;
+	const FleetClock::time_point start = FleetClock::now();
+	for (uint32_t i = 0; i < count; i++) {
+		clients.push_back(new FleetClient(options, capture, first + i));
+		/* spread the first queries over one think time */
+		const uint32_t offset = options.think ? clients[i]->jitter()() % (options.think * 1000) : 0;
+		due.push(Due(start + std::chrono::microseconds(offset), i));
+	}
+	while (!due.empty()) {
+		const Due next = due.top();
+		due.pop();
+		if (next.first >= deadline)
+			break;
+		std::this_thread::sleep_until(next.first);
+		clients[next.second]->step(stats, next.first);
+		/* from the due time, a late query must not push the schedule back (coordinated omission) */
+		due.push(Due(next.first + std::chrono::microseconds(clients[next.second]->thinkMicros()), next.second));
+	}
+	for (uint32_t i = 0; i < count; i++)
+		delete clients[i];
+}
+
+/* Single client against the server, capturing its traffic */
+static int run_record(const FleetOptions & options) {
+	SQLardWireCapture capture;
+	if (!capture.openFile(options.recordPath)) {
+		fprintf(stderr, "can not create %s\n", options.recordPath);
+		return 1;
+	}
+	SQLard connection(const_cast<uint8_t*>(options.ip), options.port);
+	connection.setWireCapture(&capture);
+	connection.setQueryTimeout(options.timeout);
+	if (!connection.connect()) {
+		fprintf(stderr, "connect failed\n");
+		return 1;
+	}
+	connection.setCredentials(options.database.c_str(), options.user.c_str(), options.password.c_str(), "sqlard-fleet");
+	if (!connection.login()) {
+		fprintf(stderr, "login failed\n");
+		return 1;
+	}
+	std::minstd_rand sequence(options.seed);
+	const uint32_t total = options.weights[QUERY_SELECT] + options.weights[QUERY_INSERT];
+	uint32_t errors = 0;
+	for (uint32_t i = 0; i < options.queries; i++) {
+		if (sequence() % total < options.weights[QUERY_SELECT])
+			delete connection.executeReader(options.statements[QUERY_SELECT].c_str());
+		else
+			connection.executeNonQuery(options.statements[QUERY_INSERT].c_str());
+		if (connection.hasError())
+			errors++;
+	}
+	capture.close();
+	printf("recorded %u queries (%u errors) into %s\n", options.queries, errors, options.recordPath);
+	return 0;
+}
+
+static uint32_t percentile(const std::vector<uint32_t> & sorted, const double p) {
+	if (sorted.empty())
+		return 0;
+	size_t index = static_cast<size_t>(p * sorted.size() + 0.999999);
+	if (index > 0)
+		index--;
+	return sorted[std::min(index, sorted.size() - 1)];
+}
+
+static void print_latency(const char * name, std::vector<uint32_t> & samples) {
+	std::sort(samples.begin(), samples.end());
+	printf("%-8s n %-9zu p50 %8u us  p99 %8u us  p999 %8u us  max %8u us\n", name, samples.size(),
+		percentile(samples, 0.50), percentile(samples, 0.99), percentile(samples, 0.999), samples.empty() ? 0 : samples.back());
+}
+
+static bool parse_server(const char * text, FleetOptions & options) {
+	unsigned a, b, c, d, port = 1433;
+	const int n = sscanf(text, "%u.%u.%u.%u:%u", &a, &b, &c, &d, &port);
+	if (n < 4 || a > 255 || b > 255 || c > 255 || d > 255 || port > 65535)
+		return false;
+	options.ip[0] = a; options.ip[1] = b; options.ip[2] = c; options.ip[3] = d;
+	options.port = port;
+	return true;
+}
+
+static bool parse_mix(const char * text, FleetOptions & options) {
+	options.weights[QUERY_SELECT] = 0;
+	options.weights[QUERY_INSERT] = 0;
+	std::string mix(text);
+	size_t pos = 0;
+	while (pos < mix.size()) {
+		size_t end = mix.find(',', pos);
+		if (end == std::string::npos)
+			end = mix.size();
+		const std::string item = mix.substr(pos, end - pos);
+		const size_t eq = item.find('=');
+		if (eq == std::string::npos)
+			return false;
+		const std::string kind = item.substr(0, eq);
+		const uint32_t weight = static_cast<uint32_t>(atoi(item.c_str() + eq + 1));
+		if (kind == "select")
+			options.weights[QUERY_SELECT] = weight;
+		else if (kind == "insert")
+			options.weights[QUERY_INSERT] = weight;
+		else
+			return false;
+		pos = end + 1;
+	}
+	return options.weights[QUERY_SELECT] + options.weights[QUERY_INSERT] > 0;
+}
+
+int main(int argc, char ** argv)
+{
+	FleetOptions options;
+	memset(options.ip, 0, sizeof(options.ip));
+	parse_server("127.0.0.1:1433", options);
+	options.recordPath = nullptr;
+	options.replayPath = nullptr;
+	options.clients = 100;
+	options.threads = 8;
+	options.duration = 10;
+	options.think = 1000;
+	options.churn = 0;
+	options.queries = 100;
+	options.weights[QUERY_SELECT] = 4;
+	options.weights[QUERY_INSERT] = 1;
+	options.seed = 1;
+	options.timeout = 0;
+	options.bOriginalSpeed = false;
+	options.statements[QUERY_SELECT] = "SELECT water_enable FROM ROOM_STATUS WHERE dnd_guid = '4567A1FF-3790-4519-83EE-A709A59E238F'";
+	options.statements[QUERY_INSERT] = "INSERT INTO [dbo].[test]([data]) VALUES('deger1234')";
+	options.database = "test";
+	options.user = "arduino";
+	options.password = "arduino";
+
+	for (int i = 1; i < argc; i++) {
+		const char * arg = argv[i];
+		const char * value = i + 1 < argc ? argv[i + 1] : nullptr;
+		bool ok = true;
+		if (!strcmp(arg, "--original-speed")) {
+			options.bOriginalSpeed = true;
+			continue;
+		}
+		if (value == nullptr)
+			ok = false;
+		else if (!strcmp(arg, "--server"))
+			ok = parse_server(value, options);
+		else if (!strcmp(arg, "--record"))
+			options.recordPath = value;
+		else if (!strcmp(arg, "--replay"))
+			options.replayPath = value;
+		else if (!strcmp(arg, "--clients"))
+			options.clients = atoi(value);
+		else if (!strcmp(arg, "--threads"))
+			options.threads = atoi(value);
+		else if (!strcmp(arg, "--duration"))
+			options.duration = atoi(value);
+		else if (!strcmp(arg, "--think"))
+			options.think = atoi(value);
+		else if (!strcmp(arg, "--churn"))
+			options.churn = atoi(value);
+		else if (!strcmp(arg, "--queries"))
+			options.queries = atoi(value);
+		else if (!strcmp(arg, "--mix"))
+			ok = parse_mix(value, options);
+		else if (!strcmp(arg, "--seed"))
+			options.seed = atoi(value);
+		else if (!strcmp(arg, "--timeout"))
+			options.timeout = atoi(value);
+		else if (!strcmp(arg, "--select"))
+			options.statements[QUERY_SELECT] = value;
+		else if (!strcmp(arg, "--insert"))
+			options.statements[QUERY_INSERT] = value;
+		else if (!strcmp(arg, "--database"))
+			options.database = value;
+		else if (!strcmp(arg, "--user"))
+			options.user = value;
+		else if (!strcmp(arg, "--password"))
+			options.password = value;
+		else
+			ok = false;
+		if (!ok) {
+			fprintf(stderr, "invalid option %s, see the top of sqlard-fleet.cpp\n", arg);
+			return 2;
+		}
+		i++;
+	}
+	if (options.clients == 0 || options.threads == 0)
+		return 2;
+	if (options.threads > options.clients)
+		options.threads = options.clients;
+	/* a replay answers at once, unless its requests went astray */
+	if (options.timeout == 0)
+		options.timeout = options.replayPath != nullptr ? 1000 : SQLARD_QUERY_TIMEOUT;
+
+	if (options.recordPath != nullptr)
+		return run_record(options);
+
+	std::vector<uint8_t> capture;
+	if (options.replayPath != nullptr) {
+		FILE * file = fopen(options.replayPath, "rb");
+		if (file == nullptr) {
+			fprintf(stderr, "can not open %s\n", options.replayPath);
+			return 1;
+		}
+		uint8_t chunk[4096];
+		for (size_t n; (n = fread(chunk, 1, sizeof(chunk), file)) > 0;)
+			capture.insert(capture.end(), chunk, chunk + n);
+		fclose(file);
+		SQLardWireReplay check(capture.data(), capture.size());
+		if (!check.isValid()) {
+			fprintf(stderr, "%s is not a capture\n", options.replayPath);
+			return 1;
+		}
+	}
+
+	const FleetClock::time_point start = FleetClock::now();
+	const FleetClock::time_point deadline = start + std::chrono::seconds(options.duration);
+	std::vector<FleetStats> stats(options.threads);
+	std::vector<std::thread> threads;
+	for (uint32_t t = 0; t < options.threads; t++) {
+		const uint32_t first = options.clients * t / options.threads;
+		const uint32_t last = options.clients * (t + 1) / options.threads;
+		threads.push_back(std::thread(run_thread, std::cref(options), std::cref(capture), first, last - first, deadline, std::ref(stats[t])));
+	}
+	for (uint32_t t = 0; t < options.threads; t++)
+		threads[t].join();
+	const double seconds = micros_between(start, FleetClock::now()) / 1e6;
+
+	FleetStats total;
+	for (uint32_t t = 0; t < options.threads; t++)
+		total.merge(stats[t]);
+	const uint64_t queries = total.queries[QUERY_SELECT] + total.queries[QUERY_INSERT];
+	printf("target   %s\n", options.replayPath ? options.replayPath : "server");
+	printf("fleet    %u clients on %u threads, think %u ms, churn %u%%, %.1f s\n", options.clients, options.threads, options.think, options.churn, seconds);
+	printf("queries  %llu (select %llu, insert %llu), %llu rows, %llu errors\n", (unsigned long long)queries,
+		(unsigned long long)total.queries[QUERY_SELECT], (unsigned long long)total.queries[QUERY_INSERT],
+		(unsigned long long)total.rows, (unsigned long long)total.errors);
+	printf("connects %llu (%llu failed)\n", (unsigned long long)total.connects, (unsigned long long)total.connectErrors);
+	printf("qps      %.1f\n", queries / seconds);
+	std::vector<uint32_t> all(total.latency[QUERY_SELECT]);
+	all.insert(all.end(), total.latency[QUERY_INSERT].begin(), total.latency[QUERY_INSERT].end());
+	print_latency("all", all);
+	print_latency("select", total.latency[QUERY_SELECT]);
+	print_latency("insert", total.latency[QUERY_INSERT]);
+	print_latency("connect", total.connectLatency);
+	print_latency("lag", total.lag);
+	if (options.replayPath != nullptr && total.errors > 0)
+		printf("requests differed from the capture, replay with the --seed, --mix and statements of --record\n");
+	return total.errors > 0 || total.connectErrors > 0 ? 1 : 0;
+}
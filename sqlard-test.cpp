@@ -1,5 +1,6 @@
 
 //#include "stdafx.h"
+#define SQLARD_RESULT_CACHE
 #include "sqlard.h"
 
 int main()
@@ -7,25 +8,29 @@ int main()
 	/* local */
 	unsigned char ipAddr[] = { 127,0,0,1 };
 	unsigned short port = 1433;
-	wchar_t userName[] = L"arduino";
-	wchar_t passWord[] = L"arduino";
-	wchar_t database[] = L"test"; 
+	char16_t userName[] = u"arduino";
+	char16_t passWord[] = u"arduino";
+	char16_t database[] = u"test"; 
 
 		SQLard MSSQL(ipAddr, port);
 		if (MSSQL.connect()) 
 		{
-			MSSQL.setCredentials(database, userName, passWord, L"host");
+			MSSQL.setCredentials(database, userName, passWord, u"host");
 			if (MSSQL.login()) {
 				printf("login ok \n");
 
 			}
+			/* serve the polling query below from a local cache, refreshed every second */
+			MSSQL.enableResultCache(16 * 1024, 1000);
 			while(true)
 			{	
 			
-				SQLardTableResult * tr = MSSQL.executeReader(L"SELECT water_enable FROM ROOM_STATUS WHERE dnd_guid = '4567A1FF-3790-4519-83EE-A709A59E238F'");
+				SQLardTableResult * tr = MSSQL.executeReader(u"SELECT water_enable FROM ROOM_STATUS WHERE dnd_guid = '4567A1FF-3790-4519-83EE-A709A59E238F'");
 				printf("COLUMNS\n");
 				for (int i = 0; i < tr->m_usColumnCount; i++) {
-					wprintf(L"%s|", tr->m_arColumnData[i]->m_wcstrColumnName);
+					char name[129];
+					SQLardUtil::sqlard_utf16_to_utf8(name, sizeof(name), tr->m_arColumnData[i]->m_wcstrColumnName);
+					printf("%s|", name);
 				}
 				printf("\n");
 				while (tr->GetRow() != nullptr)
@@ -78,8 +83,13 @@ int main()
 								printf("\t\t");
 								break;
 							case SQLardDataType::DATETIMETYPE:
+							case SQLardDataType::DATETIM4TYPE:
+							case SQLardDataType::DATETIMNTYPE:
+							case SQLardDataType::DATENTYPE:
+							case SQLardDataType::DATETIME2NTYPE:
+							case SQLardDataType::DATETIMEOFFSETNTYPE:
 							{
-								time_t val = pField->asDateTime();
+								time_t val = pField->asEpochMicros(tr->GetColumnDataType(i), tr->GetColumnScale(i)) / 1000000;
 								struct tm q;
 								localtime_s(&q, &val);
 								printf("now: %d-%d-%d %d:%d:%d\t\t",
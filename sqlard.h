@@ -4,10 +4,14 @@
 #include <stdarg.h>
 
 #ifdef WINDOWS
-	#define F 
-	#define PROGMEM
 	#include <boost/array.hpp>
 	#include <boost/asio.hpp>
+	#include <chrono>
+	#include <thread>
+	#include <atomic>
+	/* after the boost headers, which use F as a template parameter */
+	#define F 
+	#define PROGMEM
 #else
 	#ifdef UIPETHERNET
 		#include <UIPEthernet.h>
@@ -17,6 +21,159 @@
 #endif
 #define SQLARD_SKIP_COLUMN_NAMES
 //#define SQLARD_VERBOSE_OUTPUT
+/* Negotiate TDS 7.3 instead of 7.0 (required for DATE/TIME/DATETIME2/DATETIMEOFFSET columns) */
+//#define SQLARD_TDS73
+/* Client side result cache in front of executeReader (see SQLard::enableResultCache) */
+//#define SQLARD_RESULT_CACHE
+/* Per connection latency histograms, traffic counters and query fingerprints (see SQLard::getStats) */
+//#define SQLARD_METRICS
+/* Wire capture of TDS packets and replay of captures in place of the socket (see SQLard::setWireCapture) */
+//#define SQLARD_WIRE_CAPTURE
+/* CSV, JSON Lines and columnar export of results (see SQLardExporter) */
+//#define SQLARD_EXPORT
+/* Multiple active result sets, SMP sessions over one connection (see SQLard::openSession), requires SQLARD_TDS73 */
+//#define SQLARD_MARS
+/* Concurrent queries over several connections on a thread pool, host builds only (see SQLardFanOut) */
+//#define SQLARD_FANOUT
+/* Decode rows of large results on a thread pool, host builds only (see SQLard::setParallelDecode) */
+//#define SQLARD_PARALLEL_DECODE
+/* Count heap use per connection and query through an allocator hook (see SQLardHeap, SQLard::getHeapStats) */
+//#define SQLARD_HEAP_STATS
+/* Reuse parsed column metadata of repeated result layouts (see SQLardColumnCache) */
+//#define SQLARD_COLUMN_CACHE
+/* Spill rows of results over a memory budget to a memory mapped file, host builds only (see SQLard::setResultMemoryBudget) */
+//#define SQLARD_SPILL
+/* Fetch rows into caller owned column arrays, rowset by rowset (see SQLardBinding, SQLard::executeBound) */
+//#define SQLARD_BOUND_COLUMNS
+/* Read large results block by block through server cursors (see SQLardCursor, SQLard::openCursor) */
+//#define SQLARD_CURSORS
+/* Keep local copies of tables up to date from their rowversion column (see SQLardTableSync) */
+//#define SQLARD_SYNC
+/* Store each distinct value of character columns once per result (see SQLard::setDictionaryEncoding) */
+//#define SQLARD_DICTIONARY
+/* Stream query text from flash, files or generators instead of one string in RAM (see SQLardQuerySource) */
+//#define SQLARD_QUERY_SOURCES
+/* Connection state machine timing in milliseconds (see SQLard::poll) */
+#ifndef SQLARD_CONNECT_TIMEOUT
+	#define SQLARD_CONNECT_TIMEOUT 5000
+#endif
+#ifndef SQLARD_LOGIN_TIMEOUT
+	#define SQLARD_LOGIN_TIMEOUT 5000
+#endif
+#ifndef SQLARD_BACKOFF_MIN
+	#define SQLARD_BACKOFF_MIN 250
+#endif
+#ifndef SQLARD_BACKOFF_MAX
+	#define SQLARD_BACKOFF_MAX 30000
+#endif
+/* Default deadline of a query response (0 waits forever), and of the cancellation of a response (see SQLard::cancel) */
+#ifndef SQLARD_QUERY_TIMEOUT
+	#define SQLARD_QUERY_TIMEOUT 30000
+#endif
+#ifndef SQLARD_CANCEL_TIMEOUT
+	#define SQLARD_CANCEL_TIMEOUT 5000
+#endif
+/* Largest packet a SQL batch is split into, also bounded by the packet size the server announced */
+#ifndef SQLARD_REQUEST_PACKET_SIZE
+	#ifdef WINDOWS
+		#define SQLARD_REQUEST_PACKET_SIZE 4096
+	#else
+		#define SQLARD_REQUEST_PACKET_SIZE 512
+	#endif
+#endif
+#ifdef SQLARD_MARS
+	#ifndef SQLARD_TDS73
+		#error "SQLARD_MARS requires SQLARD_TDS73"
+	#endif
+	/* Sessions per connection, including the default session used by SQLard itself */
+	#ifndef SQLARD_MARS_SESSIONS
+		#define SQLARD_MARS_SESSIONS 4
+	#endif
+	/* SMP receive window of each session, in packets */
+	#ifndef SQLARD_SMP_WINDOW
+		#define SQLARD_SMP_WINDOW 4
+	#endif
+#endif
+#if defined(SQLARD_FANOUT) || defined(SQLARD_PARALLEL_DECODE)
+	#ifndef WINDOWS
+		#error "SQLARD_FANOUT and SQLARD_PARALLEL_DECODE require a host build (WINDOWS)"
+	#endif
+	#define SQLARD_THREADS
+	#include <thread>
+	#include <mutex>
+	#include <condition_variable>
+	#include <functional>
+	#include <vector>
+	#include <deque>
+	#include <atomic>
+#endif
+#ifdef SQLARD_COLUMN_CACHE
+	/* Distinct COLMETADATA layouts remembered per connection */
+	#ifndef SQLARD_COLUMN_CACHE_ENTRIES
+		#define SQLARD_COLUMN_CACHE_ENTRIES 4
+	#endif
+#endif
+#ifdef SQLARD_SPILL
+	#ifndef WINDOWS
+		#error "SQLARD_SPILL requires a host build (WINDOWS)"
+	#endif
+	/* F is defined away for host builds, boost uses it as a template parameter */
+	#pragma push_macro("F")
+	#undef F
+	#include <boost/interprocess/file_mapping.hpp>
+	#include <boost/interprocess/mapped_region.hpp>
+	#pragma pop_macro("F")
+	#include <cstdio>
+	#include <cstdlib>
+	#include <string>
+	#include <vector>
+	#include <deque>
+	/* Rows per spilled page, a page is written and read back as a whole */
+	#ifndef SQLARD_SPILL_PAGE_ROWS
+		#define SQLARD_SPILL_PAGE_ROWS 256
+	#endif
+	/* The spill file grows and is mapped in segments of this many bytes */
+	#ifndef SQLARD_SPILL_SEGMENT
+		#define SQLARD_SPILL_SEGMENT (16UL * 1024 * 1024)
+	#endif
+#endif
+#ifdef SQLARD_PARALLEL_DECODE
+	/* Rows per decoding task */
+	#ifndef SQLARD_DECODE_BATCH
+		#define SQLARD_DECODE_BATCH 512
+	#endif
+#endif
+#ifdef SQLARD_QUERY_SOURCES
+	#ifdef WINDOWS
+		#include <cstdio>
+	#endif
+	/* Bytes pulled from a query source per read */
+	#ifndef SQLARD_SOURCE_CHUNK
+		#define SQLARD_SOURCE_CHUNK 64
+	#endif
+#endif
+#ifdef SQLARD_HEAP_STATS
+	#include <stdlib.h>
+	#ifdef WINDOWS
+		#include <mutex>
+	#endif
+	#ifdef __AVR__
+		/* avr-libc's heap: its start, the break and the free list of malloc */
+		extern "C" {
+			extern char __heap_start;
+			extern char * __brkval;
+			extern void * __flp;
+		}
+	#endif
+#endif
+/* Responses are read and parsed in chunks of this many bytes */
+#ifndef SQLARD_RECEIVE_CHUNK
+	#define SQLARD_RECEIVE_CHUNK 256
+#endif
+/* Row counts of the statements of a batch kept for SQLard::getStatementCount */
+#ifndef SQLARD_MAX_STATEMENT_COUNTS
+	#define SQLARD_MAX_STATEMENT_COUNTS 8
+#endif
 /* 
 	Memory benchmarks
 	!! All examples are compiled for Arduino Nano !!
@@ -52,15 +209,279 @@
 		uint8_t ipAddr[] = { 127,0,0,1 };
 		SQLard MSSQL(ipAddr, 1433);
 		if (MSSQL.connect()) {
-			MSSQL.setCredentials(L"arduino", L"arduino", L"arduino", L"host");
+			MSSQL.setCredentials(u"arduino", u"arduino", u"arduino", u"host");
 		if (MSSQL.login()) {
 		printf("login ok \n");
 
 		}
-			MSSQL.executeNonQuery(L"INSERT INTO [dbo].[test]([data]) VALUES('DATAAAAA')");
+			MSSQL.executeNonQuery(u"INSERT INTO [dbo].[test]([data]) VALUES('DATAAAAA')");
+	}
+*/
+
+
+#ifdef SQLARD_HEAP_STATS
+/* Heap use of an account, see SQLardHeap */
+struct SQLardHeapStats {
+	uint32_t allocations;
+	uint32_t frees;
+	/* Bytes requested over all allocations */
+	uint32_t bytesAllocated;
+	uint32_t bytesInUse;
+	uint32_t peakBytes;
+	/* Fragmentation of the free heap in percent when the last call returned (AVR only) */
+	uint8_t fragmentation;
+};
+
+/*
+	Heap use of a connection, and of the query it runs at the moment.
+	Blocks remember their account, so freeing a result after its connection
+	is gone is fine: the account lives on until its last block is freed.
+*/
+class SQLardHeapAccount {
+public:
+	SQLardHeapAccount(const bool bOwned = true) {
+		memset(&m_total, 0, sizeof(m_total));
+		memset(&m_query, 0, sizeof(m_query));
+		m_bOwned = bOwned;
+		m_bQueryActive = false;
+	}
+	const SQLardHeapStats & GetStats() const { return m_total; }
+	/* Heap use of the current or last query; bytesInUse and peakBytes are net of what was in use when it started */
+	const SQLardHeapStats & GetQueryStats() const { return m_query; }
+
+	/* The owner goes away, the account follows with its last block */
+	void Detach() {
+		lock();
+		m_bOwned = false;
+		const bool bDelete = m_total.allocations == m_total.frees;
+		unlock();
+		if (bDelete)
+			delete this;
+	}
+private:
+	friend class SQLardHeap;
+	friend class SQLardHeapScope;
+
+	void onAllocate(const size_t size) {
+		lock();
+		Add(m_total, size);
+		if (m_bQueryActive)
+			Add(m_query, size);
+		unlock();
+	}
+	/* Returns true if the account has to be deleted */
+	bool onFree(const size_t size) {
+		lock();
+		Remove(m_total, size);
+		if (m_bQueryActive)
+			Remove(m_query, size);
+		const bool bDelete = !m_bOwned && m_total.allocations == m_total.frees;
+		unlock();
+		return bDelete;
+	}
+	void beginQuery() {
+		lock();
+		memset(&m_query, 0, sizeof(m_query));
+		m_bQueryActive = true;
+		unlock();
+	}
+	void endQuery(const uint8_t fragmentation) {
+		lock();
+		m_bQueryActive = false;
+		m_query.fragmentation = m_total.fragmentation = fragmentation;
+		unlock();
+	}
+
+	static void Add(SQLardHeapStats & stats, const size_t size) {
+		stats.allocations++;
+		stats.bytesAllocated += size;
+		stats.bytesInUse += size;
+		if (stats.bytesInUse > stats.peakBytes)
+			stats.peakBytes = stats.bytesInUse;
+	}
+	static void Remove(SQLardHeapStats & stats, const size_t size) {
+		stats.frees++;
+		/* a query may free blocks from before it started */
+		stats.bytesInUse = stats.bytesInUse > size ? stats.bytesInUse - size : 0;
+	}
+
+	#ifdef WINDOWS
+		/* results may be freed on other threads than the connection runs on */
+		void lock() { m_mutex.lock(); }
+		void unlock() { m_mutex.unlock(); }
+		std::mutex m_mutex;
+	#else
+		void lock() {}
+		void unlock() {}
+	#endif
+	SQLardHeapStats m_total;
+	SQLardHeapStats m_query;
+	bool m_bOwned;
+	bool m_bQueryActive;
+};
+
+/*
+	Allocator hook of the library. Every block is allocated through a
+	pluggable allocator (malloc / free by default) with a small header
+	naming the account of the connection that was current on the calling
+	thread (see SQLardHeapScope), or the global account outside of any.
+	An optional trace callback sees each allocation and free.
+*/
+class SQLardHeap {
+public:
+	typedef void * (*AllocateCallback)(size_t size);
+	typedef void (*FreeCallback)(void * ptr);
+	/* bAllocate is false for frees, stats are those of the account after the operation */
+	typedef void (*TraceCallback)(void * context, const bool bAllocate, const void * ptr, const size_t size, const SQLardHeapStats & stats);
+
+	static void setAllocator(AllocateCallback pfnAllocate, FreeCallback pfnFree) {
+		Hooks().pfnAllocate = pfnAllocate ? pfnAllocate : &malloc;
+		Hooks().pfnFree = pfnFree ? pfnFree : &free;
+	}
+	static void setTrace(TraceCallback pfnTrace, void * context) {
+		Hooks().pfnTrace = pfnTrace;
+		Hooks().pTraceContext = context;
+	}
+	/* Heap use outside of any connection */
+	static SQLardHeapAccount & Global() {
+		static SQLardHeapAccount account(true);
+		return account;
+	}
+
+	static void * allocate(const size_t size) {
+		SQLardHeapAccount * pAccount = Current() ? Current() : &Global();
+		Header * header = static_cast<Header*>(Hooks().pfnAllocate(sizeof(Header) + size));
+		if (header == nullptr)
+			return nullptr;
+		header->block.pAccount = pAccount;
+		header->block.size = size;
+		pAccount->onAllocate(size);
+		if (Hooks().pfnTrace)
+			Hooks().pfnTrace(Hooks().pTraceContext, true, header + 1, size, pAccount->m_total);
+		return header + 1;
+	}
+	static void release(void * ptr) {
+		if (ptr == nullptr)
+			return;
+		Header * header = static_cast<Header*>(ptr) - 1;
+		SQLardHeapAccount * pAccount = header->block.pAccount;
+		const size_t size = header->block.size;
+		Hooks().pfnFree(header);
+		const bool bDelete = pAccount->onFree(size);
+		if (Hooks().pfnTrace)
+			Hooks().pfnTrace(Hooks().pTraceContext, false, ptr, size, pAccount->m_total);
+		if (bDelete)
+			delete pAccount;
+	}
+
+	/* Arrays of plain types, not initialized */
+	template <typename T>
+	static T * NewArray(const size_t count) { return static_cast<T*>(allocate(count * sizeof(T))); }
+	template <typename T>
+	static void DeleteArray(T * ptr) { release(const_cast<void*>(static_cast<const void*>(ptr))); }
+
+	/* Account of the connection running on this thread, nullptr for none */
+	static SQLardHeapAccount *& Current() {
+		#ifdef WINDOWS
+			static thread_local SQLardHeapAccount * pCurrent = nullptr;
+		#else
+			static SQLardHeapAccount * pCurrent = nullptr;
+		#endif
+		return pCurrent;
+	}
+
+	/*
+		Fragmentation of the free heap in percent: how much of the free memory
+		is not part of the largest free block. Only avr-libc's heap can be
+		inspected, 0 elsewhere.
+	*/
+	static uint8_t Fragmentation() {
+		#ifdef __AVR__
+			size_t largest, total;
+			FreeMemory(total, largest);
+			return total ? static_cast<uint8_t>(100 - (largest * 100UL) / total) : 0;
+		#else
+			return 0;
+		#endif
+	}
+	#ifdef __AVR__
+		/* Free bytes between the heap and the stack plus the free list of malloc, and the largest free block */
+		static void FreeMemory(size_t & total, size_t & largest) {
+			/* layout of avr-libc's struct __freelist */
+			struct FreeBlock {
+				size_t sz;
+				FreeBlock * nx;
+			};
+			char top;
+			total = largest = &top - (__brkval ? __brkval : &__heap_start);
+			for (FreeBlock * block = static_cast<FreeBlock*>(__flp); block != nullptr; block = block->nx) {
+				total += block->sz;
+				if (block->sz > largest)
+					largest = block->sz;
+			}
+		}
+	#endif
+private:
+	/* Keeps the blocks aligned like malloc does */
+	union Header {
+		struct {
+			SQLardHeapAccount * pAccount;
+			size_t size;
+		} block;
+		long double alignDouble;
+		long long alignLong;
+		void * alignPointer;
+	};
+	struct HookSet {
+		AllocateCallback pfnAllocate;
+		FreeCallback pfnFree;
+		TraceCallback pfnTrace;
+		void * pTraceContext;
+	};
+	static HookSet & Hooks() {
+		static HookSet hooks = { &malloc, &free, nullptr, nullptr };
+		return hooks;
 	}
+};
+
+/*
+	Makes an account (or none, for nullptr) current on this thread for the lifetime of the scope.
+	A query scope also starts the per query stats of the account, unless a
+	query of the same account is running already.
 */
+class SQLardHeapScope {
+public:
+	SQLardHeapScope(SQLardHeapAccount * pAccount, const bool bQuery = false) {
+		m_pAccount = pAccount;
+		m_pPrevious = SQLardHeap::Current();
+		m_bQuery = bQuery && pAccount != nullptr && !pAccount->m_bQueryActive;
+		SQLardHeap::Current() = pAccount;
+		if (m_bQuery)
+			pAccount->beginQuery();
+	}
+	~SQLardHeapScope() {
+		if (m_bQuery)
+			m_pAccount->endQuery(SQLardHeap::Fragmentation());
+		SQLardHeap::Current() = m_pPrevious;
+	}
+private:
+	SQLardHeapAccount * m_pAccount;
+	SQLardHeapAccount * m_pPrevious;
+	bool m_bQuery;
+};
 
+/* Library objects allocated on the heap are accounted through SQLardHeap */
+struct SQLardHeapObject {
+	static void * operator new(size_t size) noexcept { return SQLardHeap::allocate(size); }
+	static void operator delete(void * ptr) { SQLardHeap::release(ptr); }
+};
+#define SQLARD_NEW_ARRAY(T, count) SQLardHeap::NewArray<T>(count)
+#define SQLARD_DELETE_ARRAY(ptr) SQLardHeap::DeleteArray(ptr)
+#else
+struct SQLardHeapObject {};
+#define SQLARD_NEW_ARRAY(T, count) (new T[count])
+#define SQLARD_DELETE_ARRAY(ptr) (delete[] (ptr))
+#endif
 
 /*
 	RAII style buffer object
@@ -70,11 +491,11 @@ struct SQLardBuffer {
 public:
 	SQLardBuffer(const size_t allocation_size) {
 		allc_size = allocation_size;
-		m_pBuffer = new T[allc_size];
-		memset(m_pBuffer, 0, allc_size);
+		m_pBuffer = SQLARD_NEW_ARRAY(T, allc_size);
+		memset(m_pBuffer, 0, allc_size * sizeof(T));
 	}
 	~SQLardBuffer() {
-		delete[] m_pBuffer;
+		SQLARD_DELETE_ARRAY(m_pBuffer);
 		//Serial.print("free\n");
 	}
 	const size_t alloc_size() const { return allc_size; }
@@ -85,93 +506,103 @@ private:
 	size_t allc_size;
 };
 
+/*
+	Growable contiguous array of owned pointers, deleted with the array.
+	Capacity doubles on growth, so appending is amortized O(1) and
+	elements can be indexed, sorted and searched in place.
+*/
 template <typename T>
-struct SQLardRowElement
-{
-	SQLardRowElement(T v)
-	{
-		val = v;
-	}
-	// Stored value
-	T val;
-	SQLardRowElement<T> * prev = nullptr;
-	SQLardRowElement() {
-	}
-	~SQLardRowElement<T>() {
-		delete val;
-	}
-};
-
-template <typename T>
-struct SQLardRowList
+struct SQLardRowArray
 {
 public:
+	SQLardRowArray() {}
 
-	SQLardRowList() {}
-
-	~SQLardRowList()
+	~SQLardRowArray()
 	{
 		Free();
 	}
 
 	void Free() {
-		// Pop all element(s) and free the allocated space
-		SQLardRowElement<T> * node = root;
-		while (node != nullptr)
-		{
-			SQLardRowElement<T> * next = node->prev;
-			delete node;
-			node = next;
-		}
+		for (uint32_t i = 0; i < count; i++)
+			delete items[i];
+		if (items != nullptr)
+			SQLARD_DELETE_ARRAY(items);
+		items = nullptr;
+		count = 0;
+		capacity = 0;
 	}
 
+	bool Reserve(const uint32_t newCapacity) {
+		if (newCapacity <= capacity)
+			return true;
+		T * newItems = SQLARD_NEW_ARRAY(T, newCapacity);
+		if (newItems == nullptr)
+			return false;
+		if (count > 0)
+			memcpy(newItems, items, count * sizeof(T));
+		if (items != nullptr)
+			SQLARD_DELETE_ARRAY(items);
+		items = newItems;
+		capacity = newCapacity;
+		return true;
+	}
 
-	/* Push a new element to the Queue */
-	void Enqueue(T c)
-	{
-		SQLardRowElement<T> * tmp = Create(c);
-		if (head)
-			head->prev = tmp;
-		head = tmp;
-
-		// If root is nullptr, then Queue is empty and it's the first element
-		if (root == nullptr)
-		{
-			root = tmp;
-			current = tmp;
-		}
+	/* Forget the elements without deleting them, after their ownership moved elsewhere */
+	void Release() {
+		if (items != nullptr)
+			SQLARD_DELETE_ARRAY(items);
+		items = nullptr;
+		count = 0;
+		capacity = 0;
 	}
-	SQLardRowElement<T> * GetRoot() { return root; }
-	const SQLardRowElement<T> * GetCurrent() const { return current; }
-	void MoveNext() {
-		if (current != nullptr)
-			current = current->prev;
+
+	/* Append an element, the array takes ownership */
+	bool Append(T c)
+	{
+		if (count == capacity && !Reserve(capacity ? capacity * 2 : 4))
+			return false;
+		items[count++] = c;
+		return true;
 	}
-	void Reset() {
-		current = root;
+
+	/* Insert an element before index, the array takes ownership */
+	bool Insert(const uint32_t index, T c)
+	{
+		if (count == capacity && !Reserve(capacity ? capacity * 2 : 4))
+			return false;
+		memmove(&items[index + 1], &items[index], (count - index) * sizeof(T));
+		items[index] = c;
+		count++;
+		return true;
 	}
-	/* Returns true if Queue is empty (the root should be null) */
-	bool isEmpty() { return root == nullptr; }
-private:
-	/* The first added elements' address */
-	SQLardRowElement<T> * root = nullptr;
-	/* The last added elements' address */
-	SQLardRowElement<T> * head = nullptr;
-	SQLardRowElement<T>  * current = nullptr;
 
-	/* Creates a new LinkListElement object and returns its' address */
-	SQLardRowElement<T> * Create(T val)
+	/* Put c at index, returns the element it replaces, which the caller now owns */
+	T Replace(const uint32_t index, T c)
 	{
-		return new SQLardRowElement<T>(val);
+		T old = items[index];
+		items[index] = c;
+		return old;
 	}
 
-	/* Returns the value of existing LinkListElement object and frees the memory */
-	T Remove(SQLardRowElement<T> * p)
+	/* Take the element at index out of the array, the caller now owns it */
+	T Remove(const uint32_t index)
 	{
-		T val = p->val;
-		delete p;
-		return val;
+		T old = items[index];
+		memmove(&items[index], &items[index + 1], (count - index - 1) * sizeof(T));
+		count--;
+		return old;
 	}
+
+	const uint32_t Count() const { return count; }
+	T operator[](const uint32_t index) const { return items[index]; }
+	T * Data() { return items; }
+	T * const Data() const { return items; }
+	/* Returns true if the array is empty */
+	bool isEmpty() const { return count == 0; }
+private:
+	T * items = nullptr;
+	uint32_t count = 0;
+	uint32_t capacity = 0;
 };
 
 enum SQLardDataType
@@ -220,6 +651,14 @@ enum SQLardDataType
 	MONEYNTYPE = 0x6E,
 	/* Date time with variable length*/
 	DATETIMNTYPE = 0x6F,
+	/* Date (TDS 7.3) */
+	DATENTYPE = 0x28,
+	/* Time (TDS 7.3) */
+	TIMENTYPE = 0x29,
+	/* Datetime2 (TDS 7.3) */
+	DATETIME2NTYPE = 0x2A,
+	/* Datetimeoffset (TDS 7.3) */
+	DATETIMEOFFSETNTYPE = 0x2B,
 	/* Char (legacy support)*/
 	CHARTYPE = 0x2F,
 	/*VarChar(legacy support)*/
@@ -247,6 +686,11 @@ enum SQLardDataType
 	NTEXTTYPE = 0x63
 };
 
+/* Days from 0001-01-01 (DATE base) and 1900-01-01 (DATETIME base) to 1970-01-01 */
+#define SQLARD_DAYS_0001_TO_UNIX 719162LL
+#define SQLARD_DAYS_1900_TO_UNIX 25567LL
+#define SQLARD_US_PER_DAY 86400000000LL
+
 class SQLardUtil {
 public:
 #ifdef SQLARD_VERBOSE_OUTPUT
@@ -296,24 +740,15 @@ public:
 	#endif
 #endif
 
-	static int freeRam(const char * who) {
-		extern int __heap_start, *__brkval;
-		int v;
-		int fr = (int)&v - (__brkval == 0 ? (int)&__heap_start : (int)__brkval);
-		Serial.print(who);
-		Serial.print("Free ram: ");
-		Serial.println(fr);
-
-	}
 	/*
-	* @brief 	Measure the length of a wide char string
-	* @return	Measured length as size_t 
+	* @brief 	Measure the length of a UTF-16 string
+	* @return	Measured length in code units
 	*/
-	static size_t sqlard_wcslen(const wchar_t * s)
+	static size_t sqlard_wcslen(const char16_t * s)
 	{
 		if (s == nullptr)
 			return 0;
-		const wchar_t *p;
+		const char16_t *p;
 		p = s;
 		while (*p)
 			p++;
@@ -321,22 +756,69 @@ public:
 	}
 
 	/*
-	* @brief 	Copy a wide char array from one memory place to another.
-	* @return	Beginning of the copied region as wide char pointer
+	* @brief 	Write n UTF-16 code units to d in little endian order (UTF-16LE, as TDS sends text).
+	* @return	Byte after the written region.
 	*/
-	static wchar_t * sqlard_wmemcpy(void * d, const wchar_t * s, size_t n)
+	static uint8_t * sqlard_write_utf16le(uint8_t * d, const char16_t * s, const size_t n)
 	{
-		if (s == nullptr || d == nullptr)
-			return nullptr;
-		return (wchar_t *)memcpy(d, s, n * sizeof(wchar_t));
+		if (s == nullptr || n == 0)
+			return d;
+		#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+			for (size_t i = 0; i < n; i++) {
+				*d++ = static_cast<uint8_t>(s[i]);
+				*d++ = static_cast<uint8_t>(s[i] >> 8);
+			}
+			return d;
+		#else
+			memcpy(d, s, n * 2);
+			return d + n * 2;
+		#endif
+	}
+
+	/*
+	* @brief 	Convert a UTF-16 string to UTF-8, truncated to whole characters
+	*			fitting in dstLen - 1 bytes. The destination will be null-terminated.
+	* @return	Length of the UTF-8 string in bytes.
+	*/
+	static size_t sqlard_utf16_to_utf8(char * dst, const size_t dstLen, const char16_t * s)
+	{
+		size_t n = 0;
+		if (dstLen == 0)
+			return 0;
+		for (; s != nullptr && *s; s++) {
+			uint32_t cp = *s;
+			if (cp >= 0xD800 && cp < 0xDC00 && s[1] >= 0xDC00 && s[1] < 0xE000)
+				cp = 0x10000 + ((cp - 0xD800) << 10) + (*++s - 0xDC00);
+			else if (cp >= 0xD800 && cp < 0xE000)
+				cp = 0xFFFD;
+			char utf8[4];
+			const size_t len = sqlard_utf8_encode(utf8, cp);
+			if (n + len >= dstLen)
+				break;
+			memcpy(dst + n, utf8, len);
+			n += len;
+		}
+		dst[n] = '\0';
+		return n;
 	}
+
 	/*
-	* @brief 	Copy a wide char string from one memory place to another.
-	* @return	Beginning of the copied region as wide char pointer
+	* @brief 	Encode a code point as UTF-8 into d (room for 4 bytes).
+	* @return	Bytes written.
 	*/
-	static wchar_t * sqlard_wstrcpy(void *d, const wchar_t * s)
+	static size_t sqlard_utf8_encode(char * d, uint32_t cp)
 	{
-		return SQLardUtil::sqlard_wmemcpy(d, s, sqlard_wcslen(s));
+		const size_t len = cp < 0x80 ? 1 : (cp < 0x800 ? 2 : (cp < 0x10000 ? 3 : 4));
+		if (len == 1) {
+			d[0] = static_cast<char>(cp);
+			return 1;
+		}
+		for (size_t i = len - 1; i > 0; i--) {
+			d[i] = static_cast<char>(0x80 | (cp & 0x3F));
+			cp >>= 6;
+		}
+		d[0] = static_cast<char>((0xF00 >> len) | cp);
+		return len;
 	}
 
 	/*
@@ -364,27 +846,16 @@ public:
 	}
 
 	/*
-	* @brief 	Allocate a new wide character array, and copy the source to it.	
-	* @return	The wide character pointer to allocated wide character array.
-	*/
-	static wchar_t* sqlard_alloc_wstr(const wchar_t * s) {
-		wchar_t * d = new wchar_t[sqlard_wcslen(s) + 1];
-		wchar_t *save = d;
-		for (; (*d = *s); ++s, ++d);
-		return save;
-	}
-
-	/*
-	* @brief 	Allocate a new wide character array, read wide character string
+	* @brief 	Allocate a new wide character array, read UTF-16LE string
 				from source array[offset], and move the offset to offset + (len * 2)
 	* @return	The wide character pointer to allocated wide character array.
 	*/
-	static wchar_t* sqlard_read_nwstr(uint8_t * s, size_t & offset, const uint16_t wslen) {
-		wchar_t * d = new wchar_t[wslen + 1];
-		memcpy(d, &s[offset], wslen * 2);
-		offset += (wslen * 2);
+	static char16_t* sqlard_read_nwstr(uint8_t * s, size_t & offset, const uint16_t wslen) {
+		char16_t * d = SQLARD_NEW_ARRAY(char16_t, wslen + 1);
+		for (uint16_t i = 0; i < wslen; i++, offset += 2)
+			d[i] = static_cast<char16_t>(s[offset] | (s[offset + 1] << 8));
 		/* null terminate the string */
-		d[wslen] = '\0';
+		d[wslen] = 0;
 		return d;
 	}
 
@@ -438,565 +909,2354 @@ public:
 		sqlard_wctomb(dest, &src[offset], len * 2);
 		offset += (len * 2);
 	}
-};
 
-class SQLardColumnData {
-public:
-	unsigned int m_uiUserType;
-	uint16_t m_usFlags;
-	uint8_t m_bType;
-	uint16_t m_usLargeTypeSize;
-	uint8_t m_bColumnNameLen;
-	wchar_t * m_wcstrColumnName;
+	/*
+	* @brief 	Convert a DATETIME day count and 1/300th second tick count
+				to microseconds since UNIX epoch. Ticks are rounded to the
+				nearest microsecond instead of being truncated to seconds.
+	* @return	Microseconds since 1970-01-01 00:00:00 as int64_t
+	*/
+	static int64_t sqlard_datetime_to_epoch_us(const int32_t days, const uint32_t ticks)
+	{
+		return (static_cast<int64_t>(days) - SQLARD_DAYS_1900_TO_UNIX) * SQLARD_US_PER_DAY
+			+ (static_cast<int64_t>(ticks) * 10000 + 1) / 3;
+	}
 
-	static SQLardColumnData * ParseColumnData(uint8_t * data, size_t & offset) {
+	/*
+	* @brief 	Batch version of sqlard_datetime_to_epoch_us, converts a whole
+				column of day / tick pairs in a single pass.
+	*/
+	static void sqlard_datetime_to_epoch_us(const int32_t * days, const uint32_t * ticks, int64_t * out, const size_t count)
+	{
+		for (size_t i = 0; i < count; i++) {
+			out[i] = (static_cast<int64_t>(days[i]) - SQLARD_DAYS_1900_TO_UNIX) * SQLARD_US_PER_DAY
+				+ (static_cast<int64_t>(ticks[i]) * 10000 + 1) / 3;
+		}
+	}
 
-		SQLardColumnData * colData = new SQLardColumnData();
-		colData->m_uiUserType = SQLardUtil::sqlard_read_le<uint16_t>(data, offset);
-		colData->m_usFlags = SQLardUtil::sqlard_read_le<uint16_t>(data, offset);
-		colData->m_bType = SQLardUtil::sqlard_read_le<uint8_t>(data, offset);
+	/*
+	* @brief 	Milliseconds elapsed since an arbitrary, fixed point in time.
+	*/
+	static uint32_t sqlard_millis()
+	{
+		#ifdef WINDOWS
+			return static_cast<uint32_t>(std::chrono::duration_cast<std::chrono::milliseconds>(
+				std::chrono::steady_clock::now().time_since_epoch()).count());
+		#else
+			return millis();
+		#endif
+	}
 
-		switch (static_cast<SQLardDataType>(colData->m_bType)) {
-			case SQLardDataType::BITTYPE:
+	/*
+	* @brief 	Pseudo random number in [0, max).
+	*/
+	static uint32_t sqlard_random(const uint32_t max)
+	{
+		if (max == 0)
+			return 0;
+		#ifdef WINDOWS
+			return static_cast<uint32_t>(rand()) % max;
+		#else
+			return static_cast<uint32_t>(random(max));
+		#endif
+	}
+
+	/*
+	* @brief 	Microseconds elapsed since an arbitrary, fixed point in time (wraps around).
+	*/
+	static uint32_t sqlard_micros()
+	{
+		#ifdef WINDOWS
+			return static_cast<uint32_t>(std::chrono::duration_cast<std::chrono::microseconds>(
+				std::chrono::steady_clock::now().time_since_epoch()).count());
+		#else
+			return micros();
+		#endif
+	}
+
+	/*
+	* @brief 	FNV-1a hash of a UTF-16 string, over its UTF-16LE bytes.
+	* @return	32 bit hash, chained from the given seed.
+	*/
+	static uint32_t sqlard_hash_wstr(const char16_t * s, uint32_t hash = 2166136261UL)
+	{
+		if (s == nullptr)
+			return hash;
+		for (; *s; s++) {
+			hash = (hash ^ static_cast<uint8_t>(*s)) * 16777619UL;
+			hash = (hash ^ static_cast<uint8_t>(static_cast<uint16_t>(*s) >> 8)) * 16777619UL;
+		}
+		return hash;
+	}
+
+	/*
+	* @brief 	FNV-1a hash of raw bytes.
+	* @return	32 bit hash, chained from the given seed.
+	*/
+	static uint32_t sqlard_hash_bytes(const uint8_t * data, const size_t len, uint32_t hash = 2166136261UL)
+	{
+		for (size_t i = 0; i < len; i++)
+			hash = (hash ^ data[i]) * 16777619UL;
+		return hash;
+	}
+
+	/*
+	* @brief 	Convert a TIME value expressed in 10^-scale second units to microseconds.
+	*/
+	static int64_t sqlard_time_to_us(uint64_t units, const uint8_t scale)
+	{
+		for (uint8_t s = scale; s < 6; s++)
+			units *= 10;
+		for (uint8_t s = 6; s < scale; s++)
+			units /= 10;
+		return static_cast<int64_t>(units);
+	}
+
+	/*
+	* @brief 	Size of a fixed length data type.
+	* @return 	Byte count, or -1 if the type carries a length prefix.
+	*/
+	static int8_t sqlard_fixed_length(const uint8_t type)
+	{
+		switch (static_cast<SQLardDataType>(type)) {
+			case SQLardDataType::NULLTYPE:
+				return 0;
 			case SQLardDataType::INT1TYPE:
+			case SQLardDataType::BITTYPE:
+				return 1;
 			case SQLardDataType::INT2TYPE:
+				return 2;
 			case SQLardDataType::INT4TYPE:
+			case SQLardDataType::DATETIM4TYPE:
+			case SQLardDataType::FLT4TYPE:
+			case SQLardDataType::MONEY4TYPE:
+				return 4;
 			case SQLardDataType::INT8TYPE:
+			case SQLardDataType::MONEYTYPE:
 			case SQLardDataType::DATETIMETYPE:
-			case SQLardDataType::FLT4TYPE:
 			case SQLardDataType::FLT8TYPE:
-				break;
-			case SQLardDataType::DECIMALNTYPE:
-			case SQLardDataType::NUMERICNTYPE:
-				/* precision and shit */
-				/* like i care..*/
-				SQLardUtil::sqlard_read_le<uint16_t>(data, offset);
-				SQLardUtil::sqlard_read_le<uint8_t>(data, offset);
-				break;
-			/*
-				IMAGETYPE / NTEXTTYPE / SSVARIANTTYPE / 
-				TEXTTYPE / XMLTYPE
-			*/
-			case SQLardDataType::IMAGETYPE:
-			case SQLardDataType::NTEXTTYPE:
-			case SQLardDataType::TEXTTYPE:
-				colData->m_usLargeTypeSize = static_cast<uint16_t>(SQLardUtil::sqlard_read_le<uint32_t>(data, offset));
-				break;
+				return 8;
+			default:
+				return -1;
+		}
+	}
 
-			/*
-				BIGVARBINTYPE / BIGVARCHRTYPE / BIGBINARYTYPE /
-				BIGCHARTYPE / NVARCHARTYPE / NCHARTYPE
-			*/
-			case SQLardDataType::BIGVARBINTYPE:
-			case SQLardDataType::BIGVARCHRTYPE:
-			case SQLardDataType::BIGBINARYTYPE:
-			case SQLardDataType::BIGCHARTYPE:
-			case SQLardDataType::NVARCHARTYPE:
-			case SQLardDataType::NCHARTYPE:
-				colData->m_usLargeTypeSize = SQLardUtil::sqlard_read_le<uint16_t>(data, offset);
-				break;
-			/*
-				GUIDTYPE / INTNTYPE / DECIMALTYPE / NUMERICTYPE / BITNTYPE / 
-				DECIMALNTYPE / NUMERICNTYPE / FLTNTYPE / MONEYNTYPE / DATETIMNTYPE / 
-				DATENTYPE / TIMENTYPE/ DATETIME2NTYPE / DATETIMEOFFSETNTYPE / CHARTYPE 
-				/ VARCHARTYPE / BINARYTYPE / VARBINARYTYPE
-			*/ 
+	/*
+	* @brief 	Size of the length prefix a data type carries in TYPE_INFO and in row data.
+	* @return 	0 for fixed length types, 1 / 2 / 4 for BYTELEN / USHORTLEN / LONGLEN types,
+	*			0xFF for unknown types.
+	*/
+	static uint8_t sqlard_length_prefix(const uint8_t type)
+	{
+		if (sqlard_fixed_length(type) >= 0)
+			return 0;
+		switch (static_cast<SQLardDataType>(type)) {
 			case SQLardDataType::GUIDTYPE:
 			case SQLardDataType::INTNTYPE:
 			case SQLardDataType::DECIMALTYPE:
 			case SQLardDataType::NUMERICTYPE:
 			case SQLardDataType::BITNTYPE:
+			case SQLardDataType::DECIMALNTYPE:
+			case SQLardDataType::NUMERICNTYPE:
 			case SQLardDataType::FLTNTYPE:
 			case SQLardDataType::MONEYNTYPE:
 			case SQLardDataType::DATETIMNTYPE:
+			case SQLardDataType::DATENTYPE:
+			case SQLardDataType::TIMENTYPE:
+			case SQLardDataType::DATETIME2NTYPE:
+			case SQLardDataType::DATETIMEOFFSETNTYPE:
 			case SQLardDataType::CHARTYPE:
 			case SQLardDataType::VARCHARTYPE:
 			case SQLardDataType::BINARYTYPE:
 			case SQLardDataType::VARBINARYTYPE:
-				colData->m_usLargeTypeSize = SQLardUtil::sqlard_read_le<uint8_t>(data, offset);
-				break;
-		default:
-			#ifdef SQLARD_VERBOSE_OUTPUT
-				SQLardUtil::printf(F("ParseColumnData() >> undefined data type %d\n"), colData->m_bType);
-			#endif
-			break;
+				return 1;
+			case SQLardDataType::BIGVARBINTYPE:
+			case SQLardDataType::BIGVARCHRTYPE:
+			case SQLardDataType::BIGBINARYTYPE:
+			case SQLardDataType::BIGCHARTYPE:
+			case SQLardDataType::NVARCHARTYPE:
+			case SQLardDataType::NCHARTYPE:
+				return 2;
+			case SQLardDataType::TEXTTYPE:
+			case SQLardDataType::IMAGETYPE:
+			case SQLardDataType::NTEXTTYPE:
+				return 4;
+			default:
+				return 0xFF;
 		}
+	}
 
-		colData->m_bColumnNameLen = SQLardUtil::sqlard_read_le<uint8_t>(data, offset);
-		#ifndef SQLARD_SKIP_COLUMN_NAMES
-			colData->m_wcstrColumnName = SQLardUtil::sqlard_read_nwstr(data, offset, colData->m_bColumnNameLen);
-		#else
-			offset += colData->m_bColumnNameLen * 2;
-		#endif
-		return colData;
+	/*
+	* @brief 	True for character types whose TYPE_INFO carries a COLLATION (TDS 7.1+).
+	*/
+	static bool sqlard_has_collation(const uint8_t type)
+	{
+		switch (static_cast<SQLardDataType>(type)) {
+			case SQLardDataType::BIGVARCHRTYPE:
+			case SQLardDataType::BIGCHARTYPE:
+			case SQLardDataType::NVARCHARTYPE:
+			case SQLardDataType::NCHARTYPE:
+			case SQLardDataType::TEXTTYPE:
+			case SQLardDataType::NTEXTTYPE:
+				return true;
+			default:
+				return false;
+		}
 	}
 
-	SQLardColumnData() {
-		m_uiUserType = 0;
-		m_usFlags = 0;
-		m_bType = 0;
-		m_usLargeTypeSize = 0;
-		m_bColumnNameLen = 0;
-		m_wcstrColumnName = nullptr;
+	/*
+	* @brief 	True for the legacy BYTELEN char / binary types, which use 0xFF as NULL length.
+	*/
+	static bool sqlard_is_legacy_charbin(const uint8_t type)
+	{
+		return type == SQLardDataType::CHARTYPE || type == SQLardDataType::VARCHARTYPE || type == SQLardDataType::BINARYTYPE || type == SQLardDataType::VARBINARYTYPE;
 	}
-	~SQLardColumnData() {
-		if (!(nullptr == m_wcstrColumnName))
-			delete[] m_wcstrColumnName;
+
+	/*
+	* @brief 	True for UTF-16 character types.
+	*/
+	static bool sqlard_is_wide(const uint8_t type)
+	{
+		return type == SQLardDataType::NVARCHARTYPE || type == SQLardDataType::NCHARTYPE || type == SQLardDataType::NTEXTTYPE;
+	}
+
+	/*
+	* @brief 	True for any character type (narrow or wide).
+	*/
+	static bool sqlard_is_char(const uint8_t type)
+	{
+		switch (static_cast<SQLardDataType>(type)) {
+			case SQLardDataType::CHARTYPE:
+			case SQLardDataType::VARCHARTYPE:
+			case SQLardDataType::BIGVARCHRTYPE:
+			case SQLardDataType::BIGCHARTYPE:
+			case SQLardDataType::TEXTTYPE:
+				return true;
+			default:
+				return sqlard_is_wide(type);
+		}
 	}
 };
 
-class SQLardRowFieldData {
+/*
+	Text handed to the library: a query, a login field, a table name.
+	TDS sends text as UTF-16LE; char16_t strings (u"" literals) and wchar_t
+	strings where wchar_t has 16 bits are copied to the packet as they are,
+	UTF-8 strings and 32 bit wchar_t strings are encoded while they are
+	written. The source is not copied, it has to outlive the call.
+*/
+class SQLardText {
 public:
-	uint8_t * m_pData;
-	uint16_t m_usLength;
-	uint8_t m_bSignFlag;
-	SQLardRowFieldData() {
-		m_pData = nullptr;
-		m_usLength = 0;
-		m_bSignFlag = 1;
-	}
-	~SQLardRowFieldData() {
-		if (!(nullptr == m_pData))
-			delete[] m_pData;
+	SQLardText(const char16_t * s) { init(s, UTF16); }
+	SQLardText(const wchar_t * s) { init(s, sizeof(wchar_t) == 2 ? UTF16 : UTF32); }
+	/* UTF-8, malformed sequences become U+FFFD */
+	SQLardText(const char * s) { init(s, UTF8); }
+	SQLardText(const SQLardText & other) { init(other.m_pSource, other.m_encoding); m_szLength = other.m_szLength; }
+	SQLardText & operator=(const SQLardText & other) {
+		if (this != &other) {
+			release();
+			init(other.m_pSource, other.m_encoding);
+			m_szLength = other.m_szLength;
+		}
+		return *this;
 	}
+	~SQLardText() { release(); }
 
-	const uint32_t asDateTime() const {
-		size_t offset = 0;
-		int32_t number_of_days = SQLardUtil::sqlard_read_le<int32_t>(m_pData, offset);
-		int32_t number_of_threehund = SQLardUtil::sqlard_read_le<int32_t>(m_pData, offset);
-		/* Convert 1/300th of seconds to seconds */
-		number_of_threehund /= 300;
-		/* Convert days to seconds */
-		number_of_days *= 86400;
-		/* NTP timestamp to UNIX conversion constant*/
-		const int32_t conv_unix = 0x83AA7E80;
-		return number_of_days  - conv_unix + (number_of_threehund);
+	/* Length in UTF-16 code units, half the size on the wire */
+	size_t Length() const {
+		if (m_szLength == static_cast<size_t>(-1)) {
+			if (m_encoding == UTF16)
+				m_szLength = SQLardUtil::sqlard_wcslen(static_cast<const char16_t*>(m_pSource));
+			else {
+				size_t len = 0;
+				encode([&len](const char16_t) { len++; });
+				m_szLength = len;
+			}
+		}
+		return m_szLength;
 	}
 
-	const uint8_t getByte(const uint16_t index) const {
-		if (index >= m_usLength)
-			return -1;
-
-		return m_pData[index];
+	/* Write the text as UTF-16LE, Length() * 2 bytes, without terminator */
+	uint8_t * Write(uint8_t * d) const {
+		if (m_encoding == UTF16)
+			return SQLardUtil::sqlard_write_utf16le(d, static_cast<const char16_t*>(m_pSource), Length());
+		encode([&d](const char16_t unit) {
+			*d++ = static_cast<uint8_t>(unit);
+			*d++ = static_cast<uint8_t>(unit >> 8);
+		});
+		return d;
 	}
 
-	const uint8_t * asGUID() const {
-		return m_pData;
+	/*
+		The text as a null-terminated UTF-16 string, for code looking at its
+		characters (result cache, query fingerprints). Encoded on first use
+		and kept with this object; nullptr for a nullptr source.
+	*/
+	const char16_t * Units() const {
+		if (m_encoding == UTF16 || m_pSource == nullptr)
+			return static_cast<const char16_t*>(m_pSource);
+		if (m_pUnits == nullptr) {
+			char16_t * d = m_pUnits = SQLARD_NEW_ARRAY(char16_t, Length() + 1);
+			encode([&d](const char16_t unit) { *d++ = unit; });
+			*d = 0;
+		}
+		return m_pUnits;
 	}
 
-	const uint8_t * asVarchar() const {
-		return m_pData;
+	/* Hand the UTF-16 code units of the text to put one by one, without a copy */
+	template <typename Put>
+	void ForEachUnit(Put put) const {
+		if (m_encoding != UTF16) {
+			encode(put);
+			return;
+		}
+		const char16_t * p = static_cast<const char16_t*>(m_pSource);
+		for (size_t i = 0, len = Length(); i < len; i++)
+			put(p[i]);
 	}
 
-	const float asFloat() const {
-		float result;
-		memcpy(&result, m_pData, 4);
-		return result;
+	/* New null-terminated UTF-16 copy, freed with SQLARD_DELETE_ARRAY */
+	char16_t * Duplicate() const {
+		const size_t len = Length();
+		char16_t * d = SQLARD_NEW_ARRAY(char16_t, len + 1);
+		if (len)
+			memcpy(d, Units(), len * sizeof(char16_t));
+		d[len] = 0;
+		return d;
 	}
+private:
+	#ifdef SQLARD_QUERY_SOURCES
+		/* decodes the UTF-8 it reads the same way */
+		friend class SQLardQuerySource;
+	#endif
+	enum Encoding : uint8_t {
+		UTF16,
+		UTF32,
+		UTF8
+	};
 
-	const double asDouble() const {
-		double result;
-		memcpy(&result, m_pData, 8);
-		return result;
+	void init(const void * s, const Encoding encoding) {
+		m_pSource = s;
+		m_encoding = encoding;
+		m_szLength = s == nullptr ? 0 : static_cast<size_t>(-1);
+		m_pUnits = nullptr;
 	}
-
-	template<typename T>
-	const T interpret_integer() const {
-		size_t o = 0;
-		if (m_bSignFlag == 0)
-			return SQLardUtil::sqlard_read_le<T>(m_pData, o, (m_usLength * 8)) * (-1);
-		return SQLardUtil::sqlard_read_le<T>(m_pData, o, (m_usLength * 8));
+	void release() {
+		if (m_pUnits != nullptr)
+			SQLARD_DELETE_ARRAY(m_pUnits);
+		m_pUnits = nullptr;
 	}
 
-	
-	static SQLardRowFieldData * ParseField(const uint8_t fieldDataType,uint8_t * data, size_t & offset) {
-		SQLardRowFieldData * fieldData = new SQLardRowFieldData();
-		/*	DATE MUST NOT have a TYPE_VARLEN. The value is either 3 bytes or 0 bytes (null). 
-			TIME, DATETIME2, and DATETIMEOFFSET MUST NOT have a TYPE_VARLEN. The lengths are determined by the SCALE as indicated in section 2.2.5.4.2. 
-			PRECISION and SCALE MUST occur if the type is NUMERIC, NUMERICN, DECIMAL, or DECIMALN. 
-			SCALE (without PRECISION) MUST occur if the type is TIME, DATETIME2, or DATETIMEOFFSET (introduced in TDS 7.3). PRECISION MUST be less than or equal to decimal 38 and SCALE MUST be less than or equal to the precision value. 
-			COLLATION occurs only if the type is BIGCHARTYPE, BIGVARCHRTYPE, TEXTTYPE, NTEXTTYPE, NCHARTYPE, or NVARCHARTYPE.*/
-
-		char extraBytes = 0;
-		/* These types need null terminator. */
-		switch (SQLardDataType(fieldDataType)) 
-		{
-			/* 2 byte length specifier */
-			case SQLardDataType::VARCHARTYPE:
-			case SQLardDataType::BIGVARCHRTYPE:
-			case SQLardDataType::TEXTTYPE:
-			case SQLardDataType::BIGCHARTYPE:
-			case SQLardDataType::NTEXTTYPE:
-				fieldData->m_usLength = SQLardUtil::sqlard_read_le<uint16_t>(data, offset);
-				extraBytes = 1;
-				break;
-			case SQLardDataType::BIGBINARYTYPE:
-			case SQLardDataType::BIGVARBINTYPE:
-				fieldData->m_usLength = SQLardUtil::sqlard_read_le<uint16_t>(data, offset);
-				break;
-			case SQLardDataType::BINARYTYPE:
-			case SQLardDataType::VARBINARYTYPE:
-			case SQLardDataType::GUIDTYPE:
-				/* These are legacy, must read fixed column amount*/
-				fieldData->m_usLength = SQLardUtil::sqlard_read_le<uint8_t>(data, offset);
-				break;
-			/* 1 for INT1TYPE/BITTYPE */
-			case SQLardDataType::BITTYPE:
-			case SQLardDataType::INT1TYPE:
-				fieldData->m_usLength = 1;
-				break;
-			/* 2 for INT2TYPE */
-			case SQLardDataType::INT2TYPE:
-				fieldData->m_usLength = 2;
-				break;
-			/* 4 for INT4TYPE / DATETIM4TYPE / FLT4TYPE / MONEY4TYPE*/
-			case SQLardDataType::FLT4TYPE:
-			case SQLardDataType::INT4TYPE:
-			case SQLardDataType::MONEY4TYPE:
-			case SQLardDataType::DATETIM4TYPE:
-				fieldData->m_usLength = 4;
-				break;
-			/*8 for MONEYTYPE/DATETIMETYPE/FLT8TYPE/INT8TYPE*/
-			case SQLardDataType::INT8TYPE:
-			case SQLardDataType::MONEYTYPE:
-			case SQLardDataType::DATETIMETYPE:
-			case SQLardDataType::FLT8TYPE:
-				fieldData->m_usLength = 8;
-				break;
-			
-
-				/*PRECISION and SCALE MUST occur if the type is NUMERIC, NUMERICN, DECIMAL, or DECIMALN.*/
-			case SQLardDataType::NUMERICTYPE:
-			case SQLardDataType::NUMERICNTYPE:
-			case SQLardDataType::DECIMALNTYPE:
-			case SQLardDataType::DECIMALTYPE:
-				fieldData->m_usLength = (SQLardUtil::sqlard_read_le<uint8_t>(data, offset)) -1;
-				/* DIGIT COUNT */
-				
-				fieldData->m_bSignFlag = SQLardUtil::sqlard_read_le<uint8_t>(data, offset);
-				break;
-				/*GUIDTYPE, BITTYPE, INT1TYPE, INT2TYPE, INT4TYPE, INT8TYPE, DATETIMETYPE, DATETIM4TYPE, FLT4TYPE, FLT8TYPE, MONEYTYPE, MONEY4TYPE, DATENTYPE*/
-				/* NOT SPECIFIED*/
-				/*TIMENTYPE, DATETIME2NTYPE, DATETIMEOFFSETNTYPE*/
-				/*1 byte specifying scale
-				/*BIGVARBINTYPE, BIGBINARYTYPE*/
-				/*2 bytes specifying max length */
-				/*BIGVARCHRTYPE, BIGCHARTYPE, NVARCHARTYPE, NCHARTYPE */
-				/*5-byte COLLATION, followed by a 2-byte max length */
-			default:
-				#ifdef SQLARD_VERBOSE_OUTPUT
-					SQLardUtil::printf(F("ParseField() >> Undefined field type !!! %d\n"), fieldDataType);
-				#endif 
-
-			break;
+	/* Hand the UTF-16 code units of a UTF-8 or UTF-32 source to put */
+	template <typename Put>
+	void encode(Put put) const {
+		if (m_pSource == nullptr)
+			return;
+		if (m_encoding == UTF32) {
+			for (const wchar_t * p = static_cast<const wchar_t*>(m_pSource); *p; p++)
+				putCodePoint(put, static_cast<uint32_t>(*p));
+			return;
 		}
-		printf("FIELD LEN : %d\n", fieldData->m_usLength);
-		fieldData->m_pData = new uint8_t[fieldData->m_usLength + extraBytes];
-		memset(fieldData->m_pData, '\0', (fieldData->m_usLength+extraBytes) * sizeof(uint8_t));
-		SQLardUtil::sqlard_read_bytes(fieldData->m_pData, data, offset, fieldData->m_usLength);
-		return fieldData;
+		const uint8_t * p = static_cast<const uint8_t*>(m_pSource);
+		while (*p) {
+			/* ASCII runs need no decoding */
+			if (*p < 0x80) {
+				put(static_cast<char16_t>(*p++));
+				continue;
+			}
+			putCodePoint(put, DecodeUTF8(p));
+		}
+	}
+	template <typename Put>
+	static void putCodePoint(Put & put, uint32_t cp) {
+		if (cp > 0x10FFFF || (cp >= 0xD800 && cp < 0xE000))
+			cp = 0xFFFD;
+		if (cp < 0x10000) {
+			put(static_cast<char16_t>(cp));
+			return;
+		}
+		/* surrogate pair */
+		cp -= 0x10000;
+		put(static_cast<char16_t>(0xD800 + (cp >> 10)));
+		put(static_cast<char16_t>(0xDC00 + (cp & 0x3FF)));
+	}
+	/* Decode the sequence at p and move past it, U+FFFD and one byte for a malformed one */
+	static uint32_t DecodeUTF8(const uint8_t *& p) {
+		const uint8_t lead = *p;
+		uint8_t count;
+		uint32_t cp;
+		if (lead >= 0xC2 && lead < 0xE0) {
+			count = 1;
+			cp = lead & 0x1F;
+		}
+		else if (lead >= 0xE0 && lead < 0xF0) {
+			count = 2;
+			cp = lead & 0x0F;
+		}
+		else if (lead >= 0xF0 && lead < 0xF5) {
+			count = 3;
+			cp = lead & 0x07;
+		}
+		else {
+			p++;
+			return 0xFFFD;
+		}
+		for (uint8_t i = 1; i <= count; i++) {
+			if ((p[i] & 0xC0) != 0x80) {
+				p++;
+				return 0xFFFD;
+			}
+			cp = (cp << 6) | (p[i] & 0x3F);
+		}
+		/* overlong encodings */
+		if ((count == 2 && cp < 0x800) || (count == 3 && cp < 0x10000)) {
+			p++;
+			return 0xFFFD;
+		}
+		p += count + 1;
+		return cp;
 	}
+
+	const void * m_pSource;
+	Encoding m_encoding;
+	mutable size_t m_szLength;
+	mutable char16_t * m_pUnits;
 };
 
-class SQLardRowData {
+#ifdef SQLARD_QUERY_SOURCES
+/*
+	Query text pulled in chunks while it is sent, for statements too large
+	to hold in RAM as one string (see SQLard::executeNonQuery). Subclasses
+	hand out UTF-8 bytes; a source is read once, to its end.
+*/
+class SQLardQuerySource {
 public:
-	friend class SQLardTableResult;
-	uint16_t m_usFieldCount;
-	void allocateFieldArray(const uint16_t len) {
-		m_arrFields = new SQLardRowFieldData *[len];
-		memset(m_arrFields, 0, len);
-		m_usFieldCount = len;
-	}
+	virtual ~SQLardQuerySource() {}
 
-	const SQLardRowFieldData * operator[](const size_t index)const  { 
-		if ((signed)index <= (signed)(-1) || index > m_usFieldCount - 1)
-			return nullptr;
-		return m_arrFields[index];
-	}
-	
+	/* Copy up to len bytes of the text to buf, returns the count, 0 at the end */
+	virtual size_t read(uint8_t * buf, const size_t len) = 0;
 
-	~SQLardRowData() {
-		for (uint16_t i = 0; i < m_usFieldCount; i++) {
-			if (m_arrFields[i] == nullptr)
-				continue;
-			delete m_arrFields[i];
+	/*
+		Read the whole text, handing its UTF-16 code units to put.
+		Stops early once *pbStop is set, checked between chunks.
+	*/
+	template <typename Put>
+	void encode(Put put, const bool * pbStop = nullptr) {
+		/* one spare byte keeps the chunk null terminated for DecodeUTF8 */
+		uint8_t chunk[SQLARD_SOURCE_CHUNK + 1];
+		size_t carry = 0;
+		for (;;) {
+			const size_t count = read(&chunk[carry], SQLARD_SOURCE_CHUNK - carry);
+			const uint8_t * end = &chunk[carry + count];
+			chunk[carry + count] = 0;
+			const uint8_t * p = chunk;
+			while (p < end) {
+				if (*p < 0x80) {
+					put(static_cast<char16_t>(*p++));
+					continue;
+				}
+				/* a sequence cut by the end of the chunk is completed by the next read */
+				const uint8_t seqLen = *p >= 0xF0 ? 4 : *p >= 0xE0 ? 3 : *p >= 0xC0 ? 2 : 1;
+				if (count > 0 && p + seqLen > end)
+					break;
+				SQLardText::putCodePoint(put, SQLardText::DecodeUTF8(p));
+			}
+			if (count == 0 || (pbStop != nullptr && *pbStop))
+				return;
+			carry = end - p;
+			memmove(chunk, p, carry);
 		}
-		delete[] m_arrFields;
 	}
-protected:
-	SQLardRowFieldData ** m_arrFields;
 };
 
-
-
-class SQLardTableResult {
+/* A null-terminated string in RAM or, passed through F(), in flash */
+class SQLardStringSource : public SQLardQuerySource {
 public:
-	SQLardColumnData ** m_arColumnData;
-	uint16_t m_usColumnCount;
-
-	SQLardRowList<SQLardRowData*>  m_llRows;
-
-	SQLardTableResult() {
-		m_arColumnData = nullptr;
-	}
-	void allocatedColumnArray(const uint16_t count) {
-		m_usColumnCount = count;
-		m_arColumnData = new SQLardColumnData *[count];
+	SQLardStringSource(const char * s) {
+		m_pText = s;
+		m_bFlash = false;
 	}
-	void appendRowData(SQLardRowData * pRow) {
-		m_llRows.Enqueue(pRow);
+	#if !defined(WINDOWS) && defined(F)
+		SQLardStringSource(const __FlashStringHelper * s) {
+			m_pText = reinterpret_cast<const char*>(s);
+			m_bFlash = true;
+		}
+	#endif
+	size_t read(uint8_t * buf, const size_t len) override {
+		size_t n = 0;
+		for (; n < len; n++, m_pText++) {
+			#ifdef __AVR__
+				const char c = m_bFlash ? static_cast<char>(pgm_read_byte(m_pText)) : *m_pText;
+			#else
+				const char c = *m_pText;
+			#endif
+			if (c == '\0')
+				break;
+			buf[n] = static_cast<uint8_t>(c);
+		}
+		return n;
 	}
+private:
+	const char * m_pText;
+	bool m_bFlash;
+};
 
-	SQLardDataType GetColumnDataType(const uint16_t columnIndex) {
-		if (columnIndex >= m_usColumnCount) 
-			return static_cast<SQLardDataType>(-1);
-		return static_cast<SQLardDataType>(m_arColumnData[columnIndex]->m_bType);
+/*
+	Text read from any object with a read(buffer, length) method returning
+	the byte count, such as a SD library File. Reading stops at the first
+	read returning 0 or less.
+*/
+template <typename Stream>
+class SQLardStreamSource : public SQLardQuerySource {
+public:
+	SQLardStreamSource(Stream & stream) : m_stream(stream) {}
+	size_t read(uint8_t * buf, const size_t len) override {
+		const int count = m_stream.read(buf, len);
+		return count > 0 ? static_cast<size_t>(count) : 0;
 	}
+private:
+	Stream & m_stream;
+};
 
-
-	SQLardRowData * GetRow() const {
-		if (m_llRows.GetCurrent() != nullptr)
-			return m_llRows.GetCurrent()->val;
-		return nullptr;
-	}
-	void MoveNext() {
-		m_llRows.MoveNext();
+#ifdef WINDOWS
+/* Text read from a file opened by the caller, from its current position to its end */
+class SQLardFileSource : public SQLardQuerySource {
+public:
+	SQLardFileSource(FILE * file) {
+		m_pFile = file;
 	}
-	void ResetIterator() {
-		m_llRows.Reset();
+	size_t read(uint8_t * buf, const size_t len) override {
+		return m_pFile != nullptr ? fread(buf, 1, len, m_pFile) : 0;
 	}
+private:
+	FILE * m_pFile;
+};
+#endif
 
-	void ParseColumnData(uint8_t * data, size_t & offset) {
-		/* Parse column data */
-		uint16_t columnCount = SQLardUtil::sqlard_read_le<uint16_t>((uint8_t*)data, offset);
-		allocatedColumnArray(columnCount);
-		for (uint16_t i = 0; i < columnCount; i++) {
-			m_arColumnData[i] = SQLardColumnData::ParseColumnData((uint8_t*)data, offset);
-		}
-	}
+/*
+	Text produced piece by piece by a callback, e.g. one VALUES tuple per call.
+	The generator returns the next null-terminated piece, which must stay
+	valid until its next call, or nullptr after the last piece.
+*/
+class SQLardGeneratorSource : public SQLardQuerySource {
+public:
+	typedef const char * (*Generator)(void * pContext);
 
-	void ParseRowData( uint8_t * data, size_t & offset) {
-		SQLardRowData * pRowData = new SQLardRowData();
-		pRowData->allocateFieldArray(m_usColumnCount);
-		for (uint16_t i = 0; i < m_usColumnCount; i++) {
-			pRowData->m_arrFields[i] = SQLardRowFieldData::ParseField(m_arColumnData[i]->m_bType, (uint8_t*)data, offset);
+	SQLardGeneratorSource(Generator generator, void * pContext) {
+		m_generator = generator;
+		m_pContext = pContext;
+		m_pPiece = nullptr;
+		m_bEnd = false;
+	}
+	size_t read(uint8_t * buf, const size_t len) override {
+		size_t n = 0;
+		while (n < len && !m_bEnd) {
+			if (m_pPiece == nullptr || *m_pPiece == '\0') {
+				m_pPiece = m_generator(m_pContext);
+				m_bEnd = m_pPiece == nullptr;
+				continue;
+			}
+			buf[n++] = static_cast<uint8_t>(*m_pPiece++);
 		}
-		appendRowData(pRowData);
+		return n;
 	}
+private:
+	Generator m_generator;
+	void * m_pContext;
+	const char * m_pPiece;
+	bool m_bEnd;
+};
+#endif
 
-	~SQLardTableResult() {
-		if (!(nullptr == m_arColumnData))
-		{
-			for (int i = 0; i < m_usColumnCount; i++)
-			{
-				delete m_arColumnData[i];
-			}
-			delete[] m_arColumnData;
+class SQLardColumnData : public SQLardHeapObject {
+public:
+	unsigned int m_uiUserType;
+	uint16_t m_usFlags;
+	uint8_t m_bType;
+	uint16_t m_usLargeTypeSize;
+	/* Fractional second scale of TIME / DATETIME2 / DATETIMEOFFSET columns, decimal scale of DECIMAL / NUMERIC columns */
+	uint8_t m_bScale;
+	/* Precision of DECIMAL / NUMERIC columns */
+	uint8_t m_bPrecision;
+	uint8_t m_bColumnNameLen;
+	char16_t * m_wcstrColumnName;
+
+	static SQLardColumnData * ParseColumnData(uint8_t * data, size_t & offset) {
+
+		SQLardColumnData * colData = new SQLardColumnData();
+		#ifdef SQLARD_TDS73
+			/* UserType is 4 bytes since TDS 7.2 */
+			colData->m_uiUserType = SQLardUtil::sqlard_read_le<uint32_t>(data, offset);
+		#else
+			colData->m_uiUserType = SQLardUtil::sqlard_read_le<uint16_t>(data, offset);
+		#endif
+		colData->m_usFlags = SQLardUtil::sqlard_read_le<uint16_t>(data, offset);
+		colData->m_bType = SQLardUtil::sqlard_read_le<uint8_t>(data, offset);
+
+		switch (static_cast<SQLardDataType>(colData->m_bType)) {
+			case SQLardDataType::DECIMALTYPE:
+			case SQLardDataType::NUMERICTYPE:
+			case SQLardDataType::DECIMALNTYPE:
+			case SQLardDataType::NUMERICNTYPE:
+				/* length, precision and scale */
+				colData->m_usLargeTypeSize = SQLardUtil::sqlard_read_le<uint8_t>(data, offset);
+				colData->m_bPrecision = SQLardUtil::sqlard_read_le<uint8_t>(data, offset);
+				colData->m_bScale = SQLardUtil::sqlard_read_le<uint8_t>(data, offset);
+				break;
+			/* DATE has no length or scale */
+			case SQLardDataType::DATENTYPE:
+				break;
+			/* SCALE (without PRECISION) for TIME / DATETIME2 / DATETIMEOFFSET */
+			case SQLardDataType::TIMENTYPE:
+			case SQLardDataType::DATETIME2NTYPE:
+			case SQLardDataType::DATETIMEOFFSETNTYPE:
+				colData->m_bScale = SQLardUtil::sqlard_read_le<uint8_t>(data, offset);
+				break;
+			default:
+				switch (SQLardUtil::sqlard_length_prefix(colData->m_bType)) {
+					case 0:
+						break;
+					case 1:
+						colData->m_usLargeTypeSize = SQLardUtil::sqlard_read_le<uint8_t>(data, offset);
+						break;
+					case 2:
+						colData->m_usLargeTypeSize = SQLardUtil::sqlard_read_le<uint16_t>(data, offset);
+						break;
+					case 4:
+						colData->m_usLargeTypeSize = static_cast<uint16_t>(SQLardUtil::sqlard_read_le<uint32_t>(data, offset));
+						break;
+					default:
+						#ifdef SQLARD_VERBOSE_OUTPUT
+							SQLardUtil::printf(F("ParseColumnData() >> undefined data type %d\n"), colData->m_bType);
+						#endif
+						break;
+				}
+				#ifdef SQLARD_TDS73
+					/* 5-byte COLLATION follows the max length of character types since TDS 7.1 */
+					if (SQLardUtil::sqlard_has_collation(colData->m_bType))
+						offset += 5;
+				#endif
+				break;
+		}
+
+		/* TEXT / NTEXT / IMAGE carry the table name */
+		if (SQLardUtil::sqlard_length_prefix(colData->m_bType) == 4) {
+			#ifdef SQLARD_TDS73
+				uint8_t parts = SQLardUtil::sqlard_read_le<uint8_t>(data, offset);
+			#else
+				uint8_t parts = 1;
+			#endif
+			for (uint8_t i = 0; i < parts; i++)
+				offset += SQLardUtil::sqlard_read_le<uint16_t>(data, offset) * 2;
 		}
+
+		colData->m_bColumnNameLen = SQLardUtil::sqlard_read_le<uint8_t>(data, offset);
+		#ifndef SQLARD_SKIP_COLUMN_NAMES
+			colData->m_wcstrColumnName = SQLardUtil::sqlard_read_nwstr(data, offset, colData->m_bColumnNameLen);
+		#else
+			offset += colData->m_bColumnNameLen * 2;
+		#endif
+		return colData;
+	}
+
+	SQLardColumnData() {
+		m_uiUserType = 0;
+		m_usFlags = 0;
+		m_bType = 0;
+		m_usLargeTypeSize = 0;
+		m_bScale = 0;
+		m_bPrecision = 0;
+		m_bColumnNameLen = 0;
+		m_wcstrColumnName = nullptr;
+	}
+	~SQLardColumnData() {
+		if (!(nullptr == m_wcstrColumnName))
+			SQLARD_DELETE_ARRAY(m_wcstrColumnName);
+	}
+
+	/* (MAX) columns carry their values as PLP chunks */
+	bool isPLP() const {
+		return SQLardUtil::sqlard_length_prefix(m_bType) == 2 && m_usLargeTypeSize == 0xFFFF;
 	}
 };
 
+/*
+	What ParseField derives from the type of a column, worked out once per
+	column instead of once per field (see SQLardColumnSet).
+*/
+struct SQLardFieldPlan {
+	uint8_t type;
+	int8_t fixedLength;
+	uint8_t lengthPrefix;
+	/* null terminator bytes of character fields */
+	uint8_t extraBytes;
+	bool bPLP;
+	bool bLegacyCharBin;
+	/* DECIMAL / NUMERIC values start with a sign byte */
+	bool bDecimal;
 
+	static SQLardFieldPlan For(const uint8_t type, const bool bPLP) {
+		SQLardFieldPlan plan;
+		plan.type = type;
+		plan.fixedLength = SQLardUtil::sqlard_fixed_length(type);
+		plan.lengthPrefix = SQLardUtil::sqlard_length_prefix(type);
+		plan.extraBytes = SQLardUtil::sqlard_is_wide(type) ? 2 : (SQLardUtil::sqlard_is_char(type) ? 1 : 0);
+		plan.bPLP = bPLP;
+		plan.bLegacyCharBin = SQLardUtil::sqlard_is_legacy_charbin(type);
+		plan.bDecimal = type == SQLardDataType::NUMERICTYPE || type == SQLardDataType::NUMERICNTYPE ||
+			type == SQLardDataType::DECIMALTYPE || type == SQLardDataType::DECIMALNTYPE;
+		return plan;
+	}
+};
 
+/* Where the value of a field lies in row data, see SQLardRowFieldData::Locate */
+struct SQLardFieldSpan {
+	/* Contiguous value, nullptr for PLP values */
+	const uint8_t * pData;
+	/* First chunk of a PLP value, 0 for contiguous ones */
+	size_t plpOffset;
+	/* Full length of the value, total of the chunks for PLP values */
+	uint32_t length;
+	/* DECIMAL / NUMERIC sign, 1 for positive */
+	uint8_t signFlag;
+	bool bNull;
+};
 
-class SQLardLOGIN7
-{
+#ifdef SQLARD_DICTIONARY
+/*
+	Distinct values of a character column, each stored once, numbered by
+	codes in the order they were first seen. Fields of the column point at
+	the stored value instead of a copy of their own (see
+	SQLardRowFieldData::GetDictionaryCode). Values are reference counted by
+	these fields, so rows keep them when they outlive the dictionary. Rows
+	moved to another result take their values from its dictionaries, see
+	SQLardTableResult::Reintern. Once maxEntries values are stored, further
+	distinct values are copied into their fields as usual.
+*/
+class SQLardDictionary : public SQLardHeapObject {
 public:
-	SQLardLOGIN7() {
-		/* Here are the default values */
-		m_uiLength = 0;
-		m_uiTDSVersion = 0x70000000; /* TDS 7.0 */
-		m_uiPacketSize = 4096;
-		m_uiClientProgVer = 117440512;
-		m_uiConnectionID = 0;
-		m_uiClientPID = 256;
-		m_uiClientTimeZone = 0x000001e0;
-		m_uiClientLCID = 0x00000409;
-		m_ubOptionFlags1 = 0xE0;
-		m_ubOptionFlags2 = 0x03;
-		m_ubOptionFlags3 = 0x00;
-		m_ubTypeFlags = 0x00;
+	SQLardDictionary(const uint16_t maxEntries) {
+		/* the slots of the hash table are counted in 16 bits */
+		m_usMaxEntries = maxEntries < 0x4000 ? maxEntries : 0x4000;
+		m_usEntryCount = 0;
+		m_usSlotCount = 0;
+		m_arValues = nullptr;
+		m_arSlots = nullptr;
+	}
+	~SQLardDictionary() {
+		for (uint16_t i = 0; i < m_usEntryCount; i++)
+			Release(m_arValues[i]);
+		if (m_arValues)
+			SQLARD_DELETE_ARRAY(m_arValues);
+		if (m_arSlots)
+			SQLARD_DELETE_ARRAY(m_arSlots);
+	}
 
-		m_wcszUserName = nullptr;
-		m_wcszPassword = nullptr;
-		m_wcszHost = nullptr;
-		m_wcszAppName = nullptr;
-		m_wcszServerName = nullptr;
-		m_wcszUnused = nullptr;
-		m_wcszExtension = nullptr;
-		m_wcszCltIntName = nullptr;
-		m_wcszLanguage = nullptr;
-		m_wcszDatabase = nullptr;
-		m_wcszAttachDBFile = nullptr;
-		m_wcszChangePassword = nullptr;
-		m_wcszSSPI = nullptr;
+	/*
+		Stored value equal to the length bytes at data, followed by extraBytes
+		zero bytes, with a reference taken for the caller.
+		nullptr if the dictionary is full and the value is new.
+	*/
+	uint8_t * Intern(const uint8_t * data, const uint16_t length, const uint8_t extraBytes) {
+		#ifdef SQLARD_THREADS
+			/* rows may be decoded on several threads, see SQLardParallelDecoder */
+			std::lock_guard<std::mutex> lock(m_mutex);
+		#endif
+		const uint32_t hash = SQLardUtil::sqlard_hash_bytes(data, length);
+		uint16_t slot = 0;
+		if (m_usSlotCount > 0) {
+			for (slot = hash & (m_usSlotCount - 1); m_arSlots[slot] != 0; slot = (slot + 1) & (m_usSlotCount - 1)) {
+				uint8_t * value = m_arValues[m_arSlots[slot] - 1];
+				if (GetEntry(value)->length == length && memcmp(value, data, length) == 0) {
+					GetEntry(value)->refs++;
+					return value;
+				}
+			}
+		}
+		if (m_usEntryCount >= m_usMaxEntries)
+			return nullptr;
+		/* at most half of the slots in use */
+		if ((m_usEntryCount + 1) * 2 > m_usSlotCount) {
+			if (!grow())
+				return nullptr;
+			for (slot = hash & (m_usSlotCount - 1); m_arSlots[slot] != 0; slot = (slot + 1) & (m_usSlotCount - 1));
+		}
+		uint8_t * block = SQLARD_NEW_ARRAY(uint8_t, sizeof(Entry) + length + extraBytes);
+		if (block == nullptr)
+			return nullptr;
+		#ifdef SQLARD_THREADS
+			Entry * pEntry = new (block) Entry();
+		#else
+			Entry * pEntry = reinterpret_cast<Entry*>(block);
+		#endif
+		/* one reference for the dictionary, one for the caller */
+		pEntry->refs = 2;
+		pEntry->code = m_usEntryCount;
+		pEntry->length = length;
+		uint8_t * value = block + sizeof(Entry);
+		memcpy(value, data, length);
+		memset(value + length, 0, extraBytes);
+		m_arValues[m_usEntryCount++] = value;
+		m_arSlots[slot] = m_usEntryCount;
+		return value;
+	}
 
-		SetClientInterfaceName(L"ODBC");
-		SetApplicationName(L"SQLARD");
-		SQLardUtil::freeRam("l7");
+	/* Drop a reference to a stored value, the last one frees it */
+	static void Release(uint8_t * value) {
+		Entry * pEntry = GetEntry(value);
+		if (--pEntry->refs == 0) {
+			pEntry->~Entry();
+			SQLARD_DELETE_ARRAY(reinterpret_cast<uint8_t*>(pEntry));
+		}
 	}
-	~SQLardLOGIN7() {
-		if (!(nullptr == m_wcszUserName))
-			delete[] m_wcszUserName;
-		if (!(nullptr == m_wcszPassword))
-			delete[] m_wcszPassword;
-		if (!(nullptr == m_wcszHost))
-			delete[] m_wcszHost;
-		if (!(nullptr == m_wcszAppName))
-			delete[] m_wcszAppName;
-		if (!(nullptr == m_wcszServerName))
-			delete[] m_wcszServerName;
-		if (!(nullptr == m_wcszUnused))
-			delete[] m_wcszUnused;
-		if (!(nullptr == m_wcszExtension))
-			delete[] m_wcszExtension;
-		if (!(nullptr == m_wcszCltIntName))
-			delete[] m_wcszCltIntName;
-		if (!(nullptr == m_wcszLanguage))
-			delete[] m_wcszLanguage;
-		if (!(nullptr == m_wcszDatabase))
-			delete[] m_wcszDatabase;
-		if (!(nullptr == m_wcszAttachDBFile))
-			delete[] m_wcszAttachDBFile;
-		if (!(nullptr == m_wcszChangePassword))
-			delete[] m_wcszChangePassword;
-		if (!(nullptr == m_wcszSSPI))
-			delete[] m_wcszSSPI;
-	}
-	void SetLength(const uint32_t val) { m_uiLength = val; }
-	void SetTDSVersion(const uint32_t val) { m_uiTDSVersion = val; }
-	void SetPacketSize(const uint32_t val) { m_uiPacketSize = val; }
-	void SetClientProgVer(const uint32_t val) { m_uiClientProgVer = val; }
-	void SetClientPID(const uint32_t val) { m_uiClientPID = val; }
-	void SetConnectionID(const uint32_t val) { m_uiConnectionID = val; }
-	void SetClientTimeZone(const uint32_t val) { m_uiClientTimeZone = val; }
-	/* collation */
-	void SetClientLCID(const uint32_t val) { m_uiClientLCID = val; }
-	void SetOptionFlags1(const uint8_t val) { m_ubOptionFlags1 = val; }
-	void SetOptionFlags2(const uint8_t val) { m_ubOptionFlags2 = val; }
-	void SetOptionFlags3(const uint8_t val) { m_ubOptionFlags3 = val; }
-	void SetTypeFlags(const uint8_t val) { m_ubTypeFlags = val; }
+	static const uint16_t GetCode(const uint8_t * value) { return GetEntry(value)->code; }
 
-	/* Login related */
-	void SetUserName(const wchar_t * wcszUserName) {
-		m_wcszUserName = SQLardUtil::sqlard_alloc_wstr(wcszUserName);
-	};
-	void SetPassword(const wchar_t * wcszPassword) {
-		m_wcszPassword = SQLardUtil::sqlard_alloc_wstr(wcszPassword);
-	};
-	void SetHost(const wchar_t * wcszHost) {
-		m_wcszHost = SQLardUtil::sqlard_alloc_wstr(wcszHost);
-	};
-	void SetApplicationName(const wchar_t * wcszAppName) {
-		m_wcszAppName = SQLardUtil::sqlard_alloc_wstr(wcszAppName);
-	};
-	void SetServerName(const wchar_t * wcszServerName) {
-		m_wcszServerName = SQLardUtil::sqlard_alloc_wstr(wcszServerName);
-	};
-	void SetExtension(const wchar_t * wcszExtension) {
-		m_wcszExtension = SQLardUtil::sqlard_alloc_wstr(wcszExtension);
-	};
-	void SetClientInterfaceName(const wchar_t * wcszCltIntName) {
-		m_wcszCltIntName = SQLardUtil::sqlard_alloc_wstr(wcszCltIntName);
-	};
-	/* Initial language (overrides user's default language) */
-	void SetLanguage(const wchar_t * wcszLanguage) {
-		m_wcszLanguage = SQLardUtil::sqlard_alloc_wstr(wcszLanguage);
-	};
-	/* Initial database (overrides user's default database) */
-	void SetDatabase(const wchar_t * wcszDatabase) {
-		m_wcszDatabase = SQLardUtil::sqlard_alloc_wstr(wcszDatabase);
-	};
-	void SetAttachDatabaseFile(const wchar_t * wcszAttachDBFile) {
-		m_wcszAttachDBFile = SQLardUtil::sqlard_alloc_wstr(wcszAttachDBFile);
-	};
-	void SetChangePassword(const wchar_t * wcszChangePassword) {
-		m_wcszChangePassword = SQLardUtil::sqlard_alloc_wstr(wcszChangePassword);
+	const uint16_t GetEntryCount() const { return m_usEntryCount; }
+	const bool isFull() const { return m_usEntryCount >= m_usMaxEntries; }
+	/* Stored value of a code, nullptr for codes not in use */
+	const uint8_t * GetValue(const uint16_t code, uint16_t & length) const {
+		if (code >= m_usEntryCount)
+			return nullptr;
+		length = GetEntry(m_arValues[code])->length;
+		return m_arValues[code];
+	}
+private:
+	/* Header in front of each stored value */
+	struct Entry {
+		#ifdef SQLARD_THREADS
+			/* fields may be deleted on other threads than the one that decoded them */
+			std::atomic<uint32_t> refs;
+		#else
+			uint32_t refs;
+		#endif
+		uint16_t code;
+		uint16_t length;
 	};
+	static Entry * GetEntry(const uint8_t * value) {
+		return reinterpret_cast<Entry*>(const_cast<uint8_t*>(value) - sizeof(Entry));
+	}
 
-	size_t FillBuffer(uint8_t * buf)
-	{
-		size_t offset = 0;
-		SQLardUtil::sqlard_write_le<uint32_t>(buf, offset, m_uiLength);
-		SQLardUtil::sqlard_write_le<uint32_t>(buf, offset, m_uiTDSVersion);
-		SQLardUtil::sqlard_write_le<uint32_t>(buf, offset, m_uiPacketSize);
-		SQLardUtil::sqlard_write_le<uint32_t>(buf, offset, m_uiClientProgVer);
-		SQLardUtil::sqlard_write_le<uint32_t>(buf, offset, m_uiClientPID);
-		SQLardUtil::sqlard_write_le<uint32_t>(buf, offset, m_uiConnectionID);
-		SQLardUtil::sqlard_write_le<uint8_t>(buf, offset, m_ubOptionFlags1);
-		SQLardUtil::sqlard_write_le<uint8_t>(buf, offset, m_ubOptionFlags2);
-		SQLardUtil::sqlard_write_le<uint8_t>(buf, offset, m_ubTypeFlags);
-		SQLardUtil::sqlard_write_le<uint8_t>(buf, offset, m_ubOptionFlags3);
-		SQLardUtil::sqlard_write_le<uint32_t>(buf, offset, m_uiClientTimeZone);
-		SQLardUtil::sqlard_write_le<uint32_t>(buf, offset, m_uiClientLCID);
-		FillStringTable(buf, offset);
-		/* Now we need to adjust the size. */
-		size_t temp_offset = 0;
-		SQLardUtil::sqlard_write_le<uint32_t>(buf, temp_offset, offset);
-		SQLardUtil::freeRam("fb");
-		return offset;
+	bool grow() {
+		const uint16_t slotCount = m_usSlotCount ? m_usSlotCount * 2 : 16;
+		uint16_t * arSlots = SQLARD_NEW_ARRAY(uint16_t, slotCount);
+		uint8_t ** arValues = SQLARD_NEW_ARRAY(uint8_t *, slotCount / 2);
+		if (arSlots == nullptr || arValues == nullptr) {
+			if (arSlots)
+				SQLARD_DELETE_ARRAY(arSlots);
+			if (arValues)
+				SQLARD_DELETE_ARRAY(arValues);
+			return false;
+		}
+		memset(arSlots, 0, slotCount * sizeof(uint16_t));
+		for (uint16_t code = 0; code < m_usEntryCount; code++) {
+			arValues[code] = m_arValues[code];
+			uint16_t slot = SQLardUtil::sqlard_hash_bytes(m_arValues[code], GetEntry(m_arValues[code])->length) & (slotCount - 1);
+			while (arSlots[slot] != 0)
+				slot = (slot + 1) & (slotCount - 1);
+			arSlots[slot] = code + 1;
+		}
+		if (m_arSlots)
+			SQLARD_DELETE_ARRAY(m_arSlots);
+		if (m_arValues)
+			SQLARD_DELETE_ARRAY(m_arValues);
+		m_arSlots = arSlots;
+		m_arValues = arValues;
+		m_usSlotCount = slotCount;
+		return true;
 	}
-	size_t FillStringTable(uint8_t * buf, size_t & offset)
-	{
-		size_t table_size = 0;
-		table_size += SQLardUtil::sqlard_wcslen(m_wcszHost);
-		table_size += SQLardUtil::sqlard_wcslen(m_wcszUserName);
-		table_size += SQLardUtil::sqlard_wcslen(m_wcszPassword);
-		table_size += SQLardUtil::sqlard_wcslen(m_wcszAppName);
-		table_size += SQLardUtil::sqlard_wcslen(m_wcszServerName);
-		table_size += SQLardUtil::sqlard_wcslen(m_wcszUnused);
-		table_size += SQLardUtil::sqlard_wcslen(m_wcszCltIntName);
-		table_size += SQLardUtil::sqlard_wcslen(m_wcszLanguage);
-		table_size += SQLardUtil::sqlard_wcslen(m_wcszDatabase);
-		table_size += SQLardUtil::sqlard_wcslen(m_wcszAttachDBFile);
-		table_size += SQLardUtil::sqlard_wcslen(m_wcszChangePassword);
+
+	uint16_t m_usMaxEntries;
+	uint16_t m_usEntryCount;
+	/* open addressing table of codes + 1, 0 for free slots */
+	uint16_t m_usSlotCount;
+	uint16_t * m_arSlots;
+	/* stored values by code */
+	uint8_t ** m_arValues;
+	#ifdef SQLARD_THREADS
+		std::mutex m_mutex;
+	#endif
+};
+#endif
+
+class SQLardRowFieldData : public SQLardHeapObject {
+public:
+	uint8_t * m_pData;
+	uint16_t m_usLength;
+	uint8_t m_bSignFlag;
+	bool m_bNull;
+	#ifdef SQLARD_DICTIONARY
+		/* m_pData is a value stored in a SQLardDictionary */
+		bool m_bShared;
+	#endif
+	SQLardRowFieldData() {
+		m_pData = nullptr;
+		m_usLength = 0;
+		m_bSignFlag = 1;
+		m_bNull = false;
+		#ifdef SQLARD_DICTIONARY
+			m_bShared = false;
+		#endif
+	}
+	~SQLardRowFieldData() {
+		#ifdef SQLARD_DICTIONARY
+			if (m_bShared) {
+				SQLardDictionary::Release(m_pData);
+				return;
+			}
+		#endif
+		if (!(nullptr == m_pData))
+			SQLARD_DELETE_ARRAY(m_pData);
+	}
+
+	#ifdef SQLARD_DICTIONARY
 		/*
-		Allocate required space for the table
+			Code of the value in the dictionary of its column, -1 if the field has
+			a copy of its own. Fields of the same dictionary are equal if and only
+			if their codes are, see SQLardTableResult::GetDictionary.
 		*/
-		const size_t offset_table_size = 58;
-	
-		SQLardBuffer<uint8_t> table_buffer(table_size * 2);
-		
-		
-		uint8_t offset_buffer[offset_table_size];
-		size_t table_offset = 0;
-		size_t entry_offsets[12];
-		size_t entry_lengths[12];
-		size_t current_index = 0;
+		const int32_t GetDictionaryCode() const {
+			return m_bShared ? SQLardDictionary::GetCode(m_pData) : -1;
+		}
+	#endif
 
-		wchar_t * current_wstring = nullptr;
-		for (int i = 0; i <12; i++)
+	/*
+	* @brief 	Interpret DATETIME / SMALLDATETIME data (or DATETIMN of either size).
+	* @return	Seconds since UNIX epoch as int64_t
+	*/
+	const int64_t asDateTime() const {
+		const int64_t us = asEpochMicros(m_usLength == 4 ? SQLardDataType::DATETIM4TYPE : SQLardDataType::DATETIMETYPE);
+		/* floor division, so pre-1970 values round towards the past */
+		return (us >= 0 ? us : us - 999999) / 1000000;
+	}
+
+	/*
+	* @brief 	Interpret any temporal field as microseconds since UNIX epoch.
+				TIME values are returned as microseconds since midnight,
+				DATETIMEOFFSET values are returned in UTC.
+	* @return	Microseconds as int64_t, 0 for NULL fields.
+	*/
+	const int64_t asEpochMicros(const uint8_t fieldDataType, const uint8_t scale = 7) const {
+		if (m_usLength == 0)
+			return 0;
+		size_t offset = 0;
+		switch (SQLardDataType(fieldDataType))
 		{
-			switch (i)
+			case SQLardDataType::DATETIMNTYPE:
+				if (m_usLength == 4)
+					return asEpochMicros(SQLardDataType::DATETIM4TYPE);
+				/* fall through */
+			case SQLardDataType::DATETIMETYPE:
 			{
-			case 0: current_wstring = m_wcszHost;           break;
-			case 1: current_wstring = m_wcszUserName;       break;
-			case 2: current_wstring = m_wcszPassword;       break;
-			case 3: current_wstring = m_wcszAppName;        break;
-			case 4: current_wstring = m_wcszServerName;     break;
-			case 5: current_wstring = m_wcszUnused;         break;
-			case 6: current_wstring = m_wcszCltIntName;     break;
-			case 7: current_wstring = m_wcszLanguage;       break;
-			case 8: current_wstring = m_wcszDatabase;       break;
-			case 9: current_wstring = m_wcszSSPI;          break;
-			case 10: current_wstring = m_wcszAttachDBFile;   break;
-			case 11: current_wstring = m_wcszChangePassword; break;
+				int32_t days = SQLardUtil::sqlard_read_le<int32_t>(m_pData, offset);
+				uint32_t ticks = SQLardUtil::sqlard_read_le<uint32_t>(m_pData, offset);
+				return SQLardUtil::sqlard_datetime_to_epoch_us(days, ticks);
 			}
-			SQLardUtil::sqlard_wstrcpy(&table_buffer[table_offset], current_wstring);
-			if (i == 2)
+			case SQLardDataType::DATETIM4TYPE:
 			{
-				for (size_t i = table_offset; i < (table_offset + SQLardUtil::sqlard_wcslen(current_wstring) * 2); i++)
-				{
-					table_buffer[i] = (((table_buffer[i] & 0x0F) << 4 | (table_buffer[i] & 0xF0) >> 4) ^ 0xA5);
-				}
+				/* days since 1900-01-01 and minutes since midnight */
+				uint16_t days = SQLardUtil::sqlard_read_le<uint16_t>(m_pData, offset);
+				uint16_t minutes = SQLardUtil::sqlard_read_le<uint16_t>(m_pData, offset);
+				return (static_cast<int64_t>(days) - SQLARD_DAYS_1900_TO_UNIX) * SQLARD_US_PER_DAY
+					+ static_cast<int64_t>(minutes) * 60000000LL;
 			}
-			entry_offsets[i] = table_offset + offset + offset_table_size;
-			entry_lengths[i] = SQLardUtil::sqlard_wcslen(current_wstring);
-			table_offset += entry_lengths[i] * 2;
-			//wprintf(L"index [%d] >> table offset [%d], string length [%d], string : [%s]\n", i, table_offset, entry_lengths[i], current_wstring);
-		}
-		/*if (table_offset > table_size * 2)
-		{
+			case SQLardDataType::DATENTYPE:
+			{
+				/* 3 byte day count since 0001-01-01 */
+				uint32_t days = SQLardUtil::sqlard_read_le<uint32_t>(m_pData, offset, 24);
+				return (static_cast<int64_t>(days) - SQLARD_DAYS_0001_TO_UNIX) * SQLARD_US_PER_DAY;
+			}
+			case SQLardDataType::TIMENTYPE:
+			case SQLardDataType::DATETIME2NTYPE:
+			case SQLardDataType::DATETIMEOFFSETNTYPE:
+			{
+				/* time part is 3-5 bytes, followed by date (3) and offset (2) if present */
+				uint8_t timeLen = m_usLength;
+				if (fieldDataType == SQLardDataType::DATETIME2NTYPE)
+					timeLen -= 3;
+				else if (fieldDataType == SQLardDataType::DATETIMEOFFSETNTYPE)
+					timeLen -= 5;
+				int64_t us = SQLardUtil::sqlard_time_to_us(SQLardUtil::sqlard_read_le<uint64_t>(m_pData, offset, timeLen * 8), scale);
+				if (fieldDataType == SQLardDataType::TIMENTYPE)
+					return us;
+				uint32_t days = SQLardUtil::sqlard_read_le<uint32_t>(m_pData, offset, 24);
+				return (static_cast<int64_t>(days) - SQLARD_DAYS_0001_TO_UNIX) * SQLARD_US_PER_DAY + us;
+			}
+			default:
+				#ifdef SQLARD_VERBOSE_OUTPUT
+					SQLardUtil::printf(F("asEpochMicros() >> Not a temporal type %d\n"), fieldDataType);
+				#endif
+				break;
+		}
+		return 0;
+	}
+
+	/*
+	* @brief 	Time zone offset of a DATETIMEOFFSET field.
+	* @return	Offset from UTC in minutes.
+	*/
+	const int16_t getTimeZoneOffset() const {
+		if (m_usLength < 2)
+			return 0;
+		size_t offset = m_usLength - 2;
+		return SQLardUtil::sqlard_read_le<int16_t>(m_pData, offset);
+	}
+
+	/* NULL, as opposed to an empty string or binary */
+	const bool isNull() const {
+		return m_bNull;
+	}
+
+	const uint8_t getByte(const uint16_t index) const {
+		if (index >= m_usLength)
+			return -1;
+
+		return m_pData[index];
+	}
+
+	const uint8_t * asGUID() const {
+		return m_pData;
+	}
+
+	const uint8_t * asVarchar() const {
+		return m_pData;
+	}
+
+	const float asFloat() const {
+		float result;
+		memcpy(&result, m_pData, 4);
+		return result;
+	}
+
+	const double asDouble() const {
+		double result;
+		memcpy(&result, m_pData, 8);
+		return result;
+	}
+
+	/*
+	* @brief 	Interpret an integer, BIT or MONEY field (of any size).
+	* @return	The value as int64_t, MONEY in units of 1/10000.
+	*/
+	const int64_t asInt64(const uint8_t fieldDataType) const {
+		size_t offset = 0;
+		switch (m_usLength) {
+			case 1:
+				/* TINYINT is unsigned */
+				return m_pData[0];
+			case 2:
+				return SQLardUtil::sqlard_read_le<int16_t>(m_pData, offset);
+			case 4:
+				return SQLardUtil::sqlard_read_le<int32_t>(m_pData, offset);
+			case 8:
+				if (fieldDataType == SQLardDataType::MONEYTYPE || fieldDataType == SQLardDataType::MONEYNTYPE) {
+					/* high 4 bytes first */
+					int64_t high = SQLardUtil::sqlard_read_le<int32_t>(m_pData, offset);
+					return static_cast<int64_t>((static_cast<uint64_t>(high) << 32) | SQLardUtil::sqlard_read_le<uint32_t>(m_pData, offset));
+				}
+				return SQLardUtil::sqlard_read_le<int64_t>(m_pData, offset);
+		}
+		return 0;
+	}
+
+	/*
+	* @brief 	Order two fields of a column, NULL first. Numbers and temporal values
+				compare by value, anything else (strings, binary, GUID) by its bytes
+				or UTF-16 code units, not by collation.
+	* @return	Negative, zero or positive like memcmp.
+	*/
+	static int Compare(const uint8_t fieldDataType, const SQLardRowFieldData * a, const SQLardRowFieldData * b, const uint8_t scale = 7) {
+		const bool bNullA = (a == nullptr || a->m_bNull);
+		const bool bNullB = (b == nullptr || b->m_bNull);
+		if (bNullA || bNullB)
+			return static_cast<int>(bNullB) - static_cast<int>(bNullA);
+		#ifdef SQLARD_DICTIONARY
+			/* the same stored value */
+			if (a->m_pData == b->m_pData && a->m_usLength == b->m_usLength)
+				return 0;
+		#endif
+		switch (SQLardDataType(fieldDataType)) {
+			case SQLardDataType::INT1TYPE:
+			case SQLardDataType::BITTYPE:
+			case SQLardDataType::INT2TYPE:
+			case SQLardDataType::INT4TYPE:
+			case SQLardDataType::INT8TYPE:
+			case SQLardDataType::INTNTYPE:
+			case SQLardDataType::BITNTYPE:
+			case SQLardDataType::MONEYTYPE:
+			case SQLardDataType::MONEY4TYPE:
+			case SQLardDataType::MONEYNTYPE:
+			{
+				const int64_t x = a->asInt64(fieldDataType), y = b->asInt64(fieldDataType);
+				return (x > y) - (x < y);
+			}
+			case SQLardDataType::FLT4TYPE:
+			case SQLardDataType::FLT8TYPE:
+			case SQLardDataType::FLTNTYPE:
+			{
+				const double x = a->m_usLength == 4 ? a->asFloat() : a->asDouble();
+				const double y = b->m_usLength == 4 ? b->asFloat() : b->asDouble();
+				return (x > y) - (x < y);
+			}
+			case SQLardDataType::DECIMALTYPE:
+			case SQLardDataType::DECIMALNTYPE:
+			case SQLardDataType::NUMERICTYPE:
+			case SQLardDataType::NUMERICNTYPE:
+			{
+				/* same scale within a column: sign, then the little endian magnitude */
+				if (a->m_bSignFlag != b->m_bSignFlag)
+					return a->m_bSignFlag ? 1 : -1;
+				const uint16_t len = a->m_usLength > b->m_usLength ? a->m_usLength : b->m_usLength;
+				int result = 0;
+				for (uint16_t i = len; i-- > 0 && result == 0;) {
+					const uint8_t x = i < a->m_usLength ? a->m_pData[i] : 0;
+					const uint8_t y = i < b->m_usLength ? b->m_pData[i] : 0;
+					result = (x > y) - (x < y);
+				}
+				return a->m_bSignFlag ? result : -result;
+			}
+			case SQLardDataType::DATETIM4TYPE:
+			case SQLardDataType::DATETIMETYPE:
+			case SQLardDataType::DATETIMNTYPE:
+			case SQLardDataType::DATENTYPE:
+			case SQLardDataType::TIMENTYPE:
+			case SQLardDataType::DATETIME2NTYPE:
+			case SQLardDataType::DATETIMEOFFSETNTYPE:
+			{
+				const int64_t x = a->asEpochMicros(fieldDataType, scale), y = b->asEpochMicros(fieldDataType, scale);
+				return (x > y) - (x < y);
+			}
+			default:
+				break;
+		}
+		const uint16_t unit = SQLardUtil::sqlard_is_wide(fieldDataType) ? 2 : 1;
+		const uint16_t len = a->m_usLength < b->m_usLength ? a->m_usLength : b->m_usLength;
+		for (uint16_t i = 0; i + unit <= len; i += unit) {
+			const uint16_t x = unit == 2 ? static_cast<uint16_t>(a->m_pData[i] | (a->m_pData[i + 1] << 8)) : a->m_pData[i];
+			const uint16_t y = unit == 2 ? static_cast<uint16_t>(b->m_pData[i] | (b->m_pData[i + 1] << 8)) : b->m_pData[i];
+			if (x != y)
+				return x < y ? -1 : 1;
+		}
+		return (a->m_usLength > b->m_usLength) - (a->m_usLength < b->m_usLength);
+	}
+
+	template<typename T>
+	const T interpret_integer() const {
+		size_t o = 0;
+		if (m_bSignFlag == 0)
+			return SQLardUtil::sqlard_read_le<T>(m_pData, o, (m_usLength * 8)) * (-1);
+		return SQLardUtil::sqlard_read_le<T>(m_pData, o, (m_usLength * 8));
+	}
+
+
+	/*
+	* @brief 	Walk over a single field of row data without decoding it.
+	* @param	bPLP	The column is a (MAX) column, encoded as partially length-prefixed chunks.
+	* @return 	false if the field extends past dataSize (more data required) or the type is unknown.
+	*/
+	static bool MeasureField(const uint8_t fieldDataType, const bool bPLP, const uint8_t * data, const size_t dataSize, size_t & offset) {
+		const int8_t fixedLength = SQLardUtil::sqlard_fixed_length(fieldDataType);
+		if (fixedLength >= 0) {
+			offset += fixedLength;
+			return offset <= dataSize;
+		}
+		switch (SQLardUtil::sqlard_length_prefix(fieldDataType)) {
+			case 1:
+				if (offset + 1 > dataSize)
+					return false;
+				if (data[offset] == 0xFF && SQLardUtil::sqlard_is_legacy_charbin(fieldDataType)) {
+					offset += 1;
+					return true;
+				}
+				offset += 1 + data[offset];
+				return offset <= dataSize;
+			case 2:
+				if (bPLP) {
+					if (offset + 8 > dataSize)
+						return false;
+					/* PLP_NULL */
+					if (data[offset] == 0xFF && data[offset + 1] == 0xFF && data[offset + 2] == 0xFF && data[offset + 3] == 0xFF) {
+						offset += 8;
+						return true;
+					}
+					offset += 8;
+					for (;;) {
+						if (offset + 4 > dataSize)
+							return false;
+						const uint32_t chunk = data[offset] | (data[offset + 1] << 8) | (static_cast<uint32_t>(data[offset + 2]) << 16) | (static_cast<uint32_t>(data[offset + 3]) << 24);
+						offset += 4;
+						if (chunk == 0)
+							return true;
+						offset += chunk;
+					}
+				}
+				if (offset + 2 > dataSize)
+					return false;
+				{
+					const uint16_t len = data[offset] | (data[offset + 1] << 8);
+					offset += 2;
+					if (len != 0xFFFF)
+						offset += len;
+				}
+				return offset <= dataSize;
+			case 4:
+				if (offset + 1 > dataSize)
+					return false;
+				{
+					/* TEXTPTR length, 0 means NULL */
+					const uint8_t textPtrLen = data[offset];
+					offset += 1;
+					if (textPtrLen == 0)
+						return true;
+					/* TEXTPTR and 8 byte timestamp */
+					offset += textPtrLen + 8;
+					if (offset + 4 > dataSize)
+						return false;
+					const uint32_t len = data[offset] | (data[offset + 1] << 8) | (static_cast<uint32_t>(data[offset + 2]) << 16) | (static_cast<uint32_t>(data[offset + 3]) << 24);
+					offset += 4 + len;
+				}
+				return offset <= dataSize;
+			default:
+				return false;
+		}
+	}
+
+	/*
+	* @brief 	Decode a single field of row data.
+				Character fields get a null terminator (two bytes for UTF-16 types), NULL fields have zero length.
+	* @param	bPLP	The column is a (MAX) column, encoded as partially length-prefixed chunks.
+	*/
+	static SQLardRowFieldData * ParseField(const uint8_t fieldDataType, uint8_t * data, size_t & offset, const bool bPLP = false) {
+		return ParseField(SQLardFieldPlan::For(fieldDataType, bPLP), data, offset);
+	}
+	#ifdef SQLARD_DICTIONARY
+	/* Values found in pDictionary are shared instead of copied */
+	static SQLardRowFieldData * ParseField(const SQLardFieldPlan & plan, uint8_t * data, size_t & offset, SQLardDictionary * pDictionary = nullptr) {
+	#else
+	static SQLardRowFieldData * ParseField(const SQLardFieldPlan & plan, uint8_t * data, size_t & offset) {
+	#endif
+		SQLardFieldSpan span;
+		Locate(plan, data, offset, span);
+		SQLardRowFieldData * fieldData = new SQLardRowFieldData();
+		/* truncated to what fits into a field, character fields get a null terminator */
+		const uint8_t extraBytes = plan.extraBytes;
+		fieldData->m_usLength = span.length > static_cast<uint32_t>(0xFFFF - extraBytes) ? 0xFFFF - extraBytes : span.length;
+		fieldData->m_bNull = span.bNull;
+		fieldData->m_bSignFlag = span.signFlag;
+		#ifdef SQLARD_DICTIONARY
+			if (pDictionary != nullptr && !span.bNull && span.plpOffset == 0) {
+				fieldData->m_pData = pDictionary->Intern(span.pData, fieldData->m_usLength, extraBytes);
+				fieldData->m_bShared = (fieldData->m_pData != nullptr);
+				if (fieldData->m_bShared)
+					return fieldData;
+			}
+		#endif
+		fieldData->m_pData = SQLARD_NEW_ARRAY(uint8_t, fieldData->m_usLength + extraBytes);
+		memset(fieldData->m_pData, '\0', (fieldData->m_usLength+extraBytes) * sizeof(uint8_t));
+		CopyValue(span, data, fieldData->m_pData, fieldData->m_usLength);
+		return fieldData;
+	}
+
+	/*
+	* @brief 	Find the value of a single field in row data without copying it,
+				and move the offset past the field.
+	*/
+	static void Locate(const SQLardFieldPlan & plan, uint8_t * data, size_t & offset, SQLardFieldSpan & span) {
+		/*	DATE MUST NOT have a TYPE_VARLEN. The value is either 3 bytes or 0 bytes (null). 
+			TIME, DATETIME2, and DATETIMEOFFSET MUST NOT have a TYPE_VARLEN. The lengths are determined by the SCALE as indicated in section 2.2.5.4.2. */
+		span.pData = nullptr;
+		span.plpOffset = 0;
+		span.length = 0;
+		span.signFlag = 1;
+		span.bNull = false;
+
+		if (plan.fixedLength >= 0) {
+			span.length = plan.fixedLength;
+			span.bNull = (plan.fixedLength == 0);
+		}
+		else switch (plan.lengthPrefix) {
+			case 1:
+				/* 1 byte length, 0 means NULL (0xFF for the legacy char / binary types) */
+				span.length = SQLardUtil::sqlard_read_le<uint8_t>(data, offset);
+				if (plan.bLegacyCharBin) {
+					span.bNull = (span.length == 0xFF);
+					if (span.bNull)
+						span.length = 0;
+				}
+				else
+					span.bNull = (span.length == 0);
+				/* PRECISION and SCALE are in COLMETADATA, the value starts with a sign byte */
+				if (span.length > 0 && plan.bDecimal) {
+					span.length -= 1;
+					span.signFlag = SQLardUtil::sqlard_read_le<uint8_t>(data, offset);
+				}
+				break;
+			case 2:
+				if (plan.bPLP) {
+					/* 8 byte total length (may be unknown), followed by chunks terminated with a zero length chunk */
+					uint32_t lo = SQLardUtil::sqlard_read_le<uint32_t>(data, offset);
+					uint32_t hi = SQLardUtil::sqlard_read_le<uint32_t>(data, offset);
+					if (lo == 0xFFFFFFFF && hi == 0xFFFFFFFF) {
+						span.bNull = true;
+						break;
+					}
+					span.plpOffset = offset;
+					for (uint32_t chunk; (chunk = SQLardUtil::sqlard_read_le<uint32_t>(data, offset)) != 0; offset += chunk)
+						span.length += chunk;
+					return;
+				}
+				span.length = SQLardUtil::sqlard_read_le<uint16_t>(data, offset);
+				/* CHARBIN_NULL */
+				if (span.length == 0xFFFF) {
+					span.length = 0;
+					span.bNull = true;
+				}
+				break;
+			case 4:
+			{
+				uint8_t textPtrLen = SQLardUtil::sqlard_read_le<uint8_t>(data, offset);
+				span.bNull = (textPtrLen == 0);
+				if (textPtrLen == 0)
+					break;
+				offset += textPtrLen + 8;
+				span.length = SQLardUtil::sqlard_read_le<uint32_t>(data, offset);
+				break;
+			}
+			default:
+				#ifdef SQLARD_VERBOSE_OUTPUT
+					SQLardUtil::printf(F("ParseField() >> Undefined field type !!! %d\n"), plan.type);
+				#endif 
+				break;
+		}
+		span.pData = data + offset;
+		offset += span.length;
+	}
+
+	/*
+	* @brief 	Copy up to max bytes of a located value to d, the chunks of PLP values are concatenated.
+	* @return	Bytes copied.
+	*/
+	static uint32_t CopyValue(const SQLardFieldSpan & span, uint8_t * data, uint8_t * d, const uint32_t max) {
+		if (span.plpOffset == 0) {
+			const uint32_t n = span.length < max ? span.length : max;
+			if (n)
+				memcpy(d, span.pData, n);
+			return n;
+		}
+		size_t pos = span.plpOffset;
+		uint32_t written = 0;
+		for (uint32_t chunk; written < max && (chunk = SQLardUtil::sqlard_read_le<uint32_t>(data, pos)) != 0; pos += chunk) {
+			uint32_t n = chunk;
+			if (written + n > max)
+				n = max - written;
+			memcpy(d + written, data + pos, n);
+			written += n;
+		}
+		return written;
+	}
+};
+
+class SQLardRowData : public SQLardHeapObject {
+public:
+	friend class SQLardTableResult;
+	uint16_t m_usFieldCount;
+	void allocateFieldArray(const uint16_t len) {
+		m_arrFields = SQLARD_NEW_ARRAY(SQLardRowFieldData *, len);
+		memset(m_arrFields, 0, len * sizeof(SQLardRowFieldData *));
+		m_usFieldCount = len;
+	}
+
+	const SQLardRowFieldData * operator[](const size_t index)const  { 
+		if ((signed)index <= (signed)(-1) || index > m_usFieldCount - 1)
+			return nullptr;
+		return m_arrFields[index];
+	}
+	
+
+	~SQLardRowData() {
+		for (uint16_t i = 0; i < m_usFieldCount; i++) {
+			if (m_arrFields[i] == nullptr)
+				continue;
+			delete m_arrFields[i];
+		}
+		SQLARD_DELETE_ARRAY(m_arrFields);
+	}
+protected:
+	SQLardRowFieldData ** m_arrFields;
+};
+
+/*
+	Column metadata of a result set and the decode plan of its columns.
+	Immutable once parsed and reference counted, so results of queries
+	with the same layout can share one set (see SQLardColumnCache).
+*/
+class SQLardColumnSet : public SQLardHeapObject {
+public:
+	/* Parse a COLMETADATA token body, the set starts with one reference */
+	static SQLardColumnSet * Parse(uint8_t * data, size_t & offset) {
+		uint16_t columnCount = SQLardUtil::sqlard_read_le<uint16_t>(data, offset);
+		/* 0xFFFF means no metadata */
+		if (columnCount == 0xFFFF)
+			columnCount = 0;
+		SQLardColumnSet * pSet = new SQLardColumnSet(columnCount);
+		for (uint16_t i = 0; i < columnCount; i++) {
+			pSet->m_arColumnData[i] = SQLardColumnData::ParseColumnData(data, offset);
+			pSet->m_arPlan[i] = SQLardFieldPlan::For(pSet->m_arColumnData[i]->m_bType, pSet->m_arColumnData[i]->isPLP());
+		}
+		return pSet;
+	}
+
+	void Retain() { m_uiRefs++; }
+	/* Drop a reference, the set deletes itself with the last one */
+	void Release() {
+		if (--m_uiRefs == 0)
+			delete this;
+	}
+
+	const uint16_t GetColumnCount() const { return m_usColumnCount; }
+	SQLardColumnData ** GetColumns() const { return m_arColumnData; }
+	const SQLardFieldPlan * GetPlan() const { return m_arPlan; }
+private:
+	SQLardColumnSet(const uint16_t count) {
+		m_uiRefs = 1;
+		m_usColumnCount = count;
+		m_arColumnData = SQLARD_NEW_ARRAY(SQLardColumnData *, count);
+		m_arPlan = SQLARD_NEW_ARRAY(SQLardFieldPlan, count);
+	}
+	~SQLardColumnSet() {
+		for (uint16_t i = 0; i < m_usColumnCount; i++)
+			delete m_arColumnData[i];
+		SQLARD_DELETE_ARRAY(m_arColumnData);
+		SQLARD_DELETE_ARRAY(m_arPlan);
+	}
+
+	#ifdef SQLARD_THREADS
+		/* results may be released on other threads than the connection that parsed them */
+		std::atomic<uint32_t> m_uiRefs;
+	#else
+		uint32_t m_uiRefs;
+	#endif
+	uint16_t m_usColumnCount;
+	SQLardColumnData ** m_arColumnData;
+	SQLardFieldPlan * m_arPlan;
+};
+
+#ifdef SQLARD_COLUMN_CACHE
+/*
+	Column sets of the COLMETADATA tokens seen last, keyed by a hash of the
+	raw token bytes. A polling query that keeps returning the same layout
+	gets the same set back instead of parsing the metadata every time.
+	The bytes are compared on a hash match, so a collision can not hand
+	out a wrong layout. Least recently used layouts are replaced.
+*/
+class SQLardColumnCache {
+public:
+	SQLardColumnCache() {
+		memset(m_arEntries, 0, sizeof(m_arEntries));
+		m_uiClock = 0;
+		m_uiHits = 0;
+		m_uiMisses = 0;
+	}
+	~SQLardColumnCache() {
+		Clear();
+	}
+
+	/* Column set of a COLMETADATA token body, the caller retains it to keep it */
+	SQLardColumnSet * Get(uint8_t * data, const size_t len) {
+		const uint32_t hash = SQLardUtil::sqlard_hash_bytes(data, len);
+		Entry * victim = &m_arEntries[0];
+		for (uint8_t i = 0; i < SQLARD_COLUMN_CACHE_ENTRIES; i++) {
+			Entry & entry = m_arEntries[i];
+			if (entry.pSet != nullptr && entry.hash == hash && entry.len == len && memcmp(entry.data, data, len) == 0) {
+				entry.lastUse = ++m_uiClock;
+				m_uiHits++;
+				return entry.pSet;
+			}
+			if (entry.pSet == nullptr || (victim->pSet != nullptr && entry.lastUse < victim->lastUse))
+				victim = &entry;
+		}
+		m_uiMisses++;
+		size_t pos = 0;
+		SQLardColumnSet * pSet = SQLardColumnSet::Parse(data, pos);
+		Drop(*victim);
+		victim->pSet = pSet;
+		victim->hash = hash;
+		victim->len = len;
+		victim->data = SQLARD_NEW_ARRAY(uint8_t, len);
+		memcpy(victim->data, data, len);
+		victim->lastUse = ++m_uiClock;
+		return pSet;
+	}
+
+	void Clear() {
+		for (uint8_t i = 0; i < SQLARD_COLUMN_CACHE_ENTRIES; i++)
+			Drop(m_arEntries[i]);
+	}
+	const uint32_t GetHits() const { return m_uiHits; }
+	const uint32_t GetMisses() const { return m_uiMisses; }
+private:
+	struct Entry {
+		SQLardColumnSet * pSet;
+		uint32_t hash;
+		size_t len;
+		uint8_t * data;
+		uint32_t lastUse;
+	};
+	static void Drop(Entry & entry) {
+		if (entry.pSet != nullptr)
+			entry.pSet->Release();
+		if (entry.data != nullptr)
+			SQLARD_DELETE_ARRAY(entry.data);
+		memset(&entry, 0, sizeof(entry));
+	}
+
+	Entry m_arEntries[SQLARD_COLUMN_CACHE_ENTRIES];
+	uint32_t m_uiClock;
+	uint32_t m_uiHits;
+	uint32_t m_uiMisses;
+};
+#endif
+
+#ifdef SQLARD_SPILL
+/*
+	Temporary file holding spilled row pages, removed again on destruction.
+	The file grows by whole segments, each mapped on its own, so space that
+	was handed out never moves. A page never straddles two segments.
+*/
+class SQLardSpillFile {
+public:
+	SQLardSpillFile() {
+		m_pFile = nullptr;
+		m_ullFileSize = 0;
+		m_szSegmentUsed = 0;
+	}
+	~SQLardSpillFile() {
+		for (size_t i = 0; i < m_arSegments.size(); i++)
+			delete m_arSegments[i];
+		if (m_pFile != nullptr) {
+			delete m_pFile;
+			boost::interprocess::file_mapping::remove(m_strPath.c_str());
+		}
+	}
+
+	/* Create the file in directory, false if it can not be created */
+	bool Open(const char * directory) {
+		/* results spill from several decode threads at once */
+		static std::atomic<uint32_t> counter(0);
+		char name[64];
+		snprintf(name, sizeof(name), "/sqlard-%p-%u-%lu.spill", (void*)this, static_cast<unsigned>(counter++), (unsigned long)SQLardUtil::sqlard_millis());
+		m_strPath = directory;
+		m_strPath += name;
+		FILE * f = fopen(m_strPath.c_str(), "wb");
+		if (f == nullptr)
+			return false;
+		fclose(f);
+		try {
+			m_pFile = new boost::interprocess::file_mapping(m_strPath.c_str(), boost::interprocess::read_write);
+		}
+		catch (const boost::interprocess::interprocess_exception &) {
+			remove(m_strPath.c_str());
+			return false;
+		}
+		return true;
+	}
+
+	/* Hand out len bytes of mapped space, nullptr if the file can not grow */
+	uint8_t * Allocate(const size_t len, uint32_t & segment, size_t & offset) {
+		if (m_arSegments.empty() || m_szSegmentUsed + len > m_arSegments.back()->get_size()) {
+			const size_t size = len > SQLARD_SPILL_SEGMENT ? len : SQLARD_SPILL_SEGMENT;
+			if (!Grow(size))
+				return nullptr;
+		}
+		segment = static_cast<uint32_t>(m_arSegments.size() - 1);
+		offset = m_szSegmentUsed;
+		m_szSegmentUsed += len;
+		return At(segment, offset);
+	}
+	uint8_t * At(const uint32_t segment, const size_t offset) const {
+		return static_cast<uint8_t*>(m_arSegments[segment]->get_address()) + offset;
+	}
+	const uint64_t GetFileSize() const { return m_ullFileSize; }
+private:
+	bool Grow(const size_t size) {
+		FILE * f = fopen(m_strPath.c_str(), "r+b");
+		if (f == nullptr)
+			return false;
+		/* extend the file by writing its new last byte */
+		const bool ok = fseek(f, static_cast<long>(m_ullFileSize + size - 1), SEEK_SET) == 0 && fputc(0, f) != EOF;
+		fclose(f);
+		if (!ok)
+			return false;
+		try {
+			m_arSegments.push_back(new boost::interprocess::mapped_region(*m_pFile, boost::interprocess::read_write, m_ullFileSize, size));
+		}
+		catch (const boost::interprocess::interprocess_exception &) {
+			return false;
+		}
+		m_ullFileSize += size;
+		m_szSegmentUsed = 0;
+		return true;
+	}
+
+	std::string m_strPath;
+	boost::interprocess::file_mapping * m_pFile;
+	std::vector<boost::interprocess::mapped_region*> m_arSegments;
+	uint64_t m_ullFileSize;
+	size_t m_szSegmentUsed;
+};
+#endif
+
+class SQLardTableResult : public SQLardHeapObject {
+public:
+	SQLardColumnData ** m_arColumnData;
+	uint16_t m_usColumnCount;
+
+	SQLardRowArray<SQLardRowData*>  m_arRows;
+
+	/*
+		Independent cursor over the rows, forward or reverse.
+		Any amount of cursors can walk a result at once.
+	*/
+	class Cursor {
+	public:
+		Cursor(const SQLardTableResult * pResult, const bool bReverse = false) {
+			m_pResult = pResult;
+			m_bReverse = bReverse;
+			Reset();
+		}
+		/* Row under the cursor, nullptr past the end */
+		SQLardRowData * GetRow() const {
+			return m_pResult->row(m_uiIndex);
+		}
+		void MoveNext() {
+			if (m_uiIndex < m_pResult->rowCount())
+				m_uiIndex = m_bReverse ? (m_uiIndex == 0 ? m_pResult->rowCount() : m_uiIndex - 1) : m_uiIndex + 1;
+		}
+		void Reset() {
+			m_uiIndex = m_bReverse ? m_pResult->rowCount() - 1 : 0;
+			if (m_pResult->rowCount() == 0)
+				m_uiIndex = 0;
+		}
+		bool Seek(const uint32_t index) {
+			m_uiIndex = index < m_pResult->rowCount() ? index : m_pResult->rowCount();
+			return m_uiIndex != m_pResult->rowCount();
+		}
+		const uint32_t GetIndex() const { return m_uiIndex; }
+	private:
+		const SQLardTableResult * m_pResult;
+		uint32_t m_uiIndex;
+		bool m_bReverse;
+	};
+
+	SQLardTableResult() {
+		m_arColumnData = nullptr;
+		m_usColumnCount = 0;
+		m_pColumnSet = nullptr;
+		m_uiCurrentRow = 0;
+		m_pNextResult = nullptr;
+		m_uiDoneCount = 0;
+		m_bComplete = false;
+		#ifdef SQLARD_DICTIONARY
+			m_usDictionaryEntries = 0;
+			m_arDictionaries = nullptr;
+		#endif
+		#ifdef SQLARD_SPILL
+			m_szMemoryBudget = 0;
+			m_szResidentBytes = 0;
+			m_pSpill = nullptr;
+			m_bSpillFailed = false;
+		#endif
+	}
+	/* Share the column set of the result, which must have none */
+	void SetColumns(SQLardColumnSet * pSet) {
+		pSet->Retain();
+		m_pColumnSet = pSet;
+		m_arColumnData = pSet->GetColumns();
+		m_usColumnCount = pSet->GetColumnCount();
+		#ifdef SQLARD_DICTIONARY
+			createDictionaries();
+		#endif
+	}
+
+	#ifdef SQLARD_DICTIONARY
+		/*
+			Store each distinct value of the character columns once, up to
+			maxEntries values per column (0 turns it off). Set before the
+			columns, see SQLard::setDictionaryEncoding.
+		*/
+		void SetDictionaryEncoding(const uint16_t maxEntries) {
+			m_usDictionaryEntries = maxEntries;
+		}
+		/* Dictionary of a column, nullptr if its values are not encoded */
+		const SQLardDictionary * GetDictionary(const uint16_t columnIndex) const {
+			return m_arDictionaries != nullptr && columnIndex < m_usColumnCount ? m_arDictionaries[columnIndex] : nullptr;
+		}
+	#endif
+	SQLardColumnSet * GetColumnSet() const { return m_pColumnSet; }
+
+	/*
+		Next result set of the batch, nullptr after the last one. The results
+		of a batch are owned by the first one and deleted with it.
+	*/
+	SQLardTableResult * nextResult() const { return m_pNextResult; }
+	void SetNextResult(SQLardTableResult * pNext) { m_pNextResult = pNext; }
+	/* Row count of the DONE token that ended the statement of this result set */
+	uint32_t GetDoneCount() const { return m_uiDoneCount; }
+	/* The DONE token was received, the result set was not cut short by a cancel */
+	bool isComplete() const { return m_bComplete; }
+	void Complete(const uint32_t doneCount) {
+		m_uiDoneCount = doneCount;
+		m_bComplete = true;
+	}
+
+	void appendRowData(SQLardRowData * pRow) {
+		m_arRows.Append(pRow);
+		#ifdef SQLARD_SPILL
+			if (m_szMemoryBudget == 0)
+				return;
+			m_szResidentBytes += RowBytes(pRow);
+			if (m_szResidentBytes > m_szMemoryBudget)
+				Spill();
+		#endif
+	}
+	/* Move the column metadata of pOther into this result, which must have none */
+	void TakeColumns(SQLardTableResult * pOther) {
+		m_pColumnSet = pOther->m_pColumnSet;
+		m_arColumnData = pOther->m_arColumnData;
+		m_usColumnCount = pOther->m_usColumnCount;
+		pOther->m_pColumnSet = nullptr;
+		pOther->m_arColumnData = nullptr;
+		pOther->m_usColumnCount = 0;
+		#ifdef SQLARD_DICTIONARY
+			m_arDictionaries = pOther->m_arDictionaries;
+			m_usDictionaryEntries = pOther->m_usDictionaryEntries;
+			pOther->m_arDictionaries = nullptr;
+		#endif
+	}
+	/* Move all rows of pOther to the end of this result */
+	void TakeRows(SQLardTableResult * pOther) {
+		#ifdef SQLARD_SPILL
+			pOther->Unspill();
+		#endif
+		m_arRows.Reserve(m_arRows.Count() + pOther->m_arRows.Count());
+		for (uint32_t i = 0; i < pOther->m_arRows.Count(); i++) {
+			#ifdef SQLARD_DICTIONARY
+				Reintern(pOther->m_arRows[i]);
+			#endif
+			m_arRows.Append(pOther->m_arRows[i]);
+		}
+		pOther->m_arRows.Release();
+		pOther->m_uiCurrentRow = 0;
+	}
+
+	#ifdef SQLARD_DICTIONARY
+		/*
+			Make the dictionary codes of a row moved in from another result
+			codes of this one: shared values of other dictionaries are interned
+			into the dictionary of their column, or copied into their fields
+			(code -1) if the column has none or it is full.
+		*/
+		void Reintern(SQLardRowData * pRow) {
+			const SQLardFieldPlan * plan = m_pColumnSet->GetPlan();
+			for (uint16_t i = 0; i < pRow->m_usFieldCount && i < m_usColumnCount; i++) {
+				SQLardRowFieldData * pField = pRow->m_arrFields[i];
+				if (pField == nullptr || !pField->m_bShared)
+					continue;
+				SQLardDictionary * pDictionary = m_arDictionaries != nullptr ? m_arDictionaries[i] : nullptr;
+				uint16_t length;
+				if (pDictionary != nullptr && pDictionary->GetValue(SQLardDictionary::GetCode(pField->m_pData), length) == pField->m_pData)
+					continue;
+				uint8_t * value = pDictionary != nullptr ? pDictionary->Intern(pField->m_pData, pField->m_usLength, plan[i].extraBytes) : nullptr;
+				const bool bShared = value != nullptr;
+				if (!bShared) {
+					value = SQLARD_NEW_ARRAY(uint8_t, pField->m_usLength + plan[i].extraBytes);
+					memcpy(value, pField->m_pData, pField->m_usLength + plan[i].extraBytes);
+				}
+				SQLardDictionary::Release(pField->m_pData);
+				pField->m_pData = value;
+				pField->m_bShared = bShared;
+			}
+		}
+	#endif
+
+	SQLardDataType GetColumnDataType(const uint16_t columnIndex) {
+		if (columnIndex >= m_usColumnCount) 
+			return static_cast<SQLardDataType>(-1);
+		return static_cast<SQLardDataType>(m_arColumnData[columnIndex]->m_bType);
+	}
+
+	uint8_t GetColumnScale(const uint16_t columnIndex) {
+		if (columnIndex >= m_usColumnCount)
+			return 0;
+		return m_arColumnData[columnIndex]->m_bScale;
+	}
+
+	/*
+		Convert a whole temporal column to microseconds since UNIX epoch,
+		starting from the first row. Does not move the row iterator.
+		Returns the amount of values written to out.
+	*/
+	size_t GetEpochMicrosColumn(const uint16_t columnIndex, int64_t * out, const size_t maxCount) {
+		if (columnIndex >= m_usColumnCount)
+			return 0;
+		const uint8_t type = m_arColumnData[columnIndex]->m_bType;
+		const uint8_t scale = m_arColumnData[columnIndex]->m_bScale;
+		size_t count = 0;
+		for (; count < rowCount() && count < maxCount; count++)
+			out[count] = row(count)->m_arrFields[columnIndex]->asEpochMicros(type, scale);
+		return count;
+	}
+
+
+	const uint32_t rowCount() const {
+		return m_arRows.Count();
+	}
+	/*
+		Row at index, nullptr if out of range. Rows of a spilled page are read
+		back on demand; such a row stays valid while at most one other page
+		is read back (see SetMemoryBudget).
+	*/
+	SQLardRowData * row(const uint32_t index) const {
+		if (index >= m_arRows.Count())
+			return nullptr;
+		#ifdef SQLARD_SPILL
+			if (m_arRows[index] == nullptr)
+				PageIn(index / SQLARD_SPILL_PAGE_ROWS);
+		#endif
+		return m_arRows[index];
+	}
+	/*
+		Contiguous row pointers, for sorting / binary search in place:
+			std::sort(pResult->begin(), pResult->end(), compare);
+		Spilled rows are read back into memory first.
+	*/
+	SQLardRowData ** begin() {
+		#ifdef SQLARD_SPILL
+			Unspill();
+		#endif
+		return m_arRows.Data();
+	}
+	SQLardRowData ** end() { return m_arRows.Data() + m_arRows.Count(); }
+	Cursor GetCursor(const bool bReverse = false) const {
+		return Cursor(this, bReverse);
+	}
+
+	/* Built-in forward iterator */
+	SQLardRowData * GetRow() const {
+		return row(m_uiCurrentRow);
+	}
+	void MoveNext() {
+		if (m_uiCurrentRow < rowCount())
+			m_uiCurrentRow++;
+	}
+	void ResetIterator() {
+		m_uiCurrentRow = 0;
+	}
+
+	void ParseColumnData(uint8_t * data, size_t & offset) {
+		SQLardColumnSet * pSet = SQLardColumnSet::Parse(data, offset);
+		SetColumns(pSet);
+		pSet->Release();
+	}
+
+	void ParseRowData( uint8_t * data, size_t & offset) {
+		appendRowData(DecodeRow(data, offset));
+	}
+	/* NBCROW: a null bitmap precedes the row, NULL fields are not transmitted */
+	void ParseNbcRowData(uint8_t * data, size_t & offset) {
+		appendRowData(DecodeNbcRow(data, offset));
+	}
+	/* Decode a row without adding it, the result is not modified */
+	SQLardRowData * DecodeRow(uint8_t * data, size_t & offset) const {
+		SQLardRowData * pRowData = new SQLardRowData();
+		pRowData->allocateFieldArray(m_usColumnCount);
+		const SQLardFieldPlan * plan = m_pColumnSet->GetPlan();
+		for (uint16_t i = 0; i < m_usColumnCount; i++) {
+			#ifdef SQLARD_DICTIONARY
+				pRowData->m_arrFields[i] = SQLardRowFieldData::ParseField(plan[i], (uint8_t*)data, offset, m_arDictionaries ? m_arDictionaries[i] : nullptr);
+			#else
+				pRowData->m_arrFields[i] = SQLardRowFieldData::ParseField(plan[i], (uint8_t*)data, offset);
+			#endif
+		}
+		return pRowData;
+	}
+	SQLardRowData * DecodeNbcRow(uint8_t * data, size_t & offset) const {
+		SQLardRowData * pRowData = new SQLardRowData();
+		pRowData->allocateFieldArray(m_usColumnCount);
+		const SQLardFieldPlan * plan = m_pColumnSet->GetPlan();
+		const uint8_t * bitmap = data + offset;
+		offset += (m_usColumnCount + 7) / 8;
+		for (uint16_t i = 0; i < m_usColumnCount; i++) {
+			if (bitmap[i / 8] & (1 << (i % 8))) {
+				pRowData->m_arrFields[i] = new SQLardRowFieldData();
+				pRowData->m_arrFields[i]->m_pData = SQLARD_NEW_ARRAY(uint8_t, 2);
+				memset(pRowData->m_arrFields[i]->m_pData, 0, 2);
+				pRowData->m_arrFields[i]->m_bNull = true;
+				continue;
+			}
+			#ifdef SQLARD_DICTIONARY
+				pRowData->m_arrFields[i] = SQLardRowFieldData::ParseField(plan[i], (uint8_t*)data, offset, m_arDictionaries ? m_arDictionaries[i] : nullptr);
+			#else
+				pRowData->m_arrFields[i] = SQLardRowFieldData::ParseField(plan[i], (uint8_t*)data, offset);
+			#endif
+		}
+		return pRowData;
+	}
+
+	#ifdef SQLARD_SPILL
+		/*
+			Limit the decoded rows kept in memory to about budgetBytes (0 keeps
+			everything). Past the budget, complete pages of SQLARD_SPILL_PAGE_ROWS
+			rows are written to a temporary file in directory and dropped from
+			memory; row() reads them back when they are accessed, evicting the
+			pages read back before. Rows of a spilled result are read only.
+			If the file can not be written, rows simply stay in memory.
+		*/
+		void SetMemoryBudget(const size_t budgetBytes, const char * directory) {
+			m_szMemoryBudget = budgetBytes;
+			m_strSpillDirectory = directory;
+			m_szResidentBytes = 0;
+			for (uint32_t i = 0; i < m_arRows.Count(); i++)
+				if (m_arRows[i] != nullptr)
+					m_szResidentBytes += RowBytes(m_arRows[i]);
+		}
+		/* Some rows live in the spill file */
+		bool IsSpilled() const { return m_pSpill != nullptr; }
+		/* Approximate bytes of the decoded rows in memory */
+		const size_t GetResidentBytes() const { return m_szResidentBytes; }
+		/* Bytes of the spill file */
+		const uint64_t GetSpilledBytes() const { return m_pSpill ? m_pSpill->GetFileSize() : 0; }
+
+		/* Read all spilled rows back and remove the spill file, the budget no longer applies */
+		void Unspill() {
+			if (m_pSpill == nullptr)
+				return;
+			for (uint32_t page = 0; page < m_arPages.size(); page++)
+				if (!m_arPages[page].bResident)
+					Load(page);
+			m_arPages.clear();
+			m_dqLoaded.clear();
+			delete m_pSpill;
+			m_pSpill = nullptr;
+			m_szMemoryBudget = 0;
+		}
+	#endif
+
+	~SQLardTableResult() {
+		#ifdef SQLARD_DICTIONARY
+			/* stored values live on while rows moved elsewhere use them */
+			if (m_arDictionaries != nullptr) {
+				for (uint16_t i = 0; i < m_usColumnCount; i++)
+					if (m_arDictionaries[i])
+						delete m_arDictionaries[i];
+				SQLARD_DELETE_ARRAY(m_arDictionaries);
+			}
+		#endif
+		if (!(nullptr == m_pColumnSet))
+			m_pColumnSet->Release();
+		#ifdef SQLARD_SPILL
+			if (m_pSpill != nullptr)
+				delete m_pSpill;
+		#endif
+		/* the rest of the batch, one by one so long chains do not recurse */
+		while (m_pNextResult != nullptr) {
+			SQLardTableResult * pNext = m_pNextResult;
+			m_pNextResult = pNext->m_pNextResult;
+			pNext->m_pNextResult = nullptr;
+			delete pNext;
+		}
+	}
+protected:
+	SQLardColumnSet * m_pColumnSet;
+	uint32_t m_uiCurrentRow;
+	SQLardTableResult * m_pNextResult;
+	uint32_t m_uiDoneCount;
+	bool m_bComplete;
+
+	#ifdef SQLARD_DICTIONARY
+		/* Character columns of fixed or limited length, not (MAX) or TEXT ones */
+		void createDictionaries() {
+			if (m_usDictionaryEntries == 0 || m_usColumnCount == 0)
+				return;
+			m_arDictionaries = SQLARD_NEW_ARRAY(SQLardDictionary *, m_usColumnCount);
+			const SQLardFieldPlan * plan = m_pColumnSet->GetPlan();
+			for (uint16_t i = 0; i < m_usColumnCount; i++) {
+				const bool bEncoded = plan[i].extraBytes > 0 && !plan[i].bPLP && plan[i].lengthPrefix != 4;
+				m_arDictionaries[i] = bEncoded ? new SQLardDictionary(m_usDictionaryEntries) : nullptr;
+			}
+		}
+
+		uint16_t m_usDictionaryEntries;
+		SQLardDictionary ** m_arDictionaries;
+	#endif
+
+	#ifdef SQLARD_SPILL
+		/* Location of a written page in the spill file */
+		struct SpillPage {
+			uint32_t segment;
+			size_t offset;
+			size_t length;
+			bool bResident;
+		};
+
+		/* Approximate heap bytes of a decoded row */
+		static size_t RowBytes(const SQLardRowData * pRow) {
+			size_t bytes = sizeof(SQLardRowData) + pRow->m_usFieldCount * (sizeof(SQLardRowFieldData*) + sizeof(SQLardRowFieldData));
+			for (uint16_t i = 0; i < pRow->m_usFieldCount; i++)
+				if (pRow->m_arrFields[i] != nullptr)
+					bytes += pRow->m_arrFields[i]->m_usLength + 2;
+			return bytes;
+		}
+
+		/*
+			Get back under the budget: drop pages read back first, then write
+			complete pages that were never spilled. The page being filled stays.
+		*/
+		void Spill() {
+			while (m_szResidentBytes > m_szMemoryBudget && !m_dqLoaded.empty())
+				Evict();
+			while (m_szResidentBytes > m_szMemoryBudget && !m_bSpillFailed && (m_arPages.size() + 1) * SQLARD_SPILL_PAGE_ROWS <= m_arRows.Count())
+				m_bSpillFailed = !WritePage(static_cast<uint32_t>(m_arPages.size()));
+		}
+
+		/*
+			Page layout, per row and field:
+				uint16 length, uint8 flags (1: NULL, 2: missing), uint8 sign, data
+		*/
+		bool WritePage(const uint32_t page) {
+			if (m_pSpill == nullptr) {
+				m_pSpill = new SQLardSpillFile();
+				if (!m_pSpill->Open(m_strSpillDirectory.c_str())) {
+					delete m_pSpill;
+					m_pSpill = nullptr;
+					return false;
+				}
+			}
+			SQLardRowData ** rows = m_arRows.Data() + page * SQLARD_SPILL_PAGE_ROWS;
+			size_t length = 0;
+			for (uint32_t r = 0; r < SQLARD_SPILL_PAGE_ROWS; r++)
+				for (uint16_t i = 0; i < rows[r]->m_usFieldCount; i++)
+					length += 4 + (rows[r]->m_arrFields[i] ? rows[r]->m_arrFields[i]->m_usLength : 0);
+			SpillPage location;
+			uint8_t * out = m_pSpill->Allocate(length, location.segment, location.offset);
+			if (out == nullptr)
+				return false;
+			location.length = length;
+			location.bResident = false;
+			for (uint32_t r = 0; r < SQLARD_SPILL_PAGE_ROWS; r++) {
+				for (uint16_t i = 0; i < rows[r]->m_usFieldCount; i++) {
+					const SQLardRowFieldData * field = rows[r]->m_arrFields[i];
+					const uint16_t len = field ? field->m_usLength : 0;
+					out[0] = static_cast<uint8_t>(len);
+					out[1] = static_cast<uint8_t>(len >> 8);
+					out[2] = field ? (field->m_bNull ? 1 : 0) : 2;
+					out[3] = field ? field->m_bSignFlag : 0;
+					if (len > 0)
+						memcpy(out + 4, field->m_pData, len);
+					out += 4 + len;
+				}
+				m_szResidentBytes -= RowBytes(rows[r]);
+				delete rows[r];
+				rows[r] = nullptr;
+			}
+			m_arPages.push_back(location);
+			return true;
+		}
+
+		/* Decode a written page back into its row slots */
+		void Load(const uint32_t page) const {
+			SpillPage & location = m_arPages[page];
+			const uint8_t * in = m_pSpill->At(location.segment, location.offset);
+			SQLardRowData ** rows = const_cast<SQLardRowData**>(m_arRows.Data()) + page * SQLARD_SPILL_PAGE_ROWS;
+			for (uint32_t r = 0; r < SQLARD_SPILL_PAGE_ROWS; r++) {
+				SQLardRowData * pRow = new SQLardRowData();
+				pRow->allocateFieldArray(m_usColumnCount);
+				for (uint16_t i = 0; i < m_usColumnCount; i++) {
+					const uint16_t len = in[0] | (in[1] << 8);
+					if (in[2] != 2) {
+						SQLardRowFieldData * field = new SQLardRowFieldData();
+						field->m_usLength = len;
+						field->m_bNull = in[2] == 1;
+						field->m_bSignFlag = in[3];
+						/* room for the null terminator of character fields */
+						field->m_pData = SQLARD_NEW_ARRAY(uint8_t, len + 2);
+						memcpy(field->m_pData, in + 4, len);
+						field->m_pData[len] = field->m_pData[len + 1] = 0;
+						pRow->m_arrFields[i] = field;
+					}
+					in += 4 + len;
+				}
+				rows[r] = pRow;
+				m_szResidentBytes += RowBytes(pRow);
+			}
+			location.bResident = true;
+		}
+
+		/* Read a page back on access, dropping earlier pages while over the budget */
+		void PageIn(const uint32_t page) const {
+			Load(page);
+			m_dqLoaded.push_back(page);
+			while (m_szResidentBytes > m_szMemoryBudget && m_dqLoaded.size() > 2)
+				Evict();
+		}
+		/* Drop the rows of the oldest page read back, its copy on disk stays valid */
+		void Evict() const {
+			const uint32_t page = m_dqLoaded.front();
+			m_dqLoaded.pop_front();
+			SQLardRowData ** rows = const_cast<SQLardRowData**>(m_arRows.Data()) + page * SQLARD_SPILL_PAGE_ROWS;
+			for (uint32_t r = 0; r < SQLARD_SPILL_PAGE_ROWS; r++) {
+				m_szResidentBytes -= RowBytes(rows[r]);
+				delete rows[r];
+				rows[r] = nullptr;
+			}
+			m_arPages[page].bResident = false;
+		}
+
+		size_t m_szMemoryBudget;
+		mutable size_t m_szResidentBytes;
+		std::string m_strSpillDirectory;
+		SQLardSpillFile * m_pSpill;
+		mutable std::vector<SpillPage> m_arPages;
+		/* Pages read back, oldest first */
+		mutable std::deque<uint32_t> m_dqLoaded;
+		bool m_bSpillFailed;
+	#endif
+};
+
+
+
+
+class SQLardLOGIN7 : public SQLardHeapObject
+{
+public:
+	SQLardLOGIN7() {
+		/* Here are the default values */
+		m_uiLength = 0;
+		#ifdef SQLARD_TDS73
+			m_uiTDSVersion = 0x730B0003; /* TDS 7.3B */
+		#else
+			m_uiTDSVersion = 0x70000000; /* TDS 7.0 */
+		#endif
+		m_uiPacketSize = 4096;
+		m_uiClientProgVer = 117440512;
+		m_uiConnectionID = 0;
+		m_uiClientPID = 256;
+		m_uiClientTimeZone = 0x000001e0;
+		m_uiClientLCID = 0x00000409;
+		m_ubOptionFlags1 = 0xE0;
+		m_ubOptionFlags2 = 0x03;
+		m_ubOptionFlags3 = 0x00;
+		m_ubTypeFlags = 0x00;
+
+		m_wcszUserName = nullptr;
+		m_wcszPassword = nullptr;
+		m_wcszHost = nullptr;
+		m_wcszAppName = nullptr;
+		m_wcszServerName = nullptr;
+		m_wcszUnused = nullptr;
+		m_wcszExtension = nullptr;
+		m_wcszCltIntName = nullptr;
+		m_wcszLanguage = nullptr;
+		m_wcszDatabase = nullptr;
+		m_wcszAttachDBFile = nullptr;
+		m_wcszChangePassword = nullptr;
+		m_wcszSSPI = nullptr;
+		m_pPacket = nullptr;
+		m_szPacketLength = 0;
+
+		SetClientInterfaceName(u"ODBC");
+		SetApplicationName(u"SQLARD");
+	}
+	~SQLardLOGIN7() {
+		if (!(nullptr == m_wcszUserName))
+			SQLARD_DELETE_ARRAY(m_wcszUserName);
+		if (!(nullptr == m_wcszPassword))
+			SQLARD_DELETE_ARRAY(m_wcszPassword);
+		if (!(nullptr == m_wcszHost))
+			SQLARD_DELETE_ARRAY(m_wcszHost);
+		if (!(nullptr == m_wcszAppName))
+			SQLARD_DELETE_ARRAY(m_wcszAppName);
+		if (!(nullptr == m_wcszServerName))
+			SQLARD_DELETE_ARRAY(m_wcszServerName);
+		if (!(nullptr == m_wcszUnused))
+			SQLARD_DELETE_ARRAY(m_wcszUnused);
+		if (!(nullptr == m_wcszExtension))
+			SQLARD_DELETE_ARRAY(m_wcszExtension);
+		if (!(nullptr == m_wcszCltIntName))
+			SQLARD_DELETE_ARRAY(m_wcszCltIntName);
+		if (!(nullptr == m_wcszLanguage))
+			SQLARD_DELETE_ARRAY(m_wcszLanguage);
+		if (!(nullptr == m_wcszDatabase))
+			SQLARD_DELETE_ARRAY(m_wcszDatabase);
+		if (!(nullptr == m_wcszAttachDBFile))
+			SQLARD_DELETE_ARRAY(m_wcszAttachDBFile);
+		if (!(nullptr == m_wcszChangePassword))
+			SQLARD_DELETE_ARRAY(m_wcszChangePassword);
+		if (!(nullptr == m_wcszSSPI))
+			SQLARD_DELETE_ARRAY(m_wcszSSPI);
+		invalidatePacket();
+	}
+	void SetLength(const uint32_t val) { m_uiLength = val; invalidatePacket(); }
+	void SetTDSVersion(const uint32_t val) { m_uiTDSVersion = val; invalidatePacket(); }
+	void SetPacketSize(const uint32_t val) { m_uiPacketSize = val; invalidatePacket(); }
+	void SetClientProgVer(const uint32_t val) { m_uiClientProgVer = val; invalidatePacket(); }
+	void SetClientPID(const uint32_t val) { m_uiClientPID = val; invalidatePacket(); }
+	void SetConnectionID(const uint32_t val) { m_uiConnectionID = val; invalidatePacket(); }
+	void SetClientTimeZone(const uint32_t val) { m_uiClientTimeZone = val; invalidatePacket(); }
+	/* collation */
+	void SetClientLCID(const uint32_t val) { m_uiClientLCID = val; invalidatePacket(); }
+	void SetOptionFlags1(const uint8_t val) { m_ubOptionFlags1 = val; invalidatePacket(); }
+	void SetOptionFlags2(const uint8_t val) { m_ubOptionFlags2 = val; invalidatePacket(); }
+	void SetOptionFlags3(const uint8_t val) { m_ubOptionFlags3 = val; invalidatePacket(); }
+	void SetTypeFlags(const uint8_t val) { m_ubTypeFlags = val; invalidatePacket(); }
+
+	/* Login related */
+	void SetUserName(const SQLardText & wcszUserName) {
+		setString(m_wcszUserName, wcszUserName);
+	};
+	void SetPassword(const SQLardText & wcszPassword) {
+		setString(m_wcszPassword, wcszPassword);
+	};
+	void SetHost(const SQLardText & wcszHost) {
+		setString(m_wcszHost, wcszHost);
+	};
+	void SetApplicationName(const SQLardText & wcszAppName) {
+		setString(m_wcszAppName, wcszAppName);
+	};
+	void SetServerName(const SQLardText & wcszServerName) {
+		setString(m_wcszServerName, wcszServerName);
+	};
+	void SetExtension(const SQLardText & wcszExtension) {
+		setString(m_wcszExtension, wcszExtension);
+	};
+	void SetClientInterfaceName(const SQLardText & wcszCltIntName) {
+		setString(m_wcszCltIntName, wcszCltIntName);
+	};
+	/* Initial language (overrides user's default language) */
+	void SetLanguage(const SQLardText & wcszLanguage) {
+		setString(m_wcszLanguage, wcszLanguage);
+	};
+	/* Initial database (overrides user's default database) */
+	void SetDatabase(const SQLardText & wcszDatabase) {
+		setString(m_wcszDatabase, wcszDatabase);
+	};
+	void SetAttachDatabaseFile(const SQLardText & wcszAttachDBFile) {
+		setString(m_wcszAttachDBFile, wcszAttachDBFile);
+	};
+	void SetChangePassword(const SQLardText & wcszChangePassword) {
+		setString(m_wcszChangePassword, wcszChangePassword);
+	};
+	const char16_t * GetUserName() const { return m_wcszUserName; }
+	const char16_t * GetDatabase() const { return m_wcszDatabase; }
+
+	/*
+		Encoded LOGIN7 packet data. Built on first use and kept until a
+		setter changes a field, so reconnects do not encode it again.
+	*/
+	const uint8_t * GetPacket(size_t & len)
+	{
+		if (m_pPacket == nullptr) {
+			m_pPacket = SQLARD_NEW_ARRAY(uint8_t, GetPacketSize());
+			m_szPacketLength = FillBuffer(m_pPacket);
+		}
+		len = m_szPacketLength;
+		return m_pPacket;
+	}
+
+	/* Size of the encoded packet data */
+	size_t GetPacketSize() const
+	{
+		/* fixed part, offset table and the string table */
+		return 36 + 58 + 2 * (SQLardUtil::sqlard_wcslen(m_wcszHost) + SQLardUtil::sqlard_wcslen(m_wcszUserName) +
+			SQLardUtil::sqlard_wcslen(m_wcszPassword) + SQLardUtil::sqlard_wcslen(m_wcszAppName) +
+			SQLardUtil::sqlard_wcslen(m_wcszServerName) + SQLardUtil::sqlard_wcslen(m_wcszUnused) +
+			SQLardUtil::sqlard_wcslen(m_wcszCltIntName) + SQLardUtil::sqlard_wcslen(m_wcszLanguage) +
+			SQLardUtil::sqlard_wcslen(m_wcszDatabase) + SQLardUtil::sqlard_wcslen(m_wcszSSPI) +
+			SQLardUtil::sqlard_wcslen(m_wcszAttachDBFile) + SQLardUtil::sqlard_wcslen(m_wcszChangePassword));
+	}
+
+	size_t FillBuffer(uint8_t * buf)
+	{
+		size_t offset = 0;
+		SQLardUtil::sqlard_write_le<uint32_t>(buf, offset, m_uiLength);
+		SQLardUtil::sqlard_write_le<uint32_t>(buf, offset, m_uiTDSVersion);
+		SQLardUtil::sqlard_write_le<uint32_t>(buf, offset, m_uiPacketSize);
+		SQLardUtil::sqlard_write_le<uint32_t>(buf, offset, m_uiClientProgVer);
+		SQLardUtil::sqlard_write_le<uint32_t>(buf, offset, m_uiClientPID);
+		SQLardUtil::sqlard_write_le<uint32_t>(buf, offset, m_uiConnectionID);
+		SQLardUtil::sqlard_write_le<uint8_t>(buf, offset, m_ubOptionFlags1);
+		SQLardUtil::sqlard_write_le<uint8_t>(buf, offset, m_ubOptionFlags2);
+		SQLardUtil::sqlard_write_le<uint8_t>(buf, offset, m_ubTypeFlags);
+		SQLardUtil::sqlard_write_le<uint8_t>(buf, offset, m_ubOptionFlags3);
+		SQLardUtil::sqlard_write_le<uint32_t>(buf, offset, m_uiClientTimeZone);
+		SQLardUtil::sqlard_write_le<uint32_t>(buf, offset, m_uiClientLCID);
+		FillStringTable(buf, offset);
+		/* Now we need to adjust the size. */
+		size_t temp_offset = 0;
+		SQLardUtil::sqlard_write_le<uint32_t>(buf, temp_offset, offset);
+		return offset;
+	}
+	size_t FillStringTable(uint8_t * buf, size_t & offset)
+	{
+		size_t table_size = 0;
+		table_size += SQLardUtil::sqlard_wcslen(m_wcszHost);
+		table_size += SQLardUtil::sqlard_wcslen(m_wcszUserName);
+		table_size += SQLardUtil::sqlard_wcslen(m_wcszPassword);
+		table_size += SQLardUtil::sqlard_wcslen(m_wcszAppName);
+		table_size += SQLardUtil::sqlard_wcslen(m_wcszServerName);
+		table_size += SQLardUtil::sqlard_wcslen(m_wcszUnused);
+		table_size += SQLardUtil::sqlard_wcslen(m_wcszCltIntName);
+		table_size += SQLardUtil::sqlard_wcslen(m_wcszLanguage);
+		table_size += SQLardUtil::sqlard_wcslen(m_wcszDatabase);
+		table_size += SQLardUtil::sqlard_wcslen(m_wcszSSPI);
+		table_size += SQLardUtil::sqlard_wcslen(m_wcszAttachDBFile);
+		table_size += SQLardUtil::sqlard_wcslen(m_wcszChangePassword);
+		/*
+		Allocate required space for the table
+		*/
+		const size_t offset_table_size = 58;
+	
+		SQLardBuffer<uint8_t> table_buffer(table_size * 2);
+		
+		
+		uint8_t offset_buffer[offset_table_size];
+		size_t table_offset = 0;
+		size_t entry_offsets[12];
+		size_t entry_lengths[12];
+		size_t current_index = 0;
+
+		char16_t * current_wstring = nullptr;
+		for (int i = 0; i <12; i++)
+		{
+			switch (i)
+			{
+			case 0: current_wstring = m_wcszHost;           break;
+			case 1: current_wstring = m_wcszUserName;       break;
+			case 2: current_wstring = m_wcszPassword;       break;
+			case 3: current_wstring = m_wcszAppName;        break;
+			case 4: current_wstring = m_wcszServerName;     break;
+			case 5: current_wstring = m_wcszUnused;         break;
+			case 6: current_wstring = m_wcszCltIntName;     break;
+			case 7: current_wstring = m_wcszLanguage;       break;
+			case 8: current_wstring = m_wcszDatabase;       break;
+			case 9: current_wstring = m_wcszSSPI;          break;
+			case 10: current_wstring = m_wcszAttachDBFile;   break;
+			case 11: current_wstring = m_wcszChangePassword; break;
+			}
+			SQLardUtil::sqlard_write_utf16le(&table_buffer[table_offset], current_wstring, SQLardUtil::sqlard_wcslen(current_wstring));
+			if (i == 2)
+			{
+				for (size_t i = table_offset; i < (table_offset + SQLardUtil::sqlard_wcslen(current_wstring) * 2); i++)
+				{
+					table_buffer[i] = (((table_buffer[i] & 0x0F) << 4 | (table_buffer[i] & 0xF0) >> 4) ^ 0xA5);
+				}
+			}
+			entry_offsets[i] = table_offset + offset + offset_table_size;
+			entry_lengths[i] = SQLardUtil::sqlard_wcslen(current_wstring);
+			table_offset += entry_lengths[i] * 2;
+			//wprintf(L"index [%d] >> table offset [%d], string length [%d], string : [%s]\n", i, table_offset, entry_lengths[i], current_wstring);
+		}
+		/*if (table_offset > table_size * 2)
+		{
 		wprintf(L"EXCEEDED STRING TABLE\n");
 		}*/
 		size_t obuf_offset = 0;
@@ -1004,173 +3264,5422 @@ public:
 			SQLardUtil::sqlard_write_le<uint16_t>(offset_buffer, obuf_offset, entry_offsets[i]);
 			SQLardUtil::sqlard_write_le<uint16_t>(offset_buffer, obuf_offset, entry_lengths[i]);
 		}
-		/* Client ID */
-		uint8_t clientID[] = { 0x00,0x50,0x8B,0xE2,0xB7,0x8F };
-		memcpy(&offset_buffer[obuf_offset], clientID, sizeof(clientID));
-		obuf_offset += 6;
-		for (int i = 9; i < 12; i++) {
-			SQLardUtil::sqlard_write_le<uint16_t>(offset_buffer, obuf_offset, entry_offsets[i]);
-			SQLardUtil::sqlard_write_le<uint16_t>(offset_buffer, obuf_offset, entry_lengths[i]);
+		/* Client ID */
+		uint8_t clientID[] = { 0x00,0x50,0x8B,0xE2,0xB7,0x8F };
+		memcpy(&offset_buffer[obuf_offset], clientID, sizeof(clientID));
+		obuf_offset += 6;
+		for (int i = 9; i < 12; i++) {
+			SQLardUtil::sqlard_write_le<uint16_t>(offset_buffer, obuf_offset, entry_offsets[i]);
+			SQLardUtil::sqlard_write_le<uint16_t>(offset_buffer, obuf_offset, entry_lengths[i]);
+		}
+		/* SSPI long */
+		SQLardUtil::sqlard_write_le<uint32_t>(offset_buffer, obuf_offset, 0);
+		/* Place offset table */
+		memcpy(&buf[offset], offset_buffer, offset_table_size);
+		offset += offset_table_size;
+		memcpy(&buf[offset], table_buffer(), table_size * 2);
+		offset += table_size * 2;
+		return table_size;
+	}
+private:
+	void setString(char16_t *& field, const SQLardText & value) {
+		if (field != nullptr)
+			SQLARD_DELETE_ARRAY(field);
+		field = value.Duplicate();
+		invalidatePacket();
+	}
+	void invalidatePacket() {
+		if (m_pPacket != nullptr)
+			SQLARD_DELETE_ARRAY(m_pPacket);
+		m_pPacket = nullptr;
+		m_szPacketLength = 0;
+	}
+
+	uint32_t m_uiLength;
+	uint32_t m_uiTDSVersion;
+	uint32_t m_uiPacketSize;
+	uint32_t m_uiClientProgVer;
+	uint32_t m_uiClientPID;
+	uint32_t m_uiConnectionID;
+	uint32_t m_uiClientTimeZone;
+	uint32_t m_uiClientLCID;
+	uint8_t m_ubOptionFlags1;
+	uint8_t m_ubOptionFlags2;
+	uint8_t m_ubOptionFlags3;
+	uint8_t m_ubTypeFlags;
+
+	char16_t * m_wcszUserName;
+	char16_t * m_wcszPassword;
+	char16_t * m_wcszHost;
+	char16_t * m_wcszAppName;
+	char16_t * m_wcszServerName;
+	char16_t * m_wcszUnused;
+	char16_t * m_wcszExtension;
+	char16_t * m_wcszCltIntName;
+	char16_t * m_wcszLanguage;
+	char16_t * m_wcszDatabase;
+	char16_t * m_wcszAttachDBFile;
+	char16_t * m_wcszChangePassword;
+	char16_t * m_wcszSSPI;
+
+	/* Cached encoding, see GetPacket */
+	uint8_t * m_pPacket;
+	size_t m_szPacketLength;
+};
+
+/*
+	Growable byte buffer
+*/
+struct SQLardByteBuffer {
+public:
+	SQLardByteBuffer() {
+		m_pBuffer = nullptr;
+		m_szLength = 0;
+		m_szCapacity = 0;
+	}
+	~SQLardByteBuffer() {
+		if (m_pBuffer)
+			SQLARD_DELETE_ARRAY(m_pBuffer);
+	}
+	bool reserve(const size_t capacity) {
+		if (capacity <= m_szCapacity)
+			return true;
+		size_t newCapacity = m_szCapacity ? m_szCapacity : 32;
+		while (newCapacity < capacity)
+			newCapacity *= 2;
+		uint8_t * pBuffer = SQLARD_NEW_ARRAY(uint8_t, newCapacity);
+		if (pBuffer == nullptr)
+			return false;
+		if (m_szLength)
+			memcpy(pBuffer, m_pBuffer, m_szLength);
+		if (m_pBuffer)
+			SQLARD_DELETE_ARRAY(m_pBuffer);
+		m_pBuffer = pBuffer;
+		m_szCapacity = newCapacity;
+		return true;
+	}
+	bool append(const uint8_t * data, const size_t len) {
+		if (!reserve(m_szLength + len))
+			return false;
+		memcpy(m_pBuffer + m_szLength, data, len);
+		m_szLength += len;
+		return true;
+	}
+	/* Drop count bytes from the front */
+	void consume(const size_t count) {
+		if (count >= m_szLength) {
+			m_szLength = 0;
+			return;
+		}
+		memmove(m_pBuffer, m_pBuffer + count, m_szLength - count);
+		m_szLength -= count;
+	}
+	void clear() { m_szLength = 0; }
+	uint8_t * operator()() { return m_pBuffer; }
+	const size_t length() const { return m_szLength; }
+private:
+	uint8_t * m_pBuffer;
+	size_t m_szLength;
+	size_t m_szCapacity;
+};
+
+enum SQLardTokenType
+{
+	TOKEN_RETURNSTATUS = 0x79,
+	TOKEN_COLMETADATA = 0x81,
+	TOKEN_ALTMETADATA = 0x88,
+	TOKEN_TABNAME = 0xA4,
+	TOKEN_COLINFO = 0xA5,
+	TOKEN_ORDER = 0xA9,
+	TOKEN_ERROR = 0xAA,
+	TOKEN_INFO = 0xAB,
+	TOKEN_RETURNVALUE = 0xAC,
+	TOKEN_LOGINACK = 0xAD,
+	TOKEN_ROW = 0xD1,
+	TOKEN_NBCROW = 0xD2,
+	TOKEN_ENVCHANGE = 0xE3,
+	TOKEN_DONE = 0xFD,
+	TOKEN_DONEPROC = 0xFE,
+	TOKEN_DONEINPROC = 0xFF
+};
+
+/*
+	Receives the events of a SQLardTokenParser.
+	Payloads are the token bytes following the token type, including any length field,
+	and are only valid during the call.
+	Returning false pauses the parser after the current token (see SQLardTokenParser::resume).
+*/
+class SQLardTokenHandler {
+public:
+	virtual ~SQLardTokenHandler() {}
+	virtual bool onColumnMetadata(uint8_t * /*data*/, const size_t /*len*/) { return true; }
+	/* ROW or NBCROW */
+	virtual bool onRow(const uint8_t /*token*/, uint8_t * /*data*/, const size_t /*len*/) { return true; }
+	/* DONE, DONEPROC or DONEINPROC */
+	virtual bool onDone(const uint8_t /*token*/, const uint16_t /*status*/, const uint16_t /*curCmd*/, const uint64_t /*rowCount*/) { return true; }
+	/* ERROR or INFO */
+	virtual bool onMessage(const uint8_t /*token*/, uint8_t * /*data*/, const size_t /*len*/) { return true; }
+	virtual bool onEnvChange(uint8_t * /*data*/, const size_t /*len*/) { return true; }
+	/* Any other token (LOGINACK, RETURNVALUE, RETURNSTATUS, ...) */
+	virtual bool onToken(const uint8_t /*token*/, uint8_t * /*data*/, const size_t /*len*/) { return true; }
+	/* A token that can not be skipped, parsing stops */
+	virtual void onProtocolError(const uint8_t /*token*/) {}
+};
+
+/*
+	Incremental TDS token stream parser, free of any I/O.
+	Accepts the data part of a response in chunks of any size, emits complete
+	tokens to a SQLardTokenHandler and keeps incomplete ones until the next chunk.
+	Unknown tokens are skipped by their length class, the response ends with
+	the final DONE / DONEPROC token.
+*/
+class SQLardTokenParser {
+public:
+	enum State { RUNNING, PAUSED, DONE, ERROR };
+
+	SQLardTokenParser(SQLardTokenHandler * pHandler = nullptr) {
+		m_pHandler = pHandler;
+		m_arColumnTypes = nullptr;
+		m_usColumnCount = 0;
+		m_state = RUNNING;
+	}
+	~SQLardTokenParser() {
+		if (m_arColumnTypes)
+			SQLARD_DELETE_ARRAY(m_arColumnTypes);
+	}
+
+	void setHandler(SQLardTokenHandler * pHandler) { m_pHandler = pHandler; }
+
+	/* Start over for a new response */
+	void reset() {
+		m_buffer.clear();
+		m_state = RUNNING;
+		clearColumns();
+	}
+
+	/*
+		Parse the next chunk of the token stream.
+		Complete tokens are handled in place, only an incomplete tail is copied.
+		Data given while paused is queued until resume().
+	*/
+	State feed(const uint8_t * data, const size_t len) {
+		if (m_state == DONE || m_state == ERROR)
+			return m_state;
+		if (m_buffer.length() > 0 || m_state == PAUSED) {
+			m_buffer.append(data, len);
+			return m_state == PAUSED ? m_state : resume();
+		}
+		const size_t consumed = parse(const_cast<uint8_t*>(data), len);
+		if (m_state != DONE && m_state != ERROR)
+			m_buffer.append(data + consumed, len - consumed);
+		return m_state;
+	}
+
+	/* Continue after a handler has paused the parser */
+	State resume() {
+		if (m_state == PAUSED)
+			m_state = RUNNING;
+		if (m_state == RUNNING)
+			m_buffer.consume(parse(m_buffer(), m_buffer.length()));
+		if (m_state == DONE || m_state == ERROR)
+			m_buffer.clear();
+		return m_state;
+	}
+
+	/* Layout of rows sent without COLMETADATA, like the rows of a cursor fetch */
+	void setColumns(const SQLardColumnSet * pSet) {
+		clearColumns();
+		m_usColumnCount = pSet->GetColumnCount();
+		m_arColumnTypes = m_usColumnCount ? SQLARD_NEW_ARRAY(SQLardColumnLayout, m_usColumnCount) : nullptr;
+		for (uint16_t i = 0; i < m_usColumnCount; i++) {
+			m_arColumnTypes[i].type = pSet->GetPlan()[i].type;
+			m_arColumnTypes[i].bPLP = pSet->GetPlan()[i].bPLP;
+		}
+	}
+
+	const State getState() const { return m_state; }
+	const bool isRunning() const { return m_state == RUNNING; }
+	const bool isPaused() const { return m_state == PAUSED; }
+	const bool isDone() const { return m_state == DONE; }
+	const bool hasError() const { return m_state == ERROR; }
+
+	/* Layout of the current result set, from the last COLMETADATA token */
+	const uint16_t GetColumnCount() const { return m_usColumnCount; }
+	const uint8_t GetColumnType(const uint16_t columnIndex) const {
+		return columnIndex < m_usColumnCount ? m_arColumnTypes[columnIndex].type : 0;
+	}
+
+protected:
+	struct SQLardColumnLayout {
+		uint8_t type;
+		bool bPLP;
+	};
+
+	/* Returns the amount of bytes consumed (complete tokens only) */
+	size_t parse(uint8_t * data, const size_t len) {
+		size_t pos = 0;
+		while (m_state == RUNNING && pos < len) {
+			const uint8_t token = data[pos];
+			size_t end = pos + 1;
+			const int8_t result = measureToken(token, data, len, end);
+			if (result == 0)
+				break;
+			if (result < 0) {
+				m_state = ERROR;
+				if (m_pHandler)
+					m_pHandler->onProtocolError(token);
+				break;
+			}
+			if (!dispatch(token, data + pos + 1, end - pos - 1) && m_state == RUNNING)
+				m_state = PAUSED;
+			pos = end;
+		}
+		return pos;
+	}
+
+	/* Advance offset past the token body. Returns 1 if complete, 0 if more data is required, -1 if it can not be skipped. */
+	int8_t measureToken(const uint8_t token, const uint8_t * data, const size_t len, size_t & offset) {
+		switch (token) {
+			case SQLardTokenType::TOKEN_COLMETADATA:
+				return measureColumnMetadata(data, len, offset);
+			case SQLardTokenType::TOKEN_ROW:
+			case SQLardTokenType::TOKEN_NBCROW:
+			{
+				const uint8_t * bitmap = data + offset;
+				if (token == SQLardTokenType::TOKEN_NBCROW) {
+					offset += (m_usColumnCount + 7) / 8;
+					if (offset > len)
+						return 0;
+				}
+				for (uint16_t i = 0; i < m_usColumnCount; i++) {
+					if (token == SQLardTokenType::TOKEN_NBCROW && (bitmap[i / 8] & (1 << (i % 8))))
+						continue;
+					if (!SQLardRowFieldData::MeasureField(m_arColumnTypes[i].type, m_arColumnTypes[i].bPLP, data, len, offset))
+						return SQLardUtil::sqlard_length_prefix(m_arColumnTypes[i].type) == 0xFF ? -1 : 0;
+				}
+				return 1;
+			}
+			case SQLardTokenType::TOKEN_RETURNVALUE:
+			{
+				/* ParamOrdinal, ParamName, Status, UserType, Flags, TYPE_INFO, Value */
+				if (offset + 3 > len)
+					return 0;
+				offset += 3 + data[offset + 2] * 2 + 1;
+				#ifdef SQLARD_TDS73
+					offset += 4 + 2;
+				#else
+					offset += 2 + 2;
+				#endif
+				SQLardColumnLayout layout;
+				const int8_t result = measureTypeInfo(data, len, offset, layout);
+				if (result <= 0)
+					return result;
+				if (!SQLardRowFieldData::MeasureField(layout.type, layout.bPLP, data, len, offset))
+					return 0;
+				return 1;
+			}
+			case SQLardTokenType::TOKEN_DONE:
+			case SQLardTokenType::TOKEN_DONEPROC:
+			case SQLardTokenType::TOKEN_DONEINPROC:
+				#ifdef SQLARD_TDS73
+					offset += 12;
+				#else
+					offset += 8;
+				#endif
+				return offset <= len ? 1 : 0;
+			default:
+				break;
+		}
+		/* Length class is encoded in bits 4-5 of the token type */
+		switch (token & 0x30) {
+			case 0x10:
+				/* zero length */
+				return 1;
+			case 0x30:
+				/* fixed length of 1, 2, 4 or 8 bytes */
+				offset += 1 << ((token >> 2) & 0x03);
+				return offset <= len ? 1 : 0;
+			case 0x20:
+				/* variable length, 2 byte length field */
+				if (offset + 2 > len)
+					return 0;
+				offset += 2 + (data[offset] | (data[offset + 1] << 8));
+				return offset <= len ? 1 : 0;
+			default:
+				return -1;
+		}
+	}
+
+	/* TYPE_INFO of a column or parameter, type byte included */
+	int8_t measureTypeInfo(const uint8_t * data, const size_t len, size_t & offset, SQLardColumnLayout & layout) {
+		if (offset + 1 > len)
+			return 0;
+		layout.type = data[offset++];
+		layout.bPLP = false;
+		switch (static_cast<SQLardDataType>(layout.type)) {
+			case SQLardDataType::DECIMALTYPE:
+			case SQLardDataType::NUMERICTYPE:
+			case SQLardDataType::DECIMALNTYPE:
+			case SQLardDataType::NUMERICNTYPE:
+				offset += 3;
+				return offset <= len ? 1 : 0;
+			case SQLardDataType::DATENTYPE:
+				return 1;
+			case SQLardDataType::TIMENTYPE:
+			case SQLardDataType::DATETIME2NTYPE:
+			case SQLardDataType::DATETIMEOFFSETNTYPE:
+				offset += 1;
+				return offset <= len ? 1 : 0;
+			default:
+				break;
+		}
+		const uint8_t prefix = SQLardUtil::sqlard_length_prefix(layout.type);
+		if (prefix == 0xFF)
+			return -1;
+		if (prefix == 2 && offset + 2 <= len)
+			layout.bPLP = (data[offset] & data[offset + 1]) == 0xFF;
+		offset += prefix;
+		#ifdef SQLARD_TDS73
+			if (SQLardUtil::sqlard_has_collation(layout.type))
+				offset += 5;
+		#endif
+		return offset <= len ? 1 : 0;
+	}
+
+	/* COLMETADATA, records the column layout once the token is complete */
+	int8_t measureColumnMetadata(const uint8_t * data, const size_t len, size_t & offset) {
+		if (offset + 2 > len)
+			return 0;
+		uint16_t columnCount = data[offset] | (data[offset + 1] << 8);
+		offset += 2;
+		/* 0xFFFF means no metadata, rows keep the layout given to setColumns */
+		if (columnCount == 0xFFFF)
+			return 1;
+		SQLardColumnLayout * arLayout = columnCount ? SQLARD_NEW_ARRAY(SQLardColumnLayout, columnCount) : nullptr;
+		for (uint16_t i = 0; i < columnCount; i++) {
+			/* UserType and Flags */
+			#ifdef SQLARD_TDS73
+				offset += 4 + 2;
+			#else
+				offset += 2 + 2;
+			#endif
+			int8_t result = measureTypeInfo(data, len, offset, arLayout[i]);
+			if (result > 0 && SQLardUtil::sqlard_length_prefix(arLayout[i].type) == 4) {
+				/* table name of TEXT / NTEXT / IMAGE columns */
+				#ifdef SQLARD_TDS73
+					uint8_t parts = offset < len ? data[offset++] : 0;
+					if (offset > len)
+						result = 0;
+				#else
+					uint8_t parts = 1;
+				#endif
+				for (uint8_t p = 0; p < parts && result > 0; p++) {
+					if (offset + 2 > len)
+						result = 0;
+					else
+						offset += 2 + (data[offset] | (data[offset + 1] << 8)) * 2;
+				}
+			}
+			if (result > 0) {
+				/* column name */
+				if (offset + 1 > len)
+					result = 0;
+				else
+					offset += 1 + data[offset] * 2;
+			}
+			if (result <= 0 || offset > len) {
+				SQLARD_DELETE_ARRAY(arLayout);
+				return result < 0 ? -1 : 0;
+			}
+		}
+		clearColumns();
+		m_arColumnTypes = arLayout;
+		m_usColumnCount = columnCount;
+		return 1;
+	}
+
+	void clearColumns() {
+		if (m_arColumnTypes)
+			SQLARD_DELETE_ARRAY(m_arColumnTypes);
+		m_arColumnTypes = nullptr;
+		m_usColumnCount = 0;
+	}
+
+	bool dispatch(const uint8_t token, uint8_t * data, const size_t len) {
+		switch (token) {
+			case SQLardTokenType::TOKEN_COLMETADATA:
+				return m_pHandler ? m_pHandler->onColumnMetadata(data, len) : true;
+			case SQLardTokenType::TOKEN_ROW:
+			case SQLardTokenType::TOKEN_NBCROW:
+				return m_pHandler ? m_pHandler->onRow(token, data, len) : true;
+			case SQLardTokenType::TOKEN_DONE:
+			case SQLardTokenType::TOKEN_DONEPROC:
+			case SQLardTokenType::TOKEN_DONEINPROC:
+			{
+				size_t pos = 0;
+				const uint16_t status = SQLardUtil::sqlard_read_le<uint16_t>(data, pos);
+				const uint16_t curCmd = SQLardUtil::sqlard_read_le<uint16_t>(data, pos);
+				#ifdef SQLARD_TDS73
+					const uint64_t rowCount = SQLardUtil::sqlard_read_le<uint64_t>(data, pos);
+				#else
+					const uint64_t rowCount = SQLardUtil::sqlard_read_le<uint32_t>(data, pos);
+				#endif
+				/* DONE_MORE clear on DONE / DONEPROC ends the response */
+				if (token != SQLardTokenType::TOKEN_DONEINPROC && (status & 0x01) == 0)
+					m_state = DONE;
+				return m_pHandler ? m_pHandler->onDone(token, status, curCmd, rowCount) : true;
+			}
+			case SQLardTokenType::TOKEN_ERROR:
+			case SQLardTokenType::TOKEN_INFO:
+				return m_pHandler ? m_pHandler->onMessage(token, data, len) : true;
+			case SQLardTokenType::TOKEN_ENVCHANGE:
+				return m_pHandler ? m_pHandler->onEnvChange(data, len) : true;
+			default:
+				return m_pHandler ? m_pHandler->onToken(token, data, len) : true;
+		}
+	}
+
+	SQLardTokenHandler * m_pHandler;
+	SQLardByteBuffer m_buffer;
+	SQLardColumnLayout * m_arColumnTypes;
+	uint16_t m_usColumnCount;
+	State m_state;
+};
+
+
+#ifdef SQLARD_RESULT_CACHE
+/*
+	Memory bounded LRU cache of raw query responses.
+	Entries are keyed by a hash of the query text and session, expire after
+	their TTL, and are tagged with the tables the query reads so that writes
+	to those tables can invalidate them.
+*/
+class SQLardResultCache : public SQLardHeapObject {
+public:
+	/* Maximum amount of table tags recorded per entry */
+	#define SQLARD_CACHE_MAX_TAGS 4
+	#define SQLARD_CACHE_BUCKETS 16
+
+	SQLardResultCache(const size_t byteBudget, const uint32_t defaultTTL) {
+		m_szByteBudget = byteBudget;
+		m_uiDefaultTTL = defaultTTL;
+		m_szUsedBytes = 0;
+		m_uiHits = 0;
+		m_uiMisses = 0;
+		m_pMRU = nullptr;
+		m_pLRU = nullptr;
+		memset(m_arBuckets, 0, sizeof(m_arBuckets));
+	}
+	~SQLardResultCache() {
+		Clear();
+	}
+
+	/*
+		Look up the cached response of query (queryLen UTF-16 code units) run in
+		context, a hash of the login and current database. Expired entries are
+		dropped on access. Returns the raw token stream and its length, or
+		nullptr on a miss.
+	*/
+	const uint8_t * Lookup(const uint32_t context, const char16_t * query, const size_t queryLen, uint32_t & dataLen) {
+		SQLardCacheEntry * entry = Find(context, query, queryLen);
+		if (entry != nullptr && static_cast<int32_t>(SQLardUtil::sqlard_millis() - entry->expiresAt) >= 0) {
+			Remove(entry);
+			entry = nullptr;
+		}
+		if (entry == nullptr) {
+			m_uiMisses++;
+			return nullptr;
+		}
+		m_uiHits++;
+		Unlink(entry);
+		LinkFront(entry);
+		dataLen = entry->dataLen;
+		return entry->data;
+	}
+
+	/*
+		Store a copy of a response, evicting least recently used entries
+		until it fits into the byte budget. ttl = 0 uses the default TTL.
+	*/
+	void Store(const uint32_t context, const char16_t * query, const size_t queryLen, const uint8_t * data, const uint32_t dataLen,
+		const uint32_t * tags, const uint8_t tagCount, const uint32_t ttl = 0) {
+		const size_t cost = EntryCost(queryLen, dataLen);
+		if (cost > m_szByteBudget)
+			return;
+		SQLardCacheEntry * existing = Find(context, query, queryLen);
+		if (existing != nullptr)
+			Remove(existing);
+		while (m_szUsedBytes + cost > m_szByteBudget && m_pLRU != nullptr)
+			Remove(m_pLRU);
+
+		SQLardCacheEntry * entry = new SQLardCacheEntry();
+		entry->key = Key(context, query, queryLen);
+		entry->context = context;
+		/* hits compare the whole text, the key alone may collide */
+		entry->query = SQLARD_NEW_ARRAY(char16_t, queryLen ? queryLen : 1);
+		memcpy(entry->query, query, queryLen * sizeof(char16_t));
+		entry->queryLen = queryLen;
+		entry->expiresAt = SQLardUtil::sqlard_millis() + (ttl == 0 ? m_uiDefaultTTL : ttl);
+		entry->tagCount = tagCount > SQLARD_CACHE_MAX_TAGS ? SQLARD_CACHE_MAX_TAGS : tagCount;
+		memcpy(entry->tags, tags, entry->tagCount * sizeof(uint32_t));
+		entry->data = SQLARD_NEW_ARRAY(uint8_t, dataLen);
+		entry->dataLen = dataLen;
+		memcpy(entry->data, data, dataLen);
+
+		SQLardCacheEntry *& bucket = m_arBuckets[entry->key % SQLARD_CACHE_BUCKETS];
+		entry->hashNext = bucket;
+		bucket = entry;
+		LinkFront(entry);
+		m_szUsedBytes += cost;
+	}
+
+	void Invalidate(const uint32_t context, const char16_t * query, const size_t queryLen) {
+		SQLardCacheEntry * entry = Find(context, query, queryLen);
+		if (entry != nullptr)
+			Remove(entry);
+	}
+
+	/* Drop every entry which reads the given table tag */
+	void InvalidateTag(const uint32_t tag) {
+		SQLardCacheEntry * entry = m_pMRU;
+		while (entry != nullptr) {
+			SQLardCacheEntry * next = entry->next;
+			for (uint8_t i = 0; i < entry->tagCount; i++) {
+				if (entry->tags[i] == tag) {
+					Remove(entry);
+					break;
+				}
+			}
+			entry = next;
+		}
+	}
+
+	void Clear() {
+		while (m_pMRU != nullptr)
+			Remove(m_pMRU);
+	}
+
+	size_t GetUsedBytes() const { return m_szUsedBytes; }
+	uint32_t GetHitCount() const { return m_uiHits; }
+	uint32_t GetMissCount() const { return m_uiMisses; }
+
+	/*
+		Hash a table name the same way ExtractTableTags does:
+		brackets and schema prefix are dropped, and letters are lower cased.
+	*/
+	static uint32_t HashTableName(const char16_t * name, const size_t len) {
+		uint32_t hash = 2166136261UL;
+		for (size_t i = 0; i < len; i++) {
+			char16_t c = name[i];
+			if (c == u'[' || c == u']' || c == u'"')
+				continue;
+			if (c == u'.') {
+				/* only the last part of schema.table counts */
+				hash = 2166136261UL;
+				continue;
+			}
+			if (c >= u'A' && c <= u'Z')
+				c += (u'a' - u'A');
+			hash = (hash ^ static_cast<uint8_t>(c)) * 16777619UL;
+		}
+		return hash;
+	}
+
+	/*
+		Collect tags for the tables referenced after FROM, JOIN, INTO, UPDATE and TABLE.
+		Returns the amount of tags written.
+	*/
+	static uint8_t ExtractTableTags(const char16_t * query, uint32_t * tags, const uint8_t maxTags) {
+		uint8_t count = 0;
+		bool expectTable = false;
+		const char16_t * p = query;
+		while (p != nullptr && *p && count < maxTags) {
+			if (!IsIdentifierChar(*p)) {
+				p++;
+				continue;
+			}
+			/* read one (possibly dotted / bracketed) word */
+			const char16_t * start = p;
+			while (*p && (IsIdentifierChar(*p) || *p == u'.'))
+				p++;
+			const size_t len = p - start;
+			if (expectTable) {
+				tags[count++] = HashTableName(start, len);
+				expectTable = false;
+			}
+			else {
+				expectTable = IsKeyword(start, len, u"from") || IsKeyword(start, len, u"join") ||
+					IsKeyword(start, len, u"into") || IsKeyword(start, len, u"update") || IsKeyword(start, len, u"table");
+			}
+		}
+		return count;
+	}
+private:
+	struct SQLardCacheEntry : public SQLardHeapObject {
+		uint32_t key;
+		uint32_t context;
+		char16_t * query;
+		size_t queryLen;
+		uint32_t dataLen;
+		uint32_t expiresAt;
+		uint32_t tags[SQLARD_CACHE_MAX_TAGS];
+		uint8_t tagCount;
+		uint8_t * data;
+		SQLardCacheEntry * hashNext;
+		SQLardCacheEntry * prev;
+		SQLardCacheEntry * next;
+		~SQLardCacheEntry() {
+			SQLARD_DELETE_ARRAY(query);
+			SQLARD_DELETE_ARRAY(data);
+		}
+	};
+
+	static uint32_t Key(const uint32_t context, const char16_t * query, const size_t queryLen) {
+		return SQLardUtil::sqlard_hash_bytes(reinterpret_cast<const uint8_t*>(query), queryLen * sizeof(char16_t), context);
+	}
+	static size_t EntryCost(const size_t queryLen, const uint32_t dataLen) {
+		return sizeof(SQLardCacheEntry) + queryLen * sizeof(char16_t) + dataLen;
+	}
+
+	static bool IsIdentifierChar(const char16_t c) {
+		return (c >= u'a' && c <= u'z') || (c >= u'A' && c <= u'Z') || (c >= u'0' && c <= u'9') ||
+			c == u'_' || c == u'[' || c == u']' || c == u'#' || c == u'@';
+	}
+
+	static bool IsKeyword(const char16_t * word, const size_t len, const char16_t * keyword) {
+		size_t i = 0;
+		for (; i < len && keyword[i]; i++) {
+			char16_t c = word[i];
+			if (c >= u'A' && c <= u'Z')
+				c += (u'a' - u'A');
+			if (c != keyword[i])
+				return false;
+		}
+		return i == len && keyword[i] == 0;
+	}
+
+	SQLardCacheEntry * Find(const uint32_t context, const char16_t * query, const size_t queryLen) {
+		const uint32_t key = Key(context, query, queryLen);
+		for (SQLardCacheEntry * entry = m_arBuckets[key % SQLARD_CACHE_BUCKETS]; entry != nullptr; entry = entry->hashNext) {
+			if (entry->key == key && entry->context == context && entry->queryLen == queryLen &&
+				memcmp(entry->query, query, queryLen * sizeof(char16_t)) == 0)
+				return entry;
+		}
+		return nullptr;
+	}
+
+	void LinkFront(SQLardCacheEntry * entry) {
+		entry->prev = nullptr;
+		entry->next = m_pMRU;
+		if (m_pMRU != nullptr)
+			m_pMRU->prev = entry;
+		m_pMRU = entry;
+		if (m_pLRU == nullptr)
+			m_pLRU = entry;
+	}
+
+	void Unlink(SQLardCacheEntry * entry) {
+		if (entry->prev != nullptr)
+			entry->prev->next = entry->next;
+		else
+			m_pMRU = entry->next;
+		if (entry->next != nullptr)
+			entry->next->prev = entry->prev;
+		else
+			m_pLRU = entry->prev;
+	}
+
+	void Remove(SQLardCacheEntry * entry) {
+		Unlink(entry);
+		SQLardCacheEntry ** link = &m_arBuckets[entry->key % SQLARD_CACHE_BUCKETS];
+		while (*link != entry)
+			link = &(*link)->hashNext;
+		*link = entry->hashNext;
+		m_szUsedBytes -= EntryCost(entry->queryLen, entry->dataLen);
+		delete entry;
+	}
+
+	SQLardCacheEntry * m_arBuckets[SQLARD_CACHE_BUCKETS];
+	SQLardCacheEntry * m_pMRU;
+	SQLardCacheEntry * m_pLRU;
+	size_t m_szByteBudget;
+	size_t m_szUsedBytes;
+	uint32_t m_uiDefaultTTL;
+	uint32_t m_uiHits;
+	uint32_t m_uiMisses;
+};
+#endif
+
+#ifdef SQLARD_METRICS
+/* Distinct normalized queries tracked per connection, and the stored prefix length of each */
+#ifndef SQLARD_METRICS_FINGERPRINTS
+	#define SQLARD_METRICS_FINGERPRINTS 8
+#endif
+#ifndef SQLARD_METRICS_FINGERPRINT_LEN
+	#define SQLARD_METRICS_FINGERPRINT_LEN 48
+#endif
+/* Histogram buckets are powers of two microseconds, from 16us to ~8.4s */
+#define SQLARD_HISTOGRAM_BUCKETS 20
+#define SQLARD_HISTOGRAM_FIRST_SHIFT 4
+
+/*
+	Bounded text writer used by the metric exporters.
+	Output is always null terminated, and truncated if the buffer is too small.
+*/
+class SQLardTextWriter {
+public:
+	SQLardTextWriter(char * buf, const size_t len) {
+		m_pBuf = buf;
+		m_szLen = len;
+		m_szPos = 0;
+		if (len > 0)
+			buf[0] = '\0';
+	}
+	void put(const char c) {
+		if (m_szPos + 1 < m_szLen) {
+			m_pBuf[m_szPos] = c;
+			m_pBuf[m_szPos + 1] = '\0';
+		}
+		m_szPos++;
+	}
+	void put(const char * s) {
+		while (*s)
+			put(*s++);
+	}
+	void put(uint64_t v) {
+		char digits[20];
+		uint8_t n = 0;
+		do {
+			digits[n++] = '0' + (v % 10);
+			v /= 10;
+		} while (v != 0);
+		while (n > 0)
+			put(digits[--n]);
+	}
+	/* Put a string escaping quotes, backslashes and newlines (valid for both JSON and Prometheus labels) */
+	void putEscaped(const char * s) {
+		for (; *s; s++) {
+			if (*s == '"' || *s == '\\')
+				put('\\');
+			if (*s == '\n') {
+				put("\\n");
+				continue;
+			}
+			put(*s);
+		}
+	}
+	/* Bytes the full output needs, which may exceed the buffer length */
+	size_t length() const { return m_szPos; }
+private:
+	char * m_pBuf;
+	size_t m_szLen;
+	size_t m_szPos;
+};
+
+/*
+	Latency histogram with power of two microsecond buckets.
+*/
+struct SQLardHistogram {
+	uint32_t buckets[SQLARD_HISTOGRAM_BUCKETS + 1];
+	uint32_t count;
+	uint64_t sum;
+
+	SQLardHistogram() {
+		reset();
+	}
+	void reset() {
+		memset(buckets, 0, sizeof(buckets));
+		count = 0;
+		sum = 0;
+	}
+	void record(const uint32_t us) {
+		uint8_t i = 0;
+		while (i < SQLARD_HISTOGRAM_BUCKETS && us > (1UL << (i + SQLARD_HISTOGRAM_FIRST_SHIFT)))
+			i++;
+		buckets[i]++;
+		count++;
+		sum += us;
+	}
+	static uint32_t upperBound(const uint8_t bucket) {
+		return 1UL << (bucket + SQLARD_HISTOGRAM_FIRST_SHIFT);
+	}
+};
+
+/*
+	Aggregated statistics of one normalized query text.
+*/
+struct SQLardQueryFingerprint {
+	uint32_t hash;
+	char text[SQLARD_METRICS_FINGERPRINT_LEN + 1];
+	uint32_t count;
+	uint32_t errors;
+	uint64_t totalMicros;
+	uint32_t maxMicros;
+	uint64_t rows;
+	uint64_t bytesIn;
+};
+
+/*
+	Per connection statistics: phase latencies, traffic counters and
+	per query fingerprint aggregates. Exportable as Prometheus text or JSON.
+*/
+class SQLardStats {
+public:
+	SQLardHistogram m_hConnect;
+	SQLardHistogram m_hLogin;
+	/* Execute phases : writing the request, waiting for the first response byte, reading and parsing the response */
+	SQLardHistogram m_hSend;
+	SQLardHistogram m_hWait;
+	SQLardHistogram m_hParse;
+	SQLardHistogram m_hExecute;
+
+	uint64_t m_ullBytesOut;
+	uint64_t m_ullBytesIn;
+	uint32_t m_uiPacketsOut;
+	uint32_t m_uiPacketsIn;
+	uint64_t m_ullRowsDecoded;
+	uint32_t m_uiQueries;
+	uint32_t m_uiErrors;
+	uint32_t m_uiCacheHits;
+
+	SQLardStats() {
+		reset();
+	}
+
+	void reset() {
+		m_hConnect.reset();
+		m_hLogin.reset();
+		m_hSend.reset();
+		m_hWait.reset();
+		m_hParse.reset();
+		m_hExecute.reset();
+		m_ullBytesOut = m_ullBytesIn = 0;
+		m_uiPacketsOut = m_uiPacketsIn = 0;
+		m_ullRowsDecoded = 0;
+		m_uiQueries = m_uiErrors = m_uiCacheHits = 0;
+		m_usFingerprintCount = 0;
+		memset(&m_fpOther, 0, sizeof(m_fpOther));
+		m_ulQueryStart = m_ulQuerySent = m_ulQueryResponse = 0;
+		m_ullQueryBytesIn = 0;
+	}
+
+	/* Query timeline, called by SQLard */
+	void beginQuery() {
+		m_ulQueryStart = m_ulQuerySent = m_ulQueryResponse = SQLardUtil::sqlard_micros();
+		m_ullQueryBytesIn = m_ullBytesIn;
+	}
+	void markSent() {
+		m_ulQuerySent = m_ulQueryResponse = SQLardUtil::sqlard_micros();
+	}
+	void markResponse() {
+		m_ulQueryResponse = SQLardUtil::sqlard_micros();
+	}
+	void endQuery(const char16_t * query, const uint32_t rows, const bool bError) {
+		const uint32_t now = SQLardUtil::sqlard_micros();
+		m_hSend.record(m_ulQuerySent - m_ulQueryStart);
+		m_hWait.record(m_ulQueryResponse - m_ulQuerySent);
+		m_hParse.record(now - m_ulQueryResponse);
+		m_hExecute.record(now - m_ulQueryStart);
+		m_uiQueries++;
+		if (bError)
+			m_uiErrors++;
+
+		char text[SQLARD_METRICS_FINGERPRINT_LEN + 1];
+		const uint32_t hash = Normalize(query, text, sizeof(text));
+		SQLardQueryFingerprint * fp = FindFingerprint(hash, text);
+		fp->count++;
+		fp->errors += bError ? 1 : 0;
+		fp->totalMicros += (now - m_ulQueryStart);
+		if ((now - m_ulQueryStart) > fp->maxMicros)
+			fp->maxMicros = now - m_ulQueryStart;
+		fp->rows += rows;
+		fp->bytesIn += m_ullBytesIn - m_ullQueryBytesIn;
+	}
+
+	uint16_t GetFingerprintCount() const { return m_usFingerprintCount; }
+	const SQLardQueryFingerprint & GetFingerprint(const uint16_t index) const { return m_arFingerprints[index]; }
+
+	/*
+		Normalize a query for aggregation : string and numeric literals become '?',
+		whitespace is kept only as a single space between two words, and letters are lower cased.
+		The hash covers the whole normalized text, out keeps its first outLen - 1 characters.
+	*/
+	static uint32_t Normalize(const char16_t * query, char * out, const size_t outLen) {
+		uint32_t hash = 2166136261UL;
+		size_t n = 0;
+		char prev = '(';
+		for (const char16_t * p = query; p != nullptr && *p; ) {
+			char c;
+			const bool prevIdent = (prev >= 'a' && prev <= 'z') || (prev >= '0' && prev <= '9') || prev == '_' || prev == ']';
+			if (*p == u'\'' || ((*p == u'N' || *p == u'n') && p[1] == u'\'' && !prevIdent)) {
+				/* string literal, '' is an escaped quote */
+				if (*p != u'\'')
+					p++;
+				for (p++; *p; p++) {
+					if (*p == u'\'') {
+						if (p[1] != u'\'')
+							break;
+						p++;
+					}
+				}
+				if (*p)
+					p++;
+				c = '?';
+			}
+			else if (*p >= u'0' && *p <= u'9' && !prevIdent) {
+				/* numeric literal, including decimals, exponents and 0x binary */
+				while ((*p >= u'0' && *p <= u'9') || *p == u'.' || *p == u'x' || *p == u'X' ||
+					(*p >= u'a' && *p <= u'f') || (*p >= u'A' && *p <= u'F'))
+					p++;
+				c = '?';
+			}
+			else if (*p == u' ' || *p == u'\t' || *p == u'\r' || *p == u'\n') {
+				while (*p == u' ' || *p == u'\t' || *p == u'\r' || *p == u'\n')
+					p++;
+				const bool nextWord = (*p >= u'a' && *p <= u'z') || (*p >= u'A' && *p <= u'Z') || (*p >= u'0' && *p <= u'9') ||
+					*p == u'_' || *p == u'[' || *p == u'@' || *p == u'#' || *p == u'\'';
+				if (!(prevIdent || prev == '?') || !nextWord)
+					continue;
+				c = ' ';
+			}
+			else {
+				c = (*p >= u'A' && *p <= u'Z') ? static_cast<char>(*p - u'A' + 'a') : (*p < 0x80 ? static_cast<char>(*p) : '?');
+				p++;
+			}
+			hash = (hash ^ static_cast<uint8_t>(c)) * 16777619UL;
+			if (n + 1 < outLen)
+				out[n++] = c;
+			prev = c;
+		}
+		if (outLen > 0)
+			out[n] = '\0';
+		return hash;
+	}
+
+	/*
+		Export all statistics in Prometheus text exposition format.
+		Returns the length of the full output, which is truncated if it exceeds len.
+	*/
+	size_t exportPrometheus(char * buf, const size_t len) const {
+		SQLardTextWriter w(buf, len);
+		PutHistogram(w, "sqlard_connect_microseconds", m_hConnect);
+		PutHistogram(w, "sqlard_login_microseconds", m_hLogin);
+		PutHistogram(w, "sqlard_execute_send_microseconds", m_hSend);
+		PutHistogram(w, "sqlard_execute_wait_microseconds", m_hWait);
+		PutHistogram(w, "sqlard_execute_parse_microseconds", m_hParse);
+		PutHistogram(w, "sqlard_execute_microseconds", m_hExecute);
+		PutCounter(w, "sqlard_bytes_sent_total", m_ullBytesOut);
+		PutCounter(w, "sqlard_bytes_received_total", m_ullBytesIn);
+		PutCounter(w, "sqlard_packets_sent_total", m_uiPacketsOut);
+		PutCounter(w, "sqlard_packets_received_total", m_uiPacketsIn);
+		PutCounter(w, "sqlard_rows_decoded_total", m_ullRowsDecoded);
+		PutCounter(w, "sqlard_queries_total", m_uiQueries);
+		PutCounter(w, "sqlard_query_errors_total", m_uiErrors);
+		PutCounter(w, "sqlard_cache_hits_total", m_uiCacheHits);
+
+		const char * names[] = { "sqlard_query_count", "sqlard_query_errors", "sqlard_query_microseconds_sum",
+			"sqlard_query_microseconds_max", "sqlard_query_rows", "sqlard_query_bytes_received" };
+		for (uint8_t m = 0; m < 6; m++) {
+			w.put("# TYPE ");
+			w.put(names[m]);
+			w.put(m == 3 ? " gauge\n" : " counter\n");
+			for (uint16_t i = 0; i <= m_usFingerprintCount; i++) {
+				const SQLardQueryFingerprint & fp = (i == m_usFingerprintCount) ? m_fpOther : m_arFingerprints[i];
+				if (fp.count == 0)
+					continue;
+				const uint64_t values[] = { fp.count, fp.errors, fp.totalMicros, fp.maxMicros, fp.rows, fp.bytesIn };
+				w.put(names[m]);
+				w.put("{fingerprint=\"");
+				w.putEscaped(fp.text);
+				w.put("\"} ");
+				w.put(values[m]);
+				w.put('\n');
+			}
+		}
+		return w.length();
+	}
+
+	/*
+		Export all statistics as a single JSON object.
+		Returns the length of the full output, which is truncated if it exceeds len.
+	*/
+	size_t exportJSON(char * buf, const size_t len) const {
+		SQLardTextWriter w(buf, len);
+		w.put('{');
+		PutJSONHistogram(w, "connect", m_hConnect);
+		PutJSONHistogram(w, "login", m_hLogin);
+		PutJSONHistogram(w, "execute_send", m_hSend);
+		PutJSONHistogram(w, "execute_wait", m_hWait);
+		PutJSONHistogram(w, "execute_parse", m_hParse);
+		PutJSONHistogram(w, "execute", m_hExecute);
+		w.put("\"bytes_sent\":"); w.put(m_ullBytesOut);
+		w.put(",\"bytes_received\":"); w.put(m_ullBytesIn);
+		w.put(",\"packets_sent\":"); w.put(static_cast<uint64_t>(m_uiPacketsOut));
+		w.put(",\"packets_received\":"); w.put(static_cast<uint64_t>(m_uiPacketsIn));
+		w.put(",\"rows_decoded\":"); w.put(m_ullRowsDecoded);
+		w.put(",\"queries\":"); w.put(static_cast<uint64_t>(m_uiQueries));
+		w.put(",\"errors\":"); w.put(static_cast<uint64_t>(m_uiErrors));
+		w.put(",\"cache_hits\":"); w.put(static_cast<uint64_t>(m_uiCacheHits));
+		w.put(",\"fingerprints\":[");
+		bool first = true;
+		for (uint16_t i = 0; i <= m_usFingerprintCount; i++) {
+			const SQLardQueryFingerprint & fp = (i == m_usFingerprintCount) ? m_fpOther : m_arFingerprints[i];
+			if (fp.count == 0)
+				continue;
+			if (!first)
+				w.put(',');
+			first = false;
+			w.put("{\"query\":\""); w.putEscaped(fp.text);
+			w.put("\",\"count\":"); w.put(static_cast<uint64_t>(fp.count));
+			w.put(",\"errors\":"); w.put(static_cast<uint64_t>(fp.errors));
+			w.put(",\"total_us\":"); w.put(fp.totalMicros);
+			w.put(",\"max_us\":"); w.put(static_cast<uint64_t>(fp.maxMicros));
+			w.put(",\"rows\":"); w.put(fp.rows);
+			w.put(",\"bytes_received\":"); w.put(fp.bytesIn);
+			w.put('}');
+		}
+		w.put("]}");
+		return w.length();
+	}
+private:
+	SQLardQueryFingerprint * FindFingerprint(const uint32_t hash, const char * text) {
+		for (uint16_t i = 0; i < m_usFingerprintCount; i++) {
+			if (m_arFingerprints[i].hash == hash)
+				return &m_arFingerprints[i];
+		}
+		if (m_usFingerprintCount == SQLARD_METRICS_FINGERPRINTS) {
+			/* table is full, aggregate the rest together */
+			strcpy(m_fpOther.text, "other");
+			return &m_fpOther;
+		}
+		SQLardQueryFingerprint * fp = &m_arFingerprints[m_usFingerprintCount++];
+		memset(fp, 0, sizeof(SQLardQueryFingerprint));
+		fp->hash = hash;
+		strcpy(fp->text, text);
+		return fp;
+	}
+
+	static void PutCounter(SQLardTextWriter & w, const char * name, const uint64_t value) {
+		w.put("# TYPE ");
+		w.put(name);
+		w.put(" counter\n");
+		w.put(name);
+		w.put(' ');
+		w.put(value);
+		w.put('\n');
+	}
+
+	static void PutHistogram(SQLardTextWriter & w, const char * name, const SQLardHistogram & h) {
+		w.put("# TYPE ");
+		w.put(name);
+		w.put(" histogram\n");
+		uint64_t cumulative = 0;
+		for (uint8_t i = 0; i <= SQLARD_HISTOGRAM_BUCKETS; i++) {
+			cumulative += h.buckets[i];
+			w.put(name);
+			w.put("_bucket{le=\"");
+			if (i == SQLARD_HISTOGRAM_BUCKETS)
+				w.put("+Inf");
+			else
+				w.put(static_cast<uint64_t>(SQLardHistogram::upperBound(i)));
+			w.put("\"} ");
+			w.put(cumulative);
+			w.put('\n');
+		}
+		w.put(name); w.put("_sum "); w.put(h.sum); w.put('\n');
+		w.put(name); w.put("_count "); w.put(static_cast<uint64_t>(h.count)); w.put('\n');
+	}
+
+	static void PutJSONHistogram(SQLardTextWriter & w, const char * name, const SQLardHistogram & h) {
+		w.put('"');
+		w.put(name);
+		w.put("\":{\"count\":");
+		w.put(static_cast<uint64_t>(h.count));
+		w.put(",\"sum_us\":");
+		w.put(h.sum);
+		w.put(",\"buckets\":[");
+		for (uint8_t i = 0; i <= SQLARD_HISTOGRAM_BUCKETS; i++) {
+			if (i > 0)
+				w.put(',');
+			w.put(static_cast<uint64_t>(h.buckets[i]));
+		}
+		w.put("]},");
+	}
+
+	SQLardQueryFingerprint m_arFingerprints[SQLARD_METRICS_FINGERPRINTS];
+	SQLardQueryFingerprint m_fpOther;
+	uint16_t m_usFingerprintCount;
+	uint32_t m_ulQueryStart;
+	uint32_t m_ulQuerySent;
+	uint32_t m_ulQueryResponse;
+	uint64_t m_ullQueryBytesIn;
+};
+#endif
+
+#ifdef SQLARD_WIRE_CAPTURE
+/*
+	Capture file layout (all integers little endian)
+		file header	: "SQLC" magic, uint16_t version, uint16_t reserved
+		record		: uint8_t direction, uint32_t microseconds since previous record,
+					  uint16_t length, followed by one complete TDS packet
+*/
+#define SQLARD_CAPTURE_MAGIC "SQLC"
+#define SQLARD_CAPTURE_VERSION 1
+#define SQLARD_CAPTURE_HEADER_SIZE 8
+#define SQLARD_CAPTURE_RECORD_HEADER_SIZE 7
+/* Record directions */
+#define SQLARD_CAPTURE_OUTBOUND 0
+#define SQLARD_CAPTURE_INBOUND 1
+
+/*
+	Records the TDS packets sent and received by a SQLard instance.
+	Bytes are split into packets using the TDS header length, so only the
+	8 byte header is buffered; packet bodies are streamed to the sink.
+*/
+class SQLardWireCapture {
+public:
+	/* Sink for capture bytes, returns the amount written */
+	typedef size_t (*WriteCallback)(void * context, const uint8_t * data, const size_t len);
+
+	SQLardWireCapture(WriteCallback pfnWrite, void * context) {
+		init(pfnWrite, context);
+	}
+	#ifdef WINDOWS
+		SQLardWireCapture() {
+			init(nullptr, nullptr);
+		}
+		/* Capture into a file, replacing it. */
+		bool openFile(const char * path) {
+			close();
+			FILE * file = fopen(path, "wb");
+			if (file == nullptr)
+				return false;
+			init(&WriteFile, file);
+			m_bOwnsFile = true;
+			return true;
+		}
+		void close() {
+			if (m_bOwnsFile)
+				fclose(static_cast<FILE*>(m_pContext));
+			init(nullptr, nullptr);
+		}
+		~SQLardWireCapture() {
+			close();
+		}
+	#endif
+
+	/* Feed bytes as they are written to (SQLARD_CAPTURE_OUTBOUND) or read from (SQLARD_CAPTURE_INBOUND) the socket. */
+	void record(const uint8_t direction, const uint8_t * data, size_t len) {
+		if (m_pfnWrite == nullptr)
+			return;
+		SQLardCaptureStream & stream = m_arStreams[direction];
+		while (len > 0) {
+			if (stream.headerFill < 8) {
+				/* collect the TDS header to learn the packet length */
+				stream.header[stream.headerFill++] = *data++;
+				len--;
+				if (stream.headerFill == 1)
+					stream.timestamp = SQLardUtil::sqlard_micros();
+				if (stream.headerFill < 8)
+					continue;
+				uint16_t packetLen = (static_cast<uint16_t>(stream.header[2]) << 8) | stream.header[3];
+				if (packetLen < 8)
+					packetLen = 8;
+				writeRecordHeader(direction, stream.timestamp, packetLen);
+				m_pfnWrite(m_pContext, stream.header, 8);
+				stream.remaining = packetLen - 8;
+			}
+			else {
+				const size_t chunk = len < stream.remaining ? len : stream.remaining;
+				m_pfnWrite(m_pContext, data, chunk);
+				data += chunk;
+				len -= chunk;
+				stream.remaining -= chunk;
+			}
+			if (stream.headerFill == 8 && stream.remaining == 0)
+				stream.headerFill = 0;
+		}
+	}
+
+	uint32_t GetRecordCount() const { return m_uiRecordCount; }
+private:
+	struct SQLardCaptureStream {
+		uint8_t header[8];
+		uint8_t headerFill;
+		uint16_t remaining;
+		uint32_t timestamp;
+	};
+
+	void init(WriteCallback pfnWrite, void * context) {
+		m_pfnWrite = pfnWrite;
+		m_pContext = context;
+		m_bOwnsFile = false;
+		m_bStarted = false;
+		m_uiRecordCount = 0;
+		memset(m_arStreams, 0, sizeof(m_arStreams));
+	}
+
+	void writeRecordHeader(const uint8_t direction, const uint32_t timestamp, const uint16_t packetLen) {
+		uint8_t buf[SQLARD_CAPTURE_HEADER_SIZE];
+		size_t offset = 0;
+		if (!m_bStarted) {
+			memcpy(buf, SQLARD_CAPTURE_MAGIC, 4);
+			offset = 4;
+			SQLardUtil::sqlard_write_le<uint16_t>(buf, offset, SQLARD_CAPTURE_VERSION);
+			SQLardUtil::sqlard_write_le<uint16_t>(buf, offset, 0);
+			m_pfnWrite(m_pContext, buf, offset);
+			m_ulLastTimestamp = timestamp;
+			m_bStarted = true;
+			offset = 0;
+		}
+		SQLardUtil::sqlard_write_le<uint8_t>(buf, offset, direction);
+		SQLardUtil::sqlard_write_le<uint32_t>(buf, offset, timestamp - m_ulLastTimestamp);
+		SQLardUtil::sqlard_write_le<uint16_t>(buf, offset, packetLen);
+		m_pfnWrite(m_pContext, buf, offset);
+		m_ulLastTimestamp = timestamp;
+		m_uiRecordCount++;
+	}
+
+	#ifdef WINDOWS
+		static size_t WriteFile(void * context, const uint8_t * data, const size_t len) {
+			return fwrite(data, 1, len, static_cast<FILE*>(context));
+		}
+	#endif
+
+	WriteCallback m_pfnWrite;
+	void * m_pContext;
+	bool m_bOwnsFile;
+	bool m_bStarted;
+	uint32_t m_ulLastTimestamp;
+	uint32_t m_uiRecordCount;
+	SQLardCaptureStream m_arStreams[2];
+};
+
+/*
+	Plays a capture back in place of the socket. Outbound bytes written by
+	SQLard are matched against the captured requests, and captured responses
+	become readable once the request preceding them has been written; at
+	original speed, also not before the captured server delay has elapsed.
+*/
+class SQLardWireReplay {
+public:
+	/* The capture buffer is not copied and must outlive the replay. */
+	SQLardWireReplay(const uint8_t * capture, const size_t len, const bool bOriginalSpeed = false) {
+		m_pCapture = capture;
+		m_szLength = len;
+		m_bOriginalSpeed = bOriginalSpeed;
+		m_bOwnsCapture = false;
+		rewind();
+	}
+	#ifdef WINDOWS
+		/* Load a capture file into memory. */
+		SQLardWireReplay(const char * path, const bool bOriginalSpeed = false) {
+			m_pCapture = nullptr;
+			m_szLength = 0;
+			m_bOriginalSpeed = bOriginalSpeed;
+			m_bOwnsCapture = true;
+			FILE * file = fopen(path, "rb");
+			if (file != nullptr) {
+				fseek(file, 0, SEEK_END);
+				long size = ftell(file);
+				fseek(file, 0, SEEK_SET);
+				if (size > 0) {
+					uint8_t * data = new uint8_t[size];
+					m_szLength = fread(data, 1, size, file);
+					m_pCapture = data;
+				}
+				fclose(file);
+			}
+			rewind();
+		}
+	#endif
+	~SQLardWireReplay() {
+		if (m_bOwnsCapture)
+			delete[] m_pCapture;
+	}
+
+	bool isValid() const {
+		return m_pCapture != nullptr && m_szLength >= SQLARD_CAPTURE_HEADER_SIZE && memcmp(m_pCapture, SQLARD_CAPTURE_MAGIC, 4) == 0;
+	}
+
+	/* Start over from the first record */
+	void rewind() {
+		m_in.reset();
+		m_out.reset();
+		m_uiOutboundWritten = 0;
+		m_uiMismatches = 0;
+		m_ulLastWriteTime = SQLardUtil::sqlard_micros();
+		m_ullLastWriteCaptureTime = 0;
+		if (isValid()) {
+			seekRecord(m_in, SQLARD_CAPTURE_INBOUND);
+			seekRecord(m_out, SQLARD_CAPTURE_OUTBOUND);
+		}
+	}
+
+	/* Amount of captured response bytes that can be read now */
+	int available() {
+		SQLardReplayCursor cursor = m_in;
+		size_t total = 0;
+		while (cursor.record != 0 && isDue(cursor)) {
+			total += cursor.remaining;
+			cursor.remaining = 0;
+			seekRecord(cursor, SQLARD_CAPTURE_INBOUND);
+		}
+		return total > 0x7FFF ? 0x7FFF : static_cast<int>(total);
+	}
+
+	/* Read captured response bytes, returns the amount read */
+	size_t read(uint8_t * buf, size_t len) {
+		size_t total = 0;
+		while (len > 0 && m_in.record != 0 && isDue(m_in)) {
+			const size_t chunk = len < m_in.remaining ? len : m_in.remaining;
+			memcpy(buf, &m_pCapture[m_in.data], chunk);
+			buf += chunk;
+			len -= chunk;
+			total += chunk;
+			m_in.data += chunk;
+			m_in.remaining -= chunk;
+			if (m_in.remaining == 0)
+				seekRecord(m_in, SQLARD_CAPTURE_INBOUND);
+		}
+		return total;
+	}
+
+	/* Consume request bytes, comparing them to the captured requests */
+	size_t write(const uint8_t * buf, size_t len) {
+		const size_t total = len;
+		while (len > 0 && m_out.record != 0) {
+			const size_t chunk = len < m_out.remaining ? len : m_out.remaining;
+			for (size_t i = 0; i < chunk; i++) {
+				/* the packet id (header byte 6) may legitimately differ */
+				const size_t packetOffset = m_out.data + i - m_out.record;
+				if (packetOffset != 6 && m_pCapture[m_out.data + i] != buf[i]) {
+					m_uiMismatches++;
+					break;
+				}
+			}
+			buf += chunk;
+			len -= chunk;
+			m_out.data += chunk;
+			m_out.remaining -= chunk;
+			if (m_out.remaining == 0) {
+				m_uiOutboundWritten++;
+				m_ulLastWriteTime = SQLardUtil::sqlard_micros();
+				m_ullLastWriteCaptureTime = m_out.time;
+				seekRecord(m_out, SQLARD_CAPTURE_OUTBOUND);
+			}
+		}
+		return total;
+	}
+
+	/* True when every captured response has been read */
+	bool isFinished() const { return m_in.record == 0; }
+	/* Amount of written packets which differ from the capture */
+	uint32_t GetMismatchCount() const { return m_uiMismatches; }
+private:
+	struct SQLardReplayCursor {
+		/* offset of the current packet (0 = none left), its unread part and length */
+		size_t record;
+		size_t data;
+		size_t remaining;
+		/* capture time of the current record, and outbound records preceding it */
+		uint64_t time;
+		uint32_t outboundBefore;
+		/* offset of the next record header to scan, and capture time / outbound count so far */
+		size_t next;
+		uint64_t scanTime;
+		uint32_t scanOutbound;
+		void reset() {
+			record = data = remaining = 0;
+			time = scanTime = 0;
+			outboundBefore = scanOutbound = 0;
+			next = SQLARD_CAPTURE_HEADER_SIZE;
+		}
+	};
+
+	/* Move the cursor to the next record of the given direction */
+	void seekRecord(SQLardReplayCursor & cursor, const uint8_t direction) {
+		cursor.record = 0;
+		cursor.remaining = 0;
+		while (cursor.next + SQLARD_CAPTURE_RECORD_HEADER_SIZE <= m_szLength) {
+			size_t offset = cursor.next;
+			const uint8_t recordDirection = m_pCapture[offset++];
+			cursor.scanTime += SQLardUtil::sqlard_read_le<uint32_t>(const_cast<uint8_t*>(m_pCapture), offset);
+			size_t len = SQLardUtil::sqlard_read_le<uint16_t>(const_cast<uint8_t*>(m_pCapture), offset);
+			if (offset + len > m_szLength)
+				len = m_szLength - offset;
+			cursor.next = offset + len;
+			if (recordDirection == direction) {
+				cursor.record = cursor.data = offset;
+				cursor.remaining = len;
+				cursor.time = cursor.scanTime;
+				cursor.outboundBefore = cursor.scanOutbound;
+			}
+			if (recordDirection == SQLARD_CAPTURE_OUTBOUND)
+				cursor.scanOutbound++;
+			if (cursor.record != 0)
+				return;
+		}
+	}
+
+	bool isDue(const SQLardReplayCursor & cursor) const {
+		/* a response is never available before its request was sent */
+		if (cursor.outboundBefore > m_uiOutboundWritten)
+			return false;
+		if (!m_bOriginalSpeed || cursor.outboundBefore < m_uiOutboundWritten)
+			return true;
+		/* keep the captured delay between the last request and this response */
+		const uint64_t delay = cursor.time - m_ullLastWriteCaptureTime;
+		return static_cast<uint32_t>(SQLardUtil::sqlard_micros() - m_ulLastWriteTime) >= delay;
+	}
+
+	const uint8_t * m_pCapture;
+	size_t m_szLength;
+	bool m_bOriginalSpeed;
+	bool m_bOwnsCapture;
+	SQLardReplayCursor m_in;
+	SQLardReplayCursor m_out;
+	uint32_t m_uiOutboundWritten;
+	uint32_t m_uiMismatches;
+	uint32_t m_ulLastWriteTime;
+	uint64_t m_ullLastWriteCaptureTime;
+};
+#endif
+
+
+#ifdef SQLARD_EXPORT
+#ifndef SQLARD_EXPORT_BUFFER
+	#define SQLARD_EXPORT_BUFFER 256
+#endif
+/*
+	Columnar batch layout (all integers little endian, buffers start at 8 byte aligned offsets)
+		batch header	: "SQLA" magic, uint16_t version, uint16_t column count, uint32_t row count
+		column header	: uint16_t name length, UTF-8 name, uint8_t format length, Arrow C data
+						  interface format string ("i", "g", "u", "tsu:", "d:18,2", ...),
+						  uint8_t buffer count, uint32_t null count, uint32_t length of each buffer,
+						  padding to 8 bytes
+		buffers			: Arrow buffers of the column, validity bitmap (LSB first, 1 = valid) first,
+						  then values, or int32 offsets and data for "u" / "z"
+	A reader can hand the buffers to ArrowArray as they are.
+*/
+#define SQLARD_COLUMNAR_MAGIC "SQLA"
+#define SQLARD_COLUMNAR_VERSION 2
+
+/*
+	Fixed size unsigned integer, wide enough for any double written as a
+	fraction of two integers. Used by SQLardExporter::FormatDouble.
+*/
+class SQLardWideUnsigned {
+public:
+	SQLardWideUnsigned(const uint64_t value) {
+		memset(m_arWords, 0, sizeof(m_arWords));
+		m_arWords[0] = static_cast<uint32_t>(value);
+		m_arWords[1] = static_cast<uint32_t>(value >> 32);
+	}
+
+	void shiftLeft(const uint16_t bits) {
+		const uint16_t words = bits / 32;
+		const uint8_t rest = bits % 32;
+		for (int16_t i = WORDS - 1; i >= 0; i--) {
+			uint32_t word = 0;
+			if (i >= words) {
+				word = m_arWords[i - words] << rest;
+				if (rest != 0 && i > words)
+					word |= m_arWords[i - words - 1] >> (32 - rest);
+			}
+			m_arWords[i] = word;
+		}
+	}
+	void multiply(const uint32_t factor) {
+		uint64_t carry = 0;
+		for (uint8_t i = 0; i < WORDS; i++) {
+			carry += static_cast<uint64_t>(m_arWords[i]) * factor;
+			m_arWords[i] = static_cast<uint32_t>(carry);
+			carry >>= 32;
+		}
+	}
+	/* other must not be larger */
+	void subtract(const SQLardWideUnsigned & other) {
+		uint32_t borrow = 0;
+		for (uint8_t i = 0; i < WORDS; i++) {
+			const uint64_t diff = static_cast<uint64_t>(m_arWords[i]) - other.m_arWords[i] - borrow;
+			m_arWords[i] = static_cast<uint32_t>(diff);
+			borrow = (diff >> 32) ? 1 : 0;
+		}
+	}
+	int8_t compare(const SQLardWideUnsigned & other) const {
+		for (int16_t i = WORDS - 1; i >= 0; i--) {
+			if (m_arWords[i] != other.m_arWords[i])
+				return m_arWords[i] < other.m_arWords[i] ? -1 : 1;
+		}
+		return 0;
+	}
+
+private:
+	/* 4 * 2^1074 * 10 for doubles, far less where double is a float */
+	enum { WORDS = sizeof(double) > 4 ? 36 : 7 };
+	uint32_t m_arWords[WORDS];
+};
+
+/*
+	Streams result rows as CSV (RFC 4180, with a header line), JSON Lines or
+	columnar batches. Output is collected into a small buffer and handed to
+	the sink in SQLARD_EXPORT_BUFFER sized writes.
+	Narrow character data is written as received, UTF-16 data as UTF-8,
+	temporal values as ISO 8601 (UTC for DATETIMEOFFSET), binary as hex.
+	JSON Lines stays valid UTF-8: narrow bytes that are not part of a UTF-8
+	sequence are read as code page 1252, the default collation's.
+*/
+class SQLardExporter {
+public:
+	/* Sink for exported bytes, returns the amount written */
+	typedef size_t (*WriteCallback)(void * context, const uint8_t * data, const size_t len);
+
+	enum Format { CSV, JSONL, COLUMNAR };
+
+	SQLardExporter(WriteCallback pfnWrite, void * context, const Format format) {
+		init(pfnWrite, context, format);
+	}
+	/* Export into memory. GetBytesWritten() may exceed capacity, the output is then truncated. */
+	SQLardExporter(uint8_t * buffer, const size_t capacity, const Format format) {
+		init(&WriteMemory, this, format);
+		m_pMemory = buffer;
+		m_szMemoryCapacity = capacity;
+	}
+	/* The memory sink's context is the exporter itself, a copy would write through the original */
+	SQLardExporter(const SQLardExporter &) = delete;
+	SQLardExporter & operator=(const SQLardExporter &) = delete;
+	#ifdef WINDOWS
+		/* Export into a file, replacing it. */
+		bool openFile(const char * path) {
+			close();
+			FILE * file = fopen(path, "wb");
+			if (file == nullptr)
+				return false;
+			init(&WriteFile, file, m_format);
+			m_bOwnsFile = true;
+			return true;
+		}
+		void close() {
+			flush();
+			if (m_bOwnsFile)
+				fclose(static_cast<FILE*>(m_pContext));
+			init(nullptr, nullptr, m_format);
+		}
+		~SQLardExporter() {
+			close();
+		}
+	#endif
+
+	/*
+		Export a whole result, starting from its first row.
+		Does not move the row iterator. Returns the amount of rows written.
+	*/
+	uint32_t write(SQLardTableResult * pResult) {
+		uint32_t rows = 0;
+		if (pResult == nullptr)
+			return 0;
+		if (m_format == COLUMNAR) {
+			rows = writeColumnar(pResult);
+		}
+		else {
+			begin(pResult);
+			for (; rows < pResult->rowCount(); rows++)
+				writeRow(*pResult->row(rows));
+		}
+		flush();
+		return rows;
+	}
+
+	/* Row by row export (CSV / JSON Lines): begin writes the CSV header line */
+	void begin(SQLardTableResult * pResult) {
+		m_pResult = pResult;
+		if (m_format != CSV)
+			return;
+		for (uint16_t i = 0; i < pResult->m_usColumnCount; i++) {
+			if (i > 0)
+				put(',');
+			putColumnName(i, false);
+		}
+		put("\r\n", 2);
+	}
+	void writeRow(const SQLardRowData & row) {
+		if (m_pResult == nullptr)
+			return;
+		if (m_format == JSONL)
+			put('{');
+		for (uint16_t i = 0; i < m_pResult->m_usColumnCount; i++) {
+			if (i > 0)
+				put(',');
+			if (m_format == JSONL) {
+				putColumnName(i, true);
+				put(':');
+			}
+			putValue(m_pResult->m_arColumnData[i], row[i]);
+		}
+		if (m_format == JSONL)
+			put("}\n", 2);
+		else
+			put("\r\n", 2);
+	}
+
+	/* Hand buffered output to the sink */
+	void flush() {
+		if (m_usFill > 0 && m_pfnWrite != nullptr)
+			m_pfnWrite(m_pContext, m_arBuffer, m_usFill);
+		m_usFill = 0;
+	}
+
+	const size_t GetBytesWritten() const { return m_szWritten; }
+
+	/* Number formatting, returns the amount of characters written to out */
+	static uint8_t FormatUnsigned(uint64_t value, char * out) {
+		char digits[20];
+		uint8_t count = 0;
+		do {
+			digits[count++] = '0' + static_cast<char>(value % 10);
+			value /= 10;
+		} while (value != 0);
+		for (uint8_t i = 0; i < count; i++)
+			out[i] = digits[count - 1 - i];
+		return count;
+	}
+	static uint8_t FormatSigned(const int64_t value, char * out) {
+		if (value >= 0)
+			return FormatUnsigned(static_cast<uint64_t>(value), out);
+		out[0] = '-';
+		return 1 + FormatUnsigned(0 - static_cast<uint64_t>(value), out + 1);
+	}
+	/*
+		Fewest digits that read back as the same value, in the shorter of positional
+		and scientific notation. bSingle formats value as a float. out needs 26 characters.
+	*/
+	static uint8_t FormatDouble(double value, const bool bSingle, char * out) {
+		char * p = out;
+		if (value != value) {
+			memcpy(p, "NaN", 3);
+			return 3;
+		}
+		if (value < 0) {
+			*p++ = '-';
+			value = -value;
+		}
+		if (value > 1.7976931348623157e308) {
+			memcpy(p, "Infinity", 8);
+			return static_cast<uint8_t>(p - out) + 8;
+		}
+		if (value == 0) {
+			*p++ = '0';
+			return static_cast<uint8_t>(p - out);
+		}
+		/* value = m * 2^e, exactly */
+		uint64_t m;
+		int16_t e, minExponent;
+		uint8_t precision;
+		if (bSingle || sizeof(double) == 4) {
+			const float single = static_cast<float>(value);
+			uint32_t bits;
+			memcpy(&bits, &single, 4);
+			precision = 24;
+			minExponent = -149;
+			m = bits & 0x7FFFFF;
+			e = static_cast<int16_t>((bits >> 23) & 0xFF);
+		}
+		else {
+			uint64_t bits;
+			memcpy(&bits, &value, 8);
+			precision = 53;
+			minExponent = -1074;
+			m = bits & 0xFFFFFFFFFFFFFULL;
+			e = static_cast<int16_t>((bits >> 52) & 0x7FF);
+		}
+		/* a power of two is twice as close to its lower neighbour */
+		const bool bNarrowBelow = (m == 0 && e > 1);
+		if (e == 0)
+			e = minExponent;
+		else {
+			m |= static_cast<uint64_t>(1) << (precision - 1);
+			e += minExponent - 1;
+		}
+
+		/* decimal exponent of the leading digit, corrected below */
+		int16_t exponent = 0;
+		double probe = value;
+		while (probe >= 1e16) { probe /= 1e16; exponent += 16; }
+		while (probe >= 10) { probe /= 10; exponent++; }
+		while (probe < 1e-15) { probe *= 1e16; exponent -= 16; }
+		while (probe < 1) { probe *= 10; exponent--; }
+
+		/*
+			Free-format digit generation (Steele and White): remainder / scale is the
+			value over 10^exponent, below and above are the distances to the midpoints
+			between value and its neighbours. Digits stop as soon as they identify the
+			value, so the text reads back as the same double (or float with bSingle).
+		*/
+		SQLardWideUnsigned remainder(m << 2), scale(4), below(bNarrowBelow ? 1 : 2), above(2);
+		if (e >= 0) {
+			remainder.shiftLeft(e);
+			below.shiftLeft(e);
+			above.shiftLeft(e);
+		}
+		else
+			scale.shiftLeft(-e);
+		for (int16_t i = exponent; i > 0; i -= 9)
+			scale.multiply(i >= 9 ? 1000000000UL : Pow10(i));
+		for (int16_t i = -exponent; i > 0; i -= 9) {
+			const uint32_t factor = i >= 9 ? 1000000000UL : Pow10(i);
+			remainder.multiply(factor);
+			below.multiply(factor);
+			above.multiply(factor);
+		}
+		while (remainder.compare(scale) < 0) {
+			remainder.multiply(10);
+			below.multiply(10);
+			above.multiply(10);
+			exponent--;
+		}
+		for (;;) {
+			SQLardWideUnsigned tenfold = scale;
+			tenfold.multiply(10);
+			if (remainder.compare(tenfold) < 0)
+				break;
+			scale = tenfold;
+			exponent++;
+		}
+		const bool bEven = (m & 1) == 0;
+		uint64_t mantissa = 0;
+		uint8_t generated = 0;
+		for (;;) {
+			uint8_t digit = 0;
+			while (remainder.compare(scale) >= 0) {
+				remainder.subtract(scale);
+				digit++;
+			}
+			SQLardWideUnsigned gap = scale;
+			gap.subtract(remainder);
+			/* midpoints read back as value when its mantissa is even */
+			const bool bLow = remainder.compare(below) < (bEven ? 1 : 0);
+			const bool bHigh = gap.compare(above) < (bEven ? 1 : 0);
+			generated++;
+			if (bLow || bHigh || generated == 17) {
+				/* round to the nearer end, a 10 carries into the previous digit */
+				SQLardWideUnsigned twice = remainder;
+				twice.shiftLeft(1);
+				if (bLow != bHigh ? bHigh : twice.compare(scale) >= 0)
+					digit++;
+				mantissa = mantissa * 10 + digit;
+				break;
+			}
+			mantissa = mantissa * 10 + digit;
+			remainder.multiply(10);
+			below.multiply(10);
+			above.multiply(10);
+		}
+		char digits[20];
+		uint8_t count = FormatUnsigned(mantissa, digits);
+		if (count > generated)
+			exponent++;
+		while (count > 1 && digits[count - 1] == '0')
+			count--;
+		if (exponent >= -5 && exponent < 17) {
+			if (exponent < 0) {
+				*p++ = '0';
+				*p++ = '.';
+				for (int16_t i = -1; i > exponent; i--)
+					*p++ = '0';
+				memcpy(p, digits, count);
+				p += count;
+			}
+			else {
+				for (int16_t i = 0; i <= exponent; i++)
+					*p++ = i < count ? digits[i] : '0';
+				if (count > exponent + 1) {
+					*p++ = '.';
+					memcpy(p, digits + exponent + 1, count - exponent - 1);
+					p += count - exponent - 1;
+				}
+			}
+		}
+		else {
+			*p++ = digits[0];
+			if (count > 1) {
+				*p++ = '.';
+				memcpy(p, digits + 1, count - 1);
+				p += count - 1;
+			}
+			*p++ = 'e';
+			p += FormatSigned(exponent, p);
+		}
+		return static_cast<uint8_t>(p - out);
+	}
+	static uint32_t Pow10(const int16_t exponent) {
+		uint32_t power = 1;
+		for (int16_t i = 0; i < exponent; i++)
+			power *= 10;
+		return power;
+	}
+	/* Little endian magnitude of up to 16 bytes with a decimal scale. out needs 42 characters. */
+	static uint8_t FormatDecimal(const uint8_t * magnitude, const uint8_t len, const bool bNegative, const uint8_t scale, char * out) {
+		uint32_t words[4] = { 0, 0, 0, 0 };
+		for (uint8_t i = 0; i < len && i < 16; i++)
+			words[i / 4] |= static_cast<uint32_t>(magnitude[i]) << ((i % 4) * 8);
+		char digits[40];
+		uint8_t count = 0;
+		bool bZero;
+		do {
+			/* divide the 128 bit value by 10 */
+			uint64_t remainder = 0;
+			bZero = true;
+			for (int8_t w = 3; w >= 0; w--) {
+				const uint64_t cur = (remainder << 32) | words[w];
+				words[w] = static_cast<uint32_t>(cur / 10);
+				remainder = cur % 10;
+				if (words[w] != 0)
+					bZero = false;
+			}
+			digits[count++] = '0' + static_cast<char>(remainder);
+		} while (!bZero);
+		while (count <= scale)
+			digits[count++] = '0';
+		char * p = out;
+		if (bNegative)
+			*p++ = '-';
+		for (uint8_t i = count; i > 0; i--) {
+			if (i == scale && scale > 0)
+				*p++ = '.';
+			*p++ = digits[i - 1];
+		}
+		return static_cast<uint8_t>(p - out);
+	}
+	/* ISO 8601 text of microseconds since UNIX epoch (or since midnight for TIME). out needs 28 characters. */
+	static uint8_t FormatEpochMicros(const int64_t us, const uint8_t type, char * out) {
+		int64_t days = us / SQLARD_US_PER_DAY;
+		int64_t rest = us % SQLARD_US_PER_DAY;
+		if (rest < 0) {
+			rest += SQLARD_US_PER_DAY;
+			days--;
+		}
+		char * p = out;
+		if (type != SQLardDataType::TIMENTYPE) {
+			/* civil date from day count */
+			const int64_t z = days + 719468;
+			const int64_t era = (z >= 0 ? z : z - 146096) / 146097;
+			const uint32_t doe = static_cast<uint32_t>(z - era * 146097);
+			const uint32_t yoe = (doe - doe / 1460 + doe / 36524 - doe / 146096) / 365;
+			const uint32_t doy = doe - (365 * yoe + yoe / 4 - yoe / 100);
+			const uint32_t mp = (5 * doy + 2) / 153;
+			const uint32_t day = doy - (153 * mp + 2) / 5 + 1;
+			const uint32_t month = mp < 10 ? mp + 3 : mp - 9;
+			const int64_t year = static_cast<int64_t>(yoe) + era * 400 + (month <= 2 ? 1 : 0);
+			p += putDigits(p, static_cast<uint32_t>(year), 4);
+			*p++ = '-';
+			p += putDigits(p, month, 2);
+			*p++ = '-';
+			p += putDigits(p, day, 2);
+			if (type == SQLardDataType::DATENTYPE)
+				return static_cast<uint8_t>(p - out);
+			*p++ = 'T';
+		}
+		const uint32_t seconds = static_cast<uint32_t>(rest / 1000000);
+		const uint32_t fraction = static_cast<uint32_t>(rest % 1000000);
+		p += putDigits(p, seconds / 3600, 2);
+		*p++ = ':';
+		p += putDigits(p, (seconds / 60) % 60, 2);
+		*p++ = ':';
+		p += putDigits(p, seconds % 60, 2);
+		if (fraction != 0) {
+			*p++ = '.';
+			p += putDigits(p, fraction, 6);
+		}
+		if (type == SQLardDataType::DATETIMEOFFSETNTYPE)
+			*p++ = 'Z';
+		return static_cast<uint8_t>(p - out);
+	}
+
+protected:
+	/* How a column is presented */
+	enum Kind { KIND_NULL, KIND_INTEGER, KIND_UNSIGNED, KIND_BOOL, KIND_FLOAT, KIND_MONEY, KIND_DECIMAL,
+		KIND_TIMESTAMP, KIND_DATE, KIND_TIME, KIND_GUID, KIND_TEXT, KIND_WTEXT, KIND_BINARY };
+
+	static Kind GetKind(const SQLardColumnData * pColumn) {
+		switch (static_cast<SQLardDataType>(pColumn->m_bType)) {
+			case SQLardDataType::NULLTYPE:
+				return KIND_NULL;
+			case SQLardDataType::INT1TYPE:
+				return KIND_UNSIGNED;
+			case SQLardDataType::INT2TYPE:
+			case SQLardDataType::INT4TYPE:
+			case SQLardDataType::INT8TYPE:
+				return KIND_INTEGER;
+			case SQLardDataType::INTNTYPE:
+				return pColumn->m_usLargeTypeSize == 1 ? KIND_UNSIGNED : KIND_INTEGER;
+			case SQLardDataType::BITTYPE:
+			case SQLardDataType::BITNTYPE:
+				return KIND_BOOL;
+			case SQLardDataType::FLT4TYPE:
+			case SQLardDataType::FLT8TYPE:
+			case SQLardDataType::FLTNTYPE:
+				return KIND_FLOAT;
+			case SQLardDataType::MONEYTYPE:
+			case SQLardDataType::MONEY4TYPE:
+			case SQLardDataType::MONEYNTYPE:
+				return KIND_MONEY;
+			case SQLardDataType::DECIMALTYPE:
+			case SQLardDataType::NUMERICTYPE:
+			case SQLardDataType::DECIMALNTYPE:
+			case SQLardDataType::NUMERICNTYPE:
+				return KIND_DECIMAL;
+			case SQLardDataType::DATETIMETYPE:
+			case SQLardDataType::DATETIM4TYPE:
+			case SQLardDataType::DATETIMNTYPE:
+			case SQLardDataType::DATETIME2NTYPE:
+			case SQLardDataType::DATETIMEOFFSETNTYPE:
+				return KIND_TIMESTAMP;
+			case SQLardDataType::DATENTYPE:
+				return KIND_DATE;
+			case SQLardDataType::TIMENTYPE:
+				return KIND_TIME;
+			case SQLardDataType::GUIDTYPE:
+				return KIND_GUID;
+			default:
+				if (SQLardUtil::sqlard_is_wide(pColumn->m_bType))
+					return KIND_WTEXT;
+				if (SQLardUtil::sqlard_is_char(pColumn->m_bType))
+					return KIND_TEXT;
+				return KIND_BINARY;
+		}
+	}
+
+	/* Integer value of INTn / MONEYn fields, sign extended by field length */
+	static int64_t ReadInteger(const SQLardRowFieldData * pField, const bool bUnsigned = false) {
+		size_t offset = 0;
+		switch (pField->m_usLength) {
+			case 1:
+				return bUnsigned ? pField->m_pData[0] : static_cast<int8_t>(pField->m_pData[0]);
+			case 2:
+				return SQLardUtil::sqlard_read_le<int16_t>(pField->m_pData, offset);
+			case 4:
+				return SQLardUtil::sqlard_read_le<int32_t>(pField->m_pData, offset);
+			case 8:
+				return SQLardUtil::sqlard_read_le<int64_t>(pField->m_pData, offset);
+			default:
+				return 0;
+		}
+	}
+	/* MONEY is sent as the high 4 bytes followed by the low 4 bytes, in 1/10000 units */
+	static int64_t ReadMoney(const SQLardRowFieldData * pField) {
+		if (pField->m_usLength != 8)
+			return ReadInteger(pField);
+		size_t offset = 0;
+		const int32_t hi = SQLardUtil::sqlard_read_le<int32_t>(pField->m_pData, offset);
+		const uint32_t lo = SQLardUtil::sqlard_read_le<uint32_t>(pField->m_pData, offset);
+		return static_cast<int64_t>((static_cast<uint64_t>(static_cast<uint32_t>(hi)) << 32) | lo);
+	}
+	static double ReadDouble(const SQLardRowFieldData * pField) {
+		return pField->m_usLength == 4 ? pField->asFloat() : pField->asDouble();
+	}
+	static uint8_t FormatMoney(const int64_t value, char * out) {
+		const uint64_t magnitude = value < 0 ? 0 - static_cast<uint64_t>(value) : static_cast<uint64_t>(value);
+		uint8_t bytes[8];
+		for (uint8_t i = 0; i < 8; i++)
+			bytes[i] = static_cast<uint8_t>(magnitude >> (i * 8));
+		return FormatDecimal(bytes, 8, value < 0, 4, out);
+	}
+	static uint8_t FormatGUID(const uint8_t * g, char * out) {
+		static const char hex[] = "0123456789ABCDEF";
+		/* first three groups are little endian */
+		static const uint8_t order[16] = { 3, 2, 1, 0, 5, 4, 7, 6, 8, 9, 10, 11, 12, 13, 14, 15 };
+		char * p = out;
+		for (uint8_t i = 0; i < 16; i++) {
+			if (i == 4 || i == 6 || i == 8 || i == 10)
+				*p++ = '-';
+			*p++ = hex[g[order[i]] >> 4];
+			*p++ = hex[g[order[i]] & 0x0F];
+		}
+		return static_cast<uint8_t>(p - out);
+	}
+	static uint8_t putDigits(char * out, uint32_t value, const uint8_t width) {
+		for (uint8_t i = width; i > 0; i--) {
+			out[i - 1] = '0' + static_cast<char>(value % 10);
+			value /= 10;
+		}
+		return width;
+	}
+
+	void init(WriteCallback pfnWrite, void * context, const Format format) {
+		m_pfnWrite = pfnWrite;
+		m_pContext = context;
+		m_format = format;
+		m_bOwnsFile = false;
+		m_pResult = nullptr;
+		m_usFill = 0;
+		m_szWritten = 0;
+		m_pMemory = nullptr;
+		m_szMemoryCapacity = 0;
+		m_szMemoryUsed = 0;
+	}
+
+	void put(const char c) {
+		if (m_usFill == SQLARD_EXPORT_BUFFER)
+			flush();
+		m_arBuffer[m_usFill++] = static_cast<uint8_t>(c);
+		m_szWritten++;
+	}
+	void put(const void * data, const size_t len) {
+		if (m_usFill + len > SQLARD_EXPORT_BUFFER)
+			flush();
+		if (len >= SQLARD_EXPORT_BUFFER) {
+			if (m_pfnWrite != nullptr)
+				m_pfnWrite(m_pContext, static_cast<const uint8_t*>(data), len);
+		}
+		else {
+			memcpy(m_arBuffer + m_usFill, data, len);
+			m_usFill += static_cast<uint16_t>(len);
+		}
+		m_szWritten += len;
+	}
+	void putZeros(size_t count) {
+		while (count-- > 0)
+			put('\0');
+	}
+	template <typename T>
+	void putLE(const T value) {
+		uint8_t buf[sizeof(T)];
+		size_t offset = 0;
+		SQLardUtil::sqlard_write_le<T>(buf, offset, value);
+		put(buf, sizeof(T));
+	}
+
+	/* Code point of text, escaped for the output format and encoded as UTF-8 */
+	void putCodePoint(const uint32_t cp, const bool bQuoted) {
+		if (m_format == JSONL && bQuoted) {
+			switch (cp) {
+				case '"': put("\\\"", 2); return;
+				case '\\': put("\\\\", 2); return;
+				case '\n': put("\\n", 2); return;
+				case '\r': put("\\r", 2); return;
+				case '\t': put("\\t", 2); return;
+				default:
+					if (cp < 0x20) {
+						static const char hex[] = "0123456789abcdef";
+						const char esc[6] = { '\\', 'u', '0', '0', hex[cp >> 4], hex[cp & 0x0F] };
+						put(esc, 6);
+						return;
+					}
+			}
+		}
+		else if (m_format == CSV && bQuoted && cp == '"') {
+			put("\"\"", 2);
+			return;
+		}
+		if (cp < 0x80) {
+			put(static_cast<char>(cp));
+		}
+		else if (cp < 0x800) {
+			put(static_cast<char>(0xC0 | (cp >> 6)));
+			put(static_cast<char>(0x80 | (cp & 0x3F)));
+		}
+		else if (cp < 0x10000) {
+			put(static_cast<char>(0xE0 | (cp >> 12)));
+			put(static_cast<char>(0x80 | ((cp >> 6) & 0x3F)));
+			put(static_cast<char>(0x80 | (cp & 0x3F)));
+		}
+		else {
+			put(static_cast<char>(0xF0 | (cp >> 18)));
+			put(static_cast<char>(0x80 | ((cp >> 12) & 0x3F)));
+			put(static_cast<char>(0x80 | ((cp >> 6) & 0x3F)));
+			put(static_cast<char>(0x80 | (cp & 0x3F)));
+		}
+	}
+
+	/* UTF-8 length of UTF-16LE text */
+	static size_t Utf16Length(const uint8_t * data, const size_t len) {
+		size_t utf8 = 0;
+		for (size_t i = 0; i + 1 < len; i += 2) {
+			uint32_t cp = data[i] | (data[i + 1] << 8);
+			if (cp >= 0xD800 && cp < 0xDC00 && i + 3 < len) {
+				i += 2;
+				cp = 0x10000;
+			}
+			utf8 += cp < 0x80 ? 1 : (cp < 0x800 ? 2 : (cp < 0x10000 ? 3 : 4));
+		}
+		return utf8;
+	}
+	/* UTF-16LE text as UTF-8, combining surrogate pairs */
+	void putUtf16(const uint8_t * data, const size_t len, const bool bQuoted) {
+		for (size_t i = 0; i + 1 < len; i += 2) {
+			uint32_t cp = data[i] | (data[i + 1] << 8);
+			if (cp >= 0xD800 && cp < 0xDC00 && i + 3 < len) {
+				const uint32_t low = data[i + 2] | (data[i + 3] << 8);
+				cp = 0x10000 + ((cp - 0xD800) << 10) + (low - 0xDC00);
+				i += 2;
+			}
+			putCodePoint(cp, bQuoted);
+		}
+	}
+	void putText(const uint8_t * data, const size_t len, const bool bWide) {
+		bool bQuote = (m_format == JSONL);
+		if (m_format == CSV) {
+			/* quote only when needed */
+			for (size_t i = 0; i < len && !bQuote; i += bWide ? 2 : 1) {
+				if (bWide && data[i + 1] != 0)
+					continue;
+				bQuote = data[i] == ',' || data[i] == '"' || data[i] == '\r' || data[i] == '\n';
+			}
+		}
+		if (bQuote)
+			put('"');
+		if (bWide)
+			putUtf16(data, len, bQuote);
+		else if (m_format == CSV && !bQuote)
+			put(data, len);
+		else
+			for (size_t i = 0; i < len; i++) {
+				if (data[i] < 0x80) {
+					putCodePoint(data[i], bQuote);
+				}
+				else if (m_format != JSONL) {
+					put(static_cast<char>(data[i]));
+				}
+				else {
+					const uint8_t sequence = Utf8SequenceLength(data + i, len - i);
+					if (sequence > 0) {
+						put(data + i, sequence);
+						i += sequence - 1;
+					}
+					else
+						putCodePoint(Cp1252CodePoint(data[i]), bQuote);
+				}
+			}
+		if (bQuote)
+			put('"');
+	}
+
+	/* Length of the well formed UTF-8 sequence at data, 0 when there is none */
+	static uint8_t Utf8SequenceLength(const uint8_t * data, const size_t len) {
+		uint8_t sequence;
+		uint8_t low = 0x80, high = 0xBF;
+		if (data[0] >= 0xC2 && data[0] <= 0xDF)
+			sequence = 2;
+		else if (data[0] >= 0xE0 && data[0] <= 0xEF) {
+			sequence = 3;
+			if (data[0] == 0xE0)
+				low = 0xA0;
+			else if (data[0] == 0xED)
+				high = 0x9F;
+		}
+		else if (data[0] >= 0xF0 && data[0] <= 0xF4) {
+			sequence = 4;
+			if (data[0] == 0xF0)
+				low = 0x90;
+			else if (data[0] == 0xF4)
+				high = 0x8F;
+		}
+		else
+			return 0;
+		if (sequence > len || data[1] < low || data[1] > high)
+			return 0;
+		for (uint8_t i = 2; i < sequence; i++) {
+			if ((data[i] & 0xC0) != 0x80)
+				return 0;
+		}
+		return sequence;
+	}
+	/* Code point of a code page 1252 byte */
+	static uint16_t Cp1252CodePoint(const uint8_t c) {
+		/* 0x80 - 0x9F, unassigned bytes map to the C1 control of the same value */
+		static const uint16_t high[32] = {
+			0x20AC, 0x0081, 0x201A, 0x0192, 0x201E, 0x2026, 0x2020, 0x2021, 0x02C6, 0x2030, 0x0160, 0x2039, 0x0152, 0x008D, 0x017D, 0x008F,
+			0x0090, 0x2018, 0x2019, 0x201C, 0x201D, 0x2022, 0x2013, 0x2014, 0x02DC, 0x2122, 0x0161, 0x203A, 0x0153, 0x009D, 0x017E, 0x0178
+		};
+		return c >= 0x80 && c < 0xA0 ? high[c - 0x80] : c;
+	}
+
+	/* UTF-8 length of a column name as written by putColumnName */
+	static size_t ColumnNameLength(const char16_t * name, const uint16_t columnIndex) {
+		if (name == nullptr || *name == 0) {
+			char buf[26];
+			return 6 + FormatUnsigned(columnIndex, buf);
+		}
+		size_t len = 0;
+		for (; *name; name++) {
+			const uint16_t cp = static_cast<uint16_t>(*name);
+			len += cp < 0x80 ? 1 : (cp < 0x800 ? 2 : 3);
+		}
+		return len;
+	}
+
+	void putColumnName(const uint16_t columnIndex, const bool bQuoted) {
+		const char16_t * name = m_pResult->m_arColumnData[columnIndex]->m_wcstrColumnName;
+		if (bQuoted)
+			put('"');
+		if (name == nullptr || *name == 0) {
+			/* names are not kept with SQLARD_SKIP_COLUMN_NAMES */
+			char buf[26];
+			put("column", 6);
+			put(buf, FormatUnsigned(columnIndex, buf));
+		}
+		else {
+			for (; *name; name++)
+				putCodePoint(static_cast<uint16_t>(*name), bQuoted);
+		}
+		if (bQuoted)
+			put('"');
+	}
+
+	void putValue(const SQLardColumnData * pColumn, const SQLardRowFieldData * pField) {
+		const bool bJSON = (m_format == JSONL);
+		const Kind kind = GetKind(pColumn);
+		if (pField == nullptr || pField->isNull() || kind == KIND_NULL) {
+			if (bJSON)
+				put("null", 4);
+			return;
+		}
+		char buf[48];
+		uint8_t len = 0;
+		bool bString = false;
+		switch (kind) {
+			case KIND_INTEGER:
+			case KIND_UNSIGNED:
+				len = FormatSigned(ReadInteger(pField, kind == KIND_UNSIGNED), buf);
+				break;
+			case KIND_BOOL:
+				if (bJSON) {
+					if (pField->m_pData[0])
+						put("true", 4);
+					else
+						put("false", 5);
+					return;
+				}
+				buf[len++] = pField->m_pData[0] ? '1' : '0';
+				break;
+			case KIND_FLOAT:
+			{
+				const double value = ReadDouble(pField);
+				/* JSON has no NaN / Infinity */
+				if (bJSON && (value != value || value > 1.7976931348623157e308 || value < -1.7976931348623157e308)) {
+					put("null", 4);
+					return;
+				}
+				len = FormatDouble(value, pField->m_usLength == 4, buf);
+				break;
+			}
+			case KIND_MONEY:
+				len = FormatMoney(ReadMoney(pField), buf);
+				break;
+			case KIND_DECIMAL:
+				len = FormatDecimal(pField->m_pData, static_cast<uint8_t>(pField->m_usLength), pField->m_bSignFlag == 0, pColumn->m_bScale, buf);
+				break;
+			case KIND_TIMESTAMP:
+			case KIND_DATE:
+			case KIND_TIME:
+				len = FormatEpochMicros(pField->asEpochMicros(pColumn->m_bType, pColumn->m_bScale), pColumn->m_bType, buf);
+				bString = true;
+				break;
+			case KIND_GUID:
+				len = FormatGUID(pField->m_pData, buf);
+				bString = true;
+				break;
+			case KIND_TEXT:
+			case KIND_WTEXT:
+				putText(pField->m_pData, pField->m_usLength, kind == KIND_WTEXT);
+				return;
+			default:
+			{
+				static const char hex[] = "0123456789abcdef";
+				if (bJSON)
+					put('"');
+				for (uint16_t i = 0; i < pField->m_usLength; i++) {
+					put(hex[pField->m_pData[i] >> 4]);
+					put(hex[pField->m_pData[i] & 0x0F]);
+				}
+				if (bJSON)
+					put('"');
+				return;
+			}
+		}
+		if (bString && bJSON)
+			put('"');
+		put(buf, len);
+		if (bString && bJSON)
+			put('"');
+	}
+
+	/* Arrow C data interface format of a column, and the width of its fixed size values (0 for variable size) */
+	static uint8_t GetArrowFormat(const SQLardColumnData * pColumn, char * format, uint8_t & valueWidth) {
+		const Kind kind = GetKind(pColumn);
+		const int8_t fixedLength = SQLardUtil::sqlard_fixed_length(pColumn->m_bType);
+		const uint16_t width = fixedLength > 0 ? fixedLength : pColumn->m_usLargeTypeSize;
+		valueWidth = 8;
+		switch (kind) {
+			case KIND_UNSIGNED:
+				valueWidth = 1;
+				format[0] = 'C';
+				return 1;
+			case KIND_INTEGER:
+				valueWidth = static_cast<uint8_t>(width);
+				format[0] = width == 2 ? 's' : (width == 4 ? 'i' : 'l');
+				return 1;
+			case KIND_BOOL:
+				/* bit packed */
+				valueWidth = 0xFF;
+				format[0] = 'b';
+				return 1;
+			case KIND_FLOAT:
+				valueWidth = static_cast<uint8_t>(width);
+				format[0] = width == 4 ? 'f' : 'g';
+				return 1;
+			case KIND_MONEY:
+				valueWidth = 16;
+				memcpy(format, "d:19,4", 6);
+				return 6;
+			case KIND_DECIMAL:
+			{
+				valueWidth = 16;
+				uint8_t len = 2;
+				memcpy(format, "d:", 2);
+				len += FormatUnsigned(pColumn->m_bPrecision ? pColumn->m_bPrecision : 38, format + len);
+				format[len++] = ',';
+				len += FormatUnsigned(pColumn->m_bScale, format + len);
+				return len;
+			}
+			case KIND_TIMESTAMP:
+				memcpy(format, pColumn->m_bType == SQLardDataType::DATETIMEOFFSETNTYPE ? "tsu:UTC" : "tsu:", pColumn->m_bType == SQLardDataType::DATETIMEOFFSETNTYPE ? 7 : 4);
+				return pColumn->m_bType == SQLardDataType::DATETIMEOFFSETNTYPE ? 7 : 4;
+			case KIND_DATE:
+				valueWidth = 4;
+				memcpy(format, "tdD", 3);
+				return 3;
+			case KIND_TIME:
+				memcpy(format, "ttu", 3);
+				return 3;
+			case KIND_GUID:
+				valueWidth = 16;
+				memcpy(format, "w:16", 4);
+				return 4;
+			case KIND_TEXT:
+			case KIND_WTEXT:
+				valueWidth = 0;
+				format[0] = 'u';
+				return 1;
+			case KIND_NULL:
+				valueWidth = 0;
+				format[0] = 'n';
+				return 1;
+			default:
+				valueWidth = 0;
+				format[0] = 'z';
+				return 1;
+		}
+	}
+
+	/* Fixed size value of a field in its Arrow representation */
+	void putArrowValue(const SQLardColumnData * pColumn, const SQLardRowFieldData * pField, const uint8_t valueWidth) {
+		const bool bNull = (pField == nullptr || pField->isNull());
+		uint8_t value[16];
+		memset(value, 0, sizeof(value));
+		if (!bNull) {
+			size_t offset = 0;
+			switch (GetKind(pColumn)) {
+				case KIND_UNSIGNED:
+				case KIND_INTEGER:
+					SQLardUtil::sqlard_write_le<int64_t>(value, offset, ReadInteger(pField, true));
+					break;
+				case KIND_FLOAT:
+					if (valueWidth == 4) {
+						const float f = static_cast<float>(ReadDouble(pField));
+						memcpy(value, &f, 4);
+					}
+					else {
+						const double d = ReadDouble(pField);
+						memcpy(value, &d, 8);
+					}
+					break;
+				case KIND_MONEY:
+				{
+					const int64_t money = ReadMoney(pField);
+					SQLardUtil::sqlard_write_le<int64_t>(value, offset, money);
+					memset(value + 8, money < 0 ? 0xFF : 0, 8);
+					break;
+				}
+				case KIND_DECIMAL:
+				{
+					/* magnitude and sign byte into 128 bit two's complement */
+					memcpy(value, pField->m_pData, pField->m_usLength < 16 ? pField->m_usLength : 16);
+					if (pField->m_bSignFlag == 0) {
+						uint16_t carry = 1;
+						for (uint8_t i = 0; i < 16; i++) {
+							carry += static_cast<uint8_t>(~value[i]);
+							value[i] = static_cast<uint8_t>(carry);
+							carry >>= 8;
+						}
+					}
+					break;
+				}
+				case KIND_TIMESTAMP:
+				case KIND_TIME:
+					SQLardUtil::sqlard_write_le<int64_t>(value, offset, pField->asEpochMicros(pColumn->m_bType, pColumn->m_bScale));
+					break;
+				case KIND_DATE:
+					SQLardUtil::sqlard_write_le<int32_t>(value, offset, static_cast<int32_t>(pField->asEpochMicros(pColumn->m_bType) / SQLARD_US_PER_DAY));
+					break;
+				case KIND_GUID:
+					memcpy(value, pField->m_pData, 16);
+					break;
+				default:
+					break;
+			}
+		}
+		put(value, valueWidth);
+	}
+
+	static size_t ArrowDataLength(const SQLardColumnData * pColumn, const SQLardRowFieldData * pField) {
+		if (pField == nullptr || pField->isNull())
+			return 0;
+		if (SQLardUtil::sqlard_is_wide(pColumn->m_bType))
+			return Utf16Length(pField->m_pData, pField->m_usLength);
+		return pField->m_usLength;
+	}
+
+	/* One columnar batch holding the whole result */
+	uint32_t writeColumnar(SQLardTableResult * pResult) {
+		const uint32_t rows = pResult->rowCount();
+		put(SQLARD_COLUMNAR_MAGIC, 4);
+		putLE<uint16_t>(SQLARD_COLUMNAR_VERSION);
+		putLE<uint16_t>(pResult->m_usColumnCount);
+		putLE<uint32_t>(rows);
+		m_pResult = pResult;
+		const size_t bitmapLen = (rows + 7) / 8;
+		for (uint16_t col = 0; col < pResult->m_usColumnCount; col++) {
+			const SQLardColumnData * pColumn = pResult->m_arColumnData[col];
+			char format[16];
+			uint8_t valueWidth = 0;
+			const uint8_t formatLen = GetArrowFormat(pColumn, format, valueWidth);
+
+			/* first pass: null count and variable data length */
+			uint32_t nullCount = 0;
+			size_t dataLen = 0;
+			for (uint32_t r = 0; r < rows; r++) {
+				const SQLardRowFieldData * pField = (*pResult->row(r))[col];
+				if (pField == nullptr || pField->isNull() || format[0] == 'n')
+					nullCount++;
+				else if (valueWidth == 0)
+					dataLen += ArrowDataLength(pColumn, pField);
+			}
+
+			/* column header */
+			putLE<uint16_t>(static_cast<uint16_t>(ColumnNameLength(pColumn->m_wcstrColumnName, col)));
+			putColumnName(col, false);
+			put(static_cast<char>(formatLen));
+			put(format, formatLen);
+			size_t bufferLen[3];
+			uint8_t bufferCount = 2;
+			bufferLen[0] = bitmapLen;
+			if (format[0] == 'n') {
+				bufferCount = 0;
+			}
+			else if (valueWidth == 0) {
+				bufferCount = 3;
+				bufferLen[1] = (static_cast<size_t>(rows) + 1) * 4;
+				bufferLen[2] = dataLen;
+			}
+			else {
+				bufferLen[1] = valueWidth == 0xFF ? bitmapLen : static_cast<size_t>(rows) * valueWidth;
+			}
+			put(static_cast<char>(bufferCount));
+			putLE<uint32_t>(nullCount);
+			for (uint8_t b = 0; b < bufferCount; b++)
+				putLE<uint32_t>(static_cast<uint32_t>(bufferLen[b]));
+			putPadding();
+			if (bufferCount == 0)
+				continue;
+
+			/* validity bitmap */
+			putBitmap(pResult, col, false);
+			if (valueWidth == 0xFF) {
+				putBitmap(pResult, col, true);
+			}
+			else if (valueWidth == 0) {
+				/* offsets, then data */
+				uint32_t offset = 0;
+				putLE<uint32_t>(0);
+				for (uint32_t r = 0; r < rows; r++) {
+					offset += static_cast<uint32_t>(ArrowDataLength(pColumn, (*pResult->row(r))[col]));
+					putLE<uint32_t>(offset);
+				}
+				putPadding();
+				for (uint32_t r = 0; r < rows; r++) {
+					const SQLardRowFieldData * pField = (*pResult->row(r))[col];
+					if (pField == nullptr || pField->isNull())
+						continue;
+					if (SQLardUtil::sqlard_is_wide(pColumn->m_bType))
+						putUtf16(pField->m_pData, pField->m_usLength, false);
+					else
+						put(pField->m_pData, pField->m_usLength);
+				}
+			}
+			else {
+				for (uint32_t r = 0; r < rows; r++)
+					putArrowValue(pColumn, (*pResult->row(r))[col], valueWidth);
+			}
+			putPadding();
+		}
+		return rows;
+	}
+
+	void putPadding() {
+		putZeros((8 - m_szWritten % 8) % 8);
+	}
+
+	/* Validity (or BIT value) bitmap of a column, LSB first */
+	void putBitmap(SQLardTableResult * pResult, const uint16_t columnIndex, const bool bValues) {
+		uint8_t bits = 0, count = 0;
+		for (uint32_t r = 0; r < pResult->rowCount(); r++) {
+			const SQLardRowFieldData * pField = (*pResult->row(r))[columnIndex];
+			const bool bValid = (pField != nullptr && !pField->isNull());
+			if (bValues ? (bValid && pField->m_pData[0] != 0) : bValid)
+				bits |= 1 << count;
+			if (++count == 8) {
+				put(static_cast<char>(bits));
+				bits = count = 0;
+			}
+		}
+		if (count > 0)
+			put(static_cast<char>(bits));
+		putPadding();
+	}
+
+	#ifdef WINDOWS
+		static size_t WriteFile(void * context, const uint8_t * data, const size_t len) {
+			return fwrite(data, 1, len, static_cast<FILE*>(context));
+		}
+	#endif
+	static size_t WriteMemory(void * context, const uint8_t * data, const size_t len) {
+		SQLardExporter * pExporter = static_cast<SQLardExporter*>(context);
+		const size_t used = pExporter->m_szMemoryUsed;
+		const size_t count = used >= pExporter->m_szMemoryCapacity ? 0 :
+			(len < pExporter->m_szMemoryCapacity - used ? len : pExporter->m_szMemoryCapacity - used);
+		memcpy(pExporter->m_pMemory + used, data, count);
+		pExporter->m_szMemoryUsed += count;
+		return count;
+	}
+
+	WriteCallback m_pfnWrite;
+	void * m_pContext;
+	Format m_format;
+	bool m_bOwnsFile;
+	SQLardTableResult * m_pResult;
+	uint8_t m_arBuffer[SQLARD_EXPORT_BUFFER];
+	uint16_t m_usFill;
+	size_t m_szWritten;
+	uint8_t * m_pMemory;
+	size_t m_szMemoryCapacity;
+	size_t m_szMemoryUsed;
+};
+#endif
+
+#ifdef SQLARD_BOUND_COLUMNS
+#ifndef SQLARD_MAX_BOUND_COLUMNS
+	#define SQLARD_MAX_BOUND_COLUMNS 16
+#endif
+/* Indicator of a NULL value, see SQLardBinding::bind */
+#define SQLARD_NULL_DATA (-1)
+/* Indicator of a numeric value clamped to the range of its array type */
+#define SQLARD_OVERFLOW_DATA (-2)
+
+/*
+	Caller owned arrays bound to column ordinals, filled with up to
+	rowsetSize rows by each SQLard::fetch, like ODBC's SQLBindCol with a
+	rowset. Rows are decoded straight from the token stream into the
+	arrays, no row or field objects are created.
+
+		int32_t ids[64];
+		float temps[64];
+		char names[64][21];
+		int32_t nameLengths[64];
+		SQLardBinding binding(64);
+		binding.bind(0, ids);
+		binding.bind(1, temps);
+		binding.bindChars(2, names[0], sizeof(names[0]), nameLengths);
+		if (MSSQL.executeBound(u"SELECT id, temp, name FROM sensors", binding))
+			for (uint16_t n; (n = MSSQL.fetch()) > 0; )
+				process(ids, temps, names, n);
+
+	Integer and floating point arrays take any numeric column (MONEY and
+	DECIMAL / NUMERIC are scaled, fractions truncated for integers), int64_t
+	also takes temporal columns as microseconds since UNIX epoch (see
+	SQLardRowFieldData::asEpochMicros). Character arrays have a fixed stride
+	and take character columns, UTF-16 ones as UTF-8; values are truncated
+	to stride - 1 bytes and null terminated. Byte arrays take the raw value
+	of any column. Indicators receive the full length of each value in bytes
+	(more than fits for truncated ones), or SQLARD_NULL_DATA. Numeric values
+	out of range of the array type are clamped to its limits and indicated
+	by SQLARD_OVERFLOW_DATA.
+	A column that can not be converted makes the query fail, see SQLard::hasError.
+*/
+class SQLardBinding {
+public:
+	SQLardBinding(const uint16_t rowsetSize) {
+		m_usRowsetSize = rowsetSize;
+		m_usRowCount = 0;
+		m_bBoundCount = 0;
+	}
+
+	bool bind(const uint16_t column, int8_t * values, int32_t * indicators = nullptr) { return add(column, BIND_INT8, values, sizeof(int8_t), indicators); }
+	bool bind(const uint16_t column, int16_t * values, int32_t * indicators = nullptr) { return add(column, BIND_INT16, values, sizeof(int16_t), indicators); }
+	bool bind(const uint16_t column, int32_t * values, int32_t * indicators = nullptr) { return add(column, BIND_INT32, values, sizeof(int32_t), indicators); }
+	bool bind(const uint16_t column, int64_t * values, int32_t * indicators = nullptr) { return add(column, BIND_INT64, values, sizeof(int64_t), indicators); }
+	bool bind(const uint16_t column, float * values, int32_t * indicators = nullptr) { return add(column, BIND_FLOAT, values, sizeof(float), indicators); }
+	bool bind(const uint16_t column, double * values, int32_t * indicators = nullptr) { return add(column, BIND_DOUBLE, values, sizeof(double), indicators); }
+	/* Row r starts at buffer + r * stride */
+	bool bindChars(const uint16_t column, char * buffer, const size_t stride, int32_t * indicators = nullptr) { return stride > 0 && add(column, BIND_CHAR, buffer, stride, indicators); }
+	bool bindBytes(const uint16_t column, uint8_t * buffer, const size_t stride, int32_t * indicators = nullptr) { return stride > 0 && add(column, BIND_BYTES, buffer, stride, indicators); }
+
+	void unbind(const uint16_t column) {
+		for (uint8_t i = 0; i < m_bBoundCount; i++) {
+			if (m_arBound[i].column != column)
+				continue;
+			memmove(&m_arBound[i], &m_arBound[i + 1], (m_bBoundCount - i - 1) * sizeof(Bound));
+			m_bBoundCount--;
+			return;
+		}
+	}
+	void unbindAll() { m_bBoundCount = 0; }
+
+	const uint16_t GetRowsetSize() const { return m_usRowsetSize; }
+	/* Rows filled by the last fetch */
+	const uint16_t GetRowCount() const { return m_usRowCount; }
+	const bool isFull() const { return m_usRowCount >= m_usRowsetSize; }
+private:
+	friend class SQLard;
+
+	enum BindType : uint8_t {
+		BIND_INT8,
+		BIND_INT16,
+		BIND_INT32,
+		BIND_INT64,
+		BIND_FLOAT,
+		BIND_DOUBLE,
+		BIND_CHAR,
+		BIND_BYTES
+	};
+	struct Bound {
+		uint16_t column;
+		BindType type;
+		void * pValues;
+		size_t stride;
+		int32_t * pIndicators;
+	};
+
+	/* Kept sorted by column, so a row is decoded in a single pass */
+	bool add(const uint16_t column, const BindType type, void * pValues, const size_t stride, int32_t * pIndicators) {
+		if (pValues == nullptr)
+			return false;
+		unbind(column);
+		if (m_bBoundCount == SQLARD_MAX_BOUND_COLUMNS)
+			return false;
+		uint8_t i = m_bBoundCount;
+		for (; i > 0 && m_arBound[i - 1].column > column; i--)
+			m_arBound[i] = m_arBound[i - 1];
+		m_arBound[i].column = column;
+		m_arBound[i].type = type;
+		m_arBound[i].pValues = pValues;
+		m_arBound[i].stride = stride;
+		m_arBound[i].pIndicators = pIndicators;
+		m_bBoundCount++;
+		return true;
+	}
+
+	/* Every bound column exists and converts, checked when the column metadata arrives */
+	bool accepts(const SQLardColumnSet * pColumns) const {
+		for (uint8_t i = 0; i < m_bBoundCount; i++) {
+			if (m_arBound[i].column >= pColumns->GetColumnCount())
+				return false;
+			const uint8_t type = pColumns->GetColumns()[m_arBound[i].column]->m_bType;
+			switch (m_arBound[i].type) {
+				case BIND_CHAR:
+					if (!SQLardUtil::sqlard_is_char(type) && !SQLardUtil::sqlard_is_wide(type))
+						return false;
+					break;
+				case BIND_BYTES:
+					break;
+				case BIND_INT64:
+					if (GetKind(type) == KIND_TEMPORAL)
+						break;
+					/* fall through */
+				default:
+					if (GetKind(type) == KIND_TEMPORAL || GetKind(type) == KIND_OTHER)
+						return false;
+					break;
+			}
+		}
+		return true;
+	}
+
+	/* Decode a ROW or NBCROW token into the next row of the arrays */
+	void store(const uint8_t token, uint8_t * data, const SQLardColumnSet * pColumns) {
+		const uint16_t row = m_usRowCount++;
+		const uint16_t count = pColumns->GetColumnCount();
+		const SQLardFieldPlan * plan = pColumns->GetPlan();
+		size_t offset = 0;
+		const uint8_t * bitmap = nullptr;
+		if (token == SQLardTokenType::TOKEN_NBCROW) {
+			bitmap = data;
+			offset += (count + 7) / 8;
+		}
+		uint8_t b = 0;
+		for (uint16_t i = 0; i < count && b < m_bBoundCount; i++) {
+			SQLardFieldSpan span;
+			if (bitmap != nullptr && (bitmap[i / 8] & (1 << (i % 8)))) {
+				memset(&span, 0, sizeof(span));
+				span.bNull = true;
+			}
+			else
+				SQLardRowFieldData::Locate(plan[i], data, offset, span);
+			if (m_arBound[b].column == i)
+				put(m_arBound[b++], row, pColumns->GetColumns()[i], span, data);
+		}
+	}
+
+	enum Kind : uint8_t {
+		KIND_INTEGER,
+		KIND_MONEY,
+		KIND_DECIMAL,
+		KIND_FLOAT,
+		KIND_TEMPORAL,
+		KIND_OTHER
+	};
+	static Kind GetKind(const uint8_t type) {
+		switch (static_cast<SQLardDataType>(type)) {
+			case SQLardDataType::INT1TYPE:
+			case SQLardDataType::INT2TYPE:
+			case SQLardDataType::INT4TYPE:
+			case SQLardDataType::INT8TYPE:
+			case SQLardDataType::INTNTYPE:
+			case SQLardDataType::BITTYPE:
+			case SQLardDataType::BITNTYPE:
+				return KIND_INTEGER;
+			case SQLardDataType::MONEYTYPE:
+			case SQLardDataType::MONEY4TYPE:
+			case SQLardDataType::MONEYNTYPE:
+				return KIND_MONEY;
+			case SQLardDataType::DECIMALTYPE:
+			case SQLardDataType::NUMERICTYPE:
+			case SQLardDataType::DECIMALNTYPE:
+			case SQLardDataType::NUMERICNTYPE:
+				return KIND_DECIMAL;
+			case SQLardDataType::FLT4TYPE:
+			case SQLardDataType::FLT8TYPE:
+			case SQLardDataType::FLTNTYPE:
+				return KIND_FLOAT;
+			case SQLardDataType::DATETIMETYPE:
+			case SQLardDataType::DATETIM4TYPE:
+			case SQLardDataType::DATETIMNTYPE:
+			case SQLardDataType::DATENTYPE:
+			case SQLardDataType::TIMENTYPE:
+			case SQLardDataType::DATETIME2NTYPE:
+			case SQLardDataType::DATETIMEOFFSETNTYPE:
+				return KIND_TEMPORAL;
+			default:
+				return KIND_OTHER;
+		}
+	}
+
+	/* A field pointing into the row data, for the interpretation methods of SQLardRowFieldData */
+	struct FieldView : SQLardRowFieldData {
+		FieldView(const SQLardFieldSpan & span) {
+			m_pData = const_cast<uint8_t*>(span.pData);
+			m_usLength = static_cast<uint16_t>(span.length);
+			m_bSignFlag = span.signFlag;
+			m_bNull = span.bNull;
+		}
+		~FieldView() { m_pData = nullptr; }
+	};
+
+	static void put(const Bound & bound, const uint16_t row, const SQLardColumnData * pColumn, const SQLardFieldSpan & span, uint8_t * data) {
+		int32_t indicator = span.bNull ? SQLARD_NULL_DATA : static_cast<int32_t>(span.length);
+		switch (bound.type) {
+			case BIND_CHAR:
+			{
+				char * d = static_cast<char*>(bound.pValues) + row * bound.stride;
+				if (span.bNull)
+					d[0] = '\0';
+				else if (SQLardUtil::sqlard_is_wide(pColumn->m_bType))
+					indicator = static_cast<int32_t>(PutUTF8(d, bound.stride, span, data));
+				else
+					d[SQLardRowFieldData::CopyValue(span, data, reinterpret_cast<uint8_t*>(d), static_cast<uint32_t>(bound.stride - 1))] = '\0';
+				break;
+			}
+			case BIND_BYTES:
+				if (!span.bNull)
+					SQLardRowFieldData::CopyValue(span, data, static_cast<uint8_t*>(bound.pValues) + row * bound.stride, static_cast<uint32_t>(bound.stride));
+				break;
+			case BIND_FLOAT:
+			case BIND_DOUBLE:
+			{
+				const double value = span.bNull ? 0 : AsDouble(pColumn, span);
+				if (bound.type == BIND_FLOAT)
+					static_cast<float*>(bound.pValues)[row] = static_cast<float>(value);
+				else
+					static_cast<double*>(bound.pValues)[row] = value;
+				if (!span.bNull)
+					indicator = static_cast<int32_t>(bound.stride);
+				break;
+			}
+			default:
+			{
+				bool bOverflow = false;
+				const int64_t value = span.bNull ? 0 : AsInt64(pColumn, span, bOverflow);
+				switch (bound.type) {
+					case BIND_INT8: static_cast<int8_t*>(bound.pValues)[row] = static_cast<int8_t>(Clamp(value, INT8_MIN, INT8_MAX, bOverflow)); break;
+					case BIND_INT16: static_cast<int16_t*>(bound.pValues)[row] = static_cast<int16_t>(Clamp(value, INT16_MIN, INT16_MAX, bOverflow)); break;
+					case BIND_INT32: static_cast<int32_t*>(bound.pValues)[row] = static_cast<int32_t>(Clamp(value, INT32_MIN, INT32_MAX, bOverflow)); break;
+					default: static_cast<int64_t*>(bound.pValues)[row] = value; break;
+				}
+				if (!span.bNull)
+					indicator = bOverflow ? SQLARD_OVERFLOW_DATA : static_cast<int32_t>(bound.stride);
+				break;
+			}
+		}
+		if (bound.pIndicators != nullptr)
+			bound.pIndicators[row] = indicator;
+	}
+
+	static double Pow10(uint8_t scale) {
+		double p = 1;
+		while (scale--)
+			p *= 10;
+		return p;
+	}
+	static int64_t Clamp(const int64_t value, const int64_t min, const int64_t max, bool & bOverflow) {
+		if (value < min || value > max) {
+			bOverflow = true;
+			return value < min ? min : max;
+		}
+		return value;
+	}
+	/* NaN and values beyond the int64_t range saturate */
+	static int64_t Saturate(const double value, bool & bOverflow) {
+		if (value >= -9223372036854775808.0 && value < 9223372036854775808.0)
+			return static_cast<int64_t>(value);
+		bOverflow = true;
+		return value < 0 ? INT64_MIN : INT64_MAX;
+	}
+	/* The magnitude takes up to 16 bytes (precision 38), divided as 128 bits like SQLardExporter::FormatDecimal */
+	static int64_t DecimalToInt64(const SQLardFieldSpan & span, uint8_t scale, bool & bOverflow) {
+		uint32_t words[4] = { 0, 0, 0, 0 };
+		for (uint32_t i = 0; i < span.length && i < 16; i++)
+			words[i / 4] |= static_cast<uint32_t>(span.pData[i]) << ((i % 4) * 8);
+		for (; scale > 0; scale--) {
+			uint64_t remainder = 0;
+			for (int8_t w = 3; w >= 0; w--) {
+				const uint64_t cur = (remainder << 32) | words[w];
+				words[w] = static_cast<uint32_t>(cur / 10);
+				remainder = cur % 10;
+			}
+		}
+		const uint64_t magnitude = (static_cast<uint64_t>(words[1]) << 32) | words[0];
+		const uint64_t limit = span.signFlag == 0 ? 0x8000000000000000ULL : 0x7FFFFFFFFFFFFFFFULL;
+		if (words[2] != 0 || words[3] != 0 || magnitude > limit) {
+			bOverflow = true;
+			return span.signFlag == 0 ? INT64_MIN : INT64_MAX;
+		}
+		return span.signFlag == 0 ? static_cast<int64_t>(0 - magnitude) : static_cast<int64_t>(magnitude);
+	}
+	static int64_t AsInt64(const SQLardColumnData * pColumn, const SQLardFieldSpan & span, bool & bOverflow) {
+		const FieldView field(span);
+		switch (GetKind(pColumn->m_bType)) {
+			case KIND_INTEGER:
+				return field.asInt64(pColumn->m_bType);
+			case KIND_MONEY:
+				return field.asInt64(pColumn->m_bType) / 10000;
+			case KIND_DECIMAL:
+				return DecimalToInt64(span, pColumn->m_bScale, bOverflow);
+			case KIND_FLOAT:
+				return Saturate(AsDouble(pColumn, span), bOverflow);
+			case KIND_TEMPORAL:
+				return field.asEpochMicros(pColumn->m_bType, pColumn->m_bScale);
+			default:
+				return 0;
+		}
+	}
+	static double AsDouble(const SQLardColumnData * pColumn, const SQLardFieldSpan & span) {
+		const FieldView field(span);
+		switch (GetKind(pColumn->m_bType)) {
+			case KIND_FLOAT:
+				return span.length == 4 ? field.asFloat() : field.asDouble();
+			case KIND_MONEY:
+				return field.asInt64(pColumn->m_bType) / 10000.0;
+			case KIND_DECIMAL:
+			{
+				double magnitude = 0;
+				for (uint32_t i = span.length; i > 0; i--)
+					magnitude = magnitude * 256 + span.pData[i - 1];
+				magnitude /= Pow10(pColumn->m_bScale);
+				return span.signFlag == 0 ? -magnitude : magnitude;
+			}
+			default:
+			{
+				bool bOverflow = false;
+				return static_cast<double>(AsInt64(pColumn, span, bOverflow));
+			}
+		}
+	}
+
+	/*
+		Convert a UTF-16LE value, PLP chunks included, to UTF-8 in d.
+		Returns the UTF-8 length of the whole value.
+	*/
+	static size_t PutUTF8(char * d, const size_t stride, const SQLardFieldSpan & span, uint8_t * data) {
+		size_t n = 0, total = 0;
+		bool bFull = false;
+		uint16_t high = 0;
+		int16_t pending = -1;
+		size_t pos = span.plpOffset;
+		uint32_t len = span.length;
+		const uint8_t * p = span.pData;
+		for (;;) {
+			if (span.plpOffset != 0) {
+				len = SQLardUtil::sqlard_read_le<uint32_t>(data, pos);
+				p = data + pos;
+				pos += len;
+				if (len == 0)
+					break;
+			}
+			/* chunks may split a character */
+			for (uint32_t i = 0; i < len; i++) {
+				if (pending < 0) {
+					pending = p[i];
+					continue;
+				}
+				uint32_t cp = static_cast<uint16_t>(pending | (p[i] << 8));
+				pending = -1;
+				if (cp >= 0xD800 && cp < 0xDC00) {
+					high = static_cast<uint16_t>(cp);
+					continue;
+				}
+				if (cp >= 0xDC00 && cp < 0xE000 && high != 0)
+					cp = 0x10000 + ((high - 0xD800) << 10) + (cp - 0xDC00);
+				else if (cp >= 0xD800 && cp < 0xE000)
+					cp = 0xFFFD;
+				high = 0;
+				char utf8[4];
+				const size_t count = SQLardUtil::sqlard_utf8_encode(utf8, cp);
+				total += count;
+				if (bFull || n + count >= stride) {
+					bFull = true;
+					continue;
+				}
+				memcpy(d + n, utf8, count);
+				n += count;
+			}
+			if (span.plpOffset == 0)
+				break;
+		}
+		d[n] = '\0';
+		return total;
+	}
+
+	Bound m_arBound[SQLARD_MAX_BOUND_COLUMNS];
+	uint8_t m_bBoundCount;
+	uint16_t m_usRowsetSize;
+	uint16_t m_usRowCount;
+};
+#endif
+
+#ifdef SQLARD_MARS
+/* Session Multiplexing Protocol packet flags */
+enum SQLardSMPFlags
+{
+	SMP_SYN = 0x01,
+	SMP_ACK = 0x02,
+	SMP_FIN = 0x04,
+	SMP_DATA = 0x08
+};
+
+class SQLardSession;
+
+/* Connection used by SQLardSession, implemented by SQLard */
+class SQLardSessionLink {
+public:
+	virtual ~SQLardSessionLink() {}
+	/* Read one SMP packet from the connection and hand it to its session. Returns false if none arrived */
+	virtual bool receiveSMP(const bool bBlocking) = 0;
+	virtual bool sendSMP(SQLardSession * pSession, const uint8_t flags, const uint8_t * data, const uint16_t len) = 0;
+	virtual bool sendSessionBatch(SQLardSession * pSession, const SQLardText & query) = 0;
+	virtual void sendSessionAttention(SQLardSession * pSession) = 0;
+	#ifdef SQLARD_COLUMN_CACHE
+		/* Column layouts are cached per connection, for all of its sessions */
+		virtual SQLardColumnCache * sessionColumnCache() = 0;
+	#endif
+};
+
+/*
+	A logical session multiplexed over the connection of a SQLard with SMP (MARS).
+	Each session has its own request, token parser and result, so queries of
+	different sessions run concurrently; the packets of interleaved responses
+	are demultiplexed into the receive buffer of their session.
+	Sessions are owned by SQLard, see SQLard::openSession.
+*/
+class SQLardSession : public SQLardTokenHandler {
+	friend class SQLard;
+public:
+	SQLardSession() {
+		m_pLink = nullptr;
+		m_pOwner = nullptr;
+		m_usSID = 0;
+		m_bOpen = false;
+		m_pResult = nullptr;
+		m_pReceivingResult = nullptr;
+		m_parser.setHandler(this);
+		reset();
+	}
+	~SQLardSession() {
+		if (m_pResult)
+			delete m_pResult;
+	}
+
+	/*
+		Send a SQL batch on this session without waiting for the response.
+		Returns false if a batch is pending or it could not be sent, see hasError.
+	*/
+	bool execute(const SQLardText & query) {
+		if (!m_bOpen || m_bPending)
+			return false;
+		if (m_pResult)
+			delete m_pResult;
+		m_pResult = m_pReceivingResult = new SQLardTableResult();
+		m_parser.reset();
+		m_bError = false;
+		m_uiDoneCount = 0;
+		m_usPacketRemaining = 0;
+		m_bLastPacket = false;
+		m_bPending = true;
+		if (m_pLink->sendSessionBatch(this, query))
+			return true;
+		m_bPending = false;
+		m_bError = true;
+		return false;
+	}
+
+	/* Process whatever has arrived. Returns true once the response is complete */
+	bool poll() {
+		if (!m_bPending)
+			return true;
+		while (m_pLink->receiveSMP(false));
+		return pump();
+	}
+
+	/*
+		Wait for the response and take its result (deleted by the caller),
+		or nullptr if nothing was executed. The query is cancelled if the
+		server stays silent for longer than the query timeout of the SQLard.
+	*/
+	SQLardTableResult * getResult() {
+		while (!pump()) {
+			if (!m_pLink->receiveSMP(true)) {
+				#ifdef SQLARD_VERBOSE_OUTPUT
+					SQLardUtil::printf(F("SQLARD > session %u : Timed out!\n"), m_usSID);
+				#endif
+				cancel();
+			}
+		}
+		SQLardTableResult * pResult = m_pResult;
+		m_pResult = m_pReceivingResult = nullptr;
+		return pResult;
+	}
+
+	/*
+		Abort the query of this session: send ATTENTION and drain the response
+		up to the acknowledgement, dropping its rows. Returns false if the
+		server did not acknowledge.
+	*/
+	bool cancel() {
+		if (!m_bPending)
+			return true;
+		m_bError = true;
+		m_bAttentionPending = true;
+		m_pLink->sendSessionAttention(this);
+		/* waits for SQLARD_CANCEL_TIMEOUT like SQLard::cancelResponse, not the query timeout */
+		const uint32_t ulStart = SQLardUtil::sqlard_millis();
+		while (m_bAttentionPending) {
+			if (!m_bPending) {
+				/* the acknowledgement may follow in a message of its own */
+				m_parser.reset();
+				m_usPacketRemaining = 0;
+				m_bLastPacket = false;
+				m_bPending = true;
+			}
+			if (pump() || m_pLink->receiveSMP(false))
+				continue;
+			if (SQLardUtil::sqlard_millis() - ulStart >= SQLARD_CANCEL_TIMEOUT)
+				break;
+			#ifdef WINDOWS
+				std::this_thread::yield();
+			#endif
+		}
+		m_bPending = false;
+		const bool bAcknowledged = !m_bAttentionPending;
+		m_bAttentionPending = false;
+		return bAcknowledged;
+	}
+
+	/* End the session, it can be opened again by SQLard::openSession */
+	void close() {
+		if (!m_bOpen)
+			return;
+		m_pLink->sendSMP(this, SMP_FIN, nullptr, 0);
+		m_bOpen = false;
+		m_bPending = false;
+		m_inbound.clear();
+	}
+
+	bool isOpen() const { return m_bOpen; }
+	bool isBusy() const { return m_bPending; }
+	bool hasError() const { return m_bError; }
+	/* Row count of the last DONE token */
+	long getDoneCount() const { return m_uiDoneCount; }
+	uint16_t getSessionID() const { return m_usSID; }
+
+protected:
+	void attach(SQLardSessionLink * pLink, SQLardTokenHandler * pOwner, const uint16_t sid) {
+		m_pLink = pLink;
+		m_pOwner = pOwner;
+		m_usSID = sid;
+	}
+
+	/* Start over for a new SYN, or drop the session when the connection is gone */
+	void reset() {
+		m_bPending = false;
+		m_bAttentionPending = false;
+		m_bError = false;
+		m_uiDoneCount = 0;
+		m_usPacketRemaining = 0;
+		m_bLastPacket = false;
+		m_uiSendSeq = 0;
+		m_uiPeerWindow = SQLARD_SMP_WINDOW;
+		m_uiReceivedSeq = 0;
+		m_uiConsumedSeq = 0;
+		m_uiHighWater = SQLARD_SMP_WINDOW;
+		m_inbound.clear();
+	}
+
+	/* 16 byte SMP header, DATA packets take the next sequence number */
+	void putSMPHeader(uint8_t * buf, const uint8_t flags, const uint32_t totalLen) {
+		if (flags == SMP_DATA)
+			m_uiSendSeq++;
+		size_t offset = 0;
+		buf[offset++] = 0x53;
+		buf[offset++] = flags;
+		SQLardUtil::sqlard_write_le<uint16_t>(buf, offset, m_usSID);
+		SQLardUtil::sqlard_write_le<uint32_t>(buf, offset, totalLen);
+		SQLardUtil::sqlard_write_le<uint32_t>(buf, offset, m_uiSendSeq);
+		SQLardUtil::sqlard_write_le<uint32_t>(buf, offset, m_uiHighWater);
+	}
+
+	/* The peer window allows one more DATA packet */
+	bool canSend() const {
+		return static_cast<int32_t>(m_uiPeerWindow - (m_uiSendSeq + 1)) >= 0;
+	}
+
+	void onSMP(const uint8_t flags, const uint32_t seq, const uint32_t window) {
+		if (flags & (SMP_DATA | SMP_ACK))
+			m_uiPeerWindow = window;
+		if (flags & SMP_DATA)
+			m_uiReceivedSeq = seq;
+		if (flags & SMP_FIN) {
+			m_bOpen = false;
+			if (m_bPending) {
+				m_bError = true;
+				m_bPending = false;
+			}
+		}
+	}
+
+	/*
+		Drop count bytes of the receive buffer. Once all received packets are
+		consumed and half of the window is used, the window is moved forward.
+	*/
+	void consume(const size_t count) {
+		m_inbound.consume(count);
+		if (m_inbound.length() != 0)
+			return;
+		m_uiConsumedSeq = m_uiReceivedSeq;
+		if (m_bOpen && m_uiHighWater - m_uiConsumedSeq <= SQLARD_SMP_WINDOW / 2) {
+			m_uiHighWater = m_uiConsumedSeq + SQLARD_SMP_WINDOW;
+			m_pLink->sendSMP(this, SMP_ACK, nullptr, 0);
+		}
+	}
+
+	/* Feed the buffered TDS packets of the response to the parser */
+	bool pump() {
+		while (m_bPending) {
+			if (m_usPacketRemaining == 0) {
+				if (m_bLastPacket) {
+					m_bPending = false;
+					break;
+				}
+				if (m_inbound.length() < 8)
+					return false;
+				const uint8_t * header = m_inbound();
+				const uint16_t size = (static_cast<uint16_t>(header[2]) << 8) | header[3];
+				if (size < 8) {
+					m_bError = true;
+					m_bPending = false;
+					break;
+				}
+				m_usPacketRemaining = size - 8;
+				/* EOM status bit marks the last packet of the message */
+				m_bLastPacket = (header[1] & 0x01) != 0;
+				consume(8);
+				continue;
+			}
+			if (m_inbound.length() == 0)
+				return false;
+			size_t count = m_inbound.length();
+			if (count > m_usPacketRemaining)
+				count = m_usPacketRemaining;
+			if (!m_parser.isDone() && !m_parser.hasError())
+				m_parser.feed(m_inbound(), count);
+			m_usPacketRemaining -= count;
+			consume(count);
+		}
+		return true;
+	}
+
+	/* Token events of the response of this session */
+	bool onColumnMetadata(uint8_t * data, const size_t len) override
+	{
+		if (m_pReceivingResult != nullptr && !m_bAttentionPending) {
+			/* each further result set of the batch gets a result of its own */
+			if (m_pReceivingResult->m_arColumnData != nullptr) {
+				SQLardTableResult * pNext = new SQLardTableResult();
+				m_pReceivingResult->SetNextResult(pNext);
+				m_pReceivingResult = pNext;
+			}
+			#ifdef SQLARD_COLUMN_CACHE
+				m_pReceivingResult->SetColumns(m_pLink->sessionColumnCache()->Get(data, len));
+			#else
+				size_t pos = 0;
+				m_pReceivingResult->ParseColumnData(data, pos);
+			#endif
+		}
+		return true;
+	}
+
+	bool onRow(const uint8_t token, uint8_t * data, const size_t len) override
+	{
+		if (m_pReceivingResult != nullptr && m_pReceivingResult->m_usColumnCount == m_parser.GetColumnCount() && !m_bAttentionPending) {
+			size_t pos = 0;
+			if (token == SQLardTokenType::TOKEN_NBCROW)
+				m_pReceivingResult->ParseNbcRowData(data, pos);
+			else
+				m_pReceivingResult->ParseRowData(data, pos);
+		}
+		return true;
+	}
+
+	bool onDone(const uint8_t token, const uint16_t status, const uint16_t curCmd, const uint64_t rowCount) override
+	{
+		if (token != SQLardTokenType::TOKEN_DONEINPROC || (status & 0x10) != 0)
+			m_uiDoneCount = (long)rowCount;
+		if (status & 0x02)
+			m_bError = true;
+		/* DONE_ATTN acknowledges an ATTENTION */
+		if (status & 0x20)
+			m_bAttentionPending = false;
+		/* the first DONE after a result set ends its statement */
+		else if (m_pReceivingResult != nullptr && m_pReceivingResult->m_arColumnData != nullptr && !m_pReceivingResult->isComplete())
+			m_pReceivingResult->Complete((status & 0x10) != 0 ? static_cast<uint32_t>(rowCount) : 0);
+		return true;
+	}
+
+	bool onMessage(const uint8_t token, uint8_t * data, const size_t len) override
+	{
+		if (token == SQLardTokenType::TOKEN_ERROR) {
+			m_bError = true;
+			#ifdef SQLARD_VERBOSE_OUTPUT
+				size_t pos = 2;
+				SQLardUtil::printf(F("SQLARD > session %u : Error %ld\n"), m_usSID, static_cast<long>(SQLardUtil::sqlard_read_le<uint32_t>(data, pos)));
+			#endif
+		}
+		return true;
+	}
+
+	/* Environment changes and other tokens concern the connection */
+	bool onEnvChange(uint8_t * data, const size_t len) override
+	{
+		return m_pOwner->onEnvChange(data, len);
+	}
+
+	bool onToken(const uint8_t token, uint8_t * data, const size_t len) override
+	{
+		return m_pOwner->onToken(token, data, len);
+	}
+
+	void onProtocolError(const uint8_t token) override
+	{
+		m_bError = true;
+	}
+
+	SQLardSessionLink * m_pLink;
+	SQLardTokenHandler * m_pOwner;
+	uint16_t m_usSID;
+	bool m_bOpen;
+
+	/* SMP flow control, in DATA packets */
+	uint32_t m_uiSendSeq;
+	uint32_t m_uiPeerWindow;
+	uint32_t m_uiReceivedSeq;
+	uint32_t m_uiConsumedSeq;
+	uint32_t m_uiHighWater;
+	/* Payload of the DATA packets received for this session */
+	SQLardByteBuffer m_inbound;
+
+	/* Response being received */
+	SQLardTokenParser m_parser;
+	SQLardTableResult * m_pResult;
+	/* Result of the result set being received, m_pResult or one chained to it */
+	SQLardTableResult * m_pReceivingResult;
+	uint16_t m_usPacketRemaining;
+	bool m_bLastPacket;
+	bool m_bPending;
+	bool m_bAttentionPending;
+	bool m_bError;
+	uint32_t m_uiDoneCount;
+};
+#endif
+
+#ifdef SQLARD_THREADS
+/* Counts finished tasks down, wait() blocks until all of them are done */
+class SQLardLatch {
+public:
+	SQLardLatch(const uint32_t count = 0) {
+		m_uiCount = count;
+	}
+	/* Expect count more tasks */
+	void add(const uint32_t count = 1) {
+		std::lock_guard<std::mutex> lock(m_mutex);
+		m_uiCount += count;
+	}
+	void countDown() {
+		std::lock_guard<std::mutex> lock(m_mutex);
+		if (m_uiCount > 0 && --m_uiCount == 0)
+			m_cvDone.notify_all();
+	}
+	void wait() {
+		std::unique_lock<std::mutex> lock(m_mutex);
+		m_cvDone.wait(lock, [this] { return m_uiCount == 0; });
+	}
+	bool isDone() {
+		std::lock_guard<std::mutex> lock(m_mutex);
+		return m_uiCount == 0;
+	}
+private:
+	std::mutex m_mutex;
+	std::condition_variable m_cvDone;
+	uint32_t m_uiCount;
+};
+
+/*
+	Work stealing thread pool: every worker has a task queue of its own.
+	Tasks submitted from a worker go to its queue and are run newest first,
+	other tasks are spread over the queues. Idle workers steal the oldest
+	task of another queue.
+*/
+class SQLardThreadPool {
+public:
+	/* 0 threads uses one per hardware thread */
+	SQLardThreadPool(uint16_t threadCount = 0) {
+		if (threadCount == 0)
+			threadCount = static_cast<uint16_t>(std::thread::hardware_concurrency());
+		if (threadCount == 0)
+			threadCount = 1;
+		m_bStop = false;
+		m_uiQueued = 0;
+		m_uiNextQueue = 0;
+		m_usQueueCount = threadCount;
+		m_arQueues = new Queue[threadCount];
+		for (uint16_t i = 0; i < threadCount; i++)
+			m_workers.push_back(std::thread(&SQLardThreadPool::work, this, i));
+	}
+	/* Runs the queued tasks, then joins the workers */
+	~SQLardThreadPool() {
+		{
+			std::lock_guard<std::mutex> lock(m_mutex);
+			m_bStop = true;
+		}
+		m_cvTask.notify_all();
+		for (size_t i = 0; i < m_workers.size(); i++)
+			m_workers[i].join();
+		delete[] m_arQueues;
+	}
+	void submit(std::function<void()> task) {
+		uint16_t index;
+		if (CurrentPool() == this)
+			index = CurrentWorker();
+		else {
+			std::lock_guard<std::mutex> lock(m_mutex);
+			index = m_uiNextQueue++ % m_usQueueCount;
+		}
+		{
+			std::lock_guard<std::mutex> lock(m_arQueues[index].mutex);
+			m_arQueues[index].tasks.push_back(std::move(task));
+		}
+		{
+			std::lock_guard<std::mutex> lock(m_mutex);
+			m_uiQueued++;
+		}
+		m_cvTask.notify_one();
+	}
+	/* Run one queued task on the calling thread, false if there was none */
+	bool runPending() {
+		std::function<void()> task;
+		if (!take(CurrentPool() == this ? CurrentWorker() : 0, task))
+			return false;
+		{
+			std::lock_guard<std::mutex> lock(m_mutex);
+			m_uiQueued--;
+		}
+		task();
+		return true;
+	}
+	const uint16_t GetThreadCount() const { return m_usQueueCount; }
+private:
+	struct Queue {
+		std::mutex mutex;
+		std::deque<std::function<void()> > tasks;
+	};
+
+	static SQLardThreadPool *& CurrentPool() {
+		static thread_local SQLardThreadPool * pPool = nullptr;
+		return pPool;
+	}
+	static uint16_t & CurrentWorker() {
+		static thread_local uint16_t index = 0;
+		return index;
+	}
+
+	/* Newest task of the own queue, else the oldest one of another queue */
+	bool take(const uint16_t index, std::function<void()> & task) {
+		{
+			std::lock_guard<std::mutex> lock(m_arQueues[index].mutex);
+			if (!m_arQueues[index].tasks.empty()) {
+				task = std::move(m_arQueues[index].tasks.back());
+				m_arQueues[index].tasks.pop_back();
+				return true;
+			}
+		}
+		for (uint16_t i = 1; i < m_usQueueCount; i++) {
+			Queue & victim = m_arQueues[(index + i) % m_usQueueCount];
+			std::lock_guard<std::mutex> lock(victim.mutex);
+			if (!victim.tasks.empty()) {
+				task = std::move(victim.tasks.front());
+				victim.tasks.pop_front();
+				return true;
+			}
+		}
+		return false;
+	}
+
+	void work(const uint16_t index) {
+		CurrentPool() = this;
+		CurrentWorker() = index;
+		for (;;) {
+			std::function<void()> task;
+			if (take(index, task)) {
+				{
+					std::lock_guard<std::mutex> lock(m_mutex);
+					m_uiQueued--;
+				}
+				task();
+				continue;
+			}
+			std::unique_lock<std::mutex> lock(m_mutex);
+			m_cvTask.wait(lock, [this] { return m_bStop || m_uiQueued > 0; });
+			if (m_bStop && m_uiQueued == 0)
+				return;
+		}
+	}
+
+	std::vector<std::thread> m_workers;
+	Queue * m_arQueues;
+	uint16_t m_usQueueCount;
+	/* Tasks waiting in any queue */
+	uint32_t m_uiQueued;
+	uint32_t m_uiNextQueue;
+	std::mutex m_mutex;
+	std::condition_variable m_cvTask;
+	bool m_bStop;
+};
+#endif
+
+#ifdef SQLARD_PARALLEL_DECODE
+/*
+	Decodes the rows of a result on a SQLardThreadPool. The receiving thread
+	only copies complete ROW / NBCROW tokens (their boundaries are known from
+	the token parser) into batches of SQLARD_DECODE_BATCH rows, and every full
+	batch becomes a decoding task. finish() waits for the tasks and appends
+	the rows to the result in the order they were received.
+*/
+class SQLardParallelDecoder {
+public:
+	SQLardParallelDecoder() {
+		m_pPool = nullptr;
+		m_pResult = nullptr;
+		m_pCurrent = nullptr;
+	}
+	~SQLardParallelDecoder() {
+		finish();
+	}
+	void setPool(SQLardThreadPool * pPool) { m_pPool = pPool; }
+	bool isEnabled() const { return m_pPool != nullptr; }
+
+	void begin(SQLardTableResult * pResult) {
+		finish();
+		m_pResult = pResult;
+	}
+
+	/* Copy a row token of the result, token type first */
+	void addRow(const uint8_t token, const uint8_t * data, const size_t len) {
+		if (m_pCurrent == nullptr) {
+			m_pCurrent = new Batch();
+			m_pCurrent->offsets.reserve(SQLARD_DECODE_BATCH);
+		}
+		m_pCurrent->offsets.push_back(static_cast<uint32_t>(m_pCurrent->data.length()));
+		m_pCurrent->data.append(&token, 1);
+		m_pCurrent->data.append(data, len);
+		if (m_pCurrent->offsets.size() >= SQLARD_DECODE_BATCH)
+			submit();
+	}
+
+	/* Wait for all batches and move their rows into the result */
+	void finish() {
+		if (m_pResult == nullptr)
+			return;
+		if (m_pCurrent != nullptr) {
+			/* a lone small batch is not worth a task switch */
+			if (m_batches.empty())
+				Decode(m_pResult, m_pCurrent);
+			else
+				submit();
+			if (m_pCurrent != nullptr)
+				m_batches.push_back(m_pCurrent);
+			m_pCurrent = nullptr;
+		}
+		/* help with queued tasks, the caller may be a worker of the pool itself (SQLardFanOut) */
+		while (!m_latch.isDone() && m_pPool->runPending());
+		m_latch.wait();
+		for (size_t i = 0; i < m_batches.size(); i++) {
+			Batch * pBatch = m_batches[i];
+			m_pResult->m_arRows.Reserve(m_pResult->m_arRows.Count() + static_cast<uint32_t>(pBatch->rows.size()));
+			for (size_t r = 0; r < pBatch->rows.size(); r++)
+				m_pResult->appendRowData(pBatch->rows[r]);
+			delete pBatch;
+		}
+		m_batches.clear();
+		m_pResult = nullptr;
+	}
+
+private:
+	struct Batch {
+		SQLardByteBuffer data;
+		std::vector<uint32_t> offsets;
+		std::vector<SQLardRowData *> rows;
+	};
+
+	void submit() {
+		Batch * pBatch = m_pCurrent;
+		SQLardTableResult * pResult = m_pResult;
+		m_pCurrent = nullptr;
+		m_batches.push_back(pBatch);
+		m_latch.add();
+		#ifdef SQLARD_HEAP_STATS
+			/* the rows belong to the connection the result is received on */
+			SQLardHeapAccount * pAccount = SQLardHeap::Current();
+			m_pPool->submit([this, pBatch, pResult, pAccount] {
+				SQLardHeapScope heapScope(pAccount);
+				Decode(pResult, pBatch);
+				m_latch.countDown();
+			});
+		#else
+			m_pPool->submit([this, pBatch, pResult] {
+				Decode(pResult, pBatch);
+				m_latch.countDown();
+			});
+		#endif
+	}
+
+	/* Only reads the column metadata of the result, so batches decode concurrently */
+	static void Decode(const SQLardTableResult * pResult, Batch * pBatch) {
+		pBatch->rows.reserve(pBatch->offsets.size());
+		for (size_t i = 0; i < pBatch->offsets.size(); i++) {
+			size_t offset = pBatch->offsets[i] + 1;
+			const uint8_t token = pBatch->data()[pBatch->offsets[i]];
+			if (token == SQLardTokenType::TOKEN_NBCROW)
+				pBatch->rows.push_back(pResult->DecodeNbcRow(pBatch->data(), offset));
+			else
+				pBatch->rows.push_back(pResult->DecodeRow(pBatch->data(), offset));
+		}
+	}
+
+	SQLardThreadPool * m_pPool;
+	SQLardTableResult * m_pResult;
+	Batch * m_pCurrent;
+	std::vector<Batch *> m_batches;
+	SQLardLatch m_latch;
+};
+#endif
+
+#ifdef SQLARD_CURSORS
+#ifndef SQLARD_MAX_RETURN_VALUES
+	#define SQLARD_MAX_RETURN_VALUES 8
+#endif
+
+/* System stored procedures called by id in RPC requests */
+#define SQLARD_SP_CURSOROPEN 2
+#define SQLARD_SP_CURSORFETCH 7
+#define SQLARD_SP_CURSORCLOSE 9
+
+/* Unnamed parameter of a RPC request, an int (INTN) or a text (NTEXT) */
+struct SQLardRPCParam {
+	const SQLardText * pText;
+	int32_t value;
+	bool bOutput;
+	bool bNull;
+
+	static SQLardRPCParam Int(const int32_t value) {
+		SQLardRPCParam param = { nullptr, value, false, false };
+		return param;
+	}
+	/* By reference, the value comes back in a RETURNVALUE token */
+	static SQLardRPCParam Output(const int32_t value) {
+		SQLardRPCParam param = { nullptr, value, true, false };
+		return param;
+	}
+	static SQLardRPCParam Output() {
+		SQLardRPCParam param = { nullptr, 0, true, true };
+		return param;
+	}
+	static SQLardRPCParam Text(const SQLardText * pText) {
+		SQLardRPCParam param = { pText, 0, false, false };
+		return param;
+	}
+
+	/* Longest output of Write */
+	static const size_t MAX_HEADER_SIZE = 2 + 1 + 4 + 5 + 4;
+
+	/*
+		ParamName, StatusFlags, TYPE_INFO and the value, up to the UTF-16
+		units of a text value which the caller writes after it.
+	*/
+	void Write(uint8_t * buf, size_t & offset, const uint8_t * collation) const {
+		buf[offset++] = 0;
+		buf[offset++] = bOutput ? 0x01 : 0x00;
+		if (pText == nullptr) {
+			buf[offset++] = SQLardDataType::INTNTYPE;
+			buf[offset++] = 4;
+			buf[offset++] = bNull ? 0 : 4;
+			if (!bNull)
+				SQLardUtil::sqlard_write_le<int32_t>(buf, offset, value);
+			return;
+		}
+		const uint32_t len = static_cast<uint32_t>(pText->Length() * 2);
+		buf[offset++] = SQLardDataType::NTEXTTYPE;
+		SQLardUtil::sqlard_write_le<uint32_t>(buf, offset, 0x7FFFFFFF);
+		#ifdef SQLARD_TDS73
+			memcpy(&buf[offset], collation, 5);
+			offset += 5;
+		#endif
+		SQLardUtil::sqlard_write_le<uint32_t>(buf, offset, len);
+	}
+};
+
+class SQLardCursor;
+
+/* Connection used by SQLardCursor, implemented by SQLard */
+class SQLardCursorLink {
+public:
+	virtual ~SQLardCursorLink() {}
+	/* Send sp_cursorfetch for the next block without waiting for it */
+	virtual bool requestCursorBlock(SQLardCursor * pCursor) = 0;
+	/* Receive the block requested last, nullptr on failure */
+	virtual SQLardTableResult * receiveCursorBlock(SQLardCursor * pCursor) = 0;
+	virtual void closeCursor(SQLardCursor * pCursor) = 0;
+};
+
+/*
+	A forward only, read only server cursor (sp_cursoropen), read block by
+	block with sp_cursorfetch. Memory use is bounded by the fetch size
+	instead of the size of the result, and the server runs the query once.
+	With prefetch, the next block is requested as soon as one is received,
+	so the server sends it while the caller works through the current one.
+
+		SQLardCursor cursor(50);
+		if (MSSQL.openCursor(u"SELECT id, v FROM log", cursor))
+			while (SQLardTableResult * pBlock = cursor.fetch()) {
+				...
+				delete pBlock;
+			}
+		cursor.close();
+
+	Other queries may run on the connection while a cursor is open, a
+	prefetched block is received first. Cursors still open when their
+	SQLard is deleted are closed by it.
+*/
+class SQLardCursor {
+	friend class SQLard;
+public:
+	SQLardCursor(const uint16_t fetchSize, const bool bPrefetch = true) {
+		m_pLink = nullptr;
+		m_usFetchSize = fetchSize ? fetchSize : 1;
+		m_bPrefetch = bPrefetch;
+		m_iHandle = 0;
+		m_pColumns = nullptr;
+		m_pNext = nullptr;
+		m_pNextOpen = nullptr;
+		m_bRequested = false;
+		m_bEnd = false;
+		m_ulRowsFetched = 0;
+	}
+	~SQLardCursor() {
+		close();
+	}
+
+	/*
+		Next block of at most the fetch size rows, deleted by the caller,
+		or nullptr at the end of the result or on failure.
+	*/
+	SQLardTableResult * fetch() {
+		if (m_pLink == nullptr)
+			return nullptr;
+		SQLardTableResult * pBlock = m_pNext;
+		m_pNext = nullptr;
+		if (pBlock == nullptr && !m_bEnd) {
+			if (!m_bRequested && !m_pLink->requestCursorBlock(this))
+				return nullptr;
+			pBlock = m_pLink->receiveCursorBlock(this);
+		}
+		if (pBlock == nullptr)
+			return nullptr;
+		m_ulRowsFetched += pBlock->rowCount();
+		if (pBlock->rowCount() < m_usFetchSize)
+			m_bEnd = true;
+		else if (m_bPrefetch)
+			m_pLink->requestCursorBlock(this);
+		if (pBlock->rowCount() == 0) {
+			delete pBlock;
+			return nullptr;
+		}
+		return pBlock;
+	}
+
+	/* Release the cursor on the server, also done by the destructor */
+	void close() {
+		if (m_pLink != nullptr)
+			m_pLink->closeCursor(this);
+		m_pLink = nullptr;
+		if (m_pNext)
+			delete m_pNext;
+		m_pNext = nullptr;
+		if (m_pColumns != nullptr)
+			m_pColumns->Release();
+		m_pColumns = nullptr;
+		m_iHandle = 0;
+		m_bRequested = false;
+	}
+
+	const bool isOpen() const { return m_pLink != nullptr; }
+	const bool isEnd() const { return m_bEnd && m_pNext == nullptr; }
+	const uint16_t GetFetchSize() const { return m_usFetchSize; }
+	const uint32_t GetRowsFetched() const { return m_ulRowsFetched; }
+	/* Columns of the cursor, valid while it is open */
+	const SQLardColumnSet * GetColumns() const { return m_pColumns; }
+private:
+	SQLardCursorLink * m_pLink;
+	uint16_t m_usFetchSize;
+	bool m_bPrefetch;
+	int32_t m_iHandle;
+	SQLardColumnSet * m_pColumns;
+	/* block received ahead, when the connection was needed for another request */
+	SQLardTableResult * m_pNext;
+	/* next in the open cursors of the connection */
+	SQLardCursor * m_pNextOpen;
+	/* a sp_cursorfetch is on the way */
+	bool m_bRequested;
+	bool m_bEnd;
+	uint32_t m_ulRowsFetched;
+};
+#endif
+
+/* States of the connection state machine driven by SQLard::poll */
+enum SQLardConnectionState
+{
+	/* Not connected, next attempt is due */
+	STATE_IDLE,
+	/* Waiting for the TCP connection */
+	STATE_CONNECTING,
+	/* PRELOGIN sent, waiting for the response (TDS 7.3) */
+	STATE_PRELOGIN,
+	/* LOGIN7 sent, waiting for the response */
+	STATE_LOGIN,
+	/* Logged in */
+	STATE_READY,
+	/* Waiting before the next attempt */
+	STATE_BACKOFF
+};
+
+class SQLard : public SQLardTokenHandler
+#ifdef SQLARD_MARS
+	, public SQLardSessionLink
+#endif
+#ifdef SQLARD_CURSORS
+	, public SQLardCursorLink
+#endif
+{
+	#ifdef SQLARD_SYNC
+		friend class SQLardTableSync;
+	#endif
+public:
+	
+	#ifdef WINDOWS
+		SQLard(uint8_t * serverIP, const uint16_t port):resolver(io_service),socket(io_service) {
+			memcpy(m_arrServerIPv4, serverIP, 6);
+			m_usPort = port;
+			m_pLogin7 = nullptr;
+			m_bConnected = false;
+			m_bLoggedIn = false;
+			m_uiPacketIndex = 0;
+			m_usServerPacketSize = 4096;
+			m_pCurrentResult = nullptr;
+			m_bResponsePending = false;
+			m_bRequestFailed = false;
+			m_uiDoneCount = 0;
+			m_ubStatementCount = 0;
+			#ifdef SQLARD_BOUND_COLUMNS
+				m_pBinding = nullptr;
+				m_pBoundColumns = nullptr;
+				m_bBoundEnded = false;
+			#endif
+			#ifdef SQLARD_CURSORS
+				m_pCursorInFlight = nullptr;
+				m_pReceivingCursor = nullptr;
+				m_pOpenCursors = nullptr;
+				m_ubReturnValueCount = 0;
+				memset(m_arCollation, 0, sizeof(m_arCollation));
+			#endif
+			#ifdef SQLARD_DICTIONARY
+				m_usDictionaryEntries = 0;
+			#endif
+			m_bResetConnection = false;
+			m_parser.setHandler(this);
+			m_state = STATE_IDLE;
+			m_iConnectResult = 0;
+			m_ubAttempt = 0;
+			#ifdef SQLARD_MARS
+				attachSessions();
+			#endif
+			m_uiConnectTimeout = SQLARD_CONNECT_TIMEOUT;
+			m_uiLoginTimeout = SQLARD_LOGIN_TIMEOUT;
+			m_uiBackoffMin = SQLARD_BACKOFF_MIN;
+			m_uiBackoffMax = SQLARD_BACKOFF_MAX;
+			m_uiQueryTimeout = SQLARD_QUERY_TIMEOUT;
+			m_ullTransactionDescriptor = 0;
+			m_bInTransaction = false;
+			m_ulResponseDeadline = 0;
+			m_bCancelRequested = false;
+			m_bAttentionPending = false;
+			m_bTimedOut = false;
+			m_bCancelled = false;
+			#ifdef SQLARD_RESULT_CACHE
+				m_pResultCache = nullptr;
+				m_bCacheRecording = false;
+				m_uiDatabaseHash = 0;
+			#endif
+			#ifdef SQLARD_WIRE_CAPTURE
+				m_pCapture = nullptr;
+				m_pReplay = nullptr;
+			#endif
+			#ifdef SQLARD_SPILL
+				m_szResultBudget = 0;
+			#endif
+			#ifdef SQLARD_HEAP_STATS
+				m_pHeapAccount = new SQLardHeapAccount();
+			#endif
+		}
+		bool connect() {
+			#ifdef SQLARD_HEAP_STATS
+				SQLardHeapScope heapScope(m_pHeapAccount);
+			#endif
+			#ifdef SQLARD_WIRE_CAPTURE
+				if (m_pReplay != nullptr)
+					return (m_bConnected = true);
+			#endif
+			#ifdef SQLARD_METRICS
+				const uint32_t ulStart = SQLardUtil::sqlard_micros();
+			#endif
+			long longIP = m_arrServerIPv4[0] << 24 | m_arrServerIPv4[1] << 16 | m_arrServerIPv4[2] <<8| m_arrServerIPv4[3] << 0;
+ 			boost::system::error_code error = boost::asio::error::host_not_found;
+			boost::asio::ip::basic_endpoint<boost::asio::ip::tcp> endP(boost::asio::ip::address_v4(longIP), m_usPort);
+			socket.connect(endP, error);
+			m_bConnected = !error;
+			#ifdef SQLARD_VERBOSE_OUTPUT
+				SQLardUtil::printf(m_bConnected ? F("SQLARD > connect : MSSQL connection successfully established!\n") : F("SQLARD > connect : MSSQL connection failed!\n"));
+			#endif
+			#ifdef SQLARD_METRICS
+				m_stats.m_hConnect.record(SQLardUtil::sqlard_micros() - ulStart);
+			#endif
+			return m_bConnected;
+		}
+	#else
+		SQLard(uint8_t * serverIP, const uint16_t port, EthernetClient * pEthCl) {
+			setServer(serverIP, port, pEthCl);
+			m_pLogin7 = nullptr;
+			m_bConnected = false;
+			m_bLoggedIn = false;
+			m_uiPacketIndex = 0;
+			m_usServerPacketSize = 4096;
+			m_pCurrentResult = nullptr;
+			m_bResponsePending = false;
+			m_bRequestFailed = false;
+			m_uiDoneCount = 0;
+			m_ubStatementCount = 0;
+			#ifdef SQLARD_BOUND_COLUMNS
+				m_pBinding = nullptr;
+				m_pBoundColumns = nullptr;
+				m_bBoundEnded = false;
+			#endif
+			#ifdef SQLARD_CURSORS
+				m_pCursorInFlight = nullptr;
+				m_pReceivingCursor = nullptr;
+				m_pOpenCursors = nullptr;
+				m_ubReturnValueCount = 0;
+				memset(m_arCollation, 0, sizeof(m_arCollation));
+			#endif
+			#ifdef SQLARD_DICTIONARY
+				m_usDictionaryEntries = 0;
+			#endif
+			m_bResetConnection = false;
+			m_parser.setHandler(this);
+			m_state = STATE_IDLE;
+			m_iConnectResult = 0;
+			m_ubAttempt = 0;
+			#ifdef SQLARD_MARS
+				attachSessions();
+			#endif
+			m_uiConnectTimeout = SQLARD_CONNECT_TIMEOUT;
+			m_uiLoginTimeout = SQLARD_LOGIN_TIMEOUT;
+			m_uiBackoffMin = SQLARD_BACKOFF_MIN;
+			m_uiBackoffMax = SQLARD_BACKOFF_MAX;
+			m_uiQueryTimeout = SQLARD_QUERY_TIMEOUT;
+			m_ullTransactionDescriptor = 0;
+			m_bInTransaction = false;
+			m_ulResponseDeadline = 0;
+			m_bCancelRequested = false;
+			m_bAttentionPending = false;
+			m_bTimedOut = false;
+			m_bCancelled = false;
+			#ifdef SQLARD_RESULT_CACHE
+				m_pResultCache = nullptr;
+				m_bCacheRecording = false;
+				m_uiDatabaseHash = 0;
+			#endif
+			#ifdef SQLARD_WIRE_CAPTURE
+				m_pCapture = nullptr;
+				m_pReplay = nullptr;
+			#endif
+			#ifdef SQLARD_HEAP_STATS
+				m_pHeapAccount = new SQLardHeapAccount();
+			#endif
+		}
+		SQLard() {
+			m_pLogin7 = nullptr;
+			m_bConnected = false;
+			m_bLoggedIn = false;
+			m_uiPacketIndex = 0;
+			m_usServerPacketSize = 4096;
+			m_pCurrentResult = nullptr;
+			m_bResponsePending = false;
+			m_bRequestFailed = false;
+			m_uiDoneCount = 0;
+			m_ubStatementCount = 0;
+			#ifdef SQLARD_BOUND_COLUMNS
+				m_pBinding = nullptr;
+				m_pBoundColumns = nullptr;
+				m_bBoundEnded = false;
+			#endif
+			#ifdef SQLARD_CURSORS
+				m_pCursorInFlight = nullptr;
+				m_pReceivingCursor = nullptr;
+				m_pOpenCursors = nullptr;
+				m_ubReturnValueCount = 0;
+				memset(m_arCollation, 0, sizeof(m_arCollation));
+			#endif
+			#ifdef SQLARD_DICTIONARY
+				m_usDictionaryEntries = 0;
+			#endif
+			m_bResetConnection = false;
+			m_parser.setHandler(this);
+			m_state = STATE_IDLE;
+			m_iConnectResult = 0;
+			m_ubAttempt = 0;
+			#ifdef SQLARD_MARS
+				attachSessions();
+			#endif
+			m_uiConnectTimeout = SQLARD_CONNECT_TIMEOUT;
+			m_uiLoginTimeout = SQLARD_LOGIN_TIMEOUT;
+			m_uiBackoffMin = SQLARD_BACKOFF_MIN;
+			m_uiBackoffMax = SQLARD_BACKOFF_MAX;
+			m_uiQueryTimeout = SQLARD_QUERY_TIMEOUT;
+			m_ullTransactionDescriptor = 0;
+			m_bInTransaction = false;
+			m_ulResponseDeadline = 0;
+			m_bCancelRequested = false;
+			m_bAttentionPending = false;
+			m_bTimedOut = false;
+			m_bCancelled = false;
+			#ifdef SQLARD_RESULT_CACHE
+				m_pResultCache = nullptr;
+				m_bCacheRecording = false;
+				m_uiDatabaseHash = 0;
+			#endif
+			#ifdef SQLARD_WIRE_CAPTURE
+				m_pCapture = nullptr;
+				m_pReplay = nullptr;
+			#endif
+			#ifdef SQLARD_HEAP_STATS
+				m_pHeapAccount = new SQLardHeapAccount();
+			#endif
+		}
+		void setServer(uint8_t * serverIP, const uint16_t port, EthernetClient * pEthCl) {
+			memcpy(m_arrServerIPv4, serverIP, 6);
+			m_usPort = port;
+			m_pEthClient = pEthCl;
+		}
+		bool connect() {
+			#ifdef SQLARD_HEAP_STATS
+				SQLardHeapScope heapScope(m_pHeapAccount);
+			#endif
+			#ifdef SQLARD_WIRE_CAPTURE
+				if (m_pReplay != nullptr)
+					return (m_bConnected = true);
+			#endif
+			#ifdef SQLARD_METRICS
+				const uint32_t ulStart = SQLardUtil::sqlard_micros();
+			#endif
+			/* first attempt right away, then jittered exponential backoff between attempts */
+			const int max_retry_count = 10;
+			int current_retry = 0;
+			while (!(m_bConnected = m_pEthClient->connect(m_arrServerIPv4, m_usPort)) && current_retry < max_retry_count)
+				delay(backoffDelay(current_retry++));
+			#ifdef SQLARD_VERBOSE_OUTPUT
+				Serial.println(m_bConnected ? F("SQLARD > connect : MSSQL connection successfully established!") : F("SQLARD > connect : MSSQL connection failed!"));
+			#endif
+			#ifdef SQLARD_METRICS
+				m_stats.m_hConnect.record(SQLardUtil::sqlard_micros() - ulStart);
+			#endif
+			return m_bConnected;
+		}
+
+		/* Maintain the database connection, without blocking. Call it from loop(). */
+		void maintain() {
+			poll();
+		}
+	#endif
+
+	/*
+		Advance the connection state machine by one non-blocking step:
+		connect, PRELOGIN (TDS 7.3), LOGIN7, then ready. Failed or timed out
+		attempts are retried after a jittered exponential backoff, and a lost
+		connection is re-established. Needs setCredentials first.
+		Returns true while the connection is ready for queries.
+	*/
+	bool poll() {
+		if (m_pLogin7 == nullptr)
+			return false;
+		#ifdef SQLARD_HEAP_STATS
+			SQLardHeapScope heapScope(m_pHeapAccount);
+		#endif
+
+		const uint32_t now = SQLardUtil::sqlard_millis();
+		switch (m_state) {
+			case STATE_READY:
+				if (isSocketConnected())
+					return true;
+				#ifdef SQLARD_VERBOSE_OUTPUT
+					SQLardUtil::printf(F("SQLARD > poll : Connection lost!\n"));
+				#endif
+				closeConnection();
+				m_bConnected = false;
+				m_bLoggedIn = false;
+				m_bResponsePending = false;
+				m_ubAttempt = 0;
+				/* fall through */
+			case STATE_IDLE:
+				#ifdef SQLARD_METRICS
+					m_ulStateStart = SQLardUtil::sqlard_micros();
+				#endif
+				startConnect();
+				m_ulDeadline = now + m_uiConnectTimeout;
+				m_state = STATE_CONNECTING;
+				/* fall through */
+			case STATE_CONNECTING:
+			{
+				const int8_t result = checkConnect();
+				if (result == 0 && static_cast<int32_t>(now - m_ulDeadline) < 0)
+					break;
+				if (result <= 0) {
+					failAttempt(now);
+					break;
+				}
+				m_bConnected = true;
+				#ifdef SQLARD_METRICS
+					m_stats.m_hConnect.record(SQLardUtil::sqlard_micros() - m_ulStateStart);
+					m_ulStateStart = SQLardUtil::sqlard_micros();
+				#endif
+				m_ulDeadline = now + m_uiLoginTimeout;
+				#ifdef SQLARD_TDS73
+					sendPrelogin();
+					m_state = STATE_PRELOGIN;
+				#else
+					startLogin();
+				#endif
+				break;
+			}
+			case STATE_PRELOGIN:
+			{
+				const int8_t result = readPreloginResponse();
+				if (result > 0)
+					startLogin();
+				else if (result < 0 || static_cast<int32_t>(now - m_ulDeadline) >= 0)
+					failAttempt(now);
+				break;
+			}
+			case STATE_LOGIN:
+				if (pumpResponse(false)) {
+					if (!m_bLoggedIn) {
+						failAttempt(now);
+						break;
+					}
+					#ifdef SQLARD_METRICS
+						m_stats.m_hLogin.record(SQLardUtil::sqlard_micros() - m_ulStateStart);
+					#endif
+					m_state = STATE_READY;
+					m_ubAttempt = 0;
+				}
+				else if (static_cast<int32_t>(now - m_ulDeadline) >= 0)
+					failAttempt(now);
+				break;
+			case STATE_BACKOFF:
+				if (static_cast<int32_t>(now - m_ulDeadline) >= 0)
+					m_state = STATE_IDLE;
+				break;
+		}
+		return m_state == STATE_READY;
+	}
+
+	SQLardConnectionState getState() const { return m_state; }
+
+	/* Deadlines (ms) of a TCP connect, and of PRELOGIN + LOGIN7 together */
+	void setTimeouts(const uint32_t connectTimeout, const uint32_t loginTimeout) {
+		m_uiConnectTimeout = connectTimeout;
+		m_uiLoginTimeout = loginTimeout;
+	}
+	/* Retry delays (ms) start at minDelay and double per failed attempt up to maxDelay */
+	void setBackoff(const uint32_t minDelay, const uint32_t maxDelay) {
+		m_uiBackoffMin = minDelay;
+		m_uiBackoffMax = maxDelay;
+	}
+
+	/*
+		Deadline (ms) of the responses of the next queries, 0 waits forever.
+		A response not complete in time is cancelled, see cancel.
+	*/
+	void setQueryTimeout(const uint32_t timeout) { m_uiQueryTimeout = timeout; }
+	uint32_t getQueryTimeout() const { return m_uiQueryTimeout; }
+
+	/*
+		Abort the query in progress: the call waiting for its response sends an
+		ATTENTION packet, drains the response up to the server's acknowledgement
+		and returns what was received so far. Under WINDOWS it may be called
+		from another thread.
+		If the server does not acknowledge within SQLARD_CANCEL_TIMEOUT ms the
+		connection is closed, poll reconnects it.
+	*/
+	void cancel() {
+		if (m_bResponsePending)
+			m_bCancelRequested = true;
+	}
+
+	/* The last query was cancelled, by cancel or by its timeout */
+	bool wasCancelled() const { return m_bCancelled; }
+
+	#ifdef SQLARD_PARALLEL_DECODE
+		/*
+			Decode the rows of the following results on pPool (nullptr decodes
+			on the calling thread again). Pays off for results with many rows.
+		*/
+		void setParallelDecode(SQLardThreadPool * pPool) { m_decoder.setPool(pPool); }
+	#endif
+
+	#ifdef SQLARD_DICTIONARY
+		/*
+			Store each distinct value of the character columns of every following
+			result once, for columns of up to maxEntries distinct values; values
+			past that are copied per row. 0 turns it off.
+		*/
+		void setDictionaryEncoding(const uint16_t maxEntries) { m_usDictionaryEntries = maxEntries; }
+	#endif
+
+	#ifdef SQLARD_SPILL
+		/*
+			Memory budget of every following result in bytes, 0 for none. Rows
+			past the budget are spilled to a temporary file in directory, by
+			default the one named by TMPDIR, TMP or TEMP, else the current one
+			(see SQLardTableResult::SetMemoryBudget).
+		*/
+		void setResultMemoryBudget(const size_t budgetBytes, const char * directory = nullptr) {
+			m_szResultBudget = budgetBytes;
+			if (directory == nullptr)
+				directory = getenv("TMPDIR");
+			if (directory == nullptr)
+				directory = getenv("TMP");
+			if (directory == nullptr)
+				directory = getenv("TEMP");
+			m_strSpillDirectory = directory != nullptr ? directory : ".";
+		}
+	#endif
+
+	/* The response of the last request held an error, or could not be received */
+	bool hasError() const { return m_bResponseError; }
+
+	/*
+		Statements of the last batch that reported a row count (DONE_COUNT),
+		such as the UPDATE of "UPDATE ...; SELECT ...", in the order they ran.
+		Only the first SQLARD_MAX_STATEMENT_COUNTS counts are kept.
+	*/
+	uint8_t getStatementCount() const { return m_ubStatementCount; }
+	/* Row count of a statement of the last batch, see getStatementCount */
+	uint32_t getStatementRowCount(const uint8_t index) const {
+		return index < m_ubStatementCount && index < SQLARD_MAX_STATEMENT_COUNTS ? m_arStatementCounts[index] : 0;
+	}
+
+	#ifdef SQLARD_COLUMN_CACHE
+		/* Column layouts of recent results, shared by results with the same layout */
+		SQLardColumnCache & getColumnCache() { return m_columnCache; }
+	#endif
+
+	#ifdef SQLARD_HEAP_STATS
+		/* Heap use of this connection, results included until they are deleted */
+		const SQLardHeapStats & getHeapStats() const { return m_pHeapAccount->GetStats(); }
+		/* Heap use of the current or last query, see SQLardHeapAccount::GetQueryStats */
+		const SQLardHeapStats & getQueryHeapStats() const { return m_pHeapAccount->GetQueryStats(); }
+	#endif
+
+	~SQLard() {
+		#ifdef SQLARD_BOUND_COLUMNS
+			endBound();
+		#endif
+		#ifdef SQLARD_CURSORS
+			/* cursors outliving the connection must not call back into it */
+			while (m_pOpenCursors != nullptr) {
+				SQLardCursor * pCursor = m_pOpenCursors;
+				if (!m_bConnected) {
+					m_pOpenCursors = pCursor->m_pNextOpen;
+					pCursor->m_pLink = nullptr;
+				}
+				/* unlinks it, see closeCursor */
+				pCursor->close();
+			}
+		#endif
+		if (m_pLogin7)
+			delete m_pLogin7;
+		#ifdef SQLARD_RESULT_CACHE
+			if (m_pResultCache)
+				delete m_pResultCache;
+		#endif
+		#ifdef SQLARD_HEAP_STATS
+			/* results and members still holding blocks keep the account alive */
+			m_pHeapAccount->Detach();
+		#endif
+	}
+	
+	void setCredentials(const SQLardText & wcszdbName, const SQLardText & wcszUserName, const SQLardText & wcszPassword, const SQLardText & wcszHost) {
+		#ifdef SQLARD_HEAP_STATS
+			SQLardHeapScope heapScope(m_pHeapAccount);
+		#endif
+		if (m_pLogin7)
+			delete m_pLogin7;
+		m_pLogin7 = new SQLardLOGIN7();
+		m_pLogin7->SetUserName(wcszUserName);
+		m_pLogin7->SetPassword(wcszPassword);
+		m_pLogin7->SetHost(wcszHost);
+		m_pLogin7->SetDatabase(wcszdbName);
+	}
+
+	bool login() {
+		if (!m_bConnected || !m_pLogin7)
+		{
+			#ifdef SQLARD_VERBOSE_OUTPUT
+				SQLardUtil::printf(F("SQLARD > login : Not connected or no login structure!"));
+			#endif
+			return false;
+		}
+		#ifdef SQLARD_HEAP_STATS
+			SQLardHeapScope heapScope(m_pHeapAccount);
+		#endif
+		#ifdef SQLARD_METRICS
+			const uint32_t ulStart = SQLardUtil::sqlard_micros();
+		#endif
+		#ifdef SQLARD_TDS73
+			sendPrelogin();
+			int8_t result;
+			const uint32_t ulPreloginStart = SQLardUtil::sqlard_millis();
+			while ((result = readPreloginResponse()) == 0 && SQLardUtil::sqlard_millis() - ulPreloginStart < m_uiLoginTimeout);
+			if (result <= 0)
+				return false;
+		#endif
+		/* the encoded packet is kept by m_pLogin7 for later reconnects */
+		size_t len = 0;
+		const uint8_t * data = m_pLogin7->GetPacket(len);
+		m_bResetConnection = false;
+		m_bLoggedIn = false;
+		sendTDSPacket(0x10, const_cast<uint8_t*>(data), len);
+		m_state = m_bLoggedIn ? STATE_READY : STATE_IDLE;
+		#ifdef SQLARD_METRICS
+			m_stats.m_hLogin.record(SQLardUtil::sqlard_micros() - ulStart);
+		#endif
+		return m_bLoggedIn;
+	}
+
+	/*
+		Recycle the session of a logged in connection without a new login:
+		the next request carries the RESETCONNECTION status bit, and the
+		server resets the session state before executing it. The session is
+		back in the login database and an open transaction is rolled back.
+		The bit needs TDS 7.1 or later: without SQLARD_TDS73 (a TDS 7.0 login)
+		nothing is reset and false is returned.
+	*/
+	bool resetSession() {
+		#ifdef SQLARD_TDS73
+			m_bResetConnection = m_bLoggedIn;
+			return m_bLoggedIn;
+		#else
+			return false;
+		#endif
+	}
+
+	/*
+		Explicit transactions: statements executed between begin() and
+		commit() / rollback() are committed together instead of one by one.
+		With TDS 7.3 these are Transaction Manager requests, the descriptor
+		of the transaction goes into the ALL_HEADERS of every request.
+	*/
+	bool begin() {
+		#ifdef SQLARD_HEAP_STATS
+			SQLardHeapScope heapScope(m_pHeapAccount, true);
+		#endif
+		#ifdef SQLARD_TDS73
+			sendTransactionRequest(5);
+		#else
+			sendSQLBatch(u"BEGIN TRANSACTION");
+			if (!m_bResponseError)
+				m_bInTransaction = true;
+		#endif
+		return !m_bResponseError && m_bInTransaction;
+	}
+	bool commit() {
+		#ifdef SQLARD_HEAP_STATS
+			SQLardHeapScope heapScope(m_pHeapAccount, true);
+		#endif
+		#ifdef SQLARD_TDS73
+			sendTransactionRequest(7);
+		#else
+			sendSQLBatch(u"COMMIT TRANSACTION");
+			if (!m_bResponseError)
+				m_bInTransaction = false;
+		#endif
+		return !m_bResponseError && !m_bInTransaction;
+	}
+	bool rollback() {
+		#ifdef SQLARD_HEAP_STATS
+			SQLardHeapScope heapScope(m_pHeapAccount, true);
+		#endif
+		#ifdef SQLARD_TDS73
+			sendTransactionRequest(8);
+		#else
+			sendSQLBatch(u"ROLLBACK TRANSACTION");
+			if (!m_bResponseError)
+				m_bInTransaction = false;
+		#endif
+		#ifdef SQLARD_RESULT_CACHE
+			/* results read inside the transaction may hold rolled back rows */
+			if (m_pResultCache != nullptr)
+				m_pResultCache->Clear();
+		#endif
+		return !m_bResponseError && !m_bInTransaction;
+	}
+	bool inTransaction() const { return m_bInTransaction; }
+
+	/*
+		Execute a INSERT, UPDATE or DELETE query.
+		Returns affected row count.
+	*/
+	long executeNonQuery(const SQLardText & query) {
+		#ifdef SQLARD_HEAP_STATS
+			SQLardHeapScope heapScope(m_pHeapAccount, true);
+		#endif
+		{
+			#ifdef SQLARD_METRICS
+				m_stats.beginQuery();
+			#endif
+			sendSQLBatch(query, false);
+			#ifdef SQLARD_METRICS
+				m_stats.markSent();
+			#endif
+			waitResponse();
+			#ifdef SQLARD_METRICS
+				m_stats.endQuery(query.Units(), 0, m_bResponseError);
+			#endif
 		}
-		/* SSPI long */
-		SQLardUtil::sqlard_write_le<uint32_t>(offset_buffer, obuf_offset, 0);
-		/* Place offset table */
-		memcpy(&buf[offset], offset_buffer, offset_table_size);
-		offset += offset_table_size;
-		memcpy(&buf[offset], table_buffer(), table_size * 2);
-		offset += table_size * 2;
-		SQLardUtil::freeRam("fs");
-		return table_size;
+		#ifdef SQLARD_RESULT_CACHE
+			if (m_pResultCache != nullptr) {
+				/* Drop cached reads of every table this statement may have written */
+				uint32_t tags[SQLARD_CACHE_MAX_TAGS];
+				uint8_t tagCount = SQLardResultCache::ExtractTableTags(query.Units(), tags, SQLARD_CACHE_MAX_TAGS);
+				if (tagCount == 0 || tagCount == SQLARD_CACHE_MAX_TAGS)
+					m_pResultCache->Clear();
+				for (uint8_t i = 0; i < tagCount; i++)
+					m_pResultCache->InvalidateTag(tags[i]);
+			}
+		#endif
+		return m_uiDoneCount;
+	}
+	/*
+		Execute a SELECT query, or a batch of them. Each result set of the
+		batch has a result of its own, see SQLardTableResult::nextResult.
+		Row counts of the other statements of the batch, see getStatementCount.
+	*/
+	SQLardTableResult *  executeReader(const SQLardText & query) {
+		#ifdef SQLARD_HEAP_STATS
+			SQLardHeapScope heapScope(m_pHeapAccount, true);
+		#endif
+		#ifdef SQLARD_RESULT_CACHE
+			if (m_pResultCache != nullptr)
+				return executeReader(query, 0);
+		#endif
+		return executeUncached(query);
+	}
+
+	#ifdef SQLARD_QUERY_SOURCES
+		/*
+			Execute query text read from source while it is sent, so only one
+			packet of it is in RAM at a time. Streamed statements bypass the
+			result cache; executeNonQuery clears it, as the tables written are
+			not known. Returns affected row count.
+		*/
+		long executeNonQuery(SQLardQuerySource & source) {
+			#ifdef SQLARD_HEAP_STATS
+				SQLardHeapScope heapScope(m_pHeapAccount, true);
+			#endif
+			#ifdef SQLARD_METRICS
+				m_stats.beginQuery();
+			#endif
+			sendSQLBatch(source, false);
+			#ifdef SQLARD_METRICS
+				m_stats.markSent();
+			#endif
+			waitResponse();
+			#ifdef SQLARD_METRICS
+				m_stats.endQuery(nullptr, 0, m_bResponseError);
+			#endif
+			#ifdef SQLARD_RESULT_CACHE
+				if (m_pResultCache != nullptr)
+					m_pResultCache->Clear();
+			#endif
+			return m_uiDoneCount;
+		}
+		SQLardTableResult * executeReader(SQLardQuerySource & source) {
+			#ifdef SQLARD_HEAP_STATS
+				SQLardHeapScope heapScope(m_pHeapAccount, true);
+			#endif
+			#ifdef SQLARD_METRICS
+				m_stats.beginQuery();
+			#endif
+			sendSQLBatch(source, false);
+			#ifdef SQLARD_METRICS
+				m_stats.markSent();
+				SQLardTableResult * pResult = waitRowData();
+				m_stats.endQuery(nullptr, m_uiRowsParsed, m_bResponseError);
+				return pResult;
+			#else
+				return waitRowData();
+			#endif
+		}
+	#endif
+
+	#ifdef SQLARD_MARS
+		/* MARS was negotiated at login, sessions can be opened */
+		bool isMARS() const { return m_bMARS; }
+
+		/*
+			Open another session on this connection, or nullptr if MARS is off or
+			all SQLARD_MARS_SESSIONS are in use. SQLard itself uses the default
+			session; the returned session stays owned by SQLard, release it with close().
+		*/
+		SQLardSession * openSession() {
+			if (!m_bMARS || !m_bLoggedIn)
+				return nullptr;
+			for (uint16_t i = 1; i < SQLARD_MARS_SESSIONS; i++) {
+				SQLardSession & session = m_arSessions[i];
+				if (session.m_bOpen || session.m_bPending)
+					continue;
+				session.reset();
+				session.m_bOpen = true;
+				if (!sendSMP(&session, SMP_SYN, nullptr, 0)) {
+					session.m_bOpen = false;
+					return nullptr;
+				}
+				return &session;
+			}
+			return nullptr;
+		}
+	#endif
+
+	#ifdef SQLARD_METRICS
+		/* Statistics of this connection, see SQLardStats::exportPrometheus / exportJSON */
+		SQLardStats & getStats() { return m_stats; }
+	#endif
+
+	#ifdef SQLARD_WIRE_CAPTURE
+		/* Record every packet sent and received into pCapture (nullptr stops capturing). */
+		void setWireCapture(SQLardWireCapture * pCapture) { m_pCapture = pCapture; }
+		/*
+			Talk to pReplay instead of the server (nullptr returns to the socket).
+			connect() always succeeds while a replay is set.
+		*/
+		void setReplay(SQLardWireReplay * pReplay) { m_pReplay = pReplay; }
+	#endif
+
+	#ifdef SQLARD_RESULT_CACHE
+		/*
+			Serve repeated executeReader calls from a local cache holding at most
+			byteBudget bytes. Entries expire after defaultTTL milliseconds, and are
+			invalidated by executeNonQuery statements writing to tables they read.
+		*/
+		void enableResultCache(const size_t byteBudget, const uint32_t defaultTTL) {
+			disableResultCache();
+			#ifdef SQLARD_HEAP_STATS
+				SQLardHeapScope heapScope(m_pHeapAccount);
+			#endif
+			m_pResultCache = new SQLardResultCache(byteBudget, defaultTTL);
+		}
+		void disableResultCache() {
+			if (m_pResultCache)
+				delete m_pResultCache;
+			m_pResultCache = nullptr;
+		}
+		SQLardResultCache * getResultCache() { return m_pResultCache; }
+
+		void invalidateCachedResult(const SQLardText & query) {
+			if (m_pResultCache != nullptr)
+				m_pResultCache->Invalidate(resultCacheContext(), query.Units(), query.Length());
+		}
+		void invalidateCachedTable(const SQLardText & tableName) {
+			if (m_pResultCache != nullptr)
+				m_pResultCache->InvalidateTag(SQLardResultCache::HashTableName(tableName.Units(), tableName.Length()));
+		}
+
+		/*
+			Execute a SELECT query through the result cache, with a TTL (ms) for this
+			entry. A TTL of 0 uses the default TTL given to enableResultCache.
+		*/
+		SQLardTableResult * executeReader(const SQLardText & query, const uint32_t cacheTTL) {
+			if (m_pResultCache == nullptr)
+				return executeReader(query);
+			#ifdef SQLARD_HEAP_STATS
+				SQLardHeapScope heapScope(m_pHeapAccount, true);
+			#endif
+			#ifdef SQLARD_METRICS
+				m_stats.beginQuery();
+			#endif
+			uint32_t dataLen = 0;
+			SQLardTableResult * pResult = nullptr;
+			const uint8_t * cached = m_pResultCache->Lookup(resultCacheContext(), query.Units(), query.Length(), dataLen);
+			if (cached != nullptr) {
+				/* replay the cached token stream through the parser */
+				m_pCurrentResult = pResult = newResult();
+				resetResponseState();
+				#ifdef SQLARD_PARALLEL_DECODE
+					m_decoder.begin(m_pCurrentResult);
+				#endif
+				m_parser.feed(cached, dataLen);
+				#ifdef SQLARD_PARALLEL_DECODE
+					m_decoder.finish();
+				#endif
+				m_pCurrentResult = nullptr;
+				#ifdef SQLARD_METRICS
+					m_stats.m_uiCacheHits++;
+				#endif
+			}
+			else {
+				sendSQLBatch(query, false);
+				#ifdef SQLARD_METRICS
+					m_stats.markSent();
+				#endif
+				pResult = waitRowData(&query, cacheTTL);
+			}
+			#ifdef SQLARD_METRICS
+				m_stats.endQuery(query.Units(), m_uiRowsParsed, m_bResponseError);
+			#endif
+			return pResult;
+		}
+	#endif
+
+	#ifdef SQLARD_BOUND_COLUMNS
+		/*
+			Execute a SELECT query whose rows are fetched into the arrays of
+			binding, see SQLardBinding. Rows stay on the wire until fetched; the
+			statement is closed by the last fetch, closeBound, or the next query.
+			Bound statements bypass the result cache and metrics.
+			Returns false if the query failed or a bound column does not convert.
+		*/
+		bool executeBound(const SQLardText & query, SQLardBinding & binding) {
+			#ifdef SQLARD_HEAP_STATS
+				SQLardHeapScope heapScope(m_pHeapAccount, true);
+			#endif
+			sendSQLBatch(query, false);
+			binding.m_usRowCount = 0;
+			m_pBinding = &binding;
+			m_bBoundEnded = false;
+			beginResponse();
+			/* onColumnMetadata pauses the parser once the columns are bound */
+			pumpResponse();
+			if (m_parser.isPaused())
+				return true;
+			finishResponse();
+			endBound();
+			return false;
+		}
+
+		/*
+			Fill the bound arrays with the next rowset.
+			Returns the number of rows filled, 0 once the result set is exhausted.
+		*/
+		uint16_t fetch() {
+			if (m_pBinding == nullptr)
+				return 0;
+			#ifdef SQLARD_HEAP_STATS
+				SQLardHeapScope heapScope(m_pHeapAccount);
+			#endif
+			SQLardBinding * pBinding = m_pBinding;
+			pBinding->m_usRowCount = 0;
+			if (m_parser.isPaused())
+				m_parser.resume();
+			if (!m_parser.isPaused() && m_bResponsePending)
+				pumpResponse();
+			if (!m_parser.isPaused()) {
+				finishResponse();
+				endBound();
+			}
+			return pBinding->m_usRowCount;
+		}
+
+		/* Drop the rows not fetched yet, cancelling the rest of the response */
+		void closeBound() {
+			if (m_pBinding == nullptr)
+				return;
+			m_pBinding = nullptr;
+			if (m_parser.isPaused())
+				m_parser.resume();
+			/* the rest is already buffered, drain it instead of cancelling */
+			if (m_bResponsePending && m_parser.isDone())
+				pumpResponse();
+			if (m_bResponsePending)
+				cancelResponse();
+			endBound();
+		}
+	#endif
+
+	#ifdef SQLARD_CURSORS
+		/*
+			Open a forward only, read only server cursor over a SELECT query,
+			read with cursor.fetch(), see SQLardCursor. An open cursor is closed first.
+			Returns false if the query failed.
+		*/
+		bool openCursor(const SQLardText & query, SQLardCursor & cursor) {
+			cursor.close();
+			#ifdef SQLARD_HEAP_STATS
+				SQLardHeapScope heapScope(m_pHeapAccount, true);
+			#endif
+			cursor.m_bEnd = false;
+			cursor.m_ulRowsFetched = 0;
+			/* @cursor OUTPUT, @stmt, @scrollopt OUTPUT (FAST_FORWARD), @ccopt OUTPUT (READ_ONLY), @rowcount OUTPUT */
+			const SQLardRPCParam params[] = {
+				SQLardRPCParam::Output(), SQLardRPCParam::Text(&query),
+				SQLardRPCParam::Output(0x0010), SQLardRPCParam::Output(0x0001), SQLardRPCParam::Output(0)
+			};
+			sendRPC(SQLARD_SP_CURSOROPEN, params, 5);
+			SQLardTableResult * pResult = waitRowData();
+			if (!m_bResponseError && m_ubReturnValueCount > 0 && m_arReturnValues[0] != 0 && pResult->GetColumnSet() != nullptr) {
+				cursor.m_iHandle = m_arReturnValues[0];
+				cursor.m_pColumns = pResult->GetColumnSet();
+				cursor.m_pColumns->Retain();
+				cursor.m_pLink = this;
+				cursor.m_pNextOpen = m_pOpenCursors;
+				m_pOpenCursors = &cursor;
+			}
+			#ifdef SQLARD_VERBOSE_OUTPUT
+			else
+				SQLardUtil::printf(F("SQLARD > openCursor : Failed!\n"));
+			#endif
+			delete pResult;
+			return cursor.m_pLink != nullptr;
+		}
+	#endif
+protected:
+	/* executeReader past the result cache */
+	SQLardTableResult * executeUncached(const SQLardText & query) {
+		#ifdef SQLARD_HEAP_STATS
+			SQLardHeapScope heapScope(m_pHeapAccount, true);
+		#endif
+		#ifdef SQLARD_METRICS
+			m_stats.beginQuery();
+		#endif
+		sendSQLBatch(query, false);
+		#ifdef SQLARD_METRICS
+			m_stats.markSent();
+			SQLardTableResult * pResult = waitRowData();
+			m_stats.endQuery(query.Units(), m_uiRowsParsed, m_bResponseError);
+			return pResult;
+		#else
+			return waitRowData();
+		#endif
+	}
+
+	#ifdef SQLARD_CURSORS
+		bool requestCursorBlock(SQLardCursor * pCursor) override {
+			/* @cursor, @fetchtype (NEXT), @rownum, @nrows */
+			const SQLardRPCParam params[] = {
+				SQLardRPCParam::Int(pCursor->m_iHandle), SQLardRPCParam::Int(0x0002),
+				SQLardRPCParam::Int(0), SQLardRPCParam::Int(pCursor->m_usFetchSize)
+			};
+			if (!sendRPC(SQLARD_SP_CURSORFETCH, params, 4))
+				return false;
+			pCursor->m_bRequested = true;
+			m_pCursorInFlight = pCursor;
+			return true;
+		}
+
+		SQLardTableResult * receiveCursorBlock(SQLardCursor * pCursor) override {
+			#ifdef SQLARD_HEAP_STATS
+				SQLardHeapScope heapScope(m_pHeapAccount, true);
+			#endif
+			pCursor->m_bRequested = false;
+			if (m_pCursorInFlight == pCursor)
+				m_pCursorInFlight = nullptr;
+			m_pReceivingCursor = pCursor;
+			m_pCurrentResult = newResult();
+			#ifdef SQLARD_PARALLEL_DECODE
+				m_decoder.begin(m_pCurrentResult);
+			#endif
+			beginResponse();
+			m_parser.setColumns(pCursor->m_pColumns);
+			pumpResponse();
+			finishResponse();
+			#ifdef SQLARD_PARALLEL_DECODE
+				m_decoder.finish();
+			#endif
+			SQLardTableResult * pBlock = m_pCurrentResult;
+			m_pCurrentResult = nullptr;
+			m_pReceivingCursor = nullptr;
+			if (m_bResponseError || m_bTimedOut) {
+				delete pBlock;
+				pBlock = nullptr;
+				pCursor->m_bEnd = true;
+			}
+			return pBlock;
+		}
+
+		void closeCursor(SQLardCursor * pCursor) override {
+			for (SQLardCursor ** ppCursor = &m_pOpenCursors; *ppCursor != nullptr; ppCursor = &(*ppCursor)->m_pNextOpen)
+				if (*ppCursor == pCursor) {
+					*ppCursor = pCursor->m_pNextOpen;
+					break;
+				}
+			pCursor->m_pNextOpen = nullptr;
+			if (pCursor->m_bRequested) {
+				SQLardTableResult * pBlock = receiveCursorBlock(pCursor);
+				if (pBlock)
+					delete pBlock;
+			}
+			#ifdef SQLARD_HEAP_STATS
+				SQLardHeapScope heapScope(m_pHeapAccount, true);
+			#endif
+			const SQLardRPCParam params[] = { SQLardRPCParam::Int(pCursor->m_iHandle) };
+			if (sendRPC(SQLARD_SP_CURSORCLOSE, params, 1))
+				waitResponse();
+		}
+
+		/* The connection is needed for another request, receive a block that is on the way */
+		void settleCursor() {
+			if (m_pCursorInFlight == nullptr)
+				return;
+			SQLardCursor * pCursor = m_pCursorInFlight;
+			pCursor->m_pNext = receiveCursorBlock(pCursor);
+		}
+	#endif
+
+	#ifdef SQLARD_BOUND_COLUMNS
+		void endBound() {
+			m_pBinding = nullptr;
+			if (m_pBoundColumns != nullptr)
+				m_pBoundColumns->Release();
+			m_pBoundColumns = nullptr;
+		}
+	#endif
+
+	#ifdef SQLARD_RESULT_CACHE
+		/* Cached results belong to the login and the database in use, which USE may have changed */
+		uint32_t resultCacheContext() {
+			uint32_t context = 2166136261UL;
+			uint32_t database = m_uiDatabaseHash;
+			if (m_pLogin7 != nullptr) {
+				context = SQLardUtil::sqlard_hash_wstr(m_pLogin7->GetUserName());
+				if (database == 0)
+					database = SQLardUtil::sqlard_hash_wstr(m_pLogin7->GetDatabase());
+			}
+			return (context ^ database) * 16777619UL;
+		}
+	#endif
+
+	#ifdef SQLARD_MARS
+		void attachSessions() {
+			m_bMARS = false;
+			for (uint16_t i = 0; i < SQLARD_MARS_SESSIONS; i++)
+				m_arSessions[i].attach(this, this, i);
+			m_pSendSession = &m_arSessions[0];
+		}
+
+		/* Wrap data in a SMP packet of the session, DATA waits for room in the peer window */
+		bool sendSMP(SQLardSession * pSession, const uint8_t flags, const uint8_t * data, const uint16_t len) override {
+			if (flags == SMP_DATA) {
+				/* no window update before the deadline, sending anyway would overrun the peer */
+				while (!pSession->canSend()) {
+					if (!receiveSMP(true))
+						return false;
+				}
+			}
+			SQLardBuffer<uint8_t> buf(16 + len);
+			pSession->putSMPHeader(buf(), flags, buf.alloc_size());
+			if (len)
+				memcpy(&buf[16], data, len);
+			return writeToSocket(buf(), buf.alloc_size());
+		}
+
+		bool sendSessionBatch(SQLardSession * pSession, const SQLardText & query) override {
+			m_pSendSession = pSession;
+			const bool bSent = sendSQLBatch(query, false);
+			m_pSendSession = &m_arSessions[0];
+			/* the failure belongs to the session, not to the next response of the connection */
+			m_bRequestFailed = false;
+			return bSent;
+		}
+
+		void sendSessionAttention(SQLardSession * pSession) override {
+			m_pSendSession = pSession;
+			sendTDSPacket(0x06, nullptr, 0, false);
+			m_pSendSession = &m_arSessions[0];
+		}
+
+		#ifdef SQLARD_COLUMN_CACHE
+			SQLardColumnCache * sessionColumnCache() override { return &m_columnCache; }
+		#endif
+
+		/*
+			Demultiplex one SMP packet: DATA payload goes to the receive buffer of its
+			session, window updates and FIN to the session state.
+		*/
+		bool receiveSMP(const bool bBlocking) override {
+			if (availableFromSocket() < 16 && (!bBlocking || waitSocket(16, true) < 16))
+				return false;
+			uint8_t header[16];
+			if (!readFromSocket(header, 16)) {
+				m_bResponseError = true;
+				return false;
+			}
+			size_t offset = 2;
+			const uint16_t sid = SQLardUtil::sqlard_read_le<uint16_t>(header, offset);
+			const uint32_t length = SQLardUtil::sqlard_read_le<uint32_t>(header, offset);
+			const uint32_t seq = SQLardUtil::sqlard_read_le<uint32_t>(header, offset);
+			const uint32_t window = SQLardUtil::sqlard_read_le<uint32_t>(header, offset);
+			if (header[0] != 0x53 || length < 16) {
+				#ifdef SQLARD_VERBOSE_OUTPUT
+					SQLardUtil::printf(F("SQLARD > receiveSMP : Invalid packet!\n"));
+				#endif
+				m_bResponseError = true;
+				return false;
+			}
+			SQLardSession * pSession = sid < SQLARD_MARS_SESSIONS ? &m_arSessions[sid] : nullptr;
+			uint8_t chunk[SQLARD_RECEIVE_CHUNK];
+			for (uint32_t remaining = length - 16; remaining > 0;) {
+				uint16_t count = remaining > SQLARD_RECEIVE_CHUNK ? SQLARD_RECEIVE_CHUNK : static_cast<uint16_t>(remaining);
+				/* a truncated packet leaves the stream out of step, nothing after it can be trusted */
+				if ((availableFromSocket() < count && waitSocket(count) < count) || !readFromSocket(chunk, count)) {
+					#ifdef SQLARD_VERBOSE_OUTPUT
+						SQLardUtil::printf(F("SQLARD > receiveSMP : Truncated packet!\n"));
+					#endif
+					m_bResponseError = true;
+					return false;
+				}
+				if (pSession != nullptr)
+					pSession->m_inbound.append(chunk, count);
+				remaining -= count;
+			}
+			if (pSession != nullptr)
+				pSession->onSMP(header[1], seq, window);
+			return true;
+		}
+
+		/*
+			Wait until minimum bytes are available, for at most the query timeout.
+			bCancellable also stops on cancel, only between packets so the stream stays in step.
+		*/
+		int waitSocket(const int minimum, const bool bCancellable = false)
+		{
+			int num = 0;
+			const uint32_t ulStart = SQLardUtil::sqlard_millis();
+			while ((num = availableFromSocket()) < minimum && isSocketConnected() && !(bCancellable && cancelRequested())
+				&& (m_uiQueryTimeout == 0 || SQLardUtil::sqlard_millis() - ulStart < m_uiQueryTimeout));
+			return num;
+		}
+	#endif
+
+	/* Start a TCP connection attempt */
+	void startConnect()
+	{
+		#ifdef SQLARD_WIRE_CAPTURE
+			if (m_pReplay != nullptr) {
+				m_iConnectResult = 1;
+				return;
+			}
+		#endif
+		#ifndef WINDOWS
+			/* the Ethernet libraries only offer a blocking connect */
+			m_iConnectResult = m_pEthClient->connect(m_arrServerIPv4, m_usPort) ? 1 : -1;
+		#else
+			long longIP = m_arrServerIPv4[0] << 24 | m_arrServerIPv4[1] << 16 | m_arrServerIPv4[2] << 8 | m_arrServerIPv4[3] << 0;
+			boost::asio::ip::basic_endpoint<boost::asio::ip::tcp> endP(boost::asio::ip::address_v4(longIP), m_usPort);
+			boost::system::error_code ignored_error;
+			socket.close(ignored_error);
+			m_iConnectResult = 0;
+			io_service.reset();
+			socket.async_connect(endP, [this](const boost::system::error_code & error) {
+				m_iConnectResult = error ? -1 : 1;
+			});
+		#endif
+	}
+
+	/* Result of the connection attempt: 1 connected, 0 pending, -1 failed */
+	int8_t checkConnect()
+	{
+		#ifdef WINDOWS
+			if (m_iConnectResult == 0)
+				io_service.poll();
+		#endif
+		return m_iConnectResult;
+	}
+
+	void closeConnection()
+	{
+		#ifdef SQLARD_WIRE_CAPTURE
+			if (m_pReplay != nullptr)
+				return;
+		#endif
+		#ifndef WINDOWS
+			m_pEthClient->stop();
+		#else
+			boost::system::error_code ignored_error;
+			socket.close(ignored_error);
+		#endif
+		m_ullTransactionDescriptor = 0;
+		m_bInTransaction = false;
+		#ifdef SQLARD_MARS
+			m_bMARS = false;
+			for (uint16_t i = 0; i < SQLARD_MARS_SESSIONS; i++) {
+				m_arSessions[i].reset();
+				m_arSessions[i].m_bOpen = false;
+			}
+		#endif
+	}
+
+	bool isSocketConnected()
+	{
+		#ifdef SQLARD_WIRE_CAPTURE
+			if (m_pReplay != nullptr)
+				return true;
+		#endif
+		#ifndef WINDOWS
+			return m_pEthClient->connected();
+		#else
+			if (!socket.is_open())
+				return false;
+			/* is_open stays true after the peer closed, that shows as EOF on a read */
+			boost::system::error_code error;
+			if (socket.available(error) == 0 && !error) {
+				uint8_t probe;
+				socket.non_blocking(true, error);
+				if (!error)
+					socket.receive(boost::asio::buffer(&probe, 1), boost::asio::socket_base::message_peek, error);
+				boost::system::error_code ignored_error;
+				socket.non_blocking(false, ignored_error);
+				if (error == boost::asio::error::would_block)
+					error.clear();
+			}
+			if (error) {
+				boost::system::error_code ignored_error;
+				socket.close(ignored_error);
+				return false;
+			}
+			return true;
+		#endif
 	}
-private:
-	uint32_t m_uiLength;
-	uint32_t m_uiTDSVersion;
-	uint32_t m_uiPacketSize;
-	uint32_t m_uiClientProgVer;
-	uint32_t m_uiClientPID;
-	uint32_t m_uiConnectionID;
-	uint32_t m_uiClientTimeZone;
-	uint32_t m_uiClientLCID;
-	uint8_t m_ubOptionFlags1;
-	uint8_t m_ubOptionFlags2;
-	uint8_t m_ubOptionFlags3;
-	uint8_t m_ubTypeFlags;
 
-	wchar_t * m_wcszUserName;
-	wchar_t * m_wcszPassword;
-	wchar_t * m_wcszHost;
-	wchar_t * m_wcszAppName;
-	wchar_t * m_wcszServerName;
-	wchar_t * m_wcszUnused;
-	wchar_t * m_wcszExtension;
-	wchar_t * m_wcszCltIntName;
-	wchar_t * m_wcszLanguage;
-	wchar_t * m_wcszDatabase;
-	wchar_t * m_wcszAttachDBFile;
-	wchar_t * m_wcszChangePassword;
-	wchar_t * m_wcszSSPI;
+	/* Jittered exponential backoff: half of the doubled delay is fixed, the other half random */
+	uint32_t backoffDelay(const uint8_t attempt)
+	{
+		uint32_t delay = m_uiBackoffMin;
+		for (uint8_t i = 0; i < attempt && delay < m_uiBackoffMax; i++)
+			delay *= 2;
+		if (delay > m_uiBackoffMax)
+			delay = m_uiBackoffMax;
+		return delay / 2 + SQLardUtil::sqlard_random(delay / 2 + 1);
+	}
 
-};
+	void failAttempt(const uint32_t now)
+	{
+		closeConnection();
+		m_bConnected = false;
+		m_bLoggedIn = false;
+		m_bResponsePending = false;
+		const uint32_t delay = backoffDelay(m_ubAttempt);
+		if (m_ubAttempt < 31)
+			m_ubAttempt++;
+		#ifdef SQLARD_VERBOSE_OUTPUT
+			SQLardUtil::printf(F("SQLARD > poll : Connection attempt failed, retrying in %lu ms\n"), static_cast<unsigned long>(delay));
+		#endif
+		m_ulDeadline = now + delay;
+		m_state = STATE_BACKOFF;
+	}
 
+	/* Send LOGIN7 without waiting, the response is pumped by poll */
+	void startLogin()
+	{
+		size_t len = 0;
+		const uint8_t * data = m_pLogin7->GetPacket(len);
+		m_bResetConnection = false;
+		m_bLoggedIn = false;
+		sendTDSPacket(0x10, const_cast<uint8_t*>(data), len, false);
+		beginResponse();
+		m_state = STATE_LOGIN;
+	}
 
+	/* PRELOGIN with VERSION, ENCRYPTION (not supported) and MARS options */
+	void sendPrelogin()
+	{
+		#ifndef SQLARD_MARS
+			uint8_t data[] = {
+				/* option token, offset and length (big endian) */
+				0x00, 0x00, 0x0B, 0x00, 0x06,
+				0x01, 0x00, 0x11, 0x00, 0x01,
+				0xFF,
+				/* VERSION */
+				0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+				/* ENCRYPTION : ENCRYPT_NOT_SUP */
+				0x02
+			};
+		#else
+			uint8_t data[] = {
+				/* option token, offset and length (big endian) */
+				0x00, 0x00, 0x10, 0x00, 0x06,
+				0x01, 0x00, 0x16, 0x00, 0x01,
+				0x04, 0x00, 0x17, 0x00, 0x01,
+				0xFF,
+				/* VERSION */
+				0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+				/* ENCRYPTION : ENCRYPT_NOT_SUP */
+				0x02,
+				/* MARS : on */
+				0x01
+			};
+			m_bMARS = false;
+		#endif
+		m_usPacketRemaining = 0;
+		sendTDSPacket(0x12, data, sizeof(data), false);
+	}
 
-class SQLard
-{
-public:
-	
-	#ifdef WINDOWS
-		SQLard(uint8_t * serverIP, const uint16_t port):resolver(io_service),socket(io_service) {
-			memcpy(m_arrServerIPv4, serverIP, 6);
-			m_usPort = port;
-			m_pLogin7 = nullptr;
-			m_bConnected = false;
-			m_bLoggedIn = false;
-			m_uiPacketIndex = 0;
+	/*
+		Read the PRELOGIN response once it has fully arrived.
+		Returns 1 if login can go on, 0 if more data is required,
+		-1 if the server requires encryption or the response is invalid.
+	*/
+	int8_t readPreloginResponse()
+	{
+		if (m_usPacketRemaining == 0) {
+			if (availableFromServer() < 8)
+				return 0;
+			uint8_t header[8];
+			readTDSHeader(header);
+			if (readTDSPacketSize(header) <= 8)
+				return -1;
+			m_usPacketRemaining = readTDSPacketSize(header) - 8;
 		}
-		bool connect() {
-			long longIP = m_arrServerIPv4[0] << 24 | m_arrServerIPv4[1] << 16 | m_arrServerIPv4[2] <<8| m_arrServerIPv4[3] << 0;
- 			boost::system::error_code error = boost::asio::error::host_not_found;
-			boost::asio::ip::basic_endpoint<boost::asio::ip::tcp> endP(boost::asio::ip::address_v4(longIP), m_usPort);
-			socket.connect(endP, error);
-			m_bConnected = (error == 0);
-			#ifdef SQLARD_VERBOSE_OUTPUT
-				SQLardUtil::printf(m_bConnected ? F("SQLARD > connect : MSSQL connection successfully established!\n") : F("SQLARD > connect : MSSQL connection failed!\n"));
+		if (availableFromServer() < m_usPacketRemaining)
+			return 0;
+		const uint16_t len = m_usPacketRemaining;
+		SQLardBuffer<uint8_t> data(len);
+		readFromServer(data(), len);
+		m_usPacketRemaining = 0;
+		for (uint16_t i = 0; i + 5 <= len && data[i] != 0xFF; i += 5) {
+			const uint16_t offset = (static_cast<uint16_t>(data[i + 1]) << 8) | data[i + 2];
+			/* ENCRYPTION : ENCRYPT_REQ, TLS is not available */
+			if (data[i] == 0x01 && offset < len && data[offset] == 0x03) {
+				#ifdef SQLARD_VERBOSE_OUTPUT
+					SQLardUtil::printf(F("SQLARD > prelogin : Server requires encryption!\n"));
+				#endif
+				return -1;
+			}
+			#ifdef SQLARD_MARS
+				/* MARS : the server agrees to multiplex sessions */
+				if (data[i] == 0x04 && offset < len)
+					m_bMARS = data[offset] == 0x01;
 			#endif
-			return m_bConnected;
 		}
-	#else
-		SQLard(uint8_t * serverIP, const uint16_t port, EthernetClient * pEthCl) {
-			setServer(serverIP, port, pEthCl);
-			m_pLogin7 = nullptr;
-			m_bConnected = false;
-			m_bLoggedIn = false;
-			m_uiPacketIndex = 0;
+		#ifdef SQLARD_MARS
+			#ifdef SQLARD_WIRE_CAPTURE
+				/* replays only carry the packets of the default session */
+				if (m_pReplay != nullptr)
+					m_bMARS = false;
+			#endif
+			/* from here on everything goes through SMP, starting with LOGIN7 on the default session */
+			if (m_bMARS) {
+				m_arSessions[0].reset();
+				m_arSessions[0].m_bOpen = true;
+				sendSMP(&m_arSessions[0], SMP_SYN, nullptr, 0);
+			}
+		#endif
+		return 1;
+	}
+
+	/*
+		Outbound request being packed into packets as its data is written.
+		A full packet is only sent once more data follows, so the last
+		packet is the one sent by endRequest with the EOM status. Once a
+		packet fails to send, the rest of the request is dropped.
+	*/
+	struct SQLardRequestPacket {
+		SQLardRequestPacket(const size_t size, const uint8_t opcode) : buf(size) {
+			length = 8;
+			this->opcode = opcode;
+			bFailed = false;
 		}
-		SQLard() {
-			m_pLogin7 = nullptr;
-			m_bConnected = false;
-			m_bLoggedIn = false;
-			m_uiPacketIndex = 0;
+		SQLardBuffer<uint8_t> buf;
+		size_t length;
+		uint8_t opcode;
+		bool bFailed;
+	};
+
+	/* Packet size of requests, see SQLARD_REQUEST_PACKET_SIZE */
+	size_t requestPacketSize() const
+	{
+		return m_usServerPacketSize < SQLARD_REQUEST_PACKET_SIZE ? m_usServerPacketSize : SQLARD_REQUEST_PACKET_SIZE;
+	}
+	bool putRequest(SQLardRequestPacket & packet, const uint8_t * data, size_t len)
+	{
+		if (packet.bFailed)
+			return false;
+		while (len > 0) {
+			if (packet.length == packet.buf.alloc_size() && !sendRequestPacket(packet, 0x00))
+				return false;
+			const size_t room = packet.buf.alloc_size() - packet.length;
+			const size_t count = len < room ? len : room;
+			memcpy(&packet.buf[packet.length], data, count);
+			packet.length += count;
+			data += count;
+			len -= count;
 		}
-		void setServer(uint8_t * serverIP, const uint16_t port, EthernetClient * pEthCl) {
-			memcpy(m_arrServerIPv4, serverIP, 6);
-			m_usPort = port;
-			m_pEthClient = pEthCl;
+		return true;
+	}
+	bool putRequestUnit(SQLardRequestPacket & packet, const char16_t unit)
+	{
+		if (packet.length + 2 > packet.buf.alloc_size()) {
+			/* the unit may straddle two packets */
+			const uint8_t le[2] = { static_cast<uint8_t>(unit), static_cast<uint8_t>(unit >> 8) };
+			return putRequest(packet, le, 2);
 		}
-		bool connect() {
-			const int max_retry_count = 10;
-			int current_retry = 0;
-			do
-			{
-				delay(1000);
-				m_bConnected = m_pEthClient->connect(m_arrServerIPv4, m_usPort);
-			} while (current_retry++ < max_retry_count && !m_bConnected);
-			#ifdef SQLARD_VERBOSE_OUTPUT
-				Serial.println(m_bConnected ? F("SQLARD > connect : MSSQL connection successfully established!") : F("SQLARD > connect : MSSQL connection failed!"));
-			#endif
-			return m_bConnected;
+		if (packet.bFailed)
+			return false;
+		packet.buf[packet.length++] = static_cast<uint8_t>(unit);
+		packet.buf[packet.length++] = static_cast<uint8_t>(unit >> 8);
+		return true;
+	}
+	bool sendRequestPacket(SQLardRequestPacket & packet, const uint8_t status)
+	{
+		putTDSHeader(packet.buf(), packet.opcode, status);
+		putTDSLength(packet.buf(), static_cast<uint16_t>(packet.length));
+		const bool bSent = sendToServer(packet.buf(), static_cast<uint16_t>(packet.length));
+		packet.length = 8;
+		if (!bSent)
+			packet.bFailed = true;
+		return bSent;
+	}
+	/* Send the last packet, false if any packet of the request failed to send */
+	bool endRequest(SQLardRequestPacket & packet)
+	{
+		if (!packet.bFailed)
+			sendRequestPacket(packet, 0x01);
+		m_bRequestFailed = packet.bFailed;
+		#ifdef SQLARD_VERBOSE_OUTPUT
+			if (packet.bFailed)
+				SQLardUtil::printf(F("SQLARD > request : Send failed!\n"));
+		#endif
+		return !packet.bFailed;
+	}
+
+	/* Settle the statement in progress and start a SQL batch */
+	void beginSQLBatch(SQLardRequestPacket & packet)
+	{
+		#ifdef SQLARD_BOUND_COLUMNS
+			closeBound();
+		#endif
+		#ifdef SQLARD_CURSORS
+			settleCursor();
+		#endif
+		#ifdef SQLARD_TDS73
+			/* TDS 7.2+ requires ALL_HEADERS with a transaction descriptor in front of the SQL text */
+			uint8_t headers[22];
+			size_t offset = 0;
+			putAllHeaders(headers, offset);
+			putRequest(packet, headers, offset);
+		#endif
+	}
+
+	/*
+		The SQL text is encoded as UTF-16LE straight into packets of requestPacketSize().
+		Returns false if the request could not be sent, the response is an error then.
+	*/
+	bool sendSQLBatch(const SQLardText & query, bool bWaitResponse = true)
+	{
+		bool bSent;
+		{
+			SQLardRequestPacket packet(requestPacketSize(), 0x01);
+			beginSQLBatch(packet);
+			query.ForEachUnit([this, &packet](const char16_t unit) { putRequestUnit(packet, unit); });
+			bSent = endRequest(packet);
 		}
+		if (bWaitResponse)
+			waitResponse();
+		return bSent;
+	}
 
-		/* Maintain the database connection. */
-		void maintain() {
-			while (!m_pEthClient->connected()) {
-				Serial.println("retry connect");
-				/* Balanana kadar dene. */
-				if (connect()) {
-					login();
-				}
+	#ifdef SQLARD_QUERY_SOURCES
+		/* Same as above, the text is read from source as the packets fill, up to a failed send */
+		bool sendSQLBatch(SQLardQuerySource & source, bool bWaitResponse = true)
+		{
+			bool bSent;
+			{
+				SQLardRequestPacket packet(requestPacketSize(), 0x01);
+				beginSQLBatch(packet);
+				source.encode([this, &packet](const char16_t unit) { putRequestUnit(packet, unit); }, &packet.bFailed);
+				bSent = endRequest(packet);
 			}
+			if (bWaitResponse)
+				waitResponse();
+			return bSent;
 		}
 	#endif
-	
-	void setCredentials(const wchar_t * wcszdbName, const wchar_t * wcszUserName, const wchar_t * wcszPassword, const wchar_t *wcszHost) {
-		if (m_pLogin7)
-			delete m_pLogin7;
-		m_pLogin7 = new SQLardLOGIN7();
-		m_pLogin7->SetUserName(wcszUserName);
-		m_pLogin7->SetPassword(wcszPassword);
-		m_pLogin7->SetHost(wcszHost);
-		m_pLogin7->SetDatabase(wcszdbName);
-	}
 
-	bool login() {
-		if (!m_bConnected || !m_pLogin7)
+	#ifdef SQLARD_CURSORS
+		/*
+			Send a RPC request calling a system stored procedure by id, with
+			unnamed parameters, without waiting for the response. Text
+			parameters are encoded straight into packets like sendSQLBatch.
+		*/
+		bool sendRPC(const uint16_t procId, const SQLardRPCParam * params, const uint8_t paramCount)
 		{
-			#ifdef SQLARD_VERBOSE_OUTPUT
-				SQLardUtil::printf(F("SQLARD > login : Not connected or no login structure!"));
+			#ifdef SQLARD_BOUND_COLUMNS
+				closeBound();
 			#endif
-			return false;
+			settleCursor();
+			m_ubReturnValueCount = 0;
+			SQLardRequestPacket packet(requestPacketSize(), 0x03);
+			uint8_t data[22 + 6];
+			size_t offset = 0;
+			#ifdef SQLARD_TDS73
+				putAllHeaders(data, offset);
+			#endif
+			/* ProcIDSwitch, ProcID and OptionFlags */
+			data[offset++] = 0xFF;
+			data[offset++] = 0xFF;
+			data[offset++] = static_cast<uint8_t>(procId);
+			data[offset++] = static_cast<uint8_t>(procId >> 8);
+			data[offset++] = 0;
+			data[offset++] = 0;
+			putRequest(packet, data, offset);
+			for (uint8_t i = 0; i < paramCount; i++) {
+				uint8_t header[SQLardRPCParam::MAX_HEADER_SIZE];
+				offset = 0;
+				params[i].Write(header, offset, m_arCollation);
+				putRequest(packet, header, offset);
+				if (params[i].pText != nullptr)
+					params[i].pText->ForEachUnit([this, &packet](const char16_t unit) { putRequestUnit(packet, unit); });
+			}
+			return endRequest(packet);
 		}
-		uint8_t data[256] PROGMEM;
-		//SQLardBuffer<uint8_t>data(512);
-		size_t len = m_pLogin7->FillBuffer(data);
-		//delete m_pLogin7;
-		sendTDSPacket(0x10, data, len);
-		return m_bLoggedIn;
-	}
+	#endif
 
-	/*
-		Execute a INSERT, UPDATE or DELETE query.
-		Returns affected row count.
-	*/
-	long executeNonQuery(const wchar_t* query) {
+	#ifdef SQLARD_TDS73
+		/* 22 byte ALL_HEADERS holding the transaction descriptor header */
+		void putAllHeaders(uint8_t * buf, size_t & offset)
 		{
-			sendTDSPacket(0x01, (uint8_t*)query, SQLardUtil::sqlard_wcslen(query) * 2);
+			SQLardUtil::sqlard_write_le<uint32_t>(buf, offset, 22);
+			SQLardUtil::sqlard_write_le<uint32_t>(buf, offset, 18);
+			SQLardUtil::sqlard_write_le<uint16_t>(buf, offset, 0x0002);
+			SQLardUtil::sqlard_write_le<uint64_t>(buf, offset, m_ullTransactionDescriptor);
+			/* outstanding request count */
+			SQLardUtil::sqlard_write_le<uint32_t>(buf, offset, 1);
 		}
-		return m_uiDoneCount;
-	}
-	SQLardTableResult *  executeReader(const wchar_t* query) {
-		{
 
-			sendTDSPacket(0x01, (uint8_t*)query, SQLardUtil::sqlard_wcslen(query) * 2, false);
-			SQLardUtil::freeRam("execreader");
+		/* Transaction Manager request without a transaction name, see begin / commit / rollback */
+		void sendTransactionRequest(const uint16_t requestType)
+		{
+			uint8_t data[22 + 4];
+			size_t offset = 0;
+			putAllHeaders(data, offset);
+			SQLardUtil::sqlard_write_le<uint16_t>(data, offset, requestType);
+			if (requestType == 5) {
+				/* TM_BEGIN_XACT : isolation level unchanged */
+				data[offset++] = 0x00;
+				data[offset++] = 0;
+			}
+			else {
+				/* TM_COMMIT_XACT / TM_ROLLBACK_XACT : no new transaction */
+				data[offset++] = 0;
+				data[offset++] = 0x00;
+			}
+			sendTDSPacket(0x0E, data, offset);
 		}
-		SQLardUtil::freeRam("zzzz");
-		return waitRowData();
-	}
-protected:
-	void putTDSHeader(uint8_t * buf, const uint8_t opcode, const uint8_t status)
+	#endif
+
+	void putTDSHeader(uint8_t * buf, const uint8_t opcode, uint8_t status)
 	{
+		#ifdef SQLARD_TDS73
+			/* RESETCONNECTION goes on the first packet of the next SQL batch / RPC / transaction manager request */
+			if (m_bResetConnection && (opcode == 0x01 || opcode == 0x03 || opcode == 0x0E)) {
+				status |= 0x08;
+				m_bResetConnection = false;
+			}
+		#endif
 		buf[0] = opcode;
 		buf[1] = status;
 		/* SPID */
@@ -1188,7 +8697,9 @@ protected:
 	}
 	void putTDSData(uint8_t * buf, uint8_t * data, const uint16_t dataSize)
 	{
-		memcpy(&buf[8], data, dataSize);
+		/* ATTENTION has no data, and a null pointer */
+		if (dataSize > 0)
+			memcpy(&buf[8], data, dataSize);
 		putTDSLength(buf, dataSize + 8);
 	}
 	const uint16_t readTDSPacketSize(uint8_t * header)
@@ -1196,224 +8707,587 @@ protected:
 		return (static_cast<uint16_t>(header[2]) << 8) | header[3];
 	}
 	bool sendToServer(uint8_t * buf, const uint16_t len)
+	{
+		#ifdef SQLARD_METRICS
+			m_stats.m_ullBytesOut += len;
+			m_stats.m_uiPacketsOut++;
+		#endif
+		#ifdef SQLARD_WIRE_CAPTURE
+			if (m_pCapture != nullptr)
+				m_pCapture->record(SQLARD_CAPTURE_OUTBOUND, buf, len);
+			if (m_pReplay != nullptr)
+				return m_pReplay->write(buf, len) == len;
+		#endif
+		#ifdef SQLARD_MARS
+			if (m_bMARS)
+				return sendSMP(m_pSendSession, SMP_DATA, buf, len);
+		#endif
+		return writeToSocket(buf, len);
+	}
+	bool writeToSocket(const uint8_t * buf, const uint16_t len)
 	{
 		#ifndef WINDOWS
 		int wCount = m_pEthClient->write(buf, len);
 		m_pEthClient->flush();
 		return wCount == len;
 		#else
-			boost::system::error_code ignored_error;
-			size_t wcount =boost::asio::write(socket, boost::asio::buffer(buf, len), boost::asio::transfer_all(), ignored_error);
+			boost::system::error_code error;
+			size_t wcount =boost::asio::write(socket, boost::asio::buffer(buf, len), boost::asio::transfer_all(), error);
+			if (error) {
+				/* closed, so isSocketConnected sees the failure */
+				boost::system::error_code ignored_error;
+				socket.close(ignored_error);
+			}
 			return wcount == len;
 		#endif
 	}
 	void sendTDSPacket(uint8_t opcode, uint8_t *data,const uint16_t len, bool bWaitResponse = true)
 	{
+		#ifdef SQLARD_BOUND_COLUMNS
+			/* not for ATTENTION, which closeBound sends itself */
+			if (opcode != 0x06)
+				closeBound();
+		#endif
+		#ifdef SQLARD_CURSORS
+			if (opcode != 0x06)
+				settleCursor();
+		#endif
 		{
 			SQLardBuffer<uint8_t>buf(len + 8);
 			putTDSHeader(buf(), opcode, 0x01);
 			putTDSData(buf(), data, len);
-			sendToServer(buf(), buf.alloc_size());
+			const bool bSent = sendToServer(buf(), buf.alloc_size());
+			/* ATTENTION failures are handled by cancelResponse */
+			if (opcode != 0x06)
+				m_bRequestFailed = !bSent;
 		}
 		if (bWaitResponse)
-			waitResponse(opcode);
+			waitResponse();
 	}
 
-	int waitData()
+	/* Read len bytes of the response, bytes that never arrived read as zeroes and fail the response */
+	void readFromServer(uint8_t * buf, const uint16_t len)
 	{
-		int num = 0;
-		int timeout = 0;
-		do {
-			#ifndef WINDOWS
-			num = m_pEthClient->available();
-			#else
-			num = socket.available();
+		bool bComplete;
+		#ifdef SQLARD_WIRE_CAPTURE
+		if (m_pReplay != nullptr) {
+			size_t read = m_pReplay->read(buf, len);
+			memset(&buf[read], 0, len - read);
+			bComplete = (read == len);
+		}
+		else
+		#endif
+		#ifdef SQLARD_MARS
+		if (m_bMARS) {
+			/* TDS data of the default session */
+			SQLardSession & session = m_arSessions[0];
+			while (session.m_inbound.length() < len && receiveSMP(true));
+			const size_t count = session.m_inbound.length() < len ? session.m_inbound.length() : len;
+			memcpy(buf, session.m_inbound(), count);
+			memset(&buf[count], 0, len - count);
+			session.consume(count);
+			bComplete = (count == len);
+		}
+		else
+		#endif
+			bComplete = readFromSocket(buf, len);
+		if (!bComplete) {
+			#ifdef SQLARD_VERBOSE_OUTPUT
+				SQLardUtil::printf(F("SQLARD > readFromServer : Connection lost in the middle of a packet!\n"));
 			#endif
-			timeout++;
-			if (num < 8 && timeout < 5000) {
-				//delay(100);  // adjust for network latency
-			}
-		} while (num < 8 && timeout < 5000);
-		return num;
+			m_bResponseError = true;
+		}
+		#ifdef SQLARD_WIRE_CAPTURE
+			if (m_pCapture != nullptr)
+				m_pCapture->record(SQLARD_CAPTURE_INBOUND, buf, len);
+		#endif
+		#ifdef SQLARD_METRICS
+			m_stats.m_ullBytesIn += len;
+		#endif
 	}
 
-	SQLardTableResult * waitRowData() {
-		uint8_t header[8];
-		int available = 0;
-		//SQLardUtil::freeRam("abc");
-
-		while (available < 8)
-			available = waitData();
+	/* False when fewer than len bytes could be read, the rest is zeroed */
+	bool readFromSocket(uint8_t * buf, const uint16_t len)
+	{
 		#ifndef WINDOWS
-			for (int i = 0; i < 8; i++) {
-				header[i] = m_pEthClient->read();
+			for (uint16_t i = 0; i < len; i++) {
+				const int c = m_pEthClient->read();
+				if (c < 0) {
+					memset(&buf[i], 0, len - i);
+					return false;
+				}
+				buf[i] = static_cast<uint8_t>(c);
+			}
+			return true;
+		#else
+			boost::system::error_code error;
+			const size_t count = boost::asio::read(socket, boost::asio::buffer(buf, len), error);
+			if (error) {
+				/* EOF or reset, isSocketConnected reports the close from now on */
+				memset(&buf[count], 0, len - count);
+				boost::system::error_code ignored_error;
+				socket.close(ignored_error);
+				return false;
 			}
-		#else	
-			boost::asio::read(socket, boost::asio::buffer(header, 8));
+			return true;
 		#endif
-		int dataSize = readTDSPacketSize(header) - 8;
-		if (dataSize <= 0) {
-			#ifdef SQLARD_VERBOSE_OUTPUT
-				SQLardUtil::printf(F("SQLARD > waitResponse : Invalid data length!"));
-			#endif
-			return nullptr;
-		}
-		/* allocate some buffer for data part */
-	
-		SQLardBuffer<uint8_t>data(dataSize);
-	
+	}
 
-		while (available < dataSize)
-			available = waitData();
-		#ifndef WINDOWS
-			for (int i = 0; i < dataSize; i++) {
-				data[i] = m_pEthClient->read();
+	/*
+		Wait for and read the 8 byte header of the next TDS packet.
+		Returns the amount of bytes that were available.
+	*/
+	int readTDSHeader(uint8_t * header)
+	{
+		const int available = waitData();
+		if (available < 8)
+			return available;
+		readFromServer(header, 8);
+		#ifdef SQLARD_METRICS
+			m_stats.m_uiPacketsIn++;
+		#endif
+		return available;
+	}
+
+	/* Bytes that can be read without blocking */
+	int availableFromServer()
+	{
+		#ifdef SQLARD_WIRE_CAPTURE
+		if (m_pReplay != nullptr)
+			return m_pReplay->available();
+		#endif
+		#ifdef SQLARD_MARS
+			if (m_bMARS) {
+				while (receiveSMP(false));
+				return static_cast<int>(m_arSessions[0].m_inbound.length());
 			}
+		#endif
+		return availableFromSocket();
+	}
+	int availableFromSocket()
+	{
+		#ifndef WINDOWS
+			return m_pEthClient->available();
 		#else
-			size_t read_amount = boost::asio::read(socket, boost::asio::buffer(data, dataSize));
+			boost::system::error_code ignored_error;
+			return static_cast<int>(socket.available(ignored_error));
 		#endif
+	}
 
+	/*
+		Wait until minimum bytes are available, the response deadline passes,
+		the connection is lost or cancel is called
+	*/
+	int waitData(const int minimum = 8)
+	{
+		int num = 0;
+		while ((num = availableFromServer()) < minimum && !responseExpired() && isSocketConnected() && !cancelRequested()) {
+			#ifdef WINDOWS
+				/* let other connections of the process run while this one waits */
+				std::this_thread::yield();
+			#endif
+		}
+		return num;
+	}
 
-		uint8_t optionToken = 0;
-		uint16_t optionLength = 0;
-		size_t readPos = 0;
-		SQLardUtil::freeRam("btr");
-		SQLardTableResult * pTableResult = new SQLardTableResult();
-		while (true) {
-			if (readPos > dataSize)
-				break;
-			optionToken = data[readPos++];
-			
-			switch (optionToken) {
-			case 0x81: /* COLMETADATA */
-				pTableResult->ParseColumnData(data(), readPos);
-				SQLardUtil::freeRam("aftercd");
-				break;
-			case 0xD1:
-				pTableResult->ParseRowData(data(), readPos);
-				SQLardUtil::freeRam("afterrd");
-				break;
-			case 0xFF: /* DONEINPROC */
-				break;
-			case 0xFD: /* DONE */
-			case 0xFE: /* DONEPROC */
-				if (parseDone(data(), readPos))
-					return pTableResult;
-				break;
-			case 0xAA: /* Error */
-			case 0xAB: /* info */
-				parseInformationMessage(data(), readPos);
-				break;
-			default:
-				printf("unknown token %d\n", optionToken);
-				break;
+	/* cancel was called and its ATTENTION is not on the way yet, see pumpResponse */
+	bool cancelRequested() const
+	{
+		return m_bCancelRequested && !m_bAttentionPending;
+	}
+
+	bool responseExpired()
+	{
+		return m_ulResponseDeadline != 0 && static_cast<int32_t>(SQLardUtil::sqlard_millis() - m_ulResponseDeadline) >= 0;
+	}
+
+	void setResponseDeadline(const uint32_t timeout)
+	{
+		m_ulResponseDeadline = timeout ? SQLardUtil::sqlard_millis() + timeout : 0;
+		/* 0 means no deadline */
+		if (timeout && m_ulResponseDeadline == 0)
+			m_ulResponseDeadline = 1;
+	}
+
+	/* Outcome of the previous response, cleared for a response read from the wire or the result cache */
+	void resetResponseState()
+	{
+		m_parser.reset();
+		m_bTimedOut = false;
+		m_bCancelled = false;
+		m_bCancelRequested = false;
+		m_bResponseError = false;
+		m_uiDoneCount = 0;
+		m_ubStatementCount = 0;
+		m_uiRowsParsed = 0;
+	}
+
+	/* Prepare to receive a new response message */
+	void beginResponse()
+	{
+		resetResponseState();
+		setResponseDeadline(m_uiQueryTimeout);
+		/* no response comes for a request that was not sent */
+		m_bResponseError = m_bRequestFailed;
+		m_usPacketRemaining = 0;
+		m_usResponsePackets = 0;
+		m_bLastPacket = false;
+		m_bResponsePending = !m_bRequestFailed;
+		m_bRequestFailed = false;
+	}
+
+	/*
+		Move the response forward: read what the server has sent, packet by packet,
+		in chunks of at most SQLARD_RECEIVE_CHUNK bytes, and feed the token parser.
+		Packets left after the final token are drained.
+		Non-blocking mode only reads what is already available.
+		Returns true once the whole response message has been received, or
+		when blocking mode stops early for a timeout (m_bTimedOut) or a cancel
+		request; m_bResponsePending stays set then, see finishResponse.
+		Returns false as well when a token handler paused the parser.
+	*/
+	bool pumpResponse(const bool bBlocking = true)
+	{
+		uint8_t chunk[SQLARD_RECEIVE_CHUNK];
+		while (m_bResponsePending) {
+			if (cancelRequested())
+				return true;
+			if (m_usPacketRemaining == 0) {
+				if (m_bLastPacket) {
+					m_bResponsePending = false;
+					break;
+				}
+				if (!bBlocking && availableFromServer() < 8)
+					return false;
+				uint8_t header[8];
+				if (readTDSHeader(header) < 8) {
+					/* finishResponse sends the ATTENTION */
+					if (cancelRequested())
+						return true;
+					#ifdef SQLARD_VERBOSE_OUTPUT
+						SQLardUtil::printf(F("SQLARD > pumpResponse : Timed out!\n"));
+					#endif
+					m_bTimedOut = true;
+					return true;
+				}
+				if (readTDSPacketSize(header) < 8) {
+					#ifdef SQLARD_VERBOSE_OUTPUT
+						SQLardUtil::printf(F("SQLARD > pumpResponse : Invalid packet!\n"));
+					#endif
+					m_bResponseError = true;
+					m_bResponsePending = false;
+					break;
+				}
+				#ifdef SQLARD_METRICS
+					if (m_usResponsePackets == 0)
+						m_stats.markResponse();
+				#endif
+				m_usResponsePackets++;
+				m_usPacketRemaining = readTDSPacketSize(header) - 8;
+				/* EOM status bit marks the last packet of the message */
+				m_bLastPacket = (header[1] & 0x01) != 0;
+				continue;
+			}
+			int available = availableFromServer();
+			if (available <= 0) {
+				if (!bBlocking)
+					return false;
+				available = waitData(1);
+				if (available <= 0) {
+					if (cancelRequested())
+						return true;
+					#ifdef SQLARD_VERBOSE_OUTPUT
+						SQLardUtil::printf(F("SQLARD > pumpResponse : Timed out!\n"));
+					#endif
+					m_bTimedOut = true;
+					return true;
+				}
 			}
+			uint16_t count = m_usPacketRemaining;
+			if (count > available)
+				count = available;
+			if (count > SQLARD_RECEIVE_CHUNK)
+				count = SQLARD_RECEIVE_CHUNK;
+			readFromServer(chunk, count);
+			m_usPacketRemaining -= count;
+			if (m_parser.isDone() || m_parser.hasError())
+				continue;
+			#ifdef SQLARD_RESULT_CACHE
+				if (m_bCacheRecording)
+					m_cacheRecord.append(chunk, count);
+			#endif
+			m_parser.feed(chunk, count);
+			if (m_parser.isPaused())
+				return false;
+		}
+		return true;
+	}
+
+	SQLardTableResult * newResult() {
+		SQLardTableResult * pResult = new SQLardTableResult();
+		#ifdef SQLARD_DICTIONARY
+			pResult->SetDictionaryEncoding(m_usDictionaryEntries);
+		#endif
+		#ifdef SQLARD_SPILL
+			if (m_szResultBudget > 0)
+				pResult->SetMemoryBudget(m_szResultBudget, m_strSpillDirectory.c_str());
+		#endif
+		return pResult;
+	}
 
-		}
-		#ifdef SQLARD_VERBOSE_OUTPUT
-			SQLardUtil::printf(F("waitRowData() >> Unexpected return!"));
+	SQLardTableResult * waitRowData(const SQLardText * cacheQuery = nullptr, const uint32_t cacheTTL = 0) {
+		/* further result sets of the batch are chained to the first one */
+		SQLardTableResult * pTableResult = m_pCurrentResult = newResult();
+		#ifdef SQLARD_RESULT_CACHE
+			m_cacheRecord.clear();
+			m_bCacheRecording = (cacheQuery != nullptr && m_pResultCache != nullptr);
+		#endif
+		#ifdef SQLARD_PARALLEL_DECODE
+			m_decoder.begin(m_pCurrentResult);
+		#endif
+		beginResponse();
+		pumpResponse();
+		finishResponse();
+		#ifdef SQLARD_PARALLEL_DECODE
+			m_decoder.finish();
+		#endif
+		m_pCurrentResult = nullptr;
+		#ifdef SQLARD_RESULT_CACHE
+			/* Only complete, error free responses are worth serving again */
+			if (m_bCacheRecording && m_parser.isDone() && !m_bResponseError) {
+				uint32_t tags[SQLARD_CACHE_MAX_TAGS];
+				uint8_t tagCount = SQLardResultCache::ExtractTableTags(cacheQuery->Units(), tags, SQLARD_CACHE_MAX_TAGS);
+				m_pResultCache->Store(resultCacheContext(), cacheQuery->Units(), cacheQuery->Length(), m_cacheRecord(), m_cacheRecord.length(), tags, tagCount, cacheTTL);
+			}
+			m_bCacheRecording = false;
+			m_cacheRecord.clear();
 		#endif
-			SQLardUtil::freeRam("wrd");
 		return pTableResult;
 	}
 
-	
+	void waitResponse()
+	{
+		beginResponse();
+		pumpResponse();
+		finishResponse();
+	}
 
-	void waitResponse(uint8_t sent_opcode)
+	/* Cancel the response if the blocking pump stopped before its end */
+	void finishResponse()
 	{
-		uint8_t header[8];
-		int available = 0;
-		while (available < 8)
-			available = waitData();
+		if (m_bResponsePending)
+			cancelResponse();
+	}
 
-		#ifndef WINDOWS
-		for (int i = 0; i < 8; i++) {
-			header[i] = m_pEthClient->read();
-		}
-		#else	
-		boost::asio::read(socket, boost::asio::buffer(header, 8));
+	/*
+		Send ATTENTION and drain the response up to the DONE token with the
+		attention acknowledgement bit, which may follow in a message of its own.
+		Rows received meanwhile are dropped. Without an acknowledgement in time
+		the state of the connection is unknown, so it is closed.
+	*/
+	bool cancelResponse()
+	{
+		m_bCancelRequested = false;
+		m_bCancelled = true;
+		m_bResponseError = true;
+		m_bAttentionPending = true;
+		#ifdef SQLARD_VERBOSE_OUTPUT
+			SQLardUtil::printf(F("SQLARD > cancel : Sending attention\n"));
 		#endif
-		int dataSize = readTDSPacketSize(header) - 8;
-		if (dataSize <= 0) {
-			#ifdef SQLARD_VERBOSE_OUTPUT
-				SQLardUtil::printf(F("SQLARD > waitResponse : Invalid data length!"));
-			#endif
-			return;
+		if (isSocketConnected()) {
+			sendTDSPacket(0x06, nullptr, 0, false);
+			setResponseDeadline(SQLARD_CANCEL_TIMEOUT);
+			m_bTimedOut = false;
+			while (m_bAttentionPending && !m_bTimedOut) {
+				if (!m_bResponsePending) {
+					m_parser.reset();
+					m_usPacketRemaining = 0;
+					m_bLastPacket = false;
+					m_bResponsePending = true;
+				}
+				pumpResponse();
+			}
 		}
-		/* allocate some buffer for data part */
-		#ifndef SQLARD_VERBOSE_OUTPUT
-				m_bLoggedIn = true;
-				return;
+		m_bResponsePending = false;
+		if (!m_bAttentionPending)
+			return true;
+		#ifdef SQLARD_VERBOSE_OUTPUT
+			SQLardUtil::printf(F("SQLARD > cancel : No attention acknowledgement, closing the connection!\n"));
 		#endif
-		SQLardBuffer<uint8_t>data(dataSize);
+		m_bAttentionPending = false;
+		closeConnection();
+		m_bConnected = false;
+		m_bLoggedIn = false;
+		m_state = STATE_IDLE;
+		return false;
+	}
 
-		while (available < dataSize)
-			available = waitData();
-		#ifndef WINDOWS
-			for (int i = 0; i < dataSize; i++) {
-				data[i] = m_pEthClient->read();
+	/* Token events of the response being received */
+	bool onColumnMetadata(uint8_t * data, const size_t len) override
+	{
+		#ifdef SQLARD_BOUND_COLUMNS
+			if (m_pBinding != nullptr && !m_bAttentionPending) {
+				if (m_pBoundColumns != nullptr) {
+					m_bBoundEnded = true;
+					return true;
+				}
+				#ifdef SQLARD_COLUMN_CACHE
+					m_pBoundColumns = m_columnCache.Get(data, len);
+					m_pBoundColumns->Retain();
+				#else
+					size_t pos = 0;
+					m_pBoundColumns = SQLardColumnSet::Parse(data, pos);
+				#endif
+				if (m_pBinding->accepts(m_pBoundColumns))
+					return false;
+				#ifdef SQLARD_VERBOSE_OUTPUT
+					SQLardUtil::printf(F("SQLARD > executeBound : Bound column does not convert!\n"));
+				#endif
+				m_bResponseError = true;
+				m_bBoundEnded = true;
+				return true;
 			}
-		#else
-			boost::asio::read(socket, boost::asio::buffer(data, dataSize));
 		#endif
-		switch (sent_opcode) {
-		case 0x01:
-		case 0x10:
-			parseTokens(data());
-			break;
+		#ifdef SQLARD_CURSORS
+			/* rows of a cursor fetch come without metadata */
+			if (m_pReceivingCursor != nullptr && len >= 2 && data[0] == 0xFF && data[1] == 0xFF) {
+				if (m_pCurrentResult != nullptr && m_pCurrentResult->m_arColumnData == nullptr)
+					m_pCurrentResult->SetColumns(m_pReceivingCursor->m_pColumns);
+				return true;
+			}
+		#endif
+		if (m_pCurrentResult != nullptr && !m_bAttentionPending) {
+			/* each further result set of the batch gets a result of its own */
+			if (m_pCurrentResult->m_arColumnData != nullptr) {
+				SQLardTableResult * pNext = newResult();
+				m_pCurrentResult->SetNextResult(pNext);
+				m_pCurrentResult = pNext;
+				#ifdef SQLARD_PARALLEL_DECODE
+					m_decoder.begin(pNext);
+				#endif
+			}
+			#ifdef SQLARD_COLUMN_CACHE
+				m_pCurrentResult->SetColumns(m_columnCache.Get(data, len));
+			#else
+				size_t pos = 0;
+				m_pCurrentResult->ParseColumnData(data, pos);
+			#endif
 		}
+		return true;
 	}
 
-
-
-	void parseTokens(uint8_t * data)
+	bool onRow(const uint8_t token, uint8_t * data, const size_t len) override
 	{
-		uint8_t optionToken = 0;
-		uint16_t optionLength = 0;
-		size_t readPos = 0;
-		while (true) {
-			optionToken = data[readPos++];
-
-			switch (optionToken) {
-			case 0xE3: /* EnvChange */
-				parseEnvChange(data, readPos);
-				break;
-			case 0xAA: /* Error */
-			case 0xAB: /* info */
-				parseInformationMessage(data, readPos);
-				break;
-			case 0xAD: /* loginack */
-				parseLoginAcknowledgement(data, readPos);
-				break;
-
-			case 0xFF: /* DONEINPROC */
-				break;
-			case 0xA5: /* COLINFO */
-				break;
-			case 0xFD: /* DONE */
-			case 0xFE: /* DONEPROC */
-				if (parseDone(data, readPos))
-					return;
-				break;
-			default:
-				
-				break;
+		#ifdef SQLARD_BOUND_COLUMNS
+			if (m_pBinding != nullptr && m_pBoundColumns != nullptr && !m_bBoundEnded && !m_bAttentionPending) {
+				m_pBinding->store(token, data, m_pBoundColumns);
+				m_uiRowsParsed++;
+				/* pause with a full rowset, fetch resumes */
+				return !m_pBinding->isFull();
 			}
+		#endif
+		if (m_pCurrentResult != nullptr && m_pCurrentResult->m_usColumnCount == m_parser.GetColumnCount() && !m_bAttentionPending) {
+			size_t pos = 0;
+			#ifdef SQLARD_PARALLEL_DECODE
+			if (m_decoder.isEnabled())
+				m_decoder.addRow(token, data, len);
+			else
+			#endif
+			if (token == SQLardTokenType::TOKEN_NBCROW)
+				m_pCurrentResult->ParseNbcRowData(data, pos);
+			else
+				m_pCurrentResult->ParseRowData(data, pos);
 		}
+		m_uiRowsParsed++;
+		#ifdef SQLARD_METRICS
+			m_stats.m_ullRowsDecoded++;
+		#endif
+		return true;
+	}
+
+	bool onDone(const uint8_t token, const uint16_t status, const uint16_t curCmd, const uint64_t rowCount) override
+	{
+		/* DONE_ATTN acknowledges an ATTENTION */
+		if (status & 0x20)
+			m_bAttentionPending = false;
+		m_usDoneStatus = status;
+		m_usDoneCurCmd = curCmd;
+		/* DONEINPROC only carries a count if DONE_COUNT is set */
+		if (token != SQLardTokenType::TOKEN_DONEINPROC || (status & 0x10) != 0)
+			m_uiDoneCount = (long)rowCount;
+		if ((status & 0x30) == 0x10 && m_ubStatementCount < 0xFF) {
+			if (m_ubStatementCount < SQLARD_MAX_STATEMENT_COUNTS)
+				m_arStatementCounts[m_ubStatementCount] = static_cast<uint32_t>(rowCount);
+			m_ubStatementCount++;
+		}
+		/* the first DONE after a result set ends its statement */
+		if (m_pCurrentResult != nullptr && m_pCurrentResult->m_arColumnData != nullptr && !m_pCurrentResult->isComplete() && (status & 0x20) == 0)
+			m_pCurrentResult->Complete((status & 0x10) != 0 ? static_cast<uint32_t>(rowCount) : 0);
+		return true;
 	}
 
-	bool parseDone(uint8_t * data, size_t &readPos)
+	bool onMessage(const uint8_t token, uint8_t * data, const size_t len) override
 	{
+		if (token == SQLardTokenType::TOKEN_ERROR)
+			m_bResponseError = true;
+		size_t pos = 0;
+		parseInformationMessage(data, pos);
+		return true;
+	}
 
-		m_usDoneStatus = SQLardUtil::sqlard_read_le<uint16_t>(data, readPos);
+	bool onEnvChange(uint8_t * data, const size_t len) override
+	{
+		size_t pos = 0;
+		parseEnvChange(data, pos);
+		return true;
+	}
 
-		m_usDoneCurCmd = SQLardUtil::sqlard_read_le<uint16_t>(data, readPos);
-		m_uiDoneCount = (long)SQLardUtil::sqlard_read_le<uint32_t>(data, readPos);
-		/* is this last done token ? */
-		if ((m_usDoneStatus & (1 << 0)) != 0)
-			return false;
+	bool onToken(const uint8_t token, uint8_t * data, const size_t len) override
+	{
+		if (token == SQLardTokenType::TOKEN_LOGINACK) {
+			size_t pos = 0;
+			parseLoginAcknowledgement(data, pos);
+		}
+		#ifdef SQLARD_CURSORS
+			if (token == SQLardTokenType::TOKEN_RETURNVALUE)
+				parseReturnValue(data, len);
+		#endif
 		return true;
+	}
+
+	#ifdef SQLARD_CURSORS
+		/* Keep integer output parameters, others read as 0 */
+		void parseReturnValue(uint8_t * data, const size_t len)
+		{
+			/* ParamOrdinal, ParamName, Status, UserType and Flags */
+			size_t pos = 2;
+			pos += 1 + data[pos] * 2 + 1;
+			#ifdef SQLARD_TDS73
+				pos += 4 + 2;
+			#else
+				pos += 2 + 2;
+			#endif
+			const uint8_t type = SQLardUtil::sqlard_read_le<uint8_t>(data, pos);
+			int32_t value = 0;
+			if (type == SQLardDataType::INTNTYPE) {
+				pos++;
+				const uint8_t valueLen = SQLardUtil::sqlard_read_le<uint8_t>(data, pos);
+				if (valueLen > 0 && pos + valueLen <= len)
+					value = static_cast<int32_t>(SQLardUtil::sqlard_read_le<int64_t>(data, pos, valueLen * 8));
+			}
+			else if (type == SQLardDataType::INT4TYPE && pos + 4 <= len)
+				value = SQLardUtil::sqlard_read_le<int32_t>(data, pos);
+			if (m_ubReturnValueCount < SQLARD_MAX_RETURN_VALUES)
+				m_arReturnValues[m_ubReturnValueCount++] = value;
+		}
+	#endif
 
+	void onProtocolError(const uint8_t token) override
+	{
+		#ifdef SQLARD_VERBOSE_OUTPUT
+			SQLardUtil::printf(F("SQLARD > parser : Can not skip token 0x%x!\n"), token);
+		#endif
+		m_bResponseError = true;
 	}
 
 	void parseLoginAcknowledgement(uint8_t * data, size_t &readPos)
@@ -1468,26 +9342,68 @@ protected:
 	void parseEnvChange(uint8_t * data, size_t & readPos)
 	{
 		uint16_t tokenLength = SQLardUtil::sqlard_read_le<uint16_t>(data, readPos);
-		#ifndef SQLARD_VERBOSE_OUTPUT
-			readPos += tokenLength;
-		#else
-			readPos += 2;
-			uint8_t envChangeType = data[readPos++];
-			switch (envChangeType) {
+		const size_t endPos = readPos + tokenLength;
+		uint8_t envChangeType = data[readPos++];
+		#ifdef SQLARD_CURSORS
+			if (envChangeType == 0x07 && data[readPos] == 5)
+				memcpy(m_arCollation, &data[readPos + 1], 5);
+		#endif
+		switch (envChangeType) {
+			case 0x08: /* begin transaction */
+			{
+				/* the new value is the 8 byte descriptor sent in the ALL_HEADERS of later requests */
+				uint8_t newValueLength = data[readPos++];
+				if (newValueLength == 8)
+					m_ullTransactionDescriptor = SQLardUtil::sqlard_read_le<uint64_t>(data, readPos);
+				m_bInTransaction = true;
+				#ifdef SQLARD_VERBOSE_OUTPUT
+					SQLardUtil::printf(F("SQLARD > Environment change : Transaction started.\n"));
+				#endif
+			}
+			break;
+			case 0x09: /* commit transaction */
+			case 0x0A: /* rollback transaction */
+			case 0x11: /* transaction ended */
+				m_ullTransactionDescriptor = 0;
+				m_bInTransaction = false;
+				#ifdef SQLARD_VERBOSE_OUTPUT
+					SQLardUtil::printf(F("SQLARD > Environment change : Transaction %s.\n"), envChangeType == 0x09 ? F("committed") : envChangeType == 0x0A ? F("rolled back") : F("ended"));
+				#endif
+				break;
+			case 0x04: /* packet size */
+			{
+				/* requests sent from now on must not exceed it, see requestPacketSize */
+				const uint8_t newValueLength = data[readPos++];
+				uint32_t packetSize = 0;
+				for (uint8_t i = 0; i < newValueLength; i++, readPos += 2)
+					packetSize = packetSize * 10 + (data[readPos] - '0');
+				if (packetSize >= 512 && packetSize <= 0x7FFF)
+					m_usServerPacketSize = static_cast<uint16_t>(packetSize);
+				#ifdef SQLARD_VERBOSE_OUTPUT
+					SQLardUtil::printf(F("SQLARD > Environment change : Packet size changed to %lu.\n"), static_cast<unsigned long>(packetSize));
+				#endif
+			}
+			break;
+		#if defined(SQLARD_RESULT_CACHE) || defined(SQLARD_VERBOSE_OUTPUT)
 			case 0x01: /* Database */
 			{
-				uint8_t newdb[32]PROGMEM, olddb[32]PROGMEM;
-				uint8_t newValueLength = SQLardUtil::sqlard_read_le<uint8_t>(data, readPos);
-				SQLardUtil::sqlard_rwstr_mb(newdb, data, readPos, newValueLength);
-				uint8_t oldValueLength = SQLardUtil::sqlard_read_le<uint8_t>(data, readPos);
-				SQLardUtil::sqlard_rwstr_mb(olddb, data, readPos, oldValueLength);
+				#ifdef SQLARD_RESULT_CACHE
+					/* new name hashed as UTF-16LE, the same way sqlard_hash_wstr hashes the login database */
+					m_uiDatabaseHash = SQLardUtil::sqlard_hash_bytes(&data[readPos + 1], data[readPos] * 2);
+				#endif
 				#ifdef SQLARD_VERBOSE_OUTPUT
-					SQLardUtil::printf(F("SQLARD > Environment change : Changed database context from '%s' to '%s'.\n"), newdb, olddb);
+					uint8_t newdb[32]PROGMEM, olddb[32]PROGMEM;
+					uint8_t newValueLength = SQLardUtil::sqlard_read_le<uint8_t>(data, readPos);
+					SQLardUtil::sqlard_rwstr_mb(newdb, data, readPos, newValueLength);
+					uint8_t oldValueLength = SQLardUtil::sqlard_read_le<uint8_t>(data, readPos);
+					SQLardUtil::sqlard_rwstr_mb(olddb, data, readPos, oldValueLength);
+					SQLardUtil::printf(F("SQLARD > Environment change : Changed database context from '%s' to '%s'.\n"), olddb, newdb);
 				#endif
 			}
 			break;
+		#endif
+		#ifdef SQLARD_VERBOSE_OUTPUT
 			case 0x02: /* language */
-			case 0x04: /* packet size*/
 			{
 				uint8_t newlang[128]PROGMEM, oldlang[128]PROGMEM;
 				uint8_t newValueLength = SQLardUtil::sqlard_read_le<uint8_t>(data, readPos);
@@ -1495,7 +9411,7 @@ protected:
 				uint8_t oldValueLength = SQLardUtil::sqlard_read_le<uint8_t>(data, readPos);
 				SQLardUtil::sqlard_rwstr_mb(oldlang, data, readPos, oldValueLength);
 				#ifdef SQLARD_VERBOSE_OUTPUT
-					SQLardUtil::printf(F("SQLARD > Environment change : %s changed from '%s' to '%s'.\n"), envChangeType == 0x02 ? F("Language") : F("Packet size"), oldlang, newlang);
+					SQLardUtil::printf(F("SQLARD > Environment change : Language changed from '%s' to '%s'.\n"), oldlang, newlang);
 				#endif
 			}
 			break;
@@ -1516,12 +9432,63 @@ protected:
 				#endif
 			}
 			break;
-			}
 		#endif
+			case 0x12: /* reset connection acknowledgement */
+				/* back in the login database without an ENVCHANGE for it, an open transaction is rolled back */
+				#ifdef SQLARD_RESULT_CACHE
+					m_uiDatabaseHash = 0;
+				#endif
+				m_ullTransactionDescriptor = 0;
+				m_bInTransaction = false;
+				#ifdef SQLARD_VERBOSE_OUTPUT
+					SQLardUtil::printf(F("SQLARD > Environment change : Session reset.\n"));
+				#endif
+				break;
+		}
+		readPos = endPos;
 	}
 private:
 	bool m_bConnected;
 	bool m_bLoggedIn;
+	/* Set the RESETCONNECTION bit on the next request, see resetSession */
+	bool m_bResetConnection;
+
+	/* Connection state machine, see poll */
+	SQLardConnectionState m_state;
+	int8_t m_iConnectResult;
+	uint8_t m_ubAttempt;
+	uint32_t m_ulDeadline;
+	uint32_t m_uiConnectTimeout;
+	uint32_t m_uiLoginTimeout;
+	uint32_t m_uiBackoffMin;
+	uint32_t m_uiBackoffMax;
+	#ifdef SQLARD_METRICS
+		uint32_t m_ulStateStart;
+	#endif
+
+	/* Transaction of the connection, see begin / commit / rollback */
+	uint64_t m_ullTransactionDescriptor;
+	bool m_bInTransaction;
+
+	/* Query deadline and cancellation, see setQueryTimeout / cancel */
+	uint32_t m_uiQueryTimeout;
+	uint32_t m_ulResponseDeadline;
+	#ifdef WINDOWS
+		/* set by cancel, which may run on another thread */
+		std::atomic<bool> m_bCancelRequested;
+	#else
+		bool m_bCancelRequested;
+	#endif
+	bool m_bAttentionPending;
+	bool m_bTimedOut;
+	bool m_bCancelled;
+	#ifdef SQLARD_MARS
+		/* SMP sessions, the first one is the default session used by SQLard */
+		SQLardSession m_arSessions[SQLARD_MARS_SESSIONS];
+		/* Session the next TDS packets are sent on */
+		SQLardSession * m_pSendSession;
+		bool m_bMARS;
+	#endif
 	uint8_t m_arrServerIPv4[6];
 	uint16_t m_usPort;
 	#ifndef WINDOWS
@@ -1533,11 +9500,587 @@ private:
 	#endif
 	SQLardLOGIN7 * m_pLogin7;
 	uint32_t m_uiPacketIndex;
+	/* Packet size from the ENVCHANGE of the login response, see requestPacketSize */
+	uint16_t m_usServerPacketSize;
 
 	uint32_t m_uiDoneCount;
 	uint16_t m_usDoneStatus;
 	uint16_t m_usDoneCurCmd;
+	/* Row counts of the DONE tokens with DONE_COUNT of the response, see getStatementCount */
+	uint32_t m_arStatementCounts[SQLARD_MAX_STATEMENT_COUNTS];
+	uint8_t m_ubStatementCount;
+	bool m_bResponseError;
+	uint32_t m_uiRowsParsed;
+
+	/* Response being received, see beginResponse / pumpResponse */
+	SQLardTokenParser m_parser;
+	SQLardTableResult * m_pCurrentResult;
+	uint16_t m_usPacketRemaining;
+	uint16_t m_usResponsePackets;
+	bool m_bLastPacket;
+	#ifdef WINDOWS
+		/* read by cancel from other threads */
+		std::atomic<bool> m_bResponsePending;
+	#else
+		bool m_bResponsePending;
+	#endif
+	/* The last request could not be sent, its response is an error, see beginResponse */
+	bool m_bRequestFailed;
+	#ifdef SQLARD_METRICS
+		SQLardStats m_stats;
+	#endif
+	#ifdef SQLARD_PARALLEL_DECODE
+		SQLardParallelDecoder m_decoder;
+	#endif
+	#ifdef SQLARD_COLUMN_CACHE
+		SQLardColumnCache m_columnCache;
+	#endif
+	#ifdef SQLARD_DICTIONARY
+		uint16_t m_usDictionaryEntries;
+	#endif
+	#ifdef SQLARD_SPILL
+		size_t m_szResultBudget;
+		std::string m_strSpillDirectory;
+	#endif
+	#ifdef SQLARD_WIRE_CAPTURE
+		SQLardWireCapture * m_pCapture;
+		SQLardWireReplay * m_pReplay;
+	#endif
+	#ifdef SQLARD_RESULT_CACHE
+		SQLardResultCache * m_pResultCache;
+		/* Hash of the database name of the last ENVCHANGE, 0 before one was received */
+		uint32_t m_uiDatabaseHash;
+		/* Raw token stream of the response being received, for the cache */
+		SQLardByteBuffer m_cacheRecord;
+		bool m_bCacheRecording;
+	#endif
+	#ifdef SQLARD_HEAP_STATS
+		/* Outlives the connection while its results hold blocks */
+		SQLardHeapAccount * m_pHeapAccount;
+	#endif
+	#ifdef SQLARD_BOUND_COLUMNS
+		/* Statement being fetched by executeBound / fetch */
+		SQLardBinding * m_pBinding;
+		SQLardColumnSet * m_pBoundColumns;
+		/* only the first result set is bound */
+		bool m_bBoundEnded;
+	#endif
+	#ifdef SQLARD_CURSORS
+		/* Cursor whose sp_cursorfetch response has not been received yet */
+		SQLardCursor * m_pCursorInFlight;
+		/* Cursor of the response being received, for rows without COLMETADATA */
+		SQLardCursor * m_pReceivingCursor;
+		/* Cursors opened by openCursor and not closed yet, see ~SQLard */
+		SQLardCursor * m_pOpenCursors;
+		/* Integer output parameters of the last RPC, in the order of the parameters */
+		int32_t m_arReturnValues[SQLARD_MAX_RETURN_VALUES];
+		uint8_t m_ubReturnValueCount;
+		/* Server collation, for the text parameters of RPC requests */
+		uint8_t m_arCollation[5];
+	#endif
+};
+
+#ifdef SQLARD_FANOUT
+/*
+	Runs queries over a pool of logged in connections at once, one query per
+	connection at a time, and merges the results into one SQLardTableResult:
+	concatenated in query order, or k-way merged on a sort key when every query
+	returns its rows ordered by that key (ORDER BY). Wall time is about that of
+	the slowest connection instead of the sum of all of them.
+
+		SQLard * shards[] = { &a, &b, &c };
+		SQLardFanOut fanOut(shards, 3, &pool);
+		fanOut.setSortKey(0);
+		SQLardTableResult * pResult = fanOut.executeReader(u"SELECT id, v FROM t ORDER BY id");
+*/
+class SQLardFanOut {
+public:
+	SQLardFanOut(SQLard ** arConnections, const uint16_t connectionCount, SQLardThreadPool * pPool) {
+		m_arConnections = arConnections;
+		m_usConnectionCount = connectionCount;
+		m_pPool = pPool;
+		m_iSortColumn = -1;
+		m_bDescending = false;
+		m_usFailed = 0;
+	}
+
+	/*
+		Merge on this column instead of concatenating. Character columns are
+		concatenated anyway: the server orders them by its collation, which
+		a byte comparison here would not reproduce.
+	*/
+	void setSortKey(const uint16_t columnIndex, const bool bDescending = false) {
+		m_iSortColumn = columnIndex;
+		m_bDescending = bDescending;
+	}
+	void clearSortKey() { m_iSortColumn = -1; }
+
+	/* Run the same query on every connection */
+	SQLardTableResult * executeReader(const SQLardText & query) {
+		/* one copy per connection, each one encodes on its own thread */
+		std::vector<SQLardText> queries(m_usConnectionCount, query);
+		return executeReader(queries.data(), m_usConnectionCount);
+	}
+
+	/*
+		Run queries[i] on connection i % connectionCount, in parallel across
+		connections. Failed queries, and results whose columns do not match the
+		first result, are left out (see GetFailedCount).
+		Returns the merged result, deleted by the caller.
+	*/
+	SQLardTableResult * executeReader(const SQLardText * queries, const uint16_t queryCount) {
+		SQLardBuffer<SQLardTableResult *> results(queryCount);
+		const uint16_t taskCount = queryCount < m_usConnectionCount ? queryCount : m_usConnectionCount;
+		SQLardLatch latch(taskCount);
+		for (uint16_t c = 0; c < taskCount; c++) {
+			m_pPool->submit([this, c, queries, queryCount, &results, &latch] {
+				for (uint16_t q = c; q < queryCount; q += m_usConnectionCount) {
+					results[q] = m_arConnections[c]->executeReader(queries[q]);
+					if (results[q] != nullptr && m_arConnections[c]->hasError()) {
+						delete results[q];
+						results[q] = nullptr;
+					}
+				}
+				latch.countDown();
+			});
+		}
+		latch.wait();
+		return merge(results(), queryCount);
+	}
+
+	/* Queries left out of the last merged result */
+	const uint16_t GetFailedCount() const { return m_usFailed; }
+
+protected:
+	SQLardTableResult * merge(SQLardTableResult ** results, const uint16_t count) {
+		SQLardTableResult * pMerged = new SQLardTableResult();
+		m_usFailed = 0;
+		for (uint16_t i = 0; i < count; i++) {
+			if (results[i] == nullptr) {
+				m_usFailed++;
+				continue;
+			}
+			if (pMerged->m_arColumnData == nullptr)
+				pMerged->TakeColumns(results[i]);
+			else if (!sameLayout(pMerged, results[i])) {
+				delete results[i];
+				results[i] = nullptr;
+				m_usFailed++;
+			}
+		}
+		bool bSorted = m_iSortColumn >= 0 && m_iSortColumn < pMerged->m_usColumnCount;
+		if (bSorted && SQLardUtil::sqlard_is_char(pMerged->m_arColumnData[m_iSortColumn]->m_bType)) {
+			#ifdef SQLARD_VERBOSE_OUTPUT
+				SQLardUtil::printf(F("SQLARD > fan-out : Character sort key, results are concatenated instead of merged!\n"));
+			#endif
+			bSorted = false;
+		}
+		if (!bSorted) {
+			for (uint16_t i = 0; i < count; i++)
+				if (results[i] != nullptr)
+					pMerged->TakeRows(results[i]);
+		}
+		else
+			mergeSorted(pMerged, results, count);
+		for (uint16_t i = 0; i < count; i++)
+			if (results[i] != nullptr)
+				delete results[i];
+		return pMerged;
+	}
+
+	/* Results must have the columns of the first one to be merged */
+	static bool sameLayout(const SQLardTableResult * pMerged, const SQLardTableResult * pResult) {
+		if (pResult->m_usColumnCount != pMerged->m_usColumnCount)
+			return false;
+		for (uint16_t i = 0; i < pResult->m_usColumnCount; i++)
+			if (pResult->m_arColumnData[i]->m_bType != pMerged->m_arColumnData[i]->m_bType)
+				return false;
+		return true;
+	}
+
+	/* k-way merge with a binary heap of the next row of every result */
+	void mergeSorted(SQLardTableResult * pMerged, SQLardTableResult ** results, const uint16_t count) {
+		SQLardBuffer<uint16_t> heap(count);
+		SQLardBuffer<uint32_t> next(count);
+		uint16_t heapSize = 0;
+		uint32_t total = 0;
+		#ifdef SQLARD_SPILL
+			/* rows move to pMerged, they must not be evicted by their result */
+			for (uint16_t i = 0; i < count; i++)
+				if (results[i] != nullptr)
+					results[i]->Unspill();
+		#endif
+		m_bSortType = pMerged->m_arColumnData[m_iSortColumn]->m_bType;
+		m_bSortScale = pMerged->m_arColumnData[m_iSortColumn]->m_bScale;
+		for (uint16_t i = 0; i < count; i++) {
+			if (results[i] == nullptr || results[i]->rowCount() == 0)
+				continue;
+			total += results[i]->rowCount();
+			heap[heapSize] = i;
+			siftUp(heap(), heapSize++, results, next());
+		}
+		pMerged->m_arRows.Reserve(total);
+		while (heapSize > 0) {
+			const uint16_t top = heap[0];
+			#ifdef SQLARD_DICTIONARY
+				pMerged->Reintern(results[top]->row(next[top]));
+			#endif
+			pMerged->appendRowData(results[top]->row(next[top]++));
+			if (next[top] == results[top]->rowCount())
+				heap[0] = heap[--heapSize];
+			siftDown(heap(), heapSize, results, next());
+		}
+		/* the rows belong to pMerged now */
+		for (uint16_t i = 0; i < count; i++)
+			if (results[i] != nullptr)
+				results[i]->m_arRows.Release();
+	}
+
+	/* Row of result a goes before the row of result b; ties keep query order */
+	bool before(const uint16_t a, const uint16_t b, SQLardTableResult ** results, const uint32_t * next) {
+		int result = SQLardRowFieldData::Compare(m_bSortType, (*results[a]->row(next[a]))[m_iSortColumn], (*results[b]->row(next[b]))[m_iSortColumn], m_bSortScale);
+		if (m_bDescending)
+			result = -result;
+		return result < 0 || (result == 0 && a < b);
+	}
+	void siftUp(uint16_t * heap, uint16_t index, SQLardTableResult ** results, const uint32_t * next) {
+		while (index > 0) {
+			const uint16_t parent = (index - 1) / 2;
+			if (!before(heap[index], heap[parent], results, next))
+				break;
+			const uint16_t t = heap[index]; heap[index] = heap[parent]; heap[parent] = t;
+			index = parent;
+		}
+	}
+	void siftDown(uint16_t * heap, const uint16_t heapSize, SQLardTableResult ** results, const uint32_t * next) {
+		uint16_t index = 0;
+		for (;;) {
+			uint16_t smallest = index;
+			const uint16_t left = index * 2 + 1, right = index * 2 + 2;
+			if (left < heapSize && before(heap[left], heap[smallest], results, next))
+				smallest = left;
+			if (right < heapSize && before(heap[right], heap[smallest], results, next))
+				smallest = right;
+			if (smallest == index)
+				break;
+			const uint16_t t = heap[index]; heap[index] = heap[smallest]; heap[smallest] = t;
+			index = smallest;
+		}
+	}
+
+	SQLard ** m_arConnections;
+	uint16_t m_usConnectionCount;
+	SQLardThreadPool * m_pPool;
+	int32_t m_iSortColumn;
+	bool m_bDescending;
+	/* Type and scale of the sort column, while merging */
+	uint8_t m_bSortType;
+	uint8_t m_bSortScale;
+	uint16_t m_usFailed;
+};
+#endif
+
+#ifdef SQLARD_SYNC
+/* What happened to a row of a SQLardTableSync */
+enum SQLardSyncChange
+{
+	SYNC_INSERTED,
+	SYNC_UPDATED,
+	SYNC_DELETED
+};
+
+/*
+	Local copy of a table kept up to date from its rowversion column.
+	Each refresh only reads the rows whose rowversion is past the highest one
+	seen so far, and applies them to the copy by key, so the cost of a refresh
+	follows the rate of change instead of the size of the table. Rows from
+	MIN_ACTIVE_ROWVERSION() on are left for a later refresh, as transactions
+	still open may commit rows below them.
+
+		SQLardTableSync rooms(u"ROOM_STATUS", u"room_id", u"row_ver");
+		rooms.setColumns(u"room_id, water_enable");
+		rooms.setCallback(onRoomChange, nullptr);
+		...
+		rooms.refresh(MSSQL);
+		const SQLardRowData * pRoom = rooms.find(...);
+
+	The selected columns are followed by the key and the rowversion (as a
+	BIGINT), and by the deleted flag if there is one, so column indexes of
+	the copy match the select list. Rows are kept in key order, see GetTable.
+	Physically deleted rows are not seen; tables that delete rows should mark
+	them in a flag column instead, see setDeletedColumn.
+*/
+class SQLardTableSync {
+public:
+	/* Receives every change applied by refresh. pOld is deleted after the call, pNew stays in the copy */
+	typedef void (*ChangeCallback)(void * pContext, const SQLardSyncChange change, const SQLardRowData * pOld, const SQLardRowData * pNew);
+
+	SQLardTableSync(const SQLardText & table, const SQLardText & keyColumn, const SQLardText & versionColumn) {
+		m_wcszTable = table.Duplicate();
+		m_wcszKey = keyColumn.Duplicate();
+		m_wcszVersion = versionColumn.Duplicate();
+		m_wcszColumns = nullptr;
+		m_wcszDeleted = nullptr;
+		m_pTable = nullptr;
+		m_llWatermark = 0;
+		m_pCallback = nullptr;
+		m_pContext = nullptr;
+	}
+	~SQLardTableSync() {
+		reset();
+		SQLARD_DELETE_ARRAY(m_wcszTable);
+		SQLARD_DELETE_ARRAY(m_wcszKey);
+		SQLARD_DELETE_ARRAY(m_wcszVersion);
+		if (m_wcszColumns)
+			SQLARD_DELETE_ARRAY(m_wcszColumns);
+		if (m_wcszDeleted)
+			SQLARD_DELETE_ARRAY(m_wcszDeleted);
+	}
+
+	/* Select list of the copy, all columns by default. Drops the copy */
+	void setColumns(const SQLardText & columns) {
+		setString(m_wcszColumns, columns);
+	}
+	/* A column that is not 0 for deleted rows, they are removed from the copy. Drops the copy */
+	void setDeletedColumn(const SQLardText & column) {
+		setString(m_wcszDeleted, column);
+	}
+	void setCallback(ChangeCallback pCallback, void * pContext) {
+		m_pCallback = pCallback;
+		m_pContext = pContext;
+	}
+
+	/*
+		Read the rows changed since the last refresh and apply them.
+		The first refresh reads the whole table.
+		Returns the number of changes, or -1 if the query failed, the copy
+		is kept and the changes are read by the next refresh, or if the
+		layout of the table changed, the copy is dropped and read again next time.
+	*/
+	int32_t refresh(SQLard & connection) {
+		SQLardBuffer<char16_t> query(queryLength());
+		buildQuery(query());
+		SQLardTableResult * pDelta = connection.executeUncached(SQLardText(query()));
+		if (pDelta == nullptr)
+			return -1;
+		if (connection.hasError()) {
+			delete pDelta;
+			return -1;
+		}
+		if (pDelta->m_usColumnCount < (m_wcszDeleted ? 3 : 2) || !sameLayout(pDelta)) {
+			delete pDelta;
+			reset();
+			return -1;
+		}
+		const uint16_t keyColumn = GetKeyColumn(pDelta->m_usColumnCount);
+		if (m_pTable == nullptr) {
+			m_pTable = new SQLardTableResult();
+			m_pTable->TakeColumns(pDelta);
+		}
+		const uint8_t keyType = m_pTable->m_arColumnData[keyColumn]->m_bType;
+		const uint8_t keyScale = m_pTable->m_arColumnData[keyColumn]->m_bScale;
+		const uint8_t versionType = m_pTable->m_arColumnData[keyColumn + 1]->m_bType;
+		SQLardRowData ** arRows = pDelta->begin();
+		const uint32_t count = pDelta->rowCount();
+		int32_t changes = 0;
+		for (uint32_t i = 0; i < count; i++) {
+			SQLardRowData * pRow = arRows[i];
+			const int64_t version = (*pRow)[keyColumn + 1]->asInt64(versionType);
+			if (version > m_llWatermark)
+				m_llWatermark = version;
+			bool bFound = false;
+			const uint32_t index = search((*pRow)[keyColumn], keyType, keyScale, bFound);
+			const SQLardRowFieldData * pDeleted = m_wcszDeleted ? (*pRow)[keyColumn + 2] : nullptr;
+			if (pDeleted != nullptr && !pDeleted->m_bNull && pDeleted->asInt64(m_pTable->m_arColumnData[keyColumn + 2]->m_bType) != 0) {
+				if (bFound) {
+					SQLardRowData * pOld = m_pTable->m_arRows.Remove(index);
+					notify(SYNC_DELETED, pOld, nullptr);
+					delete pOld;
+					changes++;
+				}
+				delete pRow;
+				continue;
+			}
+			#ifdef SQLARD_DICTIONARY
+				/* the dictionaries of the copy are those of the first delta */
+				m_pTable->Reintern(pRow);
+			#endif
+			if (bFound) {
+				SQLardRowData * pOld = m_pTable->m_arRows.Replace(index, pRow);
+				notify(SYNC_UPDATED, pOld, pRow);
+				delete pOld;
+			}
+			else {
+				m_pTable->m_arRows.Insert(index, pRow);
+				notify(SYNC_INSERTED, nullptr, pRow);
+			}
+			changes++;
+		}
+		/* the rows moved to the copy or were deleted */
+		pDelta->m_arRows.Release();
+		delete pDelta;
+		return changes;
+	}
+
+	/* Row with this key, nullptr if there is none. key is a field of the key column, of another row or result */
+	const SQLardRowData * find(const SQLardRowFieldData * key) const {
+		if (m_pTable == nullptr)
+			return nullptr;
+		const uint16_t keyColumn = GetKeyColumn(m_pTable->m_usColumnCount);
+		bool bFound = false;
+		const uint32_t index = search(key, m_pTable->m_arColumnData[keyColumn]->m_bType, m_pTable->m_arColumnData[keyColumn]->m_bScale, bFound);
+		return bFound ? m_pTable->row(index) : nullptr;
+	}
+	/* Row with this integer key */
+	const SQLardRowData * find(const int64_t key) const {
+		if (m_pTable == nullptr)
+			return nullptr;
+		const uint16_t keyColumn = GetKeyColumn(m_pTable->m_usColumnCount);
+		const uint8_t keyType = m_pTable->m_arColumnData[keyColumn]->m_bType;
+		uint32_t lo = 0, hi = m_pTable->rowCount();
+		while (lo < hi) {
+			const uint32_t mid = (lo + hi) / 2;
+			const SQLardRowFieldData * pKey = (*m_pTable->row(mid))[keyColumn];
+			const int64_t value = pKey->m_bNull ? INT64_MIN : pKey->asInt64(keyType);
+			if (value == key)
+				return m_pTable->row(mid);
+			if (value < key)
+				lo = mid + 1;
+			else
+				hi = mid;
+		}
+		return nullptr;
+	}
+
+	/* The copy, rows in key order, nullptr before the first refresh */
+	const SQLardTableResult * GetTable() const { return m_pTable; }
+	const uint32_t GetRowCount() const { return m_pTable ? m_pTable->rowCount() : 0; }
+	/* Column of the key in the copy, the rowversion follows it */
+	const uint16_t GetKeyColumn() const { return m_pTable ? GetKeyColumn(m_pTable->m_usColumnCount) : 0; }
+
+	/* Highest rowversion in the copy, to resume after a restart along with a copy kept elsewhere */
+	const int64_t GetWatermark() const { return m_llWatermark; }
+	void SetWatermark(const int64_t watermark) { m_llWatermark = watermark; }
+
+	/* Drop the copy, the next refresh reads the whole table */
+	void reset() {
+		if (m_pTable)
+			delete m_pTable;
+		m_pTable = nullptr;
+		m_llWatermark = 0;
+	}
+private:
+	const uint16_t GetKeyColumn(const uint16_t columnCount) const {
+		return columnCount - (m_wcszDeleted ? 3 : 2);
+	}
+
+	void setString(char16_t *& wcsz, const SQLardText & text) {
+		if (wcsz)
+			SQLARD_DELETE_ARRAY(wcsz);
+		wcsz = text.Duplicate();
+		reset();
+	}
+
+	/* Deltas must have the layout of the copy */
+	bool sameLayout(const SQLardTableResult * pDelta) const {
+		if (m_pTable == nullptr)
+			return true;
+		if (pDelta->m_usColumnCount != m_pTable->m_usColumnCount)
+			return false;
+		for (uint16_t i = 0; i < pDelta->m_usColumnCount; i++)
+			if (pDelta->m_arColumnData[i]->m_bType != m_pTable->m_arColumnData[i]->m_bType)
+				return false;
+		return true;
+	}
+
+	/* Index of the row with key, or where it would be inserted */
+	uint32_t search(const SQLardRowFieldData * key, const uint8_t keyType, const uint8_t keyScale, bool & bFound) const {
+		const uint16_t keyColumn = GetKeyColumn(m_pTable->m_usColumnCount);
+		uint32_t lo = 0, hi = m_pTable->rowCount();
+		bFound = false;
+		while (lo < hi) {
+			const uint32_t mid = (lo + hi) / 2;
+			const int order = SQLardRowFieldData::Compare(keyType, (*m_pTable->row(mid))[keyColumn], key, keyScale);
+			if (order == 0) {
+				bFound = true;
+				return mid;
+			}
+			if (order < 0)
+				lo = mid + 1;
+			else
+				hi = mid;
+		}
+		return lo;
+	}
+
+	void notify(const SQLardSyncChange change, const SQLardRowData * pOld, const SQLardRowData * pNew) {
+		if (m_pCallback != nullptr)
+			m_pCallback(m_pContext, change, pOld, pNew);
+	}
+
+	/*
+		SELECT <columns>, <key>, CAST(<version> AS BIGINT)[, <deleted>] FROM <table>
+		WHERE <version> > CAST(CAST(<watermark> AS BIGINT) AS BINARY(8))
+		AND <version> < MIN_ACTIVE_ROWVERSION() ORDER BY <version>
+		The watermark only moves up to rows below MIN_ACTIVE_ROWVERSION(), so
+		a row committed late with a lower rowversion is not skipped.
+	*/
+	size_t queryLength() const {
+		size_t len = 200 + SQLardUtil::sqlard_wcslen(m_wcszTable) + SQLardUtil::sqlard_wcslen(m_wcszKey) + SQLardUtil::sqlard_wcslen(m_wcszVersion) * 4;
+		if (m_wcszColumns)
+			len += SQLardUtil::sqlard_wcslen(m_wcszColumns);
+		if (m_wcszDeleted)
+			len += SQLardUtil::sqlard_wcslen(m_wcszDeleted);
+		return len;
+	}
+	void buildQuery(char16_t * d) const {
+		d = append(d, u"SELECT ");
+		d = append(d, m_wcszColumns ? m_wcszColumns : u"*");
+		d = append(d, u", ");
+		d = append(d, m_wcszKey);
+		d = append(d, u", CAST(");
+		d = append(d, m_wcszVersion);
+		d = append(d, u" AS BIGINT)");
+		if (m_wcszDeleted) {
+			d = append(d, u", ");
+			d = append(d, m_wcszDeleted);
+		}
+		d = append(d, u" FROM ");
+		d = append(d, m_wcszTable);
+		d = append(d, u" WHERE ");
+		if (m_llWatermark != 0) {
+			d = append(d, m_wcszVersion);
+			d = append(d, u" > CAST(CAST(");
+			char16_t digits[20];
+			uint8_t n = 0;
+			for (uint64_t v = static_cast<uint64_t>(m_llWatermark); v != 0 || n == 0; v /= 10)
+				digits[n++] = static_cast<char16_t>(u'0' + v % 10);
+			while (n > 0)
+				*d++ = digits[--n];
+			d = append(d, u" AS BIGINT) AS BINARY(8)) AND ");
+		}
+		d = append(d, m_wcszVersion);
+		d = append(d, u" < MIN_ACTIVE_ROWVERSION() ORDER BY ");
+		d = append(d, m_wcszVersion);
+		*d = 0;
+	}
+	static char16_t * append(char16_t * d, const char16_t * s) {
+		while (*s)
+			*d++ = *s++;
+		return d;
+	}
+
+	char16_t * m_wcszTable;
+	char16_t * m_wcszKey;
+	char16_t * m_wcszVersion;
+	char16_t * m_wcszColumns;
+	char16_t * m_wcszDeleted;
+	SQLardTableResult * m_pTable;
+	int64_t m_llWatermark;
+	ChangeCallback m_pCallback;
+	void * m_pContext;
 };
+#endif
 
 
 #endif
@@ -16,7 +16,7 @@ void setup() {
   Ethernet.begin(Ethernet_MacAddr, Static_IPAddr, Gateway_IPAddr, Gateway_IPAddr, Subnet_Mask);
   if(MSSQL.connect())
   {
-      MSSQL.setCredentials(L"arduino", L"ard_login",L"ard_password",L"hostx");
+      MSSQL.setCredentials(u"arduino", u"ard_login",u"ard_password",u"hostx");
       MSSQL.login();
   }
   
@@ -27,8 +27,8 @@ void loop() {
   int loop_count = 0;
   delay(5000);
 
-  long affected_rows = MSSQL.executeNonQuery(L"INSERT INTO [dbo].[test]([data]) VALUES('deger1234') ");
-  long yeni = MSSQL.executeNonQuery(L"DROP TABLE [dbo].[test23]");
+  long affected_rows = MSSQL.executeNonQuery(u"INSERT INTO [dbo].[test]([data]) VALUES('deger1234') ");
+  long yeni = MSSQL.executeNonQuery(u"DROP TABLE [dbo].[test23]");
   Serial.print(affected_rows);
   Serial.println(" row(s) affected.");
   if (!client) {
@@ -37,7 +37,7 @@ void loop() {
   }
   if(++loop_count == 10)
   {
-    MSSQL.executeNonQuery(L"DELETE FROM [dbo].[test]");
+    MSSQL.executeNonQuery(u"DELETE FROM [dbo].[test]");
     loop_count = 0;
   }
 }